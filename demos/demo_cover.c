@@ -180,9 +180,13 @@ void demo_cover(void)
     camera_set_transform(&v, T);
   }
 
+  w.bvh = bvh_alloc(&w);
+
   render_stats s = {0};
   canvas *c = camera_render(&v, &w, &s);
 
+  bvh_free(w.bvh);
+
   {
     char *ppm = canvas_to_ppm(c);
     FILE *fp = fopen("./demo-out/demo_cover.ppm", "w");
@@ -418,12 +422,18 @@ void demo_cover(void)
     w.objects[w.objects_count++] = cube_i;
   }
 
+  // Frames only move the camera, but animated objects would be moved here and
+  // handed to bvh_refit, which only rebuilds once the tree degrades
+  w.bvh = bvh_alloc(&w);
+
   u32 N = 180;
   for (u32 i = 0; i < N; i++) {
     f64 step = ((f64)i / (f64)N) - 0.5;
     render_and_save(w, i, step);
   }
 
+  bvh_free(w.bvh);
+
   /*
   for (u32 i = 0; i < N; i++) {
     f64 step = (((f64)N-(f64)i) / (f64)N) - 0.5;
@@ -0,0 +1,276 @@
+#include "rtc.h"
+
+render_aovs *render_aovs_alloc(u32 width, u32 height, u32 flags)
+{
+  render_aovs *a = malloc(sizeof(render_aovs));
+  memset(a, 0, sizeof(render_aovs));
+
+  a->width = width;
+  a->height = height;
+  a->flags = flags;
+
+  u32 n = width * height;
+
+  if (flags & AovDepth) {
+    a->depth = malloc(n * sizeof(f64));
+    for (u32 i = 0; i < n; i++) {
+      a->depth[i] = F64_INF;
+    }
+  }
+
+  if (flags & AovNormal) {
+    a->normal = malloc(n * sizeof(v3));
+    memset(a->normal, 0, n * sizeof(v3));
+  }
+
+  if (flags & AovAlbedo) {
+    a->albedo = malloc(n * sizeof(v3));
+    memset(a->albedo, 0, n * sizeof(v3));
+  }
+
+  if (flags & AovObject) {
+    a->object = malloc(n * sizeof(s32));
+    for (u32 i = 0; i < n; i++) {
+      a->object[i] = -1;
+    }
+  }
+
+  if (flags & AovHits) {
+    a->hits = malloc(n * sizeof(u32));
+    memset(a->hits, 0, n * sizeof(u32));
+  }
+
+  if (flags & AovShadow) {
+    a->shadow = malloc(n * sizeof(f64));
+    memset(a->shadow, 0, n * sizeof(f64));
+  }
+
+  return a;
+}
+
+void render_aovs_free(render_aovs *a)
+{
+  free(a->depth);
+  free(a->normal);
+  free(a->albedo);
+  free(a->object);
+  free(a->hits);
+  free(a->shadow);
+  free(a);
+}
+
+// Blocked share of the diffuse light the lights in front of c would give,
+// each light weighted by its unshadowed contribution
+static f64 aov_shadow_fraction(const world *w, const computations *c)
+{
+  f64 total = 0;
+  f64 blocked = 0;
+
+  for (u32 i = 0; i < w->lights_count; i++) {
+    const light *l = &w->lights[i];
+
+    v4 lightv = {0};
+    v4_sub(l->position, c->point, lightv);
+    v4_norm(lightv, lightv);
+
+    f64 light_dot_normal = v4_dot(lightv, c->normalv);
+    f64 intensity = MAX(MAX(l->intensity[0], l->intensity[1]), l->intensity[2]);
+    f64 weight = intensity * light_attenuation(l, c->point) * light_dot_normal;
+    if (weight <= 0) {
+      continue;
+    }
+
+    f64 visibility = world_light_visibility(w, l, c->over_point, c->time);
+    total += weight;
+    blocked += weight * (1 - visibility);
+  }
+
+  return total > 0 ? blocked / total : 0;
+}
+
+void aov_sample_record(const world *w, const computations *c, aov_sample *aov)
+{
+  aov->hit = true;
+  aov->depth = c->t;
+  memcpy(aov->normal, c->normalv, sizeof(v4));
+  material_color_at(&c->o->material, c->o, c->point, c->time, aov->albedo);
+
+  aov->object = world_object_index(w, c->o);
+
+  if (aov->flags & AovShadow) {
+    aov->shadow = aov_shadow_fraction(w, c);
+  }
+}
+
+// OpenEXR stores everything little endian
+static void exr_u32(FILE *f, u32 v)
+{
+  for (u32 i = 0; i < 4; i++) {
+    fputc((s32)((v >> (8 * i)) & 0xff), f);
+  }
+}
+
+static void exr_u64(FILE *f, u64 v)
+{
+  for (u32 i = 0; i < 8; i++) {
+    fputc((s32)((v >> (8 * i)) & 0xff), f);
+  }
+}
+
+static void exr_f32(FILE *f, f32 v)
+{
+  unsigned int bits = 0;
+  memcpy(&bits, &v, sizeof(f32));
+  exr_u32(f, bits);
+}
+
+static void exr_attribute(FILE *f, const char *name, const char *type, u32 size)
+{
+  fputs(name, f);
+  fputc(0, f);
+  fputs(type, f);
+  fputc(0, f);
+  exr_u32(f, size);
+}
+
+typedef struct {
+  const char *name;
+  const f64 *f;
+  v3 *v;
+  const s32 *s;
+  const u32 *u;
+  u32 component;
+} exr_channel;
+
+static f32 exr_channel_at(const exr_channel *ch, u32 i)
+{
+  if (ch->f != NULL) {
+    return (f32)ch->f[i];
+  }
+  if (ch->v != NULL) {
+    return (f32)ch->v[i][ch->component];
+  }
+  if (ch->s != NULL) {
+    return (f32)ch->s[i];
+  }
+  return (f32)ch->u[i];
+}
+
+// Writes c, if set, and every allocated buffer of a as one uncompressed
+// scanline OpenEXR image with 32 bit float channels. Beauty is R, G, B and
+// depth Z, as compositors expect, the rest are named after their buffer.
+// Returns false if the file could not be written.
+b32 render_aovs_write_exr(const render_aovs *a, const canvas *c, const char *path)
+{
+  assert(c == NULL || (c->width == a->width && c->height == a->height));
+
+  v3 *beauty = c != NULL ? c->pixels : NULL;
+
+  // Channels must be listed, and stored in each line, sorted by name
+  exr_channel all[] = {
+    { .name = "B", .v = beauty, .component = 2 },
+    { .name = "G", .v = beauty, .component = 1 },
+    { .name = "N.X", .v = a->normal, .component = 0 },
+    { .name = "N.Y", .v = a->normal, .component = 1 },
+    { .name = "N.Z", .v = a->normal, .component = 2 },
+    { .name = "R", .v = beauty, .component = 0 },
+    { .name = "Z", .f = a->depth },
+    { .name = "albedo.B", .v = a->albedo, .component = 2 },
+    { .name = "albedo.G", .v = a->albedo, .component = 1 },
+    { .name = "albedo.R", .v = a->albedo, .component = 0 },
+    { .name = "hits", .u = a->hits },
+    { .name = "object", .s = a->object },
+    { .name = "shadow", .f = a->shadow },
+  };
+  u32 all_count = sizeof(all) / sizeof(all[0]);
+
+  exr_channel channels[sizeof(all) / sizeof(all[0])];
+  u32 channels_count = 0;
+  u32 names_size = 0;
+  for (u32 i = 0; i < all_count; i++) {
+    if (all[i].f != NULL || all[i].v != NULL || all[i].s != NULL || all[i].u != NULL) {
+      channels[channels_count++] = all[i];
+      names_size += strlen(all[i].name) + 1;
+    }
+  }
+
+  if (channels_count == 0) {
+    fprintf(stderr, "render_aovs_write_exr: nothing to write to %s\n", path);
+    return false;
+  }
+
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) {
+    fprintf(stderr, "render_aovs_write_exr: could not open %s\n", path);
+    return false;
+  }
+
+  // Magic number and version 2, single part scanline
+  exr_u32(f, 20000630);
+  exr_u32(f, 2);
+
+  // Each channel is its name, pixel type (2 is float), pLinear, three
+  // reserved bytes and x and y sampling, the list ends with a null
+  exr_attribute(f, "channels", "chlist", names_size + 16 * channels_count + 1);
+  for (u32 i = 0; i < channels_count; i++) {
+    fputs(channels[i].name, f);
+    fputc(0, f);
+    exr_u32(f, 2);
+    exr_u32(f, 0);
+    exr_u32(f, 1);
+    exr_u32(f, 1);
+  }
+  fputc(0, f);
+
+  exr_attribute(f, "compression", "compression", 1);
+  fputc(0, f);
+
+  for (u32 k = 0; k < 2; k++) {
+    exr_attribute(f, k == 0 ? "dataWindow" : "displayWindow", "box2i", 16);
+    exr_u32(f, 0);
+    exr_u32(f, 0);
+    exr_u32(f, a->width - 1);
+    exr_u32(f, a->height - 1);
+  }
+
+  exr_attribute(f, "lineOrder", "lineOrder", 1);
+  fputc(0, f);
+
+  exr_attribute(f, "pixelAspectRatio", "float", 4);
+  exr_f32(f, 1);
+
+  exr_attribute(f, "screenWindowCenter", "v2f", 8);
+  exr_f32(f, 0);
+  exr_f32(f, 0);
+
+  exr_attribute(f, "screenWindowWidth", "float", 4);
+  exr_f32(f, 1);
+
+  fputc(0, f);
+
+  // Offset table, one chunk per line holding its y, its size and then the
+  // line of each channel in turn
+  u64 line_size = 4 * (u64)a->width * channels_count;
+  u64 offset = (u64)ftell(f) + 8 * (u64)a->height;
+  for (u32 y = 0; y < a->height; y++) {
+    exr_u64(f, offset + y * (8 + line_size));
+  }
+
+  for (u32 y = 0; y < a->height; y++) {
+    exr_u32(f, y);
+    exr_u32(f, line_size);
+    for (u32 i = 0; i < channels_count; i++) {
+      for (u32 x = 0; x < a->width; x++) {
+        exr_f32(f, exr_channel_at(&channels[i], y * a->width + x));
+      }
+    }
+  }
+
+  b32 ok = !ferror(f);
+  if (fclose(f) != 0 || !ok) {
+    fprintf(stderr, "render_aovs_write_exr: could not write %s\n", path);
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,112 @@
+#include "rtc.h"
+
+void bounds_init(bounds *b)
+{
+  memcpy(b->min, point(F64_INF, F64_INF, F64_INF), sizeof(v4));
+  memcpy(b->max, point(-F64_INF, -F64_INF, -F64_INF), sizeof(v4));
+}
+
+void bounds_add_point(bounds *b, const v4 p)
+{
+  for (u32 i = 0; i < 3; i++) {
+    b->min[i] = MIN(b->min[i], p[i]);
+    b->max[i] = MAX(b->max[i], p[i]);
+  }
+}
+
+void bounds_merge(const bounds *a, const bounds *b, bounds *out)
+{
+  for (u32 i = 0; i < 3; i++) {
+    out->min[i] = MIN(a->min[i], b->min[i]);
+    out->max[i] = MAX(a->max[i], b->max[i]);
+  }
+  out->min[3] = 1;
+  out->max[3] = 1;
+}
+
+void bounds_transform(const bounds *b, const m4 T, bounds *out)
+{
+  if (!bounds_is_finite(b)) {
+    memcpy(out->min, point(-F64_INF, -F64_INF, -F64_INF), sizeof(v4));
+    memcpy(out->max, point(F64_INF, F64_INF, F64_INF), sizeof(v4));
+    return;
+  }
+
+  bounds result = {0};
+  bounds_init(&result);
+
+  for (u32 i = 0; i < 8; i++) {
+    v4 corner = point_init(
+        (i & 1) ? b->max[0] : b->min[0],
+        (i & 2) ? b->max[1] : b->min[1],
+        (i & 4) ? b->max[2] : b->min[2]);
+
+    v4 p = {0};
+    m4_mulv(T, corner, p);
+    bounds_add_point(&result, p);
+  }
+
+  *out = result;
+}
+
+b32 bounds_is_finite(const bounds *b)
+{
+  return isfinite(b->min[0]) && isfinite(b->min[1]) && isfinite(b->min[2]) &&
+         isfinite(b->max[0]) && isfinite(b->max[1]) && isfinite(b->max[2]);
+}
+
+b32 bounds_contains(const bounds *outer, const bounds *inner)
+{
+  return outer->min[0] <= inner->min[0] && inner->max[0] <= outer->max[0] &&
+         outer->min[1] <= inner->min[1] && inner->max[1] <= outer->max[1] &&
+         outer->min[2] <= inner->min[2] && inner->max[2] <= outer->max[2];
+}
+
+f64 bounds_surface_area(const bounds *b)
+{
+  f64 dx = b->max[0] - b->min[0];
+  f64 dy = b->max[1] - b->min[1];
+  f64 dz = b->max[2] - b->min[2];
+
+  if (dx < 0 || dy < 0 || dz < 0) {
+    return 0;
+  }
+
+  return 2 * (dx*dy + dy*dz + dz*dx);
+}
+
+void bounds_centroid(const bounds *b, v4 out)
+{
+  out[0] = (b->min[0] + b->max[0]) * 0.5;
+  out[1] = (b->min[1] + b->max[1]) * 0.5;
+  out[2] = (b->min[2] + b->max[2]) * 0.5;
+  out[3] = 1;
+}
+
+// Slab test against the whole line, so intersections behind the origin are
+// still reported. Callers clip [tmin, tmax] to the range they care about.
+b32 bounds_intersect(const bounds *b, const v4 origin, const v4 inv_direction, f64 *tmin, f64 *tmax)
+{
+  f64 t0 = -F64_INF;
+  f64 t1 = F64_INF;
+
+  for (u32 i = 0; i < 3; i++) {
+    f64 near = (b->min[i] - origin[i]) * inv_direction[i];
+    f64 far = (b->max[i] - origin[i]) * inv_direction[i];
+
+    if (near > far) {
+      f64 temp = near;
+      near = far;
+      far = temp;
+    }
+
+    // NaN from 0 * inf (origin on a slab of a parallel ray) leaves t0/t1 as is
+    t0 = near > t0 ? near : t0;
+    t1 = far < t1 ? far : t1;
+  }
+
+  *tmin = t0;
+  *tmax = t1;
+
+  return t0 <= t1;
+}
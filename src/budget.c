@@ -0,0 +1,149 @@
+#include "rtc.h"
+
+typedef struct {
+  u32 tile;
+  f64 error;
+} budget_tile;
+
+// Highest error first, ties in tile order
+static int budget_tile_compare(const void *a, const void *b)
+{
+  const budget_tile *x = a;
+  const budget_tile *y = b;
+
+  if (x->error != y->error) {
+    return x->error > y->error ? -1 : 1;
+  }
+  return x->tile < y->tile ? -1 : x->tile > y->tile;
+}
+
+static void budget_run(progressive *p, const camera *v, const world *w, const u32 *order, u32 order_count, u64 deadline)
+{
+  render_tiles tiles = {0};
+  tiles.v = v;
+  tiles.w = w;
+  tiles.progressive = p;
+  tiles.order = order;
+  tiles.deadline = deadline;
+  tiles.tiles_x = p->tiles_x;
+  tiles.tiles_count = order_count;
+  camera_render_tiles(&tiles);
+}
+
+// Renders coarse to fine, refining within max_seconds of wall clock time.
+// A whole frame is first shaded once without reflection or refraction.
+// That pass ignores the deadline so the image has no holes, which makes it
+// the least a call takes and max_seconds a budget for refinement only.
+// Then every tile gets a full sample, those not started by the deadline
+// keep the coarse one. The remaining time goes to the tiles with the
+// highest estimated error, an eighth of them at a time, until the deadline
+// or every pixel has max_samples. s, if set, gets the quality reached.
+canvas *camera_render_budget(const camera *v, const world *w, f64 max_seconds, u32 max_samples, render_budget_stats *s)
+{
+  u64 start = prof_read_os_timer();
+  u64 deadline = start + (u64)(MAX(max_seconds, 0) * (f64)prof_get_os_timer_freq());
+
+  if (camera_is_deterministic(v)) {
+    max_samples = 1;
+  }
+  max_samples = MAX(max_samples, 1);
+
+  camera coarse = *v;
+  coarse.max_depth = 0;
+  coarse.samples = 1;
+  canvas *c = camera_render(&coarse, w, NULL);
+
+  progressive *p = progressive_alloc(v);
+  u32 *order = malloc(p->tiles_count * sizeof(u32));
+  budget_tile *candidates = malloc(p->tiles_count * sizeof(budget_tile));
+
+  for (u32 i = 0; i < p->tiles_count; i++) {
+    order[i] = i;
+  }
+  budget_run(p, v, w, order, p->tiles_count, deadline);
+
+  u32 degraded = 0;
+  for (u32 i = 0; i < p->tiles_count; i++) {
+    if (p->tile_samples[i] == 0) {
+      degraded++;
+    }
+  }
+
+  while (degraded == 0 && prof_read_os_timer() < deadline) {
+    u32 candidates_count = 0;
+    for (u32 i = 0; i < p->tiles_count; i++) {
+      if (p->tile_samples[i] < max_samples) {
+        candidates[candidates_count].tile = i;
+        candidates[candidates_count].error = progressive_tile_error(p, i);
+        candidates_count++;
+      }
+    }
+
+    if (candidates_count == 0) {
+      break;
+    }
+
+    qsort(candidates, candidates_count, sizeof(budget_tile), budget_tile_compare);
+
+    u32 count = MIN(MAX(p->tiles_count / 8, 1), candidates_count);
+    for (u32 i = 0; i < count; i++) {
+      order[i] = candidates[i].tile;
+    }
+    budget_run(p, v, w, order, count, deadline);
+  }
+
+  canvas *fine = canvas_alloc(v->hsize, v->vsize);
+  progressive_snapshot(p, fine);
+  for (u32 i = 0; i < p->tiles_count; i++) {
+    if (p->tile_samples[i] == 0) {
+      continue;
+    }
+
+    u32 x0 = (i % p->tiles_x) * RENDER_TILE_SIZE;
+    u32 y0 = (i / p->tiles_x) * RENDER_TILE_SIZE;
+    u32 x1 = MIN(x0 + RENDER_TILE_SIZE, p->width);
+    u32 y1 = MIN(y0 + RENDER_TILE_SIZE, p->height);
+    for (u32 y = y0; y < y1; y++) {
+      memcpy(&c->pixels[y * p->width + x0], &fine->pixels[y * p->width + x0], (x1 - x0) * sizeof(v3));
+    }
+  }
+  canvas_free(fine);
+
+  if (s != NULL) {
+    memset(s, 0, sizeof(render_budget_stats));
+    s->seconds = (f64)(prof_read_os_timer() - start) / (f64)prof_get_os_timer_freq();
+    s->degraded_tiles = degraded;
+
+    u64 pixels = 0;
+    u64 samples = 0;
+    u32 measured = 0;
+    for (u32 i = 0; i < p->tiles_count; i++) {
+      u32 x0 = (i % p->tiles_x) * RENDER_TILE_SIZE;
+      u32 y0 = (i / p->tiles_x) * RENDER_TILE_SIZE;
+      u64 area = (MIN(x0 + RENDER_TILE_SIZE, p->width) - x0) * (MIN(y0 + RENDER_TILE_SIZE, p->height) - y0);
+      // Degraded tiles have their coarse sample
+      u32 n = MAX(p->tile_samples[i], 1);
+
+      s->min_samples = i == 0 ? n : MIN(s->min_samples, n);
+      s->max_samples = MAX(s->max_samples, n);
+      samples += area * n;
+      pixels += area;
+
+      f64 error = progressive_tile_error(p, i);
+      if (error != F64_INF) {
+        s->mean_error += error;
+        s->max_error = MAX(s->max_error, error);
+        measured++;
+      }
+    }
+
+    s->mean_samples = pixels > 0 ? (f64)samples / (f64)pixels : 0;
+    s->mean_error = measured > 0 ? s->mean_error / (f64)measured : 0;
+  }
+
+  free(candidates);
+  free(order);
+  progressive_free(p);
+
+  return c;
+}
@@ -0,0 +1,417 @@
+#include "rtc.h"
+
+// Past this depth binned splits fall back to median splits, which keeps the
+// tree shallow enough for the fixed traversal stack
+#define BVH_MAX_SAH_DEPTH 24
+
+static f64 bvh_node_weighted_area(const bvh_node *n)
+{
+  f64 area = bounds_surface_area(&n->b);
+  return n->count > 0 ? area * (f64)n->count : area;
+}
+
+static void bvh_leaf_bounds(const bvh *b, const bvh_node *n, bounds *out)
+{
+  bounds_init(out);
+  for (u32 i = n->first; i < n->first + n->count; i++) {
+    bounds_merge(out, &b->object_bounds[b->prims[i]], out);
+  }
+}
+
+static u32 bvh_partition(bvh *b, u32 first, u32 count, u32 axis, f64 split)
+{
+  u32 i = first;
+  u32 j = first + count;
+
+  while (i < j) {
+    v4 c = {0};
+    bounds_centroid(&b->object_bounds[b->prims[i]], c);
+
+    if (c[axis] < split) {
+      i++;
+    } else {
+      j--;
+      u32 temp = b->prims[i];
+      b->prims[i] = b->prims[j];
+      b->prims[j] = temp;
+    }
+  }
+
+  return i - first;
+}
+
+static u32 bvh_build_node(bvh *b, u32 parent, u32 first, u32 count, u32 depth)
+{
+  u32 index = b->nodes_count++;
+  bvh_node *n = &b->nodes[index];
+
+  n->parent = parent;
+  n->first = first;
+  n->count = count;
+  n->left = 0;
+  n->right = 0;
+
+  bvh_leaf_bounds(b, n, &n->b);
+
+  if (count <= BVH_MAX_LEAF_SIZE) {
+    for (u32 i = first; i < first + count; i++) {
+      b->leaf_of[b->prims[i]] = index;
+    }
+    b->area_sum += bvh_node_weighted_area(n);
+    return index;
+  }
+
+  bounds centroids = {0};
+  bounds_init(&centroids);
+  for (u32 i = first; i < first + count; i++) {
+    v4 c = {0};
+    bounds_centroid(&b->object_bounds[b->prims[i]], c);
+    bounds_add_point(&centroids, c);
+  }
+
+  u32 axis = 0;
+  for (u32 i = 1; i < 3; i++) {
+    if (centroids.max[i] - centroids.min[i] > centroids.max[axis] - centroids.min[axis]) {
+      axis = i;
+    }
+  }
+
+  f64 extent = centroids.max[axis] - centroids.min[axis];
+  u32 left_count = 0;
+
+  if (extent > 0 && depth < BVH_MAX_SAH_DEPTH) {
+    // Binned surface area heuristic
+    bounds bins[BVH_BINS];
+    u32 bin_counts[BVH_BINS] = {0};
+    for (u32 i = 0; i < BVH_BINS; i++) {
+      bounds_init(&bins[i]);
+    }
+
+    f64 scale = (f64)BVH_BINS / extent;
+    for (u32 i = first; i < first + count; i++) {
+      v4 c = {0};
+      bounds_centroid(&b->object_bounds[b->prims[i]], c);
+
+      u32 bin = (u32)((c[axis] - centroids.min[axis]) * scale);
+      bin = MIN(bin, BVH_BINS - 1);
+
+      bin_counts[bin]++;
+      bounds_merge(&bins[bin], &b->object_bounds[b->prims[i]], &bins[bin]);
+    }
+
+    f64 right_areas[BVH_BINS] = {0};
+    u32 right_counts[BVH_BINS] = {0};
+    {
+      bounds acc = {0};
+      bounds_init(&acc);
+      u32 acc_count = 0;
+      for (u32 i = BVH_BINS - 1; i > 0; i--) {
+        bounds_merge(&acc, &bins[i], &acc);
+        acc_count += bin_counts[i];
+        right_areas[i] = bounds_surface_area(&acc);
+        right_counts[i] = acc_count;
+      }
+    }
+
+    f64 best_cost = F64_INF;
+    u32 best_split = 0;
+    {
+      bounds acc = {0};
+      bounds_init(&acc);
+      u32 acc_count = 0;
+      for (u32 i = 0; i < BVH_BINS - 1; i++) {
+        bounds_merge(&acc, &bins[i], &acc);
+        acc_count += bin_counts[i];
+
+        if (acc_count == 0 || right_counts[i+1] == 0) {
+          continue;
+        }
+
+        f64 cost = bounds_surface_area(&acc) * (f64)acc_count +
+                   right_areas[i+1] * (f64)right_counts[i+1];
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_split = i + 1;
+        }
+      }
+    }
+
+    if (best_split > 0) {
+      f64 split = centroids.min[axis] + (f64)best_split / scale;
+      left_count = bvh_partition(b, first, count, axis, split);
+    }
+  }
+
+  if (left_count == 0 || left_count == count) {
+    // Degenerate centroids, split in the middle of the range
+    left_count = count / 2;
+  }
+
+  u32 left = bvh_build_node(b, index, first, left_count, depth + 1);
+  u32 right = bvh_build_node(b, index, first + left_count, count - left_count, depth + 1);
+
+  n->left = left;
+  n->right = right;
+  n->count = 0;
+  b->area_sum += bvh_node_weighted_area(n);
+
+  return index;
+}
+
+bvh *bvh_alloc(const world *w)
+{
+  bvh *b = malloc(sizeof(bvh));
+  memset(b, 0, sizeof(bvh));
+
+  b->rebuild_threshold = BVH_REBUILD_THRESHOLD;
+  bvh_build(b, w);
+
+  return b;
+}
+
+void bvh_free(bvh *b)
+{
+  free(b);
+}
+
+void bvh_build(bvh *b, const world *w)
+{
+  b->nodes_count = 0;
+  b->prims_count = 0;
+  b->unbounded_count = 0;
+  b->area_sum = 0;
+  b->objects_area = 0;
+  b->objects_count = w->objects_count;
+
+  for (u32 i = 0; i < w->objects_count; i++) {
+    object_bounds(&w->objects[i], &b->object_bounds[i]);
+
+    if (bounds_is_finite(&b->object_bounds[i])) {
+      b->prims[b->prims_count++] = i;
+      b->objects_area += bounds_surface_area(&b->object_bounds[i]);
+    } else {
+      b->unbounded[b->unbounded_count++] = i;
+    }
+  }
+
+  if (b->prims_count > 0) {
+    bvh_build_node(b, 0, 0, b->prims_count, 0);
+  }
+
+  b->build_cost = bvh_cost(b);
+  b->rebuilds++;
+}
+
+// Surface area heuristic cost of the tree relative to the summed area of the
+// objects themselves. Normalising by object area rather than root area means
+// an object moving far away inflates the cost of every ancestor it drags
+// along, instead of shrinking everything else relative to a larger root.
+f64 bvh_cost(const bvh *b)
+{
+  if (b->nodes_count == 0 || b->objects_area <= 0) {
+    return 0;
+  }
+
+  return b->area_sum / b->objects_area;
+}
+
+// Refits bounds from each moved object's leaf up to the root, stopping early
+// once an ancestor's bounds are unchanged, so the cost is proportional to the
+// number of moved objects times tree depth. Returns true if the tree had to
+// be rebuilt instead.
+b32 bvh_refit(bvh *b, const world *w, const u32 *moved, u32 moved_count)
+{
+  if (w->objects_count != b->objects_count) {
+    bvh_build(b, w);
+    return true;
+  }
+
+  for (u32 i = 0; i < moved_count; i++) {
+    u32 index = moved[i];
+    assert(index < b->objects_count);
+
+    bounds nb = {0};
+    object_bounds(&w->objects[index], &nb);
+
+    b32 was_finite = bounds_is_finite(&b->object_bounds[index]);
+    if (was_finite != bounds_is_finite(&nb)) {
+      bvh_build(b, w);
+      return true;
+    }
+
+    if (!was_finite) {
+      b->object_bounds[index] = nb;
+      continue;
+    }
+
+    b->objects_area -= bounds_surface_area(&b->object_bounds[index]);
+    b->objects_area += bounds_surface_area(&nb);
+    b->object_bounds[index] = nb;
+
+    u32 node = b->leaf_of[index];
+    while (true) {
+      bvh_node *n = &b->nodes[node];
+
+      bounds updated = {0};
+      if (n->count > 0) {
+        bvh_leaf_bounds(b, n, &updated);
+      } else {
+        bounds_merge(&b->nodes[n->left].b, &b->nodes[n->right].b, &updated);
+      }
+
+      if (bounds_contains(&n->b, &updated) && bounds_contains(&updated, &n->b)) {
+        break;
+      }
+
+      b->area_sum -= bvh_node_weighted_area(n);
+      n->b = updated;
+      b->area_sum += bvh_node_weighted_area(n);
+
+      if (node == 0) {
+        break;
+      }
+      node = n->parent;
+    }
+  }
+
+  if (bvh_cost(b) > b->build_cost * b->rebuild_threshold) {
+    bvh_build(b, w);
+    return true;
+  }
+
+  return false;
+}
+
+void bvh_intersect(const bvh *b, const world *w, const ray *r, intersection_group *ig)
+{
+  for (u32 i = 0; i < b->unbounded_count; i++) {
+    ray_intersect(r, &w->objects[b->unbounded[i]], ig);
+  }
+
+  if (b->nodes_count == 0) {
+    return;
+  }
+
+  v4 inv_direction = {0};
+  ray_inverse_direction(r, inv_direction);
+
+  u32 stack[BVH_STACK_SIZE];
+  u32 stack_count = 0;
+  stack[stack_count++] = 0;
+
+  while (stack_count > 0) {
+    const bvh_node *n = &b->nodes[stack[--stack_count]];
+
+    // All intersections along the line are needed, including those behind
+    // the origin, to track refractive containers
+    f64 tmin, tmax;
+    if (!bounds_intersect(&n->b, r->origin, inv_direction, &tmin, &tmax)) {
+      continue;
+    }
+
+    if (n->count > 0) {
+      for (u32 i = n->first; i < n->first + n->count; i++) {
+        ray_intersect(r, &w->objects[b->prims[i]], ig);
+      }
+    } else {
+      stack[stack_count++] = n->right;
+      stack[stack_count++] = n->left;
+    }
+  }
+}
+
+// Any hit in [0, max_t), used for shadow rays
+b32 bvh_intersect_any(const bvh *b, const world *w, const ray *r, f64 max_t)
+{
+  for (u32 i = 0; i < b->unbounded_count; i++) {
+    if (ray_hits_before(r, &w->objects[b->unbounded[i]], max_t)) {
+      return true;
+    }
+  }
+
+  if (b->nodes_count == 0) {
+    return false;
+  }
+
+  v4 inv_direction = {0};
+  ray_inverse_direction(r, inv_direction);
+
+  u32 stack[BVH_STACK_SIZE];
+  u32 stack_count = 0;
+  stack[stack_count++] = 0;
+
+  while (stack_count > 0) {
+    const bvh_node *n = &b->nodes[stack[--stack_count]];
+
+    f64 tmin, tmax;
+    if (!bounds_intersect(&n->b, r->origin, inv_direction, &tmin, &tmax) ||
+        tmax < 0 || tmin >= max_t) {
+      continue;
+    }
+
+    if (n->count > 0) {
+      for (u32 i = n->first; i < n->first + n->count; i++) {
+        if (ray_hits_before(r, &w->objects[b->prims[i]], max_t)) {
+          return true;
+        }
+      }
+    } else {
+      stack[stack_count++] = n->right;
+      stack[stack_count++] = n->left;
+    }
+  }
+
+  return false;
+}
+
+// bvh_intersect_any for count <= SDF_LANES rays traversing the tree
+// together, hit gets the rays blocked before their max_t
+void bvh_intersect_any_packet(const bvh *b, const world *w, const ray *rays, u32 count, const f64 *max_t, b32 *hit)
+{
+  assert(count <= SDF_LANES);
+
+  b32 active[SDF_LANES];
+  v4 inv_direction[SDF_LANES];
+  for (u32 l = 0; l < count; l++) {
+    hit[l] = false;
+    active[l] = true;
+    ray_inverse_direction(&rays[l], inv_direction[l]);
+  }
+
+  for (u32 i = 0; i < b->unbounded_count; i++) {
+    ray_packet_hits_before(rays, count, &w->objects[b->unbounded[i]], max_t, active, hit);
+  }
+
+  if (b->nodes_count == 0) {
+    return;
+  }
+
+  u32 stack[BVH_STACK_SIZE];
+  u32 stack_count = 0;
+  stack[stack_count++] = 0;
+
+  while (stack_count > 0) {
+    const bvh_node *n = &b->nodes[stack[--stack_count]];
+
+    u32 active_count = 0;
+    for (u32 l = 0; l < count; l++) {
+      f64 tmin, tmax;
+      active[l] = !hit[l] && bounds_intersect(&n->b, rays[l].origin, inv_direction[l], &tmin, &tmax) &&
+        tmax >= 0 && tmin < max_t[l];
+      active_count += active[l] ? 1 : 0;
+    }
+
+    if (active_count == 0) {
+      continue;
+    }
+
+    if (n->count > 0) {
+      for (u32 i = n->first; i < n->first + n->count; i++) {
+        ray_packet_hits_before(rays, count, &w->objects[b->prims[i]], max_t, active, hit);
+      }
+    } else {
+      stack[stack_count++] = n->right;
+      stack[stack_count++] = n->left;
+    }
+  }
+}
@@ -24,6 +24,15 @@ void camera_init(camera *c, const u32 hsize, const u32 vsize, const f64 fov)
   }
 
   c->antialias = false;
+  c->samples = SAMPLES_PER_PIXEL;
+  c->shutter_open = 0;
+  c->shutter_close = 0;
+  c->seed = 0;
+  c->aperture = 0;
+  c->focal_distance = 1;
+  c->max_depth = MAX_DEPTH;
+  c->integrator = WhittedIntegrator;
+  c->threads = 0;
 }
 
 void camera_set_transform(camera *c, const m4 T)
@@ -47,6 +56,8 @@ void camera_ray_for_pixel(const camera *c, const u32 x, const u32 y, ray *out)
 
   v4_sub(pixel, out->origin, out->direction);
   v4_norm(out->direction, out->direction);
+
+  out->time = c->shutter_open;
 }
 
 // apply jittering to implement antialiasing
@@ -62,10 +73,331 @@ void camera_raw_ray_for_pixel(const camera *c, const f64 x_offset, const f64 y_o
 
   v4_sub(pixel, out->origin, out->direction);
   v4_norm(out->direction, out->direction);
+
+  out->time = c->shutter_open;
+}
+
+// Maps a unit square sample to the unit disk keeping strata compact, from
+// Shirley and Chiu, "A Low Distortion Map Between Disk and Square"
+static void concentric_sample_disk(const v2 u, v2 out)
+{
+  f64 a = 2 * u[0] - 1;
+  f64 b = 2 * u[1] - 1;
+
+  if (a == 0 && b == 0) {
+    out[0] = 0;
+    out[1] = 0;
+    return;
+  }
+
+  f64 r, theta;
+  if (fabs(a) > fabs(b)) {
+    r = a;
+    theta = PI_4 * (b / a);
+  } else {
+    r = b;
+    theta = PI_2 - PI_4 * (a / b);
+  }
+
+  out[0] = r * cos(theta);
+  out[1] = r * sin(theta);
+}
+
+// lens is a sample in the unit square. The ray starts at that point on the
+// lens and passes through where the pinhole ray meets the focal plane.
+void camera_lens_ray_for_pixel(const camera *c, const f64 x_offset, const f64 y_offset, const v2 lens, ray *out)
+{
+  if (c->aperture <= 0) {
+    camera_raw_ray_for_pixel(c, x_offset, y_offset, out);
+    return;
+  }
+
+  f64 world_x = c->half_width - x_offset;
+  f64 world_y = c->half_height - y_offset;
+
+  v2 disk = {0};
+  concentric_sample_disk(lens, disk);
+
+  v4 focus = point_init(world_x * c->focal_distance, world_y * c->focal_distance, -c->focal_distance);
+  v4 origin = point_init(disk[0] * c->aperture, disk[1] * c->aperture, 0);
+
+  v4 focus_world = {0};
+  m4_mulv(c->inverse_transform, focus, focus_world);
+  m4_mulv(c->inverse_transform, origin, out->origin);
+
+  v4_sub(focus_world, out->origin, out->direction);
+  v4_norm(out->direction, out->direction);
+
+  out->time = c->shutter_open;
+}
+
+static void camera_aov_add(const aov_sample *sample, aov_sample *total, u32 *hits)
+{
+  if (!sample->hit) {
+    return;
+  }
+
+  if (*hits == 0) {
+    total->object = sample->object;
+  }
+
+  (*hits)++;
+  total->depth += sample->depth;
+  v4_add(total->normal, sample->normal, total->normal);
+  v3_add(total->albedo, sample->albedo, total->albedo);
+  total->shadow += sample->shadow;
+}
+
+static void camera_aov_write(render_aovs *a, u32 x, u32 y, const aov_sample *total, u32 hits, u32 samples)
+{
+  u32 i = y * a->width + x;
+
+  if (a->depth != NULL) {
+    a->depth[i] = hits > 0 ? total->depth / (f64)hits : F64_INF;
+  }
+
+  if (a->normal != NULL) {
+    for (u32 k = 0; k < 3; k++) {
+      a->normal[i][k] = total->normal[k] / (f64)samples;
+    }
+  }
+
+  if (a->albedo != NULL) {
+    v3_scale(total->albedo, 1.0 / (f64)samples, a->albedo[i]);
+  }
+
+  if (a->object != NULL) {
+    a->object[i] = hits > 0 ? total->object : -1;
+  }
+
+  if (a->hits != NULL) {
+    a->hits[i] = hits;
+  }
+
+  if (a->shadow != NULL) {
+    a->shadow[i] = hits > 0 ? total->shadow / (f64)hits : 0;
+  }
+}
+
+// Whether every sample of a pixel is the same, its center ray shaded once
+b32 camera_is_deterministic(const camera *v)
+{
+  return !v->antialias && v->shutter_close <= v->shutter_open && v->aperture <= 0 &&
+    v->integrator == WhittedIntegrator;
+}
+
+// The index-th of the pixel's stratified samples over the pixel area,
+// shutter interval and lens, all drawn from one sampler so each converges
+// with the same budget. Deterministic cameras shade the center ray for
+// every index. aov may be NULL.
+void camera_sample_pixel(const camera *v, const world *w, u32 x, u32 y, u32 index, aov_sample *aov, v3 out)
+{
+  if (camera_is_deterministic(v)) {
+    ray r = {0};
+    camera_ray_for_pixel(v, x, y, &r);
+    world_color_at_iterative(w, &r, v->max_depth, aov, out);
+    return;
+  }
+
+  sampler s = {0};
+  sampler_init(&s, x, y, v->seed);
+  sampler_start(&s, index);
+
+  // Always drawn so later dimensions line up with or without
+  // antialiasing
+  v2 jitter = {0};
+  sampler_2d(&s, jitter);
+  if (!v->antialias) {
+    jitter[0] = 0.5;
+    jitter[1] = 0.5;
+  }
+
+  f64 x_offset = ((f64)x + jitter[0]) * v->pixel_size;
+  f64 y_offset = ((f64)y + jitter[1]) * v->pixel_size;
+
+  f64 time = sampler_1d(&s);
+
+  v2 lens = {0};
+  sampler_2d(&s, lens);
+
+  ray r = {0};
+  camera_lens_ray_for_pixel(v, x_offset, y_offset, lens, &r);
+  r.time = v->shutter_open;
+  if (v->shutter_close > v->shutter_open) {
+    r.time += time * (v->shutter_close - v->shutter_open);
+  }
+
+  if (v->integrator == PathIntegrator) {
+    path_trace(w, &r, &s, v->max_depth, aov, out);
+  } else {
+    world_color_at_iterative(w, &r, v->max_depth, aov, out);
+  }
+}
+
+// aovs may be NULL
+void camera_render_pixel(const camera *v, const world *w, u32 x, u32 y, render_aovs *aovs, v3 out)
+{
+  aov_sample total = {0};
+  u32 hits = 0;
+
+  if (camera_is_deterministic(v)) {
+    aov_sample aov = {0};
+    aov.flags = aovs != NULL ? aovs->flags : 0;
+    camera_sample_pixel(v, w, x, y, 0, aovs != NULL ? &aov : NULL, out);
+
+    if (aovs != NULL) {
+      camera_aov_add(&aov, &total, &hits);
+      camera_aov_write(aovs, x, y, &total, hits, 1);
+    }
+    return;
+  }
+
+  v3 color_at = {0};
+
+  u32 N = MAX(v->samples, 1);
+  for (u32 i = 0; i < N; i++) {
+    aov_sample aov = {0};
+    aov.flags = aovs != NULL ? aovs->flags : 0;
+
+    v3 this_color = {0};
+    camera_sample_pixel(v, w, x, y, i, aovs != NULL ? &aov : NULL, this_color);
+    v3_add(this_color, color_at, color_at);
+
+    camera_aov_add(&aov, &total, &hits);
+  }
+
+  v3_scale(color_at, 1.0 / (f64)N, out);
+
+  if (aovs != NULL) {
+    camera_aov_write(aovs, x, y, &total, hits, N);
+  }
+}
+
+// Takes tiles until none are left. Pixels are independent and each has its
+// own sampler, so the image does not depend on the number of threads.
+static void *camera_render_worker(void *arg)
+{
+  render_tiles *tiles = arg;
+  const camera *v = tiles->v;
+
+  for (;;) {
+    if ((tiles->cancel != NULL && __atomic_load_n(tiles->cancel, __ATOMIC_RELAXED)) ||
+        (tiles->deadline != 0 && prof_read_os_timer() >= tiles->deadline)) {
+      break;
+    }
+
+    pthread_mutex_lock(&tiles->lock);
+    u32 job = tiles->next;
+    tiles->next += job < tiles->tiles_count;
+    pthread_mutex_unlock(&tiles->lock);
+
+    if (job >= tiles->tiles_count) {
+      break;
+    }
+
+    u32 tile = tiles->order != NULL ? tiles->order[job] : job;
+
+    if (tiles->progressive != NULL) {
+      progressive_render_tile(tiles, tile);
+      continue;
+    }
+
+    render_trace *trace = NULL;
+    if (tiles->record != NULL) {
+      trace = &tiles->record->tiles[tile];
+      memset(trace->objects, 0, sizeof(trace->objects));
+      bounds_init(&trace->rays);
+      m4_mulv(v->inverse_transform, point(0, 0, 0), trace->eye);
+      world_trace_objects(trace);
+    }
+
+    u32 x0 = (tile % tiles->tiles_x) * RENDER_TILE_SIZE;
+    u32 y0 = (tile / tiles->tiles_x) * RENDER_TILE_SIZE;
+    u32 x1 = MIN(x0 + RENDER_TILE_SIZE, v->hsize);
+    u32 y1 = MIN(y0 + RENDER_TILE_SIZE, v->vsize);
+
+    u32 cx = 0;
+    u32 cy = 0;
+    const render_region *region = tiles->region;
+    if (region != NULL) {
+      x0 = MAX(x0, region->x0);
+      y0 = MAX(y0, region->y0);
+      x1 = MIN(x1, region->x1);
+      y1 = MIN(y1, region->y1);
+
+      if (tiles->crop) {
+        cx = region->x0;
+        cy = region->y0;
+      }
+    }
+
+    for (u32 y = y0; y < y1; y++) {
+      for (u32 x = x0; x < x1; x++) {
+        if (tiles->mask != NULL && tiles->mask[y * v->hsize + x] == 0) {
+          continue;
+        }
+
+        v3 color_at = {0};
+        camera_render_pixel(v, tiles->w, x, y, tiles->aovs, color_at);
+        canvas_write(tiles->c, x - cx, y - cy, color_at);
+      }
+    }
+
+    if (trace != NULL) {
+      world_trace_objects(NULL);
+    }
+  }
+
+  return NULL;
+}
+
+// Renders the tiles on v->threads threads, all online CPUs if 0
+void camera_render_tiles(render_tiles *tiles)
+{
+  pthread_mutex_init(&tiles->lock, NULL);
+
+  u32 threads = tiles->v->threads;
+  if (threads == 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = online > 0 ? (u32)online : 1;
+  }
+  threads = MAX(MIN(threads, tiles->tiles_count), 1);
+
+  if (threads == 1) {
+    camera_render_worker(tiles);
+  } else {
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    u32 started = 0;
+    for (u32 i = 0; i < threads; i++) {
+      if (pthread_create(&workers[started], NULL, camera_render_worker, tiles) == 0) {
+        started++;
+      }
+    }
+
+    // Tiles are taken from a shared queue, so the calling thread picks up
+    // the share of any worker that could not be started
+    if (started < threads) {
+      camera_render_worker(tiles);
+    }
+
+    for (u32 i = 0; i < started; i++) {
+      pthread_join(workers[i], NULL);
+    }
+    free(workers);
+  }
+
+  pthread_mutex_destroy(&tiles->lock);
 }
 
 canvas *camera_render(const camera *v, const world *w, render_stats *s)
 {
+  return camera_render_aovs(v, w, NULL, s);
+}
+
+// aovs, if set, must match the camera's size
+canvas *camera_render_aovs(const camera *v, const world *w, render_aovs *aovs, render_stats *s)
+{
+  assert(aovs == NULL || (aovs->width == v->hsize && aovs->height == v->vsize));
 
   canvas *c = canvas_alloc(v->hsize, v->vsize);
 
@@ -75,9 +407,9 @@ canvas *camera_render(const camera *v, const world *w, render_stats *s)
     s->start = prof_read_cpu_timer();
   }
 
+  /*
+  // Fixed 3x3 antialiasing
   if (v->antialias) {
-    /*
-    // Fixed
     for (u32 y = 0; y < v->vsize; y++) {
       for (u32 x = 0; x < v->hsize; x++) {
         v3 color_at = {0};
@@ -186,45 +518,157 @@ canvas *camera_render(const camera *v, const world *w, render_stats *s)
         canvas_write(c, x, y, color_at);
       }
     } 
+  }
   */
-    // Noise
-    for (u32 y = 0; y < v->vsize; y++) {
-      for (u32 x = 0; x < v->hsize; x++) {
-        v3 color_at = {0};
-        ray r = {0};
 
-        u32 N = 32;
-        for (u32 i = 0; i < N; i++) {
-          f64 jitter_x = (random_uniform() - 0.5);
-          f64 jitter_y = (random_uniform() - 0.5);
-          f64 x_offset = ((f64)x + jitter_x + 0.5) * v->pixel_size;
-          f64 y_offset = ((f64)y + jitter_y + 0.5) * v->pixel_size;
+  render_tiles tiles = {0};
+  tiles.v = v;
+  tiles.w = w;
+  tiles.c = c;
+  tiles.aovs = aovs;
+  tiles.tiles_x = (v->hsize + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  tiles.tiles_count = tiles.tiles_x * ((v->vsize + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE);
+  camera_render_tiles(&tiles);
 
-          v3 this_color = {0};
-          camera_raw_ray_for_pixel(v, x_offset, y_offset, &r);
-          world_color_at(w, &r, MAX_DEPTH, this_color);
-          v3_add(this_color, color_at, color_at);
-        }
+  if (s != NULL) {
+    s->end = prof_read_cpu_timer();
+  }
 
-        v3_scale(color_at, 1.0 / (f64)N, color_at);
-        canvas_write(c, x, y, color_at);
-      }
-    } 
-  } else {
-    for (u32 y = 0; y < v->vsize; y++) {
-      for (u32 x = 0; x < v->hsize; x++) {
-        ray r = {0};
-        camera_ray_for_pixel(v, x, y, &r);
+  return c;
+}
 
-        v3 color_at = {0};
-        world_color_at(w, &r, MAX_DEPTH, color_at);
+// Renders the tiles overlapping r into c
+static b32 camera_region_valid(const camera *v, const render_region *r, const char *caller)
+{
+  if (r->x0 > r->x1 || r->y0 > r->y1 || r->x1 > v->hsize || r->y1 > v->vsize) {
+    fprintf(stderr, "%s: region %lu,%lu to %lu,%lu is outside the %lux%lu image\n",
+            caller, r->x0, r->y0, r->x1, r->y1, v->hsize, v->vsize);
+    return false;
+  }
 
-        canvas_write(c, x, y, color_at);
-      }
+  return true;
+}
+
+static void camera_render_region_tiles(const camera *v, const world *w, const render_region *r, canvas *c, b32 crop)
+{
+  if (r->x0 == r->x1 || r->y0 == r->y1) {
+    return;
+  }
+
+  u32 tiles_x = (v->hsize + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+
+  u32 tx0 = r->x0 / RENDER_TILE_SIZE;
+  u32 ty0 = r->y0 / RENDER_TILE_SIZE;
+  u32 tx1 = (r->x1 - 1) / RENDER_TILE_SIZE;
+  u32 ty1 = (r->y1 - 1) / RENDER_TILE_SIZE;
+
+  u32 *order = malloc((tx1 - tx0 + 1) * (ty1 - ty0 + 1) * sizeof(u32));
+  u32 order_count = 0;
+  for (u32 ty = ty0; ty <= ty1; ty++) {
+    for (u32 tx = tx0; tx <= tx1; tx++) {
+      order[order_count++] = ty * tiles_x + tx;
     }
   }
 
+  render_tiles tiles = {0};
+  tiles.v = v;
+  tiles.w = w;
+  tiles.c = c;
+  tiles.region = r;
+  tiles.crop = crop;
+  tiles.order = order;
+  tiles.tiles_x = tiles_x;
+  tiles.tiles_count = order_count;
+  camera_render_tiles(&tiles);
+
+  free(order);
+}
+
+// Renders only the pixels in r to a canvas of the region's size, NULL if
+// r is not inside the image. The pixels match those of camera_render, so
+// regions of one frame can be rendered apart and put together.
+canvas *camera_render_region(const camera *v, const world *w, const render_region *r, render_stats *s)
+{
+  if (!camera_region_valid(v, r, "camera_render_region")) {
+    return NULL;
+  }
+
+  canvas *c = canvas_alloc(r->x1 - r->x0, r->y1 - r->y0);
+
+  if (s != NULL) {
+    s->width = c->width;
+    s->height = c->height;
+    s->start = prof_read_cpu_timer();
+  }
+
+  camera_render_region_tiles(v, w, r, c, true);
+
+  if (s != NULL) {
+    s->end = prof_read_cpu_timer();
+  }
+
+  return c;
+}
+
+// Renders only the pixels in r into c, a canvas of the camera's size, and
+// leaves the rest of it as it is. False if r is not inside the image or c
+// is the wrong size.
+b32 camera_render_region_into(const camera *v, const world *w, const render_region *r, canvas *c)
+{
+  if (c->width != v->hsize || c->height != v->vsize) {
+    fprintf(stderr, "camera_render_region_into: canvas is %lux%lu, not %lux%lu\n",
+            c->width, c->height, v->hsize, v->vsize);
+    return false;
+  }
+
+  if (!camera_region_valid(v, r, "camera_render_region_into")) {
+    return false;
+  }
+
+  camera_render_region_tiles(v, w, r, c, false);
+  return true;
+}
+
+render_record *render_record_alloc(const camera *v)
+{
+  render_record *r = malloc(sizeof(render_record));
+  r->width = v->hsize;
+  r->height = v->vsize;
+  r->tiles_x = (v->hsize + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  r->tiles_count = r->tiles_x * ((v->vsize + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE);
+  r->tiles = malloc(r->tiles_count * sizeof(render_trace));
+  memset(r->tiles, 0, r->tiles_count * sizeof(render_trace));
+  return r;
+}
+
+void render_record_free(render_record *r)
+{
+  free(r->tiles);
+  free(r);
+}
+
+// Renders like camera_render and records what each tile's rays touched
+// in r, for camera_rerender
+canvas *camera_render_record(const camera *v, const world *w, render_record *r, render_stats *s)
+{
+  assert(r->width == v->hsize && r->height == v->vsize);
 
+  canvas *c = canvas_alloc(v->hsize, v->vsize);
+
+  if (s != NULL) {
+    s->width = v->hsize;
+    s->height = v->vsize;
+    s->start = prof_read_cpu_timer();
+  }
+
+  render_tiles tiles = {0};
+  tiles.v = v;
+  tiles.w = w;
+  tiles.c = c;
+  tiles.record = r;
+  tiles.tiles_x = r->tiles_x;
+  tiles.tiles_count = r->tiles_count;
+  camera_render_tiles(&tiles);
 
   if (s != NULL) {
     s->end = prof_read_cpu_timer();
@@ -233,6 +677,149 @@ canvas *camera_render(const camera *v, const world *w, render_stats *s)
   return c;
 }
 
+static b32 bounds_overlap(const bounds *a, const bounds *b)
+{
+  for (u32 i = 0; i < 3; i++) {
+    if (a->min[i] > b->max[i] || b->min[i] > a->max[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Flags the tiles whose camera rays can reach b. Bounds reaching behind
+// the camera flag every tile, as does a lens, which blurs them.
+static void camera_flag_bounds_tiles(const camera *v, const render_record *r, const bounds *b, b32 *flagged)
+{
+  f64 x0 = F64_INF;
+  f64 y0 = F64_INF;
+  f64 x1 = -F64_INF;
+  f64 y1 = -F64_INF;
+  b32 all = !bounds_is_finite(b) || v->aperture > 0;
+
+  for (u32 i = 0; i < 8 && !all; i++) {
+    v4 corner = point_init(
+        (i & 1) ? b->max[0] : b->min[0],
+        (i & 2) ? b->max[1] : b->min[1],
+        (i & 4) ? b->max[2] : b->min[2]);
+
+    // Camera space looks down -z, the image plane is at z = -1
+    v4 p = {0};
+    m4_mulv(v->transform, corner, p);
+    if (p[2] > -EPSILON) {
+      all = true;
+      break;
+    }
+
+    f64 x = (v->half_width + p[0] / p[2]) / v->pixel_size;
+    f64 y = (v->half_height + p[1] / p[2]) / v->pixel_size;
+    x0 = MIN(x0, x);
+    y0 = MIN(y0, y);
+    x1 = MAX(x1, x);
+    y1 = MAX(y1, y);
+  }
+
+  if (all) {
+    for (u32 i = 0; i < r->tiles_count; i++) {
+      flagged[i] = true;
+    }
+    return;
+  }
+
+  // A pixel of margin for samples spread over the pixel
+  if (x1 < -1 || y1 < -1 || x0 > (f64)r->width + 1 || y0 > (f64)r->height + 1) {
+    return;
+  }
+
+  u32 tiles_y = r->tiles_count / r->tiles_x;
+  u32 tx0 = (u32)MAX(x0 - 1, 0) / RENDER_TILE_SIZE;
+  u32 ty0 = (u32)MAX(y0 - 1, 0) / RENDER_TILE_SIZE;
+  u32 tx1 = MIN((u32)MAX(x1 + 1, 0) / RENDER_TILE_SIZE, r->tiles_x - 1);
+  u32 ty1 = MIN((u32)MAX(y1 + 1, 0) / RENDER_TILE_SIZE, tiles_y - 1);
+
+  for (u32 ty = ty0; ty <= ty1; ty++) {
+    for (u32 tx = tx0; tx <= tx1; tx++) {
+      flagged[ty * r->tiles_x + tx] = true;
+    }
+  }
+}
+
+// After objects of w changed, renders again the tiles of c that may see
+// it, given r from camera_render_record or earlier calls. Those are the
+// tiles whose rays touched one of the objects, whose shadow and secondary
+// rays pass through its new bounds, or that its new bounds cover on
+// screen, and r is updated for them. objects are indices in w->objects,
+// top level csgs for changes to their children. Indices past
+// w->objects_count stand for removed objects. w's bvh is refit and its grid
+// rebuilt for the edit before tracing. Returns the number of tiles
+// rendered.
+u32 camera_rerender(const camera *v, world *w, render_record *r, const u32 *objects, u32 objects_count, canvas *c)
+{
+  assert(r->width == v->hsize && r->height == v->vsize);
+  assert(c->width == v->hsize && c->height == v->vsize);
+
+  b32 *flagged = malloc(r->tiles_count * sizeof(b32));
+  memset(flagged, 0, r->tiles_count * sizeof(b32));
+
+  for (u32 k = 0; k < objects_count; k++) {
+    u32 index = objects[k];
+    assert(index < MAX_OBJECTS);
+    u64 bit = 1ull << (index % 64);
+
+    bounds b = {0};
+    b32 present = index < w->objects_count;
+    if (present) {
+      object_bounds(&w->objects[index], &b);
+      camera_flag_bounds_tiles(v, r, &b, flagged);
+    }
+
+    for (u32 i = 0; i < r->tiles_count; i++) {
+      const render_trace *t = &r->tiles[i];
+      flagged[i] = flagged[i] || (t->objects[index / 64] & bit) != 0 ||
+        (present && bounds_overlap(&t->rays, &b));
+    }
+  }
+
+  if (w->bvh != NULL) {
+    u32 moved[MAX_OBJECTS];
+    u32 moved_count = 0;
+    for (u32 k = 0; k < objects_count; k++) {
+      if (objects[k] < w->objects_count) {
+        moved[moved_count++] = objects[k];
+      }
+    }
+    bvh_refit(w->bvh, w, moved, moved_count);
+  }
+
+  if (w->grid != NULL) {
+    grid_free(w->grid);
+    w->grid = grid_alloc(w);
+  }
+
+  u32 *order = malloc(r->tiles_count * sizeof(u32));
+  u32 order_count = 0;
+  for (u32 i = 0; i < r->tiles_count; i++) {
+    if (flagged[i]) {
+      order[order_count++] = i;
+    }
+  }
+
+  render_tiles tiles = {0};
+  tiles.v = v;
+  tiles.w = w;
+  tiles.c = c;
+  tiles.record = r;
+  tiles.order = order;
+  tiles.tiles_x = r->tiles_x;
+  tiles.tiles_count = order_count;
+  camera_render_tiles(&tiles);
+
+  free(order);
+  free(flagged);
+
+  return order_count;
+}
+
 void render_stats_print(const render_stats *s)
 {
   if (s->start == 0) {
@@ -0,0 +1,108 @@
+#include "rtc.h"
+
+// Children keep a pointer to o, so o must already be at its final address,
+// e.g. csg_init(&w.objects[i], ...), and left/right must outlive it. Child
+// transforms are relative to the csg and should be set before this call so
+// their bounds are cached correctly.
+void csg_init(object *o, enum csg_operation operation, object *left, object *right)
+{
+  object_init(o);
+  o->type = CsgType;
+  o->value.csg.operation = operation;
+  o->value.csg.left = left;
+  o->value.csg.right = right;
+
+  left->parent = o;
+  right->parent = o;
+
+  object_bounds(left, &o->value.csg.left_bounds);
+  object_bounds(right, &o->value.csg.right_bounds);
+}
+
+b32 csg_intersection_allowed(enum csg_operation operation, b32 left_hit, b32 in_left, b32 in_right)
+{
+  switch (operation) {
+    case UnionOperation: {
+      return (left_hit && !in_right) || (!left_hit && !in_left);
+    } break;
+    case IntersectionOperation: {
+      return (left_hit && in_right) || (!left_hit && in_left);
+    } break;
+    case DifferenceOperation: {
+      return (left_hit && !in_right) || (!left_hit && in_left);
+    } break;
+  }
+
+  return false;
+}
+
+static void csg_intersect_child(const ray *r, const object *child, const bounds *b, const v4 inv_direction, intersection_group *ig)
+{
+  f64 tmin, tmax;
+  if (!bounds_is_finite(b) || bounds_intersect(b, r->origin, inv_direction, &tmin, &tmax)) {
+    ray_intersect(r, child, ig);
+  }
+}
+
+// r is already in csg space. Each child's sorted hits are the boundaries of
+// its inside intervals along the ray, so the two lists are merged in order
+// while tracking whether the ray is inside each child, and only boundaries
+// of the combined solid are kept.
+void csg_intersect(const ray *r, const object *o, intersection_group *ig)
+{
+  enum csg_operation operation = o->value.csg.operation;
+
+  v4 inv_direction = {0};
+  ray_inverse_direction(r, inv_direction);
+
+  intersection_group left;
+  left.count = 0;
+  csg_intersect_child(r, o->value.csg.left, &o->value.csg.left_bounds, inv_direction, &left);
+
+  // Nothing survives an intersection or difference without the left child
+  if (left.count == 0 && operation != UnionOperation) {
+    return;
+  }
+
+  intersection_group right;
+  right.count = 0;
+  csg_intersect_child(r, o->value.csg.right, &o->value.csg.right_bounds, inv_direction, &right);
+
+  if (right.count == 0) {
+    if (operation == IntersectionOperation) {
+      return;
+    }
+
+    for (u32 i = 0; i < left.count; i++) {
+      intersection_insert(ig, left.xs[i].t, left.xs[i].o);
+    }
+    return;
+  }
+
+  if (left.count == 0) {
+    for (u32 i = 0; i < right.count; i++) {
+      intersection_insert(ig, right.xs[i].t, right.xs[i].o);
+    }
+    return;
+  }
+
+  b32 in_left = false;
+  b32 in_right = false;
+  u32 i = 0;
+  u32 j = 0;
+
+  while (i < left.count || j < right.count) {
+    b32 left_hit = j >= right.count || (i < left.count && left.xs[i].t <= right.xs[j].t);
+    const intersection *x = left_hit ? &left.xs[i++] : &right.xs[j++];
+
+    if (csg_intersection_allowed(operation, left_hit, in_left, in_right)) {
+      intersection_insert(ig, x->t, x->o);
+    }
+
+    if (left_hit) {
+      in_left = !in_left;
+    } else {
+      in_right = !in_right;
+    }
+  }
+}
@@ -0,0 +1,395 @@
+#include "rtc.h"
+
+// Serialized scenes above this are refused before being read, as are
+// cameras with more pixels than RENDER_DAEMON_MAX_PIXELS
+#define RENDER_DAEMON_MAX_SCENE_SIZE (1ull << 30)
+#define RENDER_DAEMON_MAX_PIXELS (1ull << 24)
+#define RENDER_DAEMON_TIMEOUT_SECONDS 30
+
+// Every request is a header followed by size bytes of payload and gets a
+// reply header, ok 1 or 0, followed by its own payload:
+//   LoadSceneRequest    scene_serialize bytes, value of the reply is the hash
+//   UseSceneRequest     value is the hash of a scene loaded before
+//   SetCameraRequest    a camera
+//   RenderRegionRequest a render_region
+//   FetchImageRequest   reply value is the width, payload the pixels
+//   ShutdownRequest
+// Loading a scene or using one also sets the camera it was loaded with.
+enum render_daemon_request_type {
+  LoadSceneRequest, UseSceneRequest, SetCameraRequest, RenderRegionRequest, FetchImageRequest, ShutdownRequest,
+};
+
+typedef struct {
+  u64 type;
+  u64 value;
+  u64 size;
+} render_daemon_message;
+
+// Listens on a Unix domain socket at path, replacing a stale socket there.
+// Returns NULL if it cannot, or if path is anything else, including a
+// socket another daemon still listens on.
+render_daemon *render_daemon_alloc(const char *path)
+{
+  struct sockaddr_un addr = {0};
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "render_daemon_alloc: socket path too long %s\n", path);
+    return NULL;
+  }
+  strcpy(addr.sun_path, path);
+
+  struct stat st = {0};
+  if (lstat(path, &st) == 0) {
+    int live = S_ISSOCK(st.st_mode) ? render_daemon_connect(path) : -1;
+    if (!S_ISSOCK(st.st_mode) || live >= 0) {
+      fprintf(stderr, "render_daemon_alloc: %s is in use\n", path);
+      if (live >= 0) {
+        close(live);
+      }
+      return NULL;
+    }
+    unlink(path);
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    fprintf(stderr, "render_daemon_alloc: could not create socket\n");
+    return NULL;
+  }
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, RENDER_DAEMON_MAX_CLIENTS) != 0) {
+    fprintf(stderr, "render_daemon_alloc: could not listen on %s\n", path);
+    close(fd);
+    return NULL;
+  }
+
+  render_daemon *d = malloc(sizeof(render_daemon));
+  memset(d, 0, sizeof(render_daemon));
+  d->listen_fd = fd;
+  d->timeout = RENDER_DAEMON_TIMEOUT_SECONDS;
+  strcpy(d->path, path);
+  return d;
+}
+
+static void render_daemon_close(render_daemon *d, u32 i)
+{
+  render_daemon_client *client = &d->clients[i];
+  close(client->fd);
+  if (client->c != NULL) {
+    canvas_free(client->c);
+  }
+  d->clients[i] = d->clients[--d->clients_count];
+}
+
+void render_daemon_free(render_daemon *d)
+{
+  while (d->clients_count > 0) {
+    render_daemon_close(d, 0);
+  }
+  for (u32 i = 0; i < d->scenes_count; i++) {
+    scene_free(d->scenes[i].s);
+  }
+
+  close(d->listen_fd);
+  unlink(d->path);
+  free(d);
+}
+
+static render_daemon_scene *render_daemon_find(render_daemon *d, u64 hash)
+{
+  for (u32 i = 0; i < d->scenes_count; i++) {
+    if (d->scenes[i].hash == hash) {
+      d->scenes[i].last_used = ++d->clock;
+      return &d->scenes[i];
+    }
+  }
+  return NULL;
+}
+
+// Keeps s, making room by dropping the scene unused the longest
+static render_daemon_scene *render_daemon_insert(render_daemon *d, u64 hash, scene *s)
+{
+  u32 slot = d->scenes_count;
+  if (slot == RENDER_DAEMON_MAX_SCENES) {
+    slot = 0;
+    for (u32 i = 1; i < d->scenes_count; i++) {
+      if (d->scenes[i].last_used < d->scenes[slot].last_used) {
+        slot = i;
+      }
+    }
+    scene_free(d->scenes[slot].s);
+  } else {
+    d->scenes_count++;
+  }
+
+  // Scenes stay resident, so the hierarchy is worth building once
+  if (s->w->bvh == NULL && s->w->grid == NULL) {
+    s->w->bvh = bvh_alloc(s->w);
+  }
+
+  render_daemon_scene *entry = &d->scenes[slot];
+  entry->hash = hash;
+  entry->s = s;
+  entry->last_used = ++d->clock;
+  return entry;
+}
+
+static b32 render_daemon_view_valid(const camera *v)
+{
+  return v->hsize > 0 && v->vsize > 0 && v->hsize <= RENDER_DAEMON_MAX_PIXELS &&
+    v->vsize <= RENDER_DAEMON_MAX_PIXELS && v->hsize * v->vsize <= RENDER_DAEMON_MAX_PIXELS;
+}
+
+static void render_daemon_set_view(render_daemon_client *client, const camera *v)
+{
+  if (client->c != NULL && (client->c->width != v->hsize || client->c->height != v->vsize)) {
+    canvas_free(client->c);
+    client->c = NULL;
+  }
+  if (client->c == NULL) {
+    client->c = canvas_alloc(v->hsize, v->vsize);
+  }
+  client->v = *v;
+}
+
+// Answers one request, false if the client left or sent garbage
+static b32 render_daemon_serve(render_daemon *d, render_daemon_client *client)
+{
+  render_daemon_message m = {0};
+  if (!socket_recv_all(client->fd, &m, sizeof(m))) {
+    return false;
+  }
+
+  render_daemon_message reply = {0};
+  const void *payload = NULL;
+
+  switch (m.type) {
+    case LoadSceneRequest: {
+      if (m.size > RENDER_DAEMON_MAX_SCENE_SIZE) {
+        return false;
+      }
+
+      u8 *data = malloc(MAX(m.size, 1));
+      if (!socket_recv_all(client->fd, data, m.size)) {
+        free(data);
+        return false;
+      }
+
+      u64 hash = scene_hash(data, m.size);
+      render_daemon_scene *entry = render_daemon_find(d, hash);
+      if (entry != NULL) {
+        d->scene_hits++;
+
+        camera v = {0};
+        if (scene_camera(data, m.size, &v) && render_daemon_view_valid(&v)) {
+          render_daemon_set_view(client, &v);
+          client->hash = hash;
+          reply.type = true;
+          reply.value = hash;
+        }
+      } else {
+        scene *s = scene_deserialize(data, m.size);
+        if (s != NULL && !render_daemon_view_valid(&s->v)) {
+          scene_free(s);
+        } else if (s != NULL) {
+          d->scene_misses++;
+          entry = render_daemon_insert(d, hash, s);
+          render_daemon_set_view(client, &s->v);
+          client->hash = hash;
+          reply.type = true;
+          reply.value = hash;
+        }
+      }
+      free(data);
+    } break;
+    case UseSceneRequest: {
+      render_daemon_scene *entry = render_daemon_find(d, m.value);
+      if (entry != NULL) {
+        d->scene_hits++;
+        render_daemon_set_view(client, &entry->s->v);
+        client->hash = entry->hash;
+        reply.type = true;
+        reply.value = entry->hash;
+      }
+    } break;
+    case SetCameraRequest: {
+      camera v = {0};
+      if (m.size != sizeof(camera) || !socket_recv_all(client->fd, &v, sizeof(camera))) {
+        return false;
+      }
+      if (render_daemon_view_valid(&v)) {
+        render_daemon_set_view(client, &v);
+        reply.type = true;
+      }
+    } break;
+    case RenderRegionRequest: {
+      render_region r = {0};
+      if (m.size != sizeof(render_region) || !socket_recv_all(client->fd, &r, sizeof(render_region))) {
+        return false;
+      }
+
+      // Empty regions have nothing to render and succeed
+      render_daemon_scene *entry = client->c != NULL ? render_daemon_find(d, client->hash) : NULL;
+      if (entry != NULL && r.x0 <= r.x1 && r.y0 <= r.y1 && r.x1 <= client->v.hsize && r.y1 <= client->v.vsize) {
+        reply.type = camera_render_region_into(&client->v, entry->s->w, &r, client->c);
+      }
+    } break;
+    case FetchImageRequest: {
+      if (client->c != NULL) {
+        reply.type = true;
+        reply.value = client->c->width;
+        reply.size = client->c->width * client->c->height * sizeof(v3);
+        payload = client->c->pixels;
+      }
+    } break;
+    case ShutdownRequest: {
+      d->stopped = true;
+      reply.type = true;
+    } break;
+    default: {
+      return false;
+    } break;
+  }
+
+  return socket_send_all(client->fd, &reply, sizeof(reply)) &&
+    (reply.size == 0 || socket_send_all(client->fd, payload, reply.size));
+}
+
+// Serves clients until one asks for a shutdown. Requests are answered one
+// at a time, the renders themselves use the camera's threads. Clients that
+// stall for d->timeout seconds within a request or reply are dropped. Scenes are
+// kept by hash across clients, so a client loading a scene the daemon has
+// seen skips building it, and one that knows the hash need not send it.
+void render_daemon_run(render_daemon *d)
+{
+  struct pollfd fds[RENDER_DAEMON_MAX_CLIENTS + 1];
+
+  d->stopped = false;
+  while (!d->stopped) {
+    fds[0].fd = d->listen_fd;
+    fds[0].events = POLLIN;
+    for (u32 i = 0; i < d->clients_count; i++) {
+      fds[i + 1].fd = d->clients[i].fd;
+      fds[i + 1].events = POLLIN;
+    }
+
+    u32 count = d->clients_count;
+    if (poll(fds, count + 1, -1) < 0) {
+      continue;
+    }
+
+    // Back to front, closing a client moves the last one into its place
+    for (u32 i = count; i-- > 0 && !d->stopped;) {
+      if (fds[i + 1].revents != 0 && !render_daemon_serve(d, &d->clients[i])) {
+        render_daemon_close(d, i);
+      }
+    }
+
+    if ((fds[0].revents & POLLIN) && !d->stopped) {
+      int fd = accept(d->listen_fd, NULL, NULL);
+      if (fd < 0) {
+        continue;
+      }
+      if (d->clients_count == RENDER_DAEMON_MAX_CLIENTS) {
+        close(fd);
+        continue;
+      }
+
+      // Requests are served one at a time, a client stalling inside one
+      // would hold up every other
+      struct timeval timeout = {0};
+      timeout.tv_sec = (time_t)d->timeout;
+      timeout.tv_usec = (suseconds_t)((d->timeout - (f64)timeout.tv_sec) * 1e6);
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+      render_daemon_client *client = &d->clients[d->clients_count++];
+      memset(client, 0, sizeof(render_daemon_client));
+      client->fd = fd;
+    }
+  }
+}
+
+// Client side, each call is one request on a connection to a daemon
+
+int render_daemon_connect(const char *path)
+{
+  struct sockaddr_un addr = {0};
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+static b32 render_daemon_request(int fd, u64 type, u64 value, const void *payload, u64 size, render_daemon_message *reply)
+{
+  render_daemon_message m = { type, value, size };
+  return socket_send_all(fd, &m, sizeof(m)) && (size == 0 || socket_send_all(fd, payload, size)) &&
+    socket_recv_all(fd, reply, sizeof(render_daemon_message));
+}
+
+// Sends v and w, hash gets the key the daemon keeps w's scene under
+b32 render_daemon_load_scene(int fd, const camera *v, const world *w, u64 *hash)
+{
+  u64 size = 0;
+  u8 *data = scene_serialize(v, w, &size);
+
+  render_daemon_message reply = {0};
+  b32 ok = render_daemon_request(fd, LoadSceneRequest, 0, data, size, &reply) && reply.type;
+  free(data);
+
+  if (ok && hash != NULL) {
+    *hash = reply.value;
+  }
+  return ok;
+}
+
+// Uses a scene the daemon already has, false if it does not have it
+b32 render_daemon_use_scene(int fd, u64 hash)
+{
+  render_daemon_message reply = {0};
+  return render_daemon_request(fd, UseSceneRequest, hash, NULL, 0, &reply) && reply.type;
+}
+
+b32 render_daemon_set_camera(int fd, const camera *v)
+{
+  render_daemon_message reply = {0};
+  return render_daemon_request(fd, SetCameraRequest, 0, v, sizeof(camera), &reply) && reply.type;
+}
+
+// Renders r into the connection's image, which keeps the pixels of
+// earlier regions until the camera's size changes
+b32 render_daemon_render_region(int fd, const render_region *r)
+{
+  render_daemon_message reply = {0};
+  return render_daemon_request(fd, RenderRegionRequest, 0, r, sizeof(render_region), &reply) && reply.type;
+}
+
+canvas *render_daemon_fetch_image(int fd)
+{
+  render_daemon_message reply = {0};
+  if (!render_daemon_request(fd, FetchImageRequest, 0, NULL, 0, &reply) || !reply.type || reply.value == 0) {
+    return NULL;
+  }
+
+  canvas *c = canvas_alloc(reply.value, reply.size / sizeof(v3) / reply.value);
+  if (!socket_recv_all(fd, c->pixels, reply.size)) {
+    canvas_free(c);
+    return NULL;
+  }
+  return c;
+}
+
+b32 render_daemon_shutdown(int fd)
+{
+  render_daemon_message reply = {0};
+  return render_daemon_request(fd, ShutdownRequest, 0, NULL, 0, &reply) && reply.type;
+}
@@ -0,0 +1,194 @@
+#include "rtc.h"
+
+// Edge avoiding a-trous wavelet filter, after Dammertz et al., "Edge-Avoiding
+// A-Trous Wavelet Transform for fast Global Illumination Filtering", HPG
+// 2010. The image is divided by albedo so texture is kept out of the blur,
+// then filtered with a 5x5 B3 spline whose taps spread out by 2^i on pass i.
+// Each tap is weighted down by differences in color, normal and depth.
+
+// Below this the albedo is too dark to divide out
+#define DENOISE_MIN_ALBEDO 1e-3
+
+void denoise_options_init(denoise_options *o)
+{
+  o->iterations = 5;
+  o->sigma_color = 0.6;
+  o->sigma_normal = 0.3;
+  o->sigma_depth = 0.1;
+  o->threads = 0;
+}
+
+static void *denoise_band_run(void *arg)
+{
+  static const f64 kernel[5] = { 1.0 / 16, 1.0 / 4, 3.0 / 8, 1.0 / 4, 1.0 / 16 };
+
+  const denoise_band *b = arg;
+  const render_aovs *a = b->a;
+  u32 width = a->width;
+  u32 height = a->height;
+  u32 n = width * height;
+
+  const f64 *in_r = b->in;
+  const f64 *in_g = b->in + n;
+  const f64 *in_b = b->in + 2 * n;
+
+  f64 color_scale = 1 / (b->sigma_color * b->sigma_color);
+  f64 normal_scale = 1 / (b->sigma_normal * b->sigma_normal);
+
+  for (u32 y = b->y0; y < b->y1; y++) {
+    for (u32 x = 0; x < width; x++) {
+      u32 p = y * width + x;
+      f64 zp = a->depth[p];
+
+      f64 sum_r = 0;
+      f64 sum_g = 0;
+      f64 sum_b = 0;
+      f64 weights = 0;
+
+      for (s32 j = -2; j <= 2; j++) {
+        s64 qy = (s64)y + j * (s64)b->step;
+        if (qy < 0 || qy >= (s64)height) {
+          continue;
+        }
+
+        for (s32 i = -2; i <= 2; i++) {
+          s64 qx = (s64)x + i * (s64)b->step;
+          if (qx < 0 || qx >= (s64)width) {
+            continue;
+          }
+
+          u32 q = (u32)qy * width + (u32)qx;
+
+          f64 dr = in_r[p] - in_r[q];
+          f64 dg = in_g[p] - in_g[q];
+          f64 db = in_b[p] - in_b[q];
+          f64 dc = (dr * dr + dg * dg + db * db) * color_scale;
+
+          f64 nx = a->normal[p][0] - a->normal[q][0];
+          f64 ny = a->normal[p][1] - a->normal[q][1];
+          f64 nz = a->normal[p][2] - a->normal[q][2];
+          f64 dn = (nx * nx + ny * ny + nz * nz) * normal_scale;
+
+          // Relative to the depth at p so the filter does not depend on
+          // scene scale, misses only mix with misses
+          f64 zq = a->depth[q];
+          f64 dz = 0;
+          if (zp == F64_INF || zq == F64_INF) {
+            if (zp != zq) {
+              continue;
+            }
+          } else {
+            dz = fabs(zp - zq) / (b->sigma_depth * (f64)b->step * MAX(zp, EPSILON));
+          }
+
+          f64 weight = kernel[i + 2] * kernel[j + 2] * exp(-(dc + dn + dz));
+
+          sum_r += weight * in_r[q];
+          sum_g += weight * in_g[q];
+          sum_b += weight * in_b[q];
+          weights += weight;
+        }
+      }
+
+      // The center tap always counts, so weights is positive
+      b->out[p] = sum_r / weights;
+      b->out[p + n] = sum_g / weights;
+      b->out[p + 2 * n] = sum_b / weights;
+    }
+  }
+
+  return NULL;
+}
+
+// One pass split into bands of rows across threads
+static void denoise_pass(const render_aovs *a, const denoise_options *o, u32 threads, u32 iteration, const f64 *in, f64 *out)
+{
+  denoise_band *bands = malloc(threads * sizeof(denoise_band));
+
+  u32 rows = (a->height + threads - 1) / threads;
+
+  for (u32 t = 0; t < threads; t++) {
+    denoise_band *b = &bands[t];
+    b->a = a;
+    b->in = in;
+    b->out = out;
+    b->step = 1u << iteration;
+    b->sigma_color = o->sigma_color / (f64)(1u << iteration);
+    b->sigma_normal = o->sigma_normal;
+    b->sigma_depth = o->sigma_depth;
+    b->y0 = MIN(t * rows, a->height);
+    b->y1 = MIN(b->y0 + rows, a->height);
+  }
+
+  if (threads == 1) {
+    denoise_band_run(&bands[0]);
+  } else {
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    b32 *started = malloc(threads * sizeof(b32));
+    for (u32 t = 0; t < threads; t++) {
+      started[t] = pthread_create(&workers[t], NULL, denoise_band_run, &bands[t]) == 0;
+    }
+
+    // Bands whose thread could not be started are run here
+    for (u32 t = 0; t < threads; t++) {
+      if (started[t]) {
+        pthread_join(workers[t], NULL);
+      } else {
+        denoise_band_run(&bands[t]);
+      }
+    }
+    free(started);
+    free(workers);
+  }
+
+  free(bands);
+}
+
+// a needs depth, normal and albedo buffers of c's size. out may be c.
+void canvas_denoise(const canvas *c, const render_aovs *a, const denoise_options *o, canvas *out)
+{
+  assert(a->depth != NULL && a->normal != NULL && a->albedo != NULL);
+  assert(a->width == c->width && a->height == c->height);
+  assert(out->width == c->width && out->height == c->height);
+
+  u32 n = c->width * c->height;
+  if (n == 0) {
+    return;
+  }
+
+  u32 threads = o->threads;
+  if (threads == 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = online > 0 ? (u32)online : 1;
+  }
+  threads = MAX(MIN(threads, c->height), 1);
+
+  // Planar so each channel's loads are contiguous
+  f64 *front = malloc(3 * n * sizeof(f64));
+  f64 *back = malloc(3 * n * sizeof(f64));
+
+  for (u32 p = 0; p < n; p++) {
+    for (u32 k = 0; k < 3; k++) {
+      f64 albedo = a->albedo[p][k];
+      front[p + k * n] = albedo > DENOISE_MIN_ALBEDO ? c->pixels[p][k] / albedo : c->pixels[p][k];
+    }
+  }
+
+  for (u32 i = 0; i < o->iterations; i++) {
+    denoise_pass(a, o, threads, i, front, back);
+
+    f64 *swap = front;
+    front = back;
+    back = swap;
+  }
+
+  for (u32 p = 0; p < n; p++) {
+    for (u32 k = 0; k < 3; k++) {
+      f64 albedo = a->albedo[p][k];
+      out->pixels[p][k] = albedo > DENOISE_MIN_ALBEDO ? front[p + k * n] * albedo : front[p + k * n];
+    }
+  }
+
+  free(front);
+  free(back);
+}
@@ -0,0 +1,444 @@
+#include "rtc.h"
+
+// Tiles sent to a worker before its results come back, so it starts the
+// next one without waiting on the coordinator
+#define DISTRIBUTED_JOBS_IN_FLIGHT 2
+
+// Reads and writes on a peer that stalls this long fail, and the peer is
+// treated as lost. Also the default for render_coordinator's timeout.
+#define DISTRIBUTED_TIMEOUT_SECONDS 30
+
+// The coordinator sends the scene once, then jobs, each the index of a
+// tile, and done once the image is finished. Workers answer every job with
+// a result followed by the tile's pixels, left to right and top to bottom.
+// Peers must be the same build, see scene_serialize.
+enum distributed_message_type { SceneMessage, JobMessage, ResultMessage, DoneMessage };
+
+typedef struct {
+  u64 type;
+  u64 value;
+} distributed_message;
+
+// progress is the os timer value of the worker's last result, or of the
+// job that ended it being idle. Jobs are rendered in turn, so the time
+// since then is how long the job at the front has taken.
+typedef struct {
+  int fd;
+  u32 jobs[DISTRIBUTED_JOBS_IN_FLIGHT];
+  u32 jobs_count;
+  u64 progress;
+} distributed_worker;
+
+// Sends or receives all n bytes, false if the peer left or timed out. Used
+// by the render daemon too.
+b32 socket_send_all(int fd, const void *p, u64 n)
+{
+  const u8 *bytes = p;
+  while (n > 0) {
+    ssize_t sent = send(fd, bytes, n, MSG_NOSIGNAL);
+    if (sent <= 0) {
+      return false;
+    }
+    bytes += sent;
+    n -= (u64)sent;
+  }
+  return true;
+}
+
+b32 socket_recv_all(int fd, void *p, u64 n)
+{
+  u8 *bytes = p;
+  while (n > 0) {
+    ssize_t received = recv(fd, bytes, n, 0);
+    if (received <= 0) {
+      return false;
+    }
+    bytes += received;
+    n -= (u64)received;
+  }
+  return true;
+}
+
+static void distributed_set_timeout(int fd)
+{
+  struct timeval timeout = {0};
+  timeout.tv_sec = DISTRIBUTED_TIMEOUT_SECONDS;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+static void distributed_tile_region(const camera *v, u32 tile, render_region *r)
+{
+  u32 tiles_x = (v->hsize + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  r->x0 = (tile % tiles_x) * RENDER_TILE_SIZE;
+  r->y0 = (tile / tiles_x) * RENDER_TILE_SIZE;
+  r->x1 = MIN(r->x0 + RENDER_TILE_SIZE, v->hsize);
+  r->y1 = MIN(r->y0 + RENDER_TILE_SIZE, v->vsize);
+}
+
+// Listens on address, an IPv4 address such as 127.0.0.1 to take only local
+// workers or 0.0.0.0 for any, and port, 0 picks a free one which is stored
+// in port. Returns NULL if the socket cannot be set up.
+render_coordinator *render_coordinator_alloc(const char *address, u32 port)
+{
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((u16)port);
+  if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+    fprintf(stderr, "render_coordinator_alloc: bad address %s\n", address);
+    return NULL;
+  }
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    fprintf(stderr, "render_coordinator_alloc: could not create socket\n");
+    return NULL;
+  }
+
+  int reuse = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  socklen_t length = sizeof(addr);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, RENDER_MAX_WORKERS) != 0 ||
+      getsockname(fd, (struct sockaddr *)&addr, &length) != 0) {
+    fprintf(stderr, "render_coordinator_alloc: could not listen on %s:%lu\n", address, port);
+    close(fd);
+    return NULL;
+  }
+
+  render_coordinator *rc = malloc(sizeof(render_coordinator));
+  rc->listen_fd = fd;
+  rc->port = ntohs(addr.sin_port);
+  rc->timeout = DISTRIBUTED_TIMEOUT_SECONDS;
+  return rc;
+}
+
+void render_coordinator_free(render_coordinator *rc)
+{
+  close(rc->listen_fd);
+  free(rc);
+}
+
+// Takes back the tiles of a worker that left or misbehaved
+static void distributed_drop(distributed_worker *workers, u32 *workers_count, u32 i, u32 *pending, u32 *pending_count, render_distributed_stats *s)
+{
+  distributed_worker *d = &workers[i];
+  if (d->jobs_count > 0) {
+    s->lost_workers++;
+    s->requeued_tiles += d->jobs_count;
+  }
+
+  for (u32 j = 0; j < d->jobs_count; j++) {
+    pending[(*pending_count)++] = d->jobs[j];
+  }
+
+  close(d->fd);
+  workers[i] = workers[--(*workers_count)];
+}
+
+// Hands out pending tiles until the worker has its fill
+static b32 distributed_assign(distributed_worker *d, u32 *pending, u32 *pending_count)
+{
+  if (d->jobs_count == 0) {
+    d->progress = prof_read_os_timer();
+  }
+
+  while (d->jobs_count < DISTRIBUTED_JOBS_IN_FLIGHT && *pending_count > 0) {
+    u32 tile = pending[--(*pending_count)];
+    d->jobs[d->jobs_count++] = tile;
+
+    distributed_message m = { JobMessage, tile };
+    if (!socket_send_all(d->fd, &m, sizeof(m))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Reads one result into c, false if the worker broke the protocol or left
+static b32 distributed_receive(distributed_worker *d, const camera *v, canvas *c, u8 *done, v3 *pixels)
+{
+  distributed_message m = {0};
+  if (!socket_recv_all(d->fd, &m, sizeof(m)) || m.type != ResultMessage) {
+    return false;
+  }
+
+  u32 job = 0;
+  while (job < d->jobs_count && d->jobs[job] != m.value) {
+    job++;
+  }
+  if (job == d->jobs_count) {
+    return false;
+  }
+
+  render_region r = {0};
+  distributed_tile_region(v, m.value, &r);
+  u32 width = r.x1 - r.x0;
+  if (!socket_recv_all(d->fd, pixels, width * (r.y1 - r.y0) * sizeof(v3))) {
+    return false;
+  }
+
+  for (u32 y = r.y0; y < r.y1; y++) {
+    memcpy(c->pixels[y * c->width + r.x0], pixels[(y - r.y0) * width], width * sizeof(v3));
+  }
+
+  done[m.value] = true;
+  d->jobs[job] = d->jobs[--d->jobs_count];
+  d->progress = prof_read_os_timer();
+  return true;
+}
+
+// Renders the image on workers, local_workers of them started here as
+// child processes and any others that connect with render_worker_run. The
+// scene is sent to each worker once, after which they pull tiles as they
+// finish them. Tiles of workers that disconnect, or go rc->timeout
+// seconds without finishing one, are given to others, so this returns once
+// every tile is in, waiting for workers to connect if none are left. The
+// image matches camera_render.
+//
+// Local workers are forked without exec and go on to use malloc, stdio and
+// threads, which is only safe if the caller has no other threads running
+// when this is called. Multithreaded callers should pass 0 local_workers
+// and start workers as separate processes with render_worker_run instead.
+canvas *render_coordinator_run(render_coordinator *rc, const camera *v, const world *w, u32 local_workers, render_distributed_stats *s)
+{
+  render_distributed_stats stats = {0};
+  u64 start = prof_read_os_timer();
+
+  pid_t *children = malloc(MAX(local_workers, 1) * sizeof(pid_t));
+  for (u32 i = 0; i < local_workers; i++) {
+    children[i] = fork();
+    if (children[i] == 0) {
+      close(rc->listen_fd);
+      _exit(render_worker_run("127.0.0.1", rc->port, 0) ? 0 : 1);
+    }
+  }
+
+  u64 scene_size = 0;
+  u8 *scene_data = scene_serialize(v, w, &scene_size);
+
+  u32 tiles_x = (v->hsize + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  u32 tiles_count = tiles_x * ((v->vsize + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE);
+  stats.tiles = tiles_count;
+
+  // Taken from the back, so tiles go out in order and lost ones go first
+  u32 *pending = malloc(MAX(tiles_count, 1) * sizeof(u32));
+  u32 pending_count = tiles_count;
+  for (u32 i = 0; i < tiles_count; i++) {
+    pending[i] = tiles_count - 1 - i;
+  }
+
+  u8 *done = malloc(MAX(tiles_count, 1));
+  memset(done, 0, MAX(tiles_count, 1));
+  u32 done_count = 0;
+
+  canvas *c = canvas_alloc(v->hsize, v->vsize);
+  v3 *pixels = malloc(RENDER_TILE_SIZE * RENDER_TILE_SIZE * sizeof(v3));
+
+  distributed_worker workers[RENDER_MAX_WORKERS];
+  u32 workers_count = 0;
+  struct pollfd fds[RENDER_MAX_WORKERS + 1];
+  u64 timeout = (u64)(MAX(rc->timeout, 0) * (f64)prof_get_os_timer_freq());
+
+  while (done_count < tiles_count) {
+    fds[0].fd = rc->listen_fd;
+    fds[0].events = POLLIN;
+
+    // Wake up in time for the first worker with jobs to stall
+    b32 busy = false;
+    u64 stall = 0;
+    for (u32 i = 0; i < workers_count; i++) {
+      fds[i + 1].fd = workers[i].fd;
+      fds[i + 1].events = POLLIN;
+
+      if (workers[i].jobs_count > 0) {
+        stall = busy ? MIN(stall, workers[i].progress + timeout) : workers[i].progress + timeout;
+        busy = true;
+      }
+    }
+
+    int wait = -1;
+    if (busy) {
+      u64 now = prof_read_os_timer();
+      u64 ms = stall > now ? (stall - now) * 1000 / prof_get_os_timer_freq() + 1 : 0;
+      wait = (int)MIN(ms, 1ul << 30);
+    }
+
+    if (poll(fds, workers_count + 1, wait) < 0) {
+      continue;
+    }
+
+    // Back to front, dropping a worker moves the last one into its place
+    for (u32 i = workers_count; i-- > 0;) {
+      if (fds[i + 1].revents == 0) {
+        continue;
+      }
+
+      distributed_worker *d = &workers[i];
+      b32 ok = (fds[i + 1].revents & POLLIN) && distributed_receive(d, v, c, done, pixels);
+      if (ok) {
+        done_count++;
+        ok = distributed_assign(d, pending, &pending_count);
+      }
+      if (!ok) {
+        distributed_drop(workers, &workers_count, i, pending, &pending_count, &stats);
+      }
+    }
+
+    u64 now = prof_read_os_timer();
+    for (u32 i = workers_count; i-- > 0;) {
+      if (workers[i].jobs_count > 0 && now - workers[i].progress > timeout) {
+        distributed_drop(workers, &workers_count, i, pending, &pending_count, &stats);
+      }
+    }
+
+    // Tiles taken back above go to the workers with room for them
+    for (u32 i = workers_count; i-- > 0;) {
+      if (!distributed_assign(&workers[i], pending, &pending_count)) {
+        distributed_drop(workers, &workers_count, i, pending, &pending_count, &stats);
+      }
+    }
+
+    if (fds[0].revents & POLLIN) {
+      int fd = accept(rc->listen_fd, NULL, NULL);
+      if (fd < 0) {
+        continue;
+      }
+      if (workers_count == RENDER_MAX_WORKERS) {
+        close(fd);
+        continue;
+      }
+
+      distributed_set_timeout(fd);
+
+      distributed_worker *d = &workers[workers_count++];
+      memset(d, 0, sizeof(distributed_worker));
+      d->fd = fd;
+      stats.workers++;
+
+      distributed_message m = { SceneMessage, scene_size };
+      if (!socket_send_all(fd, &m, sizeof(m)) || !socket_send_all(fd, scene_data, scene_size) ||
+          !distributed_assign(d, pending, &pending_count)) {
+        distributed_drop(workers, &workers_count, workers_count - 1, pending, &pending_count, &stats);
+      }
+    }
+  }
+
+  for (u32 i = 0; i < workers_count; i++) {
+    distributed_message m = { DoneMessage, 0 };
+    socket_send_all(workers[i].fd, &m, sizeof(m));
+    close(workers[i].fd);
+  }
+
+  for (u32 i = 0; i < local_workers; i++) {
+    if (children[i] > 0) {
+      waitpid(children[i], NULL, 0);
+    }
+  }
+
+  stats.seconds = (f64)(prof_read_os_timer() - start) / (f64)prof_get_os_timer_freq();
+  if (s != NULL) {
+    *s = stats;
+  }
+
+  free(pixels);
+  free(done);
+  free(pending);
+  free(scene_data);
+  free(children);
+
+  return c;
+}
+
+static int distributed_connect(const char *host, u32 port)
+{
+  char service[32];
+  snprintf(service, sizeof(service), "%lu", port);
+
+  struct addrinfo hints = {0};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  struct addrinfo *addresses = NULL;
+  if (getaddrinfo(host, service, &hints, &addresses) != 0) {
+    return -1;
+  }
+
+  int fd = -1;
+  for (struct addrinfo *a = addresses; a != NULL && fd < 0; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+
+  freeaddrinfo(addresses);
+  return fd;
+}
+
+// Renders tiles for the coordinator at host and port until it is done.
+// Each worker renders one tile at a time on one thread, so run one per
+// CPU. If max_tiles is not 0 the worker leaves after that many, abandoning
+// the jobs it was sent since. Returns true once the coordinator finished
+// the image, false if the worker could not connect, left or lost the
+// coordinator.
+b32 render_worker_run(const char *host, u32 port, u32 max_tiles)
+{
+  int fd = distributed_connect(host, port);
+  if (fd < 0) {
+    fprintf(stderr, "render_worker_run: could not connect to %s:%lu\n", host, port);
+    return false;
+  }
+  distributed_set_timeout(fd);
+
+  scene *sc = NULL;
+  distributed_message m = {0};
+  if (socket_recv_all(fd, &m, sizeof(m)) && m.type == SceneMessage) {
+    u8 *data = malloc(MAX(m.value, 1));
+    if (socket_recv_all(fd, data, m.value)) {
+      sc = scene_deserialize(data, m.value);
+    }
+    free(data);
+  }
+
+  if (sc == NULL) {
+    close(fd);
+    return false;
+  }
+  sc->v.threads = 1;
+
+  u32 tiles_x = (sc->v.hsize + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  u32 tiles_count = tiles_x * ((sc->v.vsize + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE);
+
+  b32 finished = false;
+  u32 rendered = 0;
+
+  while (socket_recv_all(fd, &m, sizeof(m))) {
+    if (m.type == DoneMessage) {
+      finished = true;
+      break;
+    }
+    if (m.type != JobMessage || m.value >= tiles_count || (max_tiles != 0 && rendered == max_tiles)) {
+      break;
+    }
+
+    render_region r = {0};
+    distributed_tile_region(&sc->v, m.value, &r);
+    canvas *tile = camera_render_region(&sc->v, sc->w, &r, NULL);
+
+    distributed_message result = { ResultMessage, m.value };
+    b32 sent = socket_send_all(fd, &result, sizeof(result)) &&
+      socket_send_all(fd, tile->pixels, tile->width * tile->height * sizeof(v3));
+    canvas_free(tile);
+
+    if (!sent) {
+      break;
+    }
+    rendered++;
+  }
+
+  scene_free(sc);
+  close(fd);
+  return finished;
+}
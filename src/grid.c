@@ -0,0 +1,280 @@
+#include "rtc.h"
+
+static void grid_cell_range(const grid *g, const bounds *b, u32 lo[3], u32 hi[3])
+{
+  for (u32 i = 0; i < 3; i++) {
+    f64 a = floor((b->min[i] - g->b.min[i]) / g->cell_size[i]);
+    f64 z = floor((b->max[i] - g->b.min[i]) / g->cell_size[i]);
+
+    lo[i] = (u32)CLAMP(a, 0, (f64)(g->resolution[i] - 1));
+    hi[i] = (u32)CLAMP(z, 0, (f64)(g->resolution[i] - 1));
+  }
+}
+
+static u32 grid_cell_index(const grid *g, u32 x, u32 y, u32 z)
+{
+  return (z * g->resolution[1] + y) * g->resolution[0] + x;
+}
+
+// Resolution follows the density heuristic of Cleary and Wyvill: cells are
+// cubes sized so there are roughly GRID_DENSITY cells per object.
+grid *grid_alloc(const world *w)
+{
+  grid *g = malloc(sizeof(grid));
+  memset(g, 0, sizeof(grid));
+
+  g->objects_count = w->objects_count;
+
+  bounds bounds_of[MAX_OBJECTS];
+  u32 bounded[MAX_OBJECTS];
+  u32 bounded_count = 0;
+
+  bounds_init(&g->b);
+  for (u32 i = 0; i < w->objects_count; i++) {
+    object_bounds(&w->objects[i], &bounds_of[i]);
+
+    if (bounds_is_finite(&bounds_of[i])) {
+      bounded[bounded_count++] = i;
+      bounds_merge(&g->b, &bounds_of[i], &g->b);
+    } else {
+      g->unbounded[g->unbounded_count++] = i;
+    }
+  }
+
+  if (bounded_count == 0) {
+    g->resolution[0] = g->resolution[1] = g->resolution[2] = 0;
+    return g;
+  }
+
+  v4 extent = {0};
+  v4_sub(g->b.max, g->b.min, extent);
+
+  f64 volume = 1;
+  u32 dimensions = 0;
+  for (u32 i = 0; i < 3; i++) {
+    if (extent[i] > EPSILON) {
+      volume *= extent[i];
+      dimensions++;
+    }
+  }
+
+  f64 cell_width = dimensions == 0 ? 1 :
+    pow(volume / (GRID_DENSITY * (f64)bounded_count), 1.0 / (f64)dimensions);
+
+  for (u32 i = 0; i < 3; i++) {
+    f64 r = extent[i] > EPSILON ? round(extent[i] / cell_width) : 1;
+    g->resolution[i] = (u32)CLAMP(r, 1, GRID_MAX_RESOLUTION);
+    g->cell_size[i] = extent[i] > EPSILON ? extent[i] / (f64)g->resolution[i] : 1;
+  }
+
+  u32 cells = g->resolution[0] * g->resolution[1] * g->resolution[2];
+  g->cell_offsets = malloc(sizeof(u32) * (cells + 1));
+  memset(g->cell_offsets, 0, sizeof(u32) * (cells + 1));
+
+  // Count, prefix sum, then fill, all linear in object and cell count
+  for (u32 i = 0; i < bounded_count; i++) {
+    u32 lo[3], hi[3];
+    grid_cell_range(g, &bounds_of[bounded[i]], lo, hi);
+
+    for (u32 z = lo[2]; z <= hi[2]; z++) {
+      for (u32 y = lo[1]; y <= hi[1]; y++) {
+        for (u32 x = lo[0]; x <= hi[0]; x++) {
+          g->cell_offsets[grid_cell_index(g, x, y, z) + 1]++;
+        }
+      }
+    }
+  }
+
+  for (u32 i = 0; i < cells; i++) {
+    g->cell_offsets[i + 1] += g->cell_offsets[i];
+  }
+
+  g->cell_objects_count = g->cell_offsets[cells];
+  g->cell_objects = malloc(sizeof(u32) * MAX(g->cell_objects_count, 1));
+
+  u32 *cursor = malloc(sizeof(u32) * cells);
+  memcpy(cursor, g->cell_offsets, sizeof(u32) * cells);
+
+  for (u32 i = 0; i < bounded_count; i++) {
+    u32 lo[3], hi[3];
+    grid_cell_range(g, &bounds_of[bounded[i]], lo, hi);
+
+    for (u32 z = lo[2]; z <= hi[2]; z++) {
+      for (u32 y = lo[1]; y <= hi[1]; y++) {
+        for (u32 x = lo[0]; x <= hi[0]; x++) {
+          g->cell_objects[cursor[grid_cell_index(g, x, y, z)]++] = bounded[i];
+        }
+      }
+    }
+  }
+
+  free(cursor);
+
+  return g;
+}
+
+void grid_free(grid *g)
+{
+  free(g->cell_offsets);
+  free(g->cell_objects);
+  free(g);
+}
+
+typedef struct {
+  s32 cell[3];
+  s32 step[3];
+  s32 out[3];
+  f64 next_t[3];
+  f64 delta_t[3];
+  f64 t_exit;
+} grid_walk;
+
+// Sets up a 3D-DDA walk over the cells the ray overlaps in [t0, t1]
+static b32 grid_walk_init(const grid *g, const ray *r, f64 t0, f64 t1, grid_walk *walk)
+{
+  v4 inv_direction = {0};
+  ray_inverse_direction(r, inv_direction);
+
+  f64 tmin, tmax;
+  if (!bounds_intersect(&g->b, r->origin, inv_direction, &tmin, &tmax)) {
+    return false;
+  }
+
+  tmin = MAX(tmin, t0);
+  tmax = MIN(tmax, t1);
+  if (tmin > tmax) {
+    return false;
+  }
+
+  walk->t_exit = tmax;
+
+  for (u32 i = 0; i < 3; i++) {
+    f64 p = r->origin[i] + tmin * r->direction[i];
+    f64 c = floor((p - g->b.min[i]) / g->cell_size[i]);
+    walk->cell[i] = (s32)CLAMP(c, 0, (f64)(g->resolution[i] - 1));
+
+    f64 d = r->direction[i];
+    if (d > 0) {
+      walk->step[i] = 1;
+      walk->out[i] = (s32)g->resolution[i];
+      walk->next_t[i] = (g->b.min[i] + (f64)(walk->cell[i] + 1) * g->cell_size[i] - r->origin[i]) / d;
+      walk->delta_t[i] = g->cell_size[i] / d;
+    } else if (d < 0) {
+      walk->step[i] = -1;
+      walk->out[i] = -1;
+      walk->next_t[i] = (g->b.min[i] + (f64)walk->cell[i] * g->cell_size[i] - r->origin[i]) / d;
+      walk->delta_t[i] = -g->cell_size[i] / d;
+    } else {
+      walk->step[i] = 0;
+      walk->out[i] = -1;
+      walk->next_t[i] = F64_INF;
+      walk->delta_t[i] = F64_INF;
+    }
+  }
+
+  return true;
+}
+
+static b32 grid_walk_next(grid_walk *walk)
+{
+  u32 axis = 0;
+  if (walk->next_t[1] < walk->next_t[axis]) {
+    axis = 1;
+  }
+  if (walk->next_t[2] < walk->next_t[axis]) {
+    axis = 2;
+  }
+
+  if (walk->next_t[axis] > walk->t_exit) {
+    return false;
+  }
+
+  walk->cell[axis] += walk->step[axis];
+  if (walk->cell[axis] == walk->out[axis]) {
+    return false;
+  }
+
+  walk->next_t[axis] += walk->delta_t[axis];
+  return true;
+}
+
+#define MAILBOX_WORDS ((MAX_OBJECTS + 63) / 64)
+
+// Objects spanning several cells are only tested once per ray, tracked in a
+// per query bitset so the grid stays read only and shareable between threads
+static b32 mailbox_check(u64 *mailbox, u32 index)
+{
+  u64 bit = 1ull << (index % 64);
+  if (mailbox[index / 64] & bit) {
+    return false;
+  }
+
+  mailbox[index / 64] |= bit;
+  return true;
+}
+
+void grid_intersect(const grid *g, const world *w, const ray *r, intersection_group *ig)
+{
+  for (u32 i = 0; i < g->unbounded_count; i++) {
+    ray_intersect(r, &w->objects[g->unbounded[i]], ig);
+  }
+
+  if (g->cell_objects_count == 0) {
+    return;
+  }
+
+  // Walk the whole line, intersections behind the origin are still needed to
+  // track refractive containers
+  grid_walk walk = {0};
+  if (!grid_walk_init(g, r, -F64_INF, F64_INF, &walk)) {
+    return;
+  }
+
+  u64 mailbox[MAILBOX_WORDS] = {0};
+
+  do {
+    u32 cell = grid_cell_index(g, (u32)walk.cell[0], (u32)walk.cell[1], (u32)walk.cell[2]);
+
+    for (u32 i = g->cell_offsets[cell]; i < g->cell_offsets[cell + 1]; i++) {
+      u32 index = g->cell_objects[i];
+      if (mailbox_check(mailbox, index)) {
+        ray_intersect(r, &w->objects[index], ig);
+      }
+    }
+  } while (grid_walk_next(&walk));
+}
+
+// Any hit in [0, max_t), cells are visited front to back so the walk stops at
+// the first occluder
+b32 grid_intersect_any(const grid *g, const world *w, const ray *r, f64 max_t)
+{
+  for (u32 i = 0; i < g->unbounded_count; i++) {
+    if (ray_hits_before(r, &w->objects[g->unbounded[i]], max_t)) {
+      return true;
+    }
+  }
+
+  if (g->cell_objects_count == 0) {
+    return false;
+  }
+
+  grid_walk walk = {0};
+  if (!grid_walk_init(g, r, 0, max_t, &walk)) {
+    return false;
+  }
+
+  u64 mailbox[MAILBOX_WORDS] = {0};
+
+  do {
+    u32 cell = grid_cell_index(g, (u32)walk.cell[0], (u32)walk.cell[1], (u32)walk.cell[2]);
+
+    for (u32 i = g->cell_offsets[cell]; i < g->cell_offsets[cell + 1]; i++) {
+      u32 index = g->cell_objects[i];
+      if (mailbox_check(mailbox, index) && ray_hits_before(r, &w->objects[index], max_t)) {
+        return true;
+      }
+    }
+  } while (grid_walk_next(&walk));
+
+  return false;
+}
@@ -0,0 +1,510 @@
+#include "rtc.h"
+
+static f64 heightfield_sample(const heightfield *h, u32 i, u32 j)
+{
+  return (f64)h->heights[j * h->width + i];
+}
+
+// Min and max height of a node, cells (level 0) are bounded by their samples
+static void heightfield_node_range(const heightfield *h, u32 level, u32 i, u32 j, f64 *lo, f64 *hi)
+{
+  if (level == 0) {
+    f64 h00 = heightfield_sample(h, i, j);
+    f64 h10 = heightfield_sample(h, i + 1, j);
+    f64 h01 = heightfield_sample(h, i, j + 1);
+    f64 h11 = heightfield_sample(h, i + 1, j + 1);
+
+    *lo = MIN(MIN(h00, h10), MIN(h01, h11));
+    *hi = MAX(MAX(h00, h10), MAX(h01, h11));
+    return;
+  }
+
+  const f32 *p = &h->pyramid[2 * (h->level_offset[level] + j * h->level_width[level] + i)];
+  *lo = (f64)p[0];
+  *hi = (f64)p[1];
+}
+
+// Takes ownership of h->heights
+static b32 heightfield_build(heightfield *h)
+{
+  h->levels = 1;
+  h->level_width[0] = h->width - 1;
+  h->level_depth[0] = h->depth - 1;
+  h->level_offset[0] = 0;
+
+  u32 total = 0;
+  while (h->level_width[h->levels-1] > 1 || h->level_depth[h->levels-1] > 1) {
+    u32 l = h->levels++;
+    h->level_width[l] = (h->level_width[l-1] + 1) / 2;
+    h->level_depth[l] = (h->level_depth[l-1] + 1) / 2;
+    h->level_offset[l] = total;
+    total += h->level_width[l] * h->level_depth[l];
+  }
+
+  h->pyramid = malloc(sizeof(f32) * 2 * MAX(total, 1));
+  if (h->pyramid == NULL) {
+    return false;
+  }
+
+  for (u32 l = 1; l < h->levels; l++) {
+    for (u32 j = 0; j < h->level_depth[l]; j++) {
+      for (u32 i = 0; i < h->level_width[l]; i++) {
+        f64 lo = F64_INF;
+        f64 hi = -F64_INF;
+
+        // Children past the edge of an odd sized level do not exist
+        for (u32 c = 0; c < 4; c++) {
+          u32 ci = 2 * i + (c & 1);
+          u32 cj = 2 * j + (c >> 1);
+          if (ci >= h->level_width[l-1] || cj >= h->level_depth[l-1]) {
+            continue;
+          }
+
+          f64 clo, chi;
+          heightfield_node_range(h, l - 1, ci, cj, &clo, &chi);
+          lo = MIN(lo, clo);
+          hi = MAX(hi, chi);
+        }
+
+        f32 *p = &h->pyramid[2 * (h->level_offset[l] + j * h->level_width[l] + i)];
+        p[0] = (f32)lo;
+        p[1] = (f32)hi;
+      }
+    }
+  }
+
+  f64 lo, hi;
+  heightfield_node_range(h, h->levels - 1, 0, 0, &lo, &hi);
+  memcpy(h->b.min, point(0, lo, 0), sizeof(v4));
+  memcpy(h->b.max, point(1, hi, 1), sizeof(v4));
+  return true;
+}
+
+// Bounds width * depth before anything is allocated so it cannot overflow
+static b32 heightfield_size_valid(u32 width, u32 depth)
+{
+  return width >= 2 && depth >= 2 && depth <= HEIGHTFIELD_MAX_SAMPLES / width;
+}
+
+// Takes ownership of heights, which is freed on failure
+static heightfield *heightfield_wrap(u32 width, u32 depth, f32 *heights)
+{
+  heightfield *h = malloc(sizeof(heightfield));
+  if (h == NULL) {
+    free(heights);
+    return NULL;
+  }
+
+  memset(h, 0, sizeof(heightfield));
+  h->width = width;
+  h->depth = depth;
+  h->heights = heights;
+
+  if (!heightfield_build(h)) {
+    heightfield_free(h);
+    return NULL;
+  }
+
+  return h;
+}
+
+// Returns NULL if the size is out of range or allocation fails
+heightfield *heightfield_alloc(u32 width, u32 depth, const f32 *heights)
+{
+  if (!heightfield_size_valid(width, depth)) {
+    fprintf(stderr, "heightfield_alloc: invalid size %lux%lu\n", width, depth);
+    return NULL;
+  }
+
+  f32 *copy = malloc(sizeof(f32) * width * depth);
+  heightfield *h = NULL;
+  if (copy != NULL) {
+    memcpy(copy, heights, sizeof(f32) * width * depth);
+    h = heightfield_wrap(width, depth, copy);
+  }
+
+  if (h == NULL) {
+    fprintf(stderr, "heightfield_alloc: out of memory for %lux%lu\n", width, depth);
+  }
+
+  return h;
+}
+
+void heightfield_free(heightfield *h)
+{
+  free(h->heights);
+  free(h->pyramid);
+  free(h);
+}
+
+// Skips whitespace and # comments between header fields
+static const char *netpbm_skip(const char *p, const char *end)
+{
+  while (p < end) {
+    if (*p == '#') {
+      while (p < end && *p != '\n') {
+        p++;
+      }
+    } else if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+      p++;
+    } else {
+      break;
+    }
+  }
+
+  return p;
+}
+
+static const char *netpbm_read_u32(const char *p, const char *end, u32 *out)
+{
+  p = netpbm_skip(p, end);
+
+  u32 value = 0;
+  u32 digits = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    u32 digit = (u32)(*p - '0');
+    if (value > (0xffffffffUL - digit) / 10) {
+      return NULL;
+    }
+    value = value * 10 + digit;
+    digits++;
+    p++;
+  }
+
+  *out = value;
+  return digits > 0 ? p : NULL;
+}
+
+static f32 pfm_read_f32(const u8 *p, b32 little_endian)
+{
+  unsigned int bits = little_endian ?
+    (unsigned int)p[0] | (unsigned int)p[1] << 8 | (unsigned int)p[2] << 16 | (unsigned int)p[3] << 24 :
+    (unsigned int)p[3] | (unsigned int)p[2] << 8 | (unsigned int)p[1] << 16 | (unsigned int)p[0] << 24;
+
+  f32 out;
+  memcpy(&out, &bits, sizeof(f32));
+  return out;
+}
+
+// Loads a grayscale PGM (P2 or P5, heights scaled to [0, 1] by maxval) or
+// PFM (Pf, heights as stored). Image row 0 is z = 0, PFM rows are stored
+// bottom up and flipped to match. Returns NULL on malformed input.
+heightfield *heightfield_load(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "Could not open heightfield %s\n", path);
+    return NULL;
+  }
+
+  long size = fseek(f, 0, SEEK_END) == 0 ? ftell(f) : -1;
+  if (size < 0 || fseek(f, 0, SEEK_SET) != 0) {
+    fprintf(stderr, "Could not read heightfield %s\n", path);
+    fclose(f);
+    return NULL;
+  }
+
+  char *data = malloc((size_t)MAX(size, 1));
+  size_t read = data == NULL ? 0 : fread(data, 1, (size_t)size, f);
+  fclose(f);
+
+  const char *p = data;
+  const char *end = data + read;
+
+  u32 width = 0;
+  u32 depth = 0;
+  f32 *heights = NULL;
+
+  if (read < 2 || p[0] != 'P') {
+    goto error;
+  }
+
+  char kind = p[1];
+  p += 2;
+
+  if (kind != '2' && kind != '5' && kind != 'f') {
+    goto error;
+  }
+
+  if (!(p = netpbm_read_u32(p, end, &width)) || !(p = netpbm_read_u32(p, end, &depth)) ||
+      !heightfield_size_valid(width, depth)) {
+    goto error;
+  }
+
+  heights = malloc(sizeof(f32) * width * depth);
+  if (heights == NULL) {
+    goto error;
+  }
+
+  if (kind == 'f') {
+    p = netpbm_skip(p, end);
+
+    char *scale_end = NULL;
+    f64 scale = strtod(p, &scale_end);
+    if (scale_end == p || scale == 0 || scale_end >= end) {
+      goto error;
+    }
+
+    // A single whitespace byte separates the header from the samples
+    p = scale_end + 1;
+    if ((size_t)(end - p) < sizeof(f32) * width * depth) {
+      goto error;
+    }
+
+    for (u32 j = 0; j < depth; j++) {
+      for (u32 i = 0; i < width; i++) {
+        f32 v = pfm_read_f32((const u8 *)p + 4 * (j * width + i), scale < 0);
+        if (!isfinite(v)) {
+          goto error;
+        }
+        heights[(depth - 1 - j) * width + i] = v;
+      }
+    }
+  } else {
+    u32 maxval = 0;
+    if (!(p = netpbm_read_u32(p, end, &maxval)) || maxval == 0 || maxval > 65535) {
+      goto error;
+    }
+
+    if (kind == '2') {
+      for (u32 i = 0; i < width * depth; i++) {
+        u32 v = 0;
+        if (!(p = netpbm_read_u32(p, end, &v))) {
+          goto error;
+        }
+        heights[i] = (f32)((f64)v / (f64)maxval);
+      }
+    } else {
+      p++;
+
+      u32 bytes = maxval < 256 ? 1 : 2;
+      if ((size_t)(end - p) < bytes * width * depth) {
+        goto error;
+      }
+
+      const u8 *s = (const u8 *)p;
+      for (u32 i = 0; i < width * depth; i++) {
+        u32 v = bytes == 1 ? s[i] : (u32)s[2*i] << 8 | s[2*i + 1];
+        heights[i] = (f32)((f64)v / (f64)maxval);
+      }
+    }
+  }
+
+  free(data);
+
+  heightfield *h = heightfield_wrap(width, depth, heights);
+  if (h == NULL) {
+    fprintf(stderr, "Could not allocate heightfield %s\n", path);
+  }
+
+  return h;
+
+error:
+  fprintf(stderr, "Malformed heightfield %s\n", path);
+  free(heights);
+  free(data);
+  return NULL;
+}
+
+// Bilinear height at object space x, z, clamped to the grid
+f64 heightfield_height_at(const heightfield *h, f64 x, f64 z)
+{
+  f64 fx = CLAMP(x, 0, 1);
+  f64 fz = CLAMP(z, 0, 1);
+  fx *= (f64)(h->width - 1);
+  fz *= (f64)(h->depth - 1);
+
+  u32 i = (u32)MIN(floor(fx), (f64)(h->width - 2));
+  u32 j = (u32)MIN(floor(fz), (f64)(h->depth - 2));
+  f64 u = fx - (f64)i;
+  f64 v = fz - (f64)j;
+
+  f64 h00 = heightfield_sample(h, i, j);
+  f64 h10 = heightfield_sample(h, i + 1, j);
+  f64 h01 = heightfield_sample(h, i, j + 1);
+  f64 h11 = heightfield_sample(h, i + 1, j + 1);
+
+  return h00 * (1 - u) * (1 - v) + h10 * u * (1 - v) + h01 * (1 - u) * v + h11 * u * v;
+}
+
+// Normal of the bilinear patch under p, from the gradient of y - height(x, z)
+void heightfield_normal_at(const heightfield *h, const v4 p, v4 out)
+{
+  f64 fx = CLAMP(p[0], 0, 1);
+  f64 fz = CLAMP(p[2], 0, 1);
+  fx *= (f64)(h->width - 1);
+  fz *= (f64)(h->depth - 1);
+
+  u32 i = (u32)MIN(floor(fx), (f64)(h->width - 2));
+  u32 j = (u32)MIN(floor(fz), (f64)(h->depth - 2));
+  f64 u = fx - (f64)i;
+  f64 v = fz - (f64)j;
+
+  f64 h00 = heightfield_sample(h, i, j);
+  f64 h10 = heightfield_sample(h, i + 1, j);
+  f64 h01 = heightfield_sample(h, i, j + 1);
+  f64 h11 = heightfield_sample(h, i + 1, j + 1);
+
+  f64 d = h00 - h10 - h01 + h11;
+  f64 dhdx = ((h10 - h00) + d * v) * (f64)(h->width - 1);
+  f64 dhdz = ((h01 - h00) + d * u) * (f64)(h->depth - 1);
+
+  memcpy(out, vector(-dhdx, 1, -dhdz), sizeof(v4));
+  v4_norm(out, out);
+}
+
+// Exact intersection with the bilinear patch of cell (i, j) for t in
+// [t0, t1], the ray's span over the cell's bounds. Solved relative to the
+// entry point, where height(t) - y(t) is a quadratic in t.
+static b32 heightfield_cell_intersect(const heightfield *h, const ray *r, u32 i, u32 j, f64 t0, f64 t1, f64 *out)
+{
+  f64 sx = 1.0 / (f64)(h->width - 1);
+  f64 sz = 1.0 / (f64)(h->depth - 1);
+
+  f64 h00 = heightfield_sample(h, i, j);
+  f64 h10 = heightfield_sample(h, i + 1, j);
+  f64 h01 = heightfield_sample(h, i, j + 1);
+  f64 h11 = heightfield_sample(h, i + 1, j + 1);
+
+  f64 b = h10 - h00;
+  f64 c = h01 - h00;
+  f64 d = h00 - h10 - h01 + h11;
+
+  f64 u0 = (r->origin[0] + t0 * r->direction[0]) / sx - (f64)i;
+  f64 v0 = (r->origin[2] + t0 * r->direction[2]) / sz - (f64)j;
+  f64 y0 = r->origin[1] + t0 * r->direction[1];
+  f64 du = r->direction[0] / sx;
+  f64 dv = r->direction[2] / sz;
+  f64 dy = r->direction[1];
+
+  f64 qa = d * du * dv;
+  f64 qb = b * du + c * dv + d * (u0 * dv + v0 * du) - dy;
+  f64 qc = h00 + b * u0 + c * v0 + d * u0 * v0 - y0;
+
+  f64 roots[2];
+  u32 roots_count = 0;
+
+  if (fabs(qa) < 1e-12 * (fabs(qb) + fabs(qc) + 1e-300)) {
+    if (qb != 0) {
+      roots[roots_count++] = -qc / qb;
+    }
+  } else {
+    f64 discriminant = qb * qb - 4 * qa * qc;
+    if (discriminant < 0) {
+      return false;
+    }
+
+    // Numerically stable form, avoids cancellation when qb^2 >> 4 qa qc
+    f64 q = -0.5 * (qb + (qb < 0 ? -1 : 1) * sqrt(discriminant));
+    roots[roots_count++] = q / qa;
+    if (q != 0) {
+      roots[roots_count++] = qc / q;
+    }
+  }
+
+  // Roots on a shared edge may round just outside either cell
+  f64 span = t1 - t0;
+  f64 slack = 1e-9 * MAX(span, 1.0);
+  f64 best = F64_INF;
+
+  for (u32 k = 0; k < roots_count; k++) {
+    f64 s = roots[k];
+    if (s >= -slack && s <= span + slack && s < best) {
+      best = s;
+    }
+  }
+
+  if (best == F64_INF) {
+    return false;
+  }
+
+  *out = t0 + CLAMP(best, 0, span);
+  return true;
+}
+
+typedef struct {
+  u32 level;
+  u32 i;
+  u32 j;
+} heightfield_node;
+
+// Reports the nearest crossing at t >= 0 only. Like a plane the surface is
+// open, and walking the pyramid front to back means the first cell hit ends
+// the search, so cost grows with the log of the grid size rather than the
+// number of cells along the ray.
+void heightfield_intersect(const ray *r, const object *o, intersection_group *ig)
+{
+  const heightfield *h = o->value.heightfield.h;
+
+  v4 inv_direction = {0};
+  ray_inverse_direction(r, inv_direction);
+
+  f64 sx = 1.0 / (f64)(h->width - 1);
+  f64 sz = 1.0 / (f64)(h->depth - 1);
+
+  // Children are pushed far to near so the nearest is popped first
+  u32 near_i = r->direction[0] < 0 ? 1 : 0;
+  u32 near_j = r->direction[2] < 0 ? 1 : 0;
+  u32 order[4][2] = {
+    { 1 - near_i, 1 - near_j },
+    { near_i, 1 - near_j },
+    { 1 - near_i, near_j },
+    { near_i, near_j },
+  };
+
+  heightfield_node stack[HEIGHTFIELD_STACK_SIZE];
+  u32 stack_count = 0;
+  stack[stack_count++] = (heightfield_node){ h->levels - 1, 0, 0 };
+
+  while (stack_count > 0) {
+    heightfield_node n = stack[--stack_count];
+
+    u32 i0 = n.i << n.level;
+    u32 j0 = n.j << n.level;
+    u32 i1 = MIN((n.i + 1) << n.level, h->level_width[0]);
+    u32 j1 = MIN((n.j + 1) << n.level, h->level_depth[0]);
+
+    bounds b = {0};
+    heightfield_node_range(h, n.level, n.i, n.j, &b.min[1], &b.max[1]);
+    b.min[0] = (f64)i0 * sx;
+    b.max[0] = (f64)i1 * sx;
+    b.min[2] = (f64)j0 * sz;
+    b.max[2] = (f64)j1 * sz;
+
+    f64 tmin, tmax;
+    if (!bounds_intersect(&b, r->origin, inv_direction, &tmin, &tmax)) {
+      continue;
+    }
+
+    tmin = MAX(tmin, 0);
+    if (tmin > tmax) {
+      continue;
+    }
+
+    if (n.level == 0) {
+      f64 t;
+      if (heightfield_cell_intersect(h, r, n.i, n.j, tmin, tmax, &t)) {
+        intersection_insert(ig, t, o);
+        return;
+      }
+      continue;
+    }
+
+    u32 level = n.level - 1;
+    for (u32 k = 0; k < 4; k++) {
+      u32 ci = 2 * n.i + order[k][0];
+      u32 cj = 2 * n.j + order[k][1];
+
+      if (ci < h->level_width[level] && cj < h->level_depth[level]) {
+        stack[stack_count++] = (heightfield_node){ level, ci, cj };
+      }
+    }
+  }
+}
+
+void heightfield_object_init(object *o, const heightfield *h)
+{
+  object_init(o);
+  o->type = HeightfieldType;
+  o->value.heightfield.h = h;
+}
@@ -0,0 +1,255 @@
+#include "rtc.h"
+
+static f64 light_power(const light *l)
+{
+  return (l->intensity[0] + l->intensity[1] + l->intensity[2]) / 3.0;
+}
+
+static void light_bounds(const light *l, bounds *out)
+{
+  bounds_init(out);
+  bounds_add_point(out, l->position);
+
+  if (l->type == AreaLightType) {
+    v4 u = {0};
+    v4_scale(l->value.area.uvec, (f64)l->value.area.usteps, u);
+    v4 v = {0};
+    v4_scale(l->value.area.vvec, (f64)l->value.area.vsteps, v);
+
+    v4 p = {0};
+    bounds_add_point(out, l->value.area.corner);
+    v4_add(l->value.area.corner, u, p);
+    bounds_add_point(out, p);
+    v4_add(p, v, p);
+    bounds_add_point(out, p);
+    v4_add(l->value.area.corner, v, p);
+    bounds_add_point(out, p);
+  }
+}
+
+static u32 light_tree_build_node(light_tree *t, const world *w, u32 *lights, u32 count, u32 parent)
+{
+  u32 index = t->nodes_count++;
+  light_tree_node *n = &t->nodes[index];
+  n->parent = parent;
+
+  if (count == 1) {
+    n->leaf = true;
+    n->light = lights[0];
+    n->area = w->lights[lights[0]].type == AreaLightType;
+    t->leaves[lights[0]] = index;
+    n->power = light_power(&w->lights[lights[0]]);
+    n->radius = w->lights[lights[0]].radius > 0 ? w->lights[lights[0]].radius : F64_INF;
+    light_bounds(&w->lights[lights[0]], &n->b);
+    return index;
+  }
+
+  bounds centroids = {0};
+  bounds_init(&centroids);
+  for (u32 i = 0; i < count; i++) {
+    bounds_add_point(&centroids, w->lights[lights[i]].position);
+  }
+
+  u32 axis = 0;
+  for (u32 i = 1; i < 3; i++) {
+    if (centroids.max[i] - centroids.min[i] > centroids.max[axis] - centroids.min[axis]) {
+      axis = i;
+    }
+  }
+
+  // Median split, insertion sort is fine at MAX_LIGHTS
+  for (u32 i = 1; i < count; i++) {
+    u32 key = lights[i];
+    u32 j = i;
+    while (j > 0 && w->lights[lights[j-1]].position[axis] > w->lights[key].position[axis]) {
+      lights[j] = lights[j-1];
+      j--;
+    }
+    lights[j] = key;
+  }
+
+  u32 half = count / 2;
+  u32 left = light_tree_build_node(t, w, lights, half, index);
+  u32 right = light_tree_build_node(t, w, lights + half, count - half, index);
+
+  n = &t->nodes[index];
+  n->leaf = false;
+  n->left = left;
+  n->right = right;
+  n->area = t->nodes[left].area || t->nodes[right].area;
+  n->power = t->nodes[left].power + t->nodes[right].power;
+  n->radius = MAX(t->nodes[left].radius, t->nodes[right].radius);
+  bounds_merge(&t->nodes[left].b, &t->nodes[right].b, &n->b);
+
+  return index;
+}
+
+light_tree *light_tree_alloc(const world *w)
+{
+  light_tree *t = malloc(sizeof(light_tree));
+  memset(t, 0, sizeof(light_tree));
+
+  if (w->lights_count == 0) {
+    return t;
+  }
+
+  u32 lights[MAX_LIGHTS];
+  for (u32 i = 0; i < w->lights_count; i++) {
+    lights[i] = i;
+  }
+
+  light_tree_build_node(t, w, lights, w->lights_count, 0);
+
+  return t;
+}
+
+void light_tree_free(light_tree *t)
+{
+  free(t);
+}
+
+// Upper bound style estimate of what a node's lights contribute at p, power
+// over squared distance to the node's center, with the distance kept at
+// least the node's half diagonal so points near or inside a cluster do not
+// blow up one side. Nodes whose lights all fall off before reaching p
+// have none.
+static f64 light_tree_importance(const light_tree_node *n, const v4 p)
+{
+  if (n->radius != F64_INF) {
+    f64 outside2 = 0;
+    for (u32 i = 0; i < 3; i++) {
+      f64 d = MAX(MAX(n->b.min[i] - p[i], p[i] - n->b.max[i]), 0);
+      outside2 += d * d;
+    }
+    if (outside2 >= n->radius * n->radius) {
+      return 0;
+    }
+  }
+
+  v4 center = {0};
+  bounds_centroid(&n->b, center);
+
+  v4 d = {0};
+  v4_sub(p, center, d);
+  f64 distance2 = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+
+  v4 diagonal = {0};
+  v4_sub(n->b.max, n->b.min, diagonal);
+  f64 radius2 = 0.25 * (diagonal[0]*diagonal[0] + diagonal[1]*diagonal[1] + diagonal[2]*diagonal[2]);
+
+  return n->power / MAX(MAX(distance2, radius2), EPSILON);
+}
+
+static f64 light_tree_left_probability(const light_tree *t, const light_tree_node *n, const v4 p)
+{
+  f64 left = light_tree_importance(&t->nodes[n->left], p);
+  f64 right = light_tree_importance(&t->nodes[n->right], p);
+
+  if (left + right <= 0) {
+    return 0.5;
+  }
+
+  return left / (left + right);
+}
+
+// Walks from the root choosing children in proportion to their importance
+// at p. u in [0, 1) drives every choice, rescaled after each one, and pdf is
+// the probability of the returned light being chosen.
+u32 light_tree_sample(const light_tree *t, const v4 p, f64 u, f64 *pdf)
+{
+  assert(t->nodes_count > 0);
+
+  const light_tree_node *n = &t->nodes[0];
+  f64 probability = 1;
+
+  while (!n->leaf) {
+    f64 left = light_tree_left_probability(t, n, p);
+
+    if (u < left) {
+      u = u / left;
+      probability *= left;
+      n = &t->nodes[n->left];
+    } else {
+      u = (u - left) / (1 - left);
+      probability *= 1 - left;
+      n = &t->nodes[n->right];
+    }
+
+    u = MIN(u, 1 - DBL_EPSILON);
+  }
+
+  *pdf = probability;
+  return n->light;
+}
+
+// Probability light_tree_sample returns light at p, the product of the
+// choices on the way up from its leaf
+f64 light_tree_pdf(const light_tree *t, const v4 p, u32 light)
+{
+  u32 index = t->leaves[light];
+  f64 probability = 1;
+
+  while (index != 0) {
+    const light_tree_node *parent = &t->nodes[t->nodes[index].parent];
+    f64 left = light_tree_left_probability(t, parent, p);
+
+    probability *= parent->left == index ? left : 1 - left;
+    index = t->nodes[index].parent;
+  }
+
+  return probability;
+}
+
+// Nearest area light r hits before max_t, skipping subtrees without area
+// lights or whose bounds r misses. Bounds are padded since a single area
+// light's are flat.
+const light *light_tree_intersect(const light_tree *t, const world *w, const ray *r, f64 max_t, f64 *hit_t)
+{
+  const light *nearest = NULL;
+  *hit_t = max_t;
+
+  if (t->nodes_count == 0 || !t->nodes[0].area) {
+    return NULL;
+  }
+
+  v4 inv_direction = {0};
+  ray_inverse_direction(r, inv_direction);
+
+  u32 stack[2 * MAX_LIGHTS];
+  u32 stack_count = 0;
+  stack[stack_count++] = 0;
+
+  while (stack_count > 0) {
+    const light_tree_node *n = &t->nodes[stack[--stack_count]];
+
+    bounds padded = n->b;
+    for (u32 i = 0; i < 3; i++) {
+      padded.min[i] -= EPSILON;
+      padded.max[i] += EPSILON;
+    }
+
+    f64 tmin = 0;
+    f64 tmax = 0;
+    if (!bounds_intersect(&padded, r->origin, inv_direction, &tmin, &tmax) || tmax < 0 || tmin > *hit_t) {
+      continue;
+    }
+
+    if (n->leaf) {
+      f64 hit = 0;
+      if (area_light_intersect(&w->lights[n->light], r, &hit) && hit < *hit_t) {
+        nearest = &w->lights[n->light];
+        *hit_t = hit;
+      }
+      continue;
+    }
+
+    if (t->nodes[n->left].area) {
+      stack[stack_count++] = n->left;
+    }
+    if (t->nodes[n->right].area) {
+      stack[stack_count++] = n->right;
+    }
+  }
+
+  return nearest;
+}
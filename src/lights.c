@@ -12,3 +12,118 @@ void point_light_init(light *o, const v4 position, const v3 intensity)
   light_init(o, position, intensity);
 }
 
+void area_light_init(light *o, const v4 corner, const v4 full_uvec, u32 usteps, const v4 full_vvec, u32 vsteps, const v3 intensity)
+{
+  assert(usteps > 0 && vsteps > 0);
+
+  o->type = AreaLightType;
+  memcpy(o->value.area.corner, corner, sizeof(v4));
+  v4_scale(full_uvec, 1.0 / (f64)usteps, o->value.area.uvec);
+  v4_scale(full_vvec, 1.0 / (f64)vsteps, o->value.area.vvec);
+  o->value.area.usteps = usteps;
+  o->value.area.vsteps = vsteps;
+
+  v4 position = {0};
+  v4_scale(full_uvec, 0.5, position);
+  v4_add(corner, position, position);
+  v4 half_v = {0};
+  v4_scale(full_vvec, 0.5, half_v);
+  v4_add(position, half_v, position);
+
+  light_init(o, position, intensity);
+}
+
+// Point in cell (u, v), jitter in [0, 1)^2 places it within the cell
+void area_light_point(const light *l, u32 u, u32 v, const v2 jitter, v4 out)
+{
+  v4 du = {0};
+  v4_scale(l->value.area.uvec, (f64)u + jitter[0], du);
+  v4 dv = {0};
+  v4_scale(l->value.area.vvec, (f64)v + jitter[1], dv);
+
+  v4_add(l->value.area.corner, du, out);
+  v4_add(out, dv, out);
+}
+
+// Area of the whole light, with its unit normal in normal
+f64 area_light_area(const light *l, v4 normal)
+{
+  v4 u = {0};
+  v4_scale(l->value.area.uvec, (f64)l->value.area.usteps, u);
+  v4 v = {0};
+  v4_scale(l->value.area.vvec, (f64)l->value.area.vsteps, v);
+
+  v4 n = {0};
+  v4_cross(u, v, n);
+  f64 area = v4_mag(n);
+  v4_scale(n, 1.0 / area, normal);
+
+  return area;
+}
+
+// Hit on either face of the light's parallelogram, for rays that can see
+// the light itself rather than only its shading
+b32 area_light_intersect(const light *l, const ray *r, f64 *t)
+{
+  v4 u = {0};
+  v4_scale(l->value.area.uvec, (f64)l->value.area.usteps, u);
+  v4 v = {0};
+  v4_scale(l->value.area.vvec, (f64)l->value.area.vsteps, v);
+
+  v4 n = {0};
+  v4_cross(u, v, n);
+
+  f64 denominator = v4_dot(r->direction, n);
+  if (fabs(denominator) < EPSILON * EPSILON) {
+    return false;
+  }
+
+  v4 to_corner = {0};
+  v4_sub(l->value.area.corner, r->origin, to_corner);
+  f64 hit = v4_dot(to_corner, n) / denominator;
+  if (hit < EPSILON) {
+    return false;
+  }
+
+  v4 p = {0};
+  ray_position(r, hit, p);
+  v4 d = {0};
+  v4_sub(p, l->value.area.corner, d);
+
+  // Coordinates along u and v of d, which lies in their plane
+  v4 cross = {0};
+  f64 nn = v4_dot(n, n);
+  v4_cross(d, v, cross);
+  f64 a = v4_dot(cross, n) / nn;
+  v4_cross(u, d, cross);
+  f64 b = v4_dot(cross, n) / nn;
+
+  if (a < 0 || a > 1 || b < 0 || b > 1) {
+    return false;
+  }
+
+  *t = hit;
+  return true;
+}
+
+// Inverse square falloff windowed to reach zero at the radius, after Karis,
+// "Real Shading in Unreal Engine 4". The + 1 keeps points near the light
+// finite.
+f64 light_attenuation(const light *l, const v4 p)
+{
+  if (l->radius <= 0) {
+    return 1;
+  }
+
+  v4 d = {0};
+  v4_sub(l->position, p, d);
+  f64 distance2 = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+
+  f64 ratio2 = distance2 / (l->radius * l->radius);
+  f64 window = 1 - ratio2 * ratio2;
+  if (window <= 0) {
+    return 0;
+  }
+
+  return window * window / (distance2 + 1);
+}
@@ -1,7 +1,27 @@
 #include "rtc.h"
 
+static int usage(const char *name)
+{
+  fprintf(stderr, "usage: %s serve <socket path>\n", name);
+  fprintf(stderr, "       %s worker <host> <port>\n", name);
+  return 1;
+}
+
 int main(int argc, char **argv)
 {
-  printf("TODO: implement CLI\n");
-  return 0;
+  if (argc == 3 && strcmp(argv[1], "serve") == 0) {
+    render_daemon *d = render_daemon_alloc(argv[2]);
+    if (d == NULL) {
+      return 1;
+    }
+    render_daemon_run(d);
+    render_daemon_free(d);
+    return 0;
+  }
+
+  if (argc == 4 && strcmp(argv[1], "worker") == 0) {
+    return render_worker_run(argv[2], strtoul(argv[3], NULL, 10), 0) ? 0 : 1;
+  }
+
+  return usage(argv[0]);
 }
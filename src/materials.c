@@ -14,16 +14,34 @@ void material_init(material *m)
 
 void material_lighting(const material *m, const light *l, const object *o, const v4 position, const v4 eyev, const v4 normalv, const b32 in_shadow, v3 result)
 {
-  v3 c = {0};
+  material_lighting_visibility(m, l, o, position, 0, eyev, normalv, in_shadow ? 0 : 1, result);
+}
 
+// Surface color at position, from the pattern if there is one
+void material_color_at(const material *m, const object *o, const v4 position, f64 time, v3 out)
+{
   if (m->p != NULL) {
-    pattern_object_color_at(m->p, o, position, c);
+    pattern_object_color_at_time(m->p, o, position, time, out);
   } else {
-    memcpy(c, m->color, sizeof(v3));
+    memcpy(out, m->color, sizeof(v3));
   }
+}
+
+// visibility is the fraction of the light reaching position, which scales
+// its diffuse and specular terms. Area lights are shaded from their center,
+// and every term falls off with the light's attenuation.
+void material_lighting_visibility(const material *m, const light *l, const object *o, const v4 position, f64 time, const v4 eyev, const v4 normalv, f64 visibility, v3 result)
+{
+  v3 c = {0};
+  material_color_at(m, o, position, time, c);
+
+  f64 attenuation = light_attenuation(l, position);
+
+  v3 intensity = {0};
+  v3_scale(l->intensity, attenuation, intensity);
 
   v3 effective_color = {0};
-  v3_mul(c, l->intensity, effective_color);
+  v3_mul(c, intensity, effective_color);
 
   v4 lightv = {0};
   v4_sub(l->position, position, lightv);
@@ -36,10 +54,10 @@ void material_lighting(const material *m, const light *l, const object *o, const
 
   f64 light_dot_normal = v4_dot(lightv, normalv);
 
-  b32 calculate_diffuse_and_specular = light_dot_normal >= 0 && !in_shadow;
+  b32 calculate_diffuse_and_specular = light_dot_normal >= 0 && visibility > 0;
 
   if (calculate_diffuse_and_specular) {
-    v3_scale(effective_color, m->diffuse * light_dot_normal, diffuse);
+    v3_scale(effective_color, m->diffuse * light_dot_normal * visibility, diffuse);
 
     v4 neg_lightv = {0};
     v4_neg(lightv, neg_lightv);
@@ -50,7 +68,7 @@ void material_lighting(const material *m, const light *l, const object *o, const
 
     if (reflect_dot_eye > 0) {
       f64 factor = (f64)pow(reflect_dot_eye, m->shininess);
-      v3_scale(l->intensity, m->specular * factor, specular);
+      v3_scale(intensity, m->specular * factor * visibility, specular);
     }
   }
 
@@ -59,3 +77,29 @@ void material_lighting(const material *m, const light *l, const object *o, const
   v3_add(ambient, result, result);
 }
 
+// Largest channel material_lighting_visibility could produce for l at
+// position, taking the light as fully visible. Patterned colors are taken
+// to be at most 1.
+f64 material_lighting_bound(const material *m, const light *l, const v4 position, const v4 normalv)
+{
+  f64 attenuation = light_attenuation(l, position);
+  if (attenuation <= 0) {
+    return 0;
+  }
+
+  f64 intensity = MAX(MAX(l->intensity[0], l->intensity[1]), l->intensity[2]) * attenuation;
+  f64 c = m->p != NULL ? 1 : MAX(MAX(m->color[0], m->color[1]), m->color[2]);
+
+  v4 lightv = {0};
+  v4_sub(l->position, position, lightv);
+  v4_norm(lightv, lightv);
+  f64 light_dot_normal = v4_dot(lightv, normalv);
+
+  f64 bound = c * m->ambient;
+  if (light_dot_normal >= 0) {
+    bound += c * m->diffuse * light_dot_normal + m->specular;
+  }
+
+  return intensity * bound;
+}
+
@@ -0,0 +1,256 @@
+#include "rtc.h"
+
+// Splits the upper 3x3 of T into rotation R and scale S with R * S = M,
+// iterating R = (R + R^-T) / 2 which converges to the polar rotation
+static void motion_decompose(const m4 T, v4 translation, m4 R, m4 S)
+{
+  memcpy(translation, vector(T[0 _ 3], T[1 _ 3], T[2 _ 3]), sizeof(v4));
+
+  m4 M = {0};
+  memcpy(M, IDENTITY, sizeof(m4));
+  for (u32 r = 0; r < 3; r++) {
+    for (u32 c = 0; c < 3; c++) {
+      M[r _ c] = T[r _ c];
+    }
+  }
+
+  // Keep R a proper rotation for mirrored transforms, R * S = (-R) * (-S)
+  f64 sign = m4_det(M) < 0 ? -1 : 1;
+
+  m4 current = {0};
+  memcpy(current, M, sizeof(m4));
+  for (u32 r = 0; r < 3; r++) {
+    for (u32 c = 0; c < 3; c++) {
+      current[r _ c] *= sign;
+    }
+  }
+
+  for (u32 i = 0; i < 100; i++) {
+    m4 inverse = {0};
+    m4_inverse(current, inverse);
+    m4 inverse_transpose = {0};
+    m4_transpose(inverse, inverse_transpose);
+
+    f64 change = 0;
+    for (u32 r = 0; r < 3; r++) {
+      for (u32 c = 0; c < 3; c++) {
+        f64 next = 0.5 * (current[r _ c] + inverse_transpose[r _ c]);
+        change = MAX(change, fabs(next - current[r _ c]));
+        current[r _ c] = next;
+      }
+    }
+
+    if (change < 1e-12) {
+      break;
+    }
+  }
+
+  memcpy(R, current, sizeof(m4));
+
+  // S = R^-1 * M = R^T * M
+  m4 Rt = {0};
+  m4_transpose(R, Rt);
+  m4_mul(Rt, M, S);
+}
+
+static void quaternion_from_rotation(const m4 R, v4 q)
+{
+  f64 trace = R[0 _ 0] + R[1 _ 1] + R[2 _ 2];
+
+  if (trace > 0) {
+    f64 s = sqrt(trace + 1) * 2;
+    q[0] = (R[2 _ 1] - R[1 _ 2]) / s;
+    q[1] = (R[0 _ 2] - R[2 _ 0]) / s;
+    q[2] = (R[1 _ 0] - R[0 _ 1]) / s;
+    q[3] = 0.25 * s;
+  } else if (R[0 _ 0] > R[1 _ 1] && R[0 _ 0] > R[2 _ 2]) {
+    f64 s = sqrt(1 + R[0 _ 0] - R[1 _ 1] - R[2 _ 2]) * 2;
+    q[0] = 0.25 * s;
+    q[1] = (R[0 _ 1] + R[1 _ 0]) / s;
+    q[2] = (R[0 _ 2] + R[2 _ 0]) / s;
+    q[3] = (R[2 _ 1] - R[1 _ 2]) / s;
+  } else if (R[1 _ 1] > R[2 _ 2]) {
+    f64 s = sqrt(1 + R[1 _ 1] - R[0 _ 0] - R[2 _ 2]) * 2;
+    q[0] = (R[0 _ 1] + R[1 _ 0]) / s;
+    q[1] = 0.25 * s;
+    q[2] = (R[1 _ 2] + R[2 _ 1]) / s;
+    q[3] = (R[0 _ 2] - R[2 _ 0]) / s;
+  } else {
+    f64 s = sqrt(1 + R[2 _ 2] - R[0 _ 0] - R[1 _ 1]) * 2;
+    q[0] = (R[0 _ 2] + R[2 _ 0]) / s;
+    q[1] = (R[1 _ 2] + R[2 _ 1]) / s;
+    q[2] = 0.25 * s;
+    q[3] = (R[1 _ 0] - R[0 _ 1]) / s;
+  }
+}
+
+static void quaternion_to_rotation(const v4 q, m4 R)
+{
+  f64 x = q[0];
+  f64 y = q[1];
+  f64 z = q[2];
+  f64 w = q[3];
+
+  memcpy(R, IDENTITY, sizeof(m4));
+  R[0 _ 0] = 1 - 2 * (y*y + z*z);
+  R[0 _ 1] = 2 * (x*y - w*z);
+  R[0 _ 2] = 2 * (x*z + w*y);
+  R[1 _ 0] = 2 * (x*y + w*z);
+  R[1 _ 1] = 1 - 2 * (x*x + z*z);
+  R[1 _ 2] = 2 * (y*z - w*x);
+  R[2 _ 0] = 2 * (x*z - w*y);
+  R[2 _ 1] = 2 * (y*z + w*x);
+  R[2 _ 2] = 1 - 2 * (x*x + y*y);
+}
+
+static void quaternion_slerp(const v4 a, const v4 b, f64 t, v4 out)
+{
+  f64 cos_theta = v4_dot(a, b);
+
+  if (cos_theta > 0.9995) {
+    for (u32 i = 0; i < 4; i++) {
+      out[i] = a[i] + t * (b[i] - a[i]);
+    }
+  } else {
+    f64 theta = acos(MAX(MIN(cos_theta, 1), -1)) * t;
+
+    v4 perpendicular = {0};
+    for (u32 i = 0; i < 4; i++) {
+      perpendicular[i] = b[i] - a[i] * cos_theta;
+    }
+    f64 length = sqrt(v4_dot(perpendicular, perpendicular));
+
+    for (u32 i = 0; i < 4; i++) {
+      out[i] = a[i] * cos(theta) + perpendicular[i] / length * sin(theta);
+    }
+  }
+
+  f64 length = sqrt(v4_dot(out, out));
+  for (u32 i = 0; i < 4; i++) {
+    out[i] /= length;
+  }
+}
+
+// Keys transform start at start_time and end at end_time, times outside the
+// interval clamp to the nearest key
+void motion_init(motion *m, const m4 start, f64 start_time, const m4 end, f64 end_time)
+{
+  memset(m, 0, sizeof(motion));
+  m->start = start_time;
+  m->end = end_time;
+
+  const f64 *keys[2] = { start, end };
+  for (u32 k = 0; k < 2; k++) {
+    m4 R = {0};
+    motion_decompose(keys[k], m->translation[k], R, m->scale[k]);
+    quaternion_from_rotation(R, m->rotation[k]);
+  }
+
+  // Take the shorter arc between the keys
+  if (v4_dot(m->rotation[0], m->rotation[1]) < 0) {
+    v4_neg(m->rotation[1], m->rotation[1]);
+  }
+}
+
+void motion_transform_at(const motion *m, f64 time, m4 T, m4 inverse)
+{
+  f64 span = m->end - m->start;
+  f64 t = span > 0 ? (time - m->start) / span : 0;
+  t = CLAMP(t, 0, 1);
+
+  v4 q = {0};
+  quaternion_slerp(m->rotation[0], m->rotation[1], t, q);
+
+  m4 R = {0};
+  quaternion_to_rotation(q, R);
+
+  m4 S = {0};
+  for (u32 i = 0; i < 16; i++) {
+    S[i] = m->scale[0][i] + t * (m->scale[1][i] - m->scale[0][i]);
+  }
+
+  m4_mul(R, S, T);
+  for (u32 i = 0; i < 3; i++) {
+    T[i _ 3] = m->translation[0][i] + t * (m->translation[1][i] - m->translation[0][i]);
+  }
+
+  m4_inverse(T, inverse);
+}
+
+// m must outlive o. Static paths such as the world space fast paths are
+// disabled for moving objects.
+void object_set_motion(object *o, const motion *m)
+{
+  m4 T = {0};
+  m4 inverse = {0};
+  motion_transform_at(m, m->start, T, inverse);
+  object_set_transform(o, T);
+
+  o->motion = m;
+  o->transform_class = GeneralTransform;
+}
+
+void object_transform_at(const object *o, f64 time, m4 T, m4 inverse)
+{
+  if (o->motion == NULL) {
+    memcpy(T, o->transform, sizeof(m4));
+    memcpy(inverse, o->inverse_transform, sizeof(m4));
+    return;
+  }
+
+  motion_transform_at(o->motion, time, T, inverse);
+}
+
+// Bounds over the whole motion. Without rotation every point moves along a
+// segment between its key positions, so the union of the key bounds holds
+// it. With rotation, the scaled local bounds are enclosed in a sphere about
+// the object origin whose radius no rotation changes, swept along the
+// translation.
+void object_motion_bounds(const object *o, const bounds *local, bounds *out)
+{
+  if (!bounds_is_finite(local)) {
+    bounds_transform(local, o->transform, out);
+    return;
+  }
+
+  const motion *m = o->motion;
+
+  if (v4_dot(m->rotation[0], m->rotation[1]) > 1 - 1e-12) {
+    m4 T = {0};
+    m4 inverse = {0};
+
+    bounds a = {0};
+    motion_transform_at(m, m->start, T, inverse);
+    bounds_transform(local, T, &a);
+
+    bounds b = {0};
+    motion_transform_at(m, m->end, T, inverse);
+    bounds_transform(local, T, &b);
+
+    bounds_merge(&a, &b, out);
+    return;
+  }
+
+  f64 radius = 0;
+  for (u32 k = 0; k < 2; k++) {
+    for (u32 i = 0; i < 8; i++) {
+      v4 corner = point_init(
+          (i & 1) ? local->max[0] : local->min[0],
+          (i & 2) ? local->max[1] : local->min[1],
+          (i & 4) ? local->max[2] : local->min[2]);
+
+      v4 p = {0};
+      m4_mulv(m->scale[k], corner, p);
+      radius = MAX(radius, sqrt(p[0]*p[0] + p[1]*p[1] + p[2]*p[2]));
+    }
+  }
+
+  for (u32 i = 0; i < 3; i++) {
+    f64 a = m->translation[0][i];
+    f64 b = m->translation[1][i];
+    out->min[i] = MIN(a, b) - radius;
+    out->max[i] = MAX(a, b) + radius;
+  }
+  out->min[3] = 1;
+  out->max[3] = 1;
+}
@@ -13,6 +13,47 @@ void object_set_transform(object *o, const m4 T)
 {
   memcpy(o->transform, T, sizeof(m4));
   m4_inverse(o->transform, o->inverse_transform);
+
+  o->motion = NULL;
+  o->transform_class = transform_classify(T);
+  memcpy(o->center, point(T[0 _ 3], T[1 _ 3], T[2 _ 3]), sizeof(v4));
+  memcpy(o->extent, vector(fabs(T[0 _ 0]), fabs(T[1 _ 1]), fabs(T[2 _ 2])), sizeof(v4));
+}
+
+enum transform_class transform_classify(const m4 T)
+{
+  b32 axis_aligned =
+    T[0 _ 1] == 0 && T[0 _ 2] == 0 &&
+    T[1 _ 0] == 0 && T[1 _ 2] == 0 &&
+    T[2 _ 0] == 0 && T[2 _ 1] == 0 &&
+    T[3 _ 0] == 0 && T[3 _ 1] == 0 && T[3 _ 2] == 0 && T[3 _ 3] == 1 &&
+    T[0 _ 0] != 0 && T[1 _ 1] != 0 && T[2 _ 2] != 0;
+
+  if (!axis_aligned) {
+    return GeneralTransform;
+  }
+
+  if (m4_eq(T, IDENTITY)) {
+    return IdentityTransform;
+  }
+
+  f64 sx = fabs(T[0 _ 0]);
+  if (sx == fabs(T[1 _ 1]) && sx == fabs(T[2 _ 2])) {
+    return TranslateUniformScaleTransform;
+  }
+
+  return TranslateScaleTransform;
+}
+
+static b32 object_is_world_sphere(const object *o)
+{
+  return o->type == SphereType &&
+    (o->transform_class == IdentityTransform || o->transform_class == TranslateUniformScaleTransform);
+}
+
+static b32 object_is_world_box(const object *o)
+{
+  return o->type == CubeType && o->transform_class != GeneralTransform;
 }
 
 void object_set_material(object *o, const material *m)
@@ -65,10 +106,104 @@ void cone_init(object *o)
   o->value.cone.closed = false;
 }
 
-void object_normal_at(const object *o, const v4 p, v4 out)
+void object_local_bounds(const object *o, bounds *out)
 {
+  switch (o->type) {
+    case SphereType:
+    case CubeType: {
+      memcpy(out->min, point(-1, -1, -1), sizeof(v4));
+      memcpy(out->max, point(1, 1, 1), sizeof(v4));
+    } break;
+    case PlaneType: {
+      memcpy(out->min, point(-F64_INF, 0, -F64_INF), sizeof(v4));
+      memcpy(out->max, point(F64_INF, 0, F64_INF), sizeof(v4));
+    } break;
+    case CylinderType: {
+      f64 minimum = o->value.cylinder.minimum;
+      f64 maximum = o->value.cylinder.maximum;
+      memcpy(out->min, point(-1, minimum, -1), sizeof(v4));
+      memcpy(out->max, point(1, maximum, 1), sizeof(v4));
+    } break;
+    case ConeType: {
+      f64 minimum = o->value.cone.minimum;
+      f64 maximum = o->value.cone.maximum;
+      f64 r = MAX(fabs(minimum), fabs(maximum));
+      memcpy(out->min, point(-r, minimum, -r), sizeof(v4));
+      memcpy(out->max, point(r, maximum, r), sizeof(v4));
+    } break;
+    case CsgType: {
+      bounds_merge(&o->value.csg.left_bounds, &o->value.csg.right_bounds, out);
+    } break;
+    case SdfType: {
+      *out = o->value.sdf.s->b;
+    } break;
+    case HeightfieldType: {
+      *out = o->value.heightfield.h->b;
+    } break;
+  }
+}
+
+void object_bounds(const object *o, bounds *out)
+{
+  bounds local = {0};
+  object_local_bounds(o, &local);
+
+  if (o->motion != NULL) {
+    object_motion_bounds(o, &local, out);
+    return;
+  }
+
+  bounds_transform(&local, o->transform, out);
+}
+
+// Inverse transform of o at time, computed into scratch if o is moving
+static const f64 *object_inverse_at(const object *o, f64 time, m4 scratch)
+{
+  if (o->motion == NULL) {
+    return o->inverse_transform;
+  }
+
+  m4 T = {0};
+  object_transform_at(o, time, T, scratch);
+  return scratch;
+}
+
+// Normal for a point in the space o's transform maps into, which is world
+// space unless o is part of a csg
+static void object_parent_normal_at(const object *o, const v4 p, f64 time, v4 out)
+{
+  if (object_is_world_sphere(o)) {
+    v4_sub(p, o->center, out);
+    out[3] = 0.0;
+    v4_norm(out, out);
+    return;
+  }
+
+  if (object_is_world_box(o)) {
+    f64 x = (p[0] - o->center[0]) / o->extent[0];
+    f64 y = (p[1] - o->center[1]) / o->extent[1];
+    f64 z = (p[2] - o->center[2]) / o->extent[2];
+
+    f64 ax = fabs(x);
+    f64 ay = fabs(y);
+    f64 az = fabs(z);
+    f64 maxc = MAX(MAX(ax, ay), az);
+
+    if (maxc == ax) {
+      memcpy(out, vector(x > 0 ? 1 : -1, 0, 0), sizeof(v4));
+    } else if (maxc == ay) {
+      memcpy(out, vector(0, y > 0 ? 1 : -1, 0), sizeof(v4));
+    } else {
+      memcpy(out, vector(0, 0, z > 0 ? 1 : -1), sizeof(v4));
+    }
+    return;
+  }
+
+  m4 scratch = {0};
+  const f64 *inverse_transform = object_inverse_at(o, time, scratch);
+
   v4 object_point = {0};
-  m4_mulv(o->inverse_transform, p, object_point);
+  m4_mulv(inverse_transform, p, object_point);
 
   v4 object_normal = {0};
 
@@ -123,26 +258,160 @@ void object_normal_at(const object *o, const v4 p, v4 out)
         memcpy(object_normal, vector(x, ty, z), sizeof(v4));
       }
     } break;
+    case CsgType: {
+      // Intersections always reference the csg's children
+      assert(false);
+    } break;
+    case SdfType: {
+      sdf_normal_at(o->value.sdf.s, object_point, object_normal);
+    } break;
+    case HeightfieldType: {
+      heightfield_normal_at(o->value.heightfield.h, object_point, object_normal);
+    } break;
   }
 
   m4 world_transform = {0};
-  m4_transpose(o->inverse_transform, world_transform);
+  m4_transpose(inverse_transform, world_transform);
 
   m4_mulv(world_transform, object_normal, out);
   out[3] = 0.0;
   v4_norm(out, out);
 }
 
+void object_normal_at(const object *o, const v4 p, v4 out)
+{
+  object_normal_at_time(o, p, 0, out);
+}
+
+void object_normal_at_time(const object *o, const v4 p, f64 time, v4 out)
+{
+  if (o->parent == NULL) {
+    object_parent_normal_at(o, p, time, out);
+    return;
+  }
+
+  v4 parent_point = {0};
+  object_world_to_object(o->parent, p, time, parent_point);
+
+  v4 normal = {0};
+  object_parent_normal_at(o, parent_point, time, normal);
+
+  object_normal_to_world(o->parent, normal, time, out);
+}
+
+void object_world_to_object(const object *o, const v4 p, f64 time, v4 out)
+{
+  m4 scratch = {0};
+  const f64 *inverse_transform = object_inverse_at(o, time, scratch);
+
+  if (o->parent == NULL) {
+    m4_mulv(inverse_transform, p, out);
+    return;
+  }
+
+  v4 parent_point = {0};
+  object_world_to_object(o->parent, p, time, parent_point);
+
+  m4_mulv(inverse_transform, parent_point, out);
+}
+
+void object_normal_to_world(const object *o, const v4 n, f64 time, v4 out)
+{
+  m4 scratch = {0};
+  const f64 *inverse_transform = object_inverse_at(o, time, scratch);
+
+  m4 world_transform = {0};
+  m4_transpose(inverse_transform, world_transform);
+
+  v4 normal = {0};
+  m4_mulv(world_transform, n, normal);
+  normal[3] = 0.0;
+  v4_norm(normal, normal);
+
+  if (o->parent == NULL) {
+    memcpy(out, normal, sizeof(v4));
+    return;
+  }
+
+  object_normal_to_world(o->parent, normal, time, out);
+}
+
 void ray_position(const ray *r, f64 t, v4 out)
 {
   v4_scale(r->direction, t, out);
   v4_add(r->origin, out, out);
 }
 
+// Spheres and cubes that are only translated and scaled are intersected in
+// world space. Directions are not normalized by ray_transform, so t values
+// match the object space path exactly.
+static b32 ray_intersect_world_space(const ray *r, const object *o, intersection_group *ig)
+{
+  if (object_is_world_sphere(o)) {
+    f64 ox = r->origin[0] - o->center[0];
+    f64 oy = r->origin[1] - o->center[1];
+    f64 oz = r->origin[2] - o->center[2];
+    f64 dx = r->direction[0];
+    f64 dy = r->direction[1];
+    f64 dz = r->direction[2];
+    f64 radius = o->extent[0];
+
+    f64 a = dx*dx + dy*dy + dz*dz;
+    f64 b = 2 * (dx*ox + dy*oy + dz*oz);
+    f64 c = ox*ox + oy*oy + oz*oz - radius*radius;
+
+    f64 discriminant = (b*b) - 4 * a * c;
+
+    if (discriminant >= 0) {
+      f64 root_discriminant = (f64)sqrt(discriminant);
+      f64 t0 = (-b - root_discriminant) / (2*a);
+      f64 t1 = (-b + root_discriminant) / (2*a);
+
+      intersection_insert(ig, t0, o);
+      intersection_insert(ig, t1, o);
+    }
+
+    return true;
+  }
+
+  if (object_is_world_box(o)) {
+    v2 t[3] = {0};
+    for (u32 i = 0; i < 3; i++) {
+      t[i][0] = (o->center[i] - o->extent[i] - r->origin[i]) / r->direction[i];
+      t[i][1] = (o->center[i] + o->extent[i] - r->origin[i]) / r->direction[i];
+
+      if (t[i][0] > t[i][1]) {
+        f64 temp = t[i][0];
+        t[i][0] = t[i][1];
+        t[i][1] = temp;
+      }
+    }
+
+    // Same combination order as the object space path, so rays grazing a
+    // face (0 / 0) resolve the same way
+    f64 tmin = MAX(MAX(t[0][0], t[1][0]), t[2][0]);
+    f64 tmax = MIN(MIN(t[0][1], t[1][1]), t[2][1]);
+
+    if (tmin <= tmax) {
+      intersection_insert(ig, tmin, o);
+      intersection_insert(ig, tmax, o);
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
 void ray_intersect(const ray *input_r, const object *o, intersection_group *ig)
 {
+  if (ray_intersect_world_space(input_r, o, ig)) {
+    return;
+  }
+
+  m4 scratch = {0};
   ray r = {0};
-  ray_transform(input_r, o->inverse_transform, &r);
+  ray_transform(input_r, object_inverse_at(o, input_r->time, scratch), &r);
 
   f64 ox = r.origin[0]; f64 oy = r.origin[1]; f64 oz = r.origin[2];
   f64 dx = r.direction[0]; f64 dy = r.direction[1]; f64 dz = r.direction[2];
@@ -274,6 +543,70 @@ void ray_intersect(const ray *input_r, const object *o, intersection_group *ig)
 
       cone_intersect_caps(&r, o, ig);
     } break;
+    case CsgType: {
+      csg_intersect(&r, o, ig);
+    } break;
+    case SdfType: {
+      sdf_intersect(&r, o, ig);
+    } break;
+    case HeightfieldType: {
+      heightfield_intersect(&r, o, ig);
+    } break;
+  }
+}
+
+// Any intersection in [0, max_t), used for shadow rays
+b32 ray_hits_before(const ray *r, const object *o, f64 max_t)
+{
+  intersection_group ig;
+  ig.count = 0;
+  ray_intersect(r, o, &ig);
+
+  for (u32 i = 0; i < ig.count; i++) {
+    if (ig.xs[i].t >= 0 && ig.xs[i].t < max_t) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// ray_hits_before for count <= SDF_LANES rays at once, setting hit for the
+// active rays that are not hit yet and hit o. Sdfs trace those rays in one
+// sdf_trace, whose first hit is all a shadow ray needs, other types take
+// them one at a time.
+void ray_packet_hits_before(const ray *rays, u32 count, const object *o, const f64 *max_t, const b32 *active, b32 *hit)
+{
+  assert(count <= SDF_LANES);
+
+  if (o->type != SdfType) {
+    for (u32 l = 0; l < count; l++) {
+      if (active[l] && !hit[l]) {
+        hit[l] = ray_hits_before(&rays[l], o, max_t[l]);
+      }
+    }
+    return;
+  }
+
+  ray local[SDF_LANES];
+  u32 lane[SDF_LANES];
+  u32 local_count = 0;
+  m4 scratch = {0};
+  for (u32 l = 0; l < count; l++) {
+    if (active[l] && !hit[l]) {
+      ray_transform(&rays[l], object_inverse_at(o, rays[l].time, scratch), &local[local_count]);
+      lane[local_count++] = l;
+    }
+  }
+
+  if (local_count == 0) {
+    return;
+  }
+
+  f64 t[SDF_LANES];
+  sdf_trace(o->value.sdf.s, local_count, local, t);
+  for (u32 i = 0; i < local_count; i++) {
+    hit[lane[i]] = t[i] < max_t[lane[i]];
   }
 }
 
@@ -307,10 +640,12 @@ void computations_prepare(const intersection *i, const ray *r, const intersectio
 {
   out->t = i->t;
   out->o = i->o;
+  out->time = r->time;
+  out->weight = 1;
 
   ray_position(r, out->t, out->point);
   v4_neg(r->direction, out->eyev);
-  object_normal_at(out->o, out->point, out->normalv);
+  object_normal_at_time(out->o, out->point, out->time, out->normalv);
 
   f64 normal_dot_eye = v4_dot(out->normalv, out->eyev);
   if (normal_dot_eye < 0) {
@@ -384,6 +719,30 @@ void computations_prepare(const intersection *i, const ray *r, const intersectio
   }
 }
 
+// Direction of the ray refracted at comps, false under total internal
+// reflection
+b32 computations_refract_direction(const computations *comps, v4 out)
+{
+  f64 n_ratio = comps->n1 / comps->n2;
+  f64 cos_i = v4_dot(comps->eyev, comps->normalv);
+  f64 sin2_t = (n_ratio*n_ratio) * (1 - (cos_i*cos_i));
+
+  if (sin2_t > 1) {
+    return false;
+  }
+
+  f64 cos_t = sqrt(1.0 - sin2_t);
+
+  v4 a = {0};
+  v4_scale(comps->normalv, n_ratio * cos_i - cos_t, a);
+
+  v4 b = {0};
+  v4_scale(comps->eyev, n_ratio, b);
+
+  v4_sub(a, b, out);
+  return true;
+}
+
 f64 computations_schlick(const computations *comps)
 {
   f64 cos = v4_dot(comps->eyev, comps->normalv);
@@ -0,0 +1,359 @@
+#include "rtc.h"
+
+// Unidirectional path tracing with next event estimation. Shares the scene,
+// acceleration structures and shadow rays with world_color_at. Point lights
+// give the irradiance pi * intensity * attenuation, so a path's first
+// diffuse bounce matches the Whitted diffuse term, and area lights emit
+// their intensity as radiance from both faces. Both fall off with
+// light_attenuation at the point they light. Ambient is not used, indirect
+// light takes its place.
+
+static void path_basis(const v4 n, v4 t, v4 b)
+{
+  // Duff et al., "Building an Orthonormal Basis, Revisited"
+  f64 sign = n[2] >= 0 ? 1 : -1;
+  f64 a = -1 / (sign + n[2]);
+  f64 c = n[0] * n[1] * a;
+
+  memcpy(t, vector(1 + sign * n[0] * n[0] * a, sign * c, -sign * n[0]), sizeof(v4));
+  memcpy(b, vector(c, sign + n[1] * n[1] * a, -n[1]), sizeof(v4));
+}
+
+static void path_local_to_world(const v4 n, f64 x, f64 y, f64 z, v4 out)
+{
+  v4 t = {0};
+  v4 b = {0};
+  path_basis(n, t, b);
+
+  for (u32 i = 0; i < 3; i++) {
+    out[i] = t[i] * x + b[i] * y + n[i] * z;
+  }
+  out[3] = 0;
+}
+
+static f64 path_max3(const v3 c)
+{
+  return MAX(MAX(c[0], c[1]), c[2]);
+}
+
+static void path_bsdf_init(const computations *c, path_bsdf *b)
+{
+  const material *m = &c->o->material;
+
+  v3 color = {0};
+  material_color_at(m, c->o, c->point, c->time, color);
+
+  v3_scale(color, m->diffuse, b->albedo);
+  b->specular = m->specular;
+  b->shininess = m->shininess;
+
+  b->diffuse_weight = MAX(path_max3(b->albedo), 0);
+  b->specular_weight = MAX(m->specular, 0);
+
+  v4 direction = {0};
+  b32 refracts = m->transparency > 0 && computations_refract_direction(c, direction);
+
+  f64 reflectance = 1;
+  if (m->reflective > 0 && m->transparency > 0) {
+    reflectance = computations_schlick(c);
+  }
+
+  b->reflect_weight = m->reflective > 0 ? m->reflective * reflectance : 0;
+  b->refract_weight = refracts ? m->transparency * (m->reflective > 0 ? 1 - reflectance : 1) : 0;
+
+  b->total_weight = b->diffuse_weight + b->specular_weight + b->reflect_weight + b->refract_weight;
+}
+
+// Surface lobes for light arriving along wi, f is the scattered fraction
+// and pdf the density of path_bsdf_sample choosing wi
+static void path_bsdf_eval(const path_bsdf *b, const computations *c, const v4 wi, v3 f, f64 *pdf)
+{
+  memset(f, 0, sizeof(v3));
+  *pdf = 0;
+
+  f64 cos_i = v4_dot(wi, c->normalv);
+  f64 surface_weight = b->diffuse_weight + b->specular_weight;
+  if (cos_i <= 0 || surface_weight <= 0) {
+    return;
+  }
+
+  v3_scale(b->albedo, 1 / PI, f);
+  f64 diffuse_pdf = cos_i / PI;
+
+  f64 specular_pdf = 0;
+  f64 cos_r = v4_dot(wi, c->reflectv);
+  if (cos_r > 0 && b->specular > 0) {
+    f64 lobe = pow(cos_r, b->shininess);
+    f64 specular = b->specular * (b->shininess + 2) / (2 * PI) * lobe;
+    for (u32 i = 0; i < 3; i++) {
+      f[i] += specular;
+    }
+    specular_pdf = (b->shininess + 1) / (2 * PI) * lobe;
+  }
+
+  *pdf = (b->diffuse_weight * diffuse_pdf + b->specular_weight * specular_pdf) / b->total_weight;
+}
+
+// Chooses a lobe with u_lobe and a direction with u. weight is f * cos / pdf
+// for the whole choice, delta is set for the mirror and refraction lobes,
+// which no light sample can reach.
+static b32 path_bsdf_sample(const path_bsdf *b, const computations *c, f64 u_lobe, const v2 u, ray *next, v3 weight, f64 *pdf, b32 *delta)
+{
+  if (b->total_weight <= 0) {
+    return false;
+  }
+
+  f64 x = u_lobe * b->total_weight;
+  next->time = c->time;
+
+  if (x < b->reflect_weight) {
+    memcpy(next->origin, c->over_point, sizeof(v4));
+    memcpy(next->direction, c->reflectv, sizeof(v4));
+    memcpy(weight, color(b->total_weight, b->total_weight, b->total_weight), sizeof(v3));
+    *pdf = 0;
+    *delta = true;
+    return true;
+  }
+  x -= b->reflect_weight;
+
+  if (x < b->refract_weight) {
+    memcpy(next->origin, c->under_point, sizeof(v4));
+    computations_refract_direction(c, next->direction);
+    v4_norm(next->direction, next->direction);
+    memcpy(weight, color(b->total_weight, b->total_weight, b->total_weight), sizeof(v3));
+    *pdf = 0;
+    *delta = true;
+    return true;
+  }
+  x -= b->refract_weight;
+
+  v4 wi = {0};
+  if (x < b->diffuse_weight) {
+    f64 r = sqrt(u[0]);
+    f64 phi = 2 * PI * u[1];
+    path_local_to_world(c->normalv, r * cos(phi), r * sin(phi), sqrt(MAX(1 - u[0], 0)), wi);
+  } else {
+    f64 cos_a = pow(u[0], 1 / (b->shininess + 1));
+    f64 sin_a = sqrt(MAX(1 - cos_a * cos_a, 0));
+    f64 phi = 2 * PI * u[1];
+    path_local_to_world(c->reflectv, sin_a * cos(phi), sin_a * sin(phi), cos_a, wi);
+  }
+
+  v3 f = {0};
+  path_bsdf_eval(b, c, wi, f, pdf);
+  if (*pdf <= 0) {
+    return false;
+  }
+
+  v3_scale(f, v4_dot(wi, c->normalv) / *pdf, weight);
+
+  memcpy(next->origin, c->over_point, sizeof(v4));
+  memcpy(next->direction, wi, sizeof(v4));
+  *delta = false;
+  return true;
+}
+
+static f64 path_light_selection_pdf(const world *w, const v4 p, u32 index)
+{
+  if (w->light_tree != NULL) {
+    return light_tree_pdf(w->light_tree, p, index);
+  }
+  return 1.0 / (f64)w->lights_count;
+}
+
+// Density over solid angle of sampling the point at distance on l from p
+static f64 path_area_light_pdf(const light *l, const v4 direction, f64 distance)
+{
+  v4 normal = {0};
+  f64 area = area_light_area(l, normal);
+  f64 cos_l = fabs(v4_dot(normal, direction));
+  if (cos_l <= 0) {
+    return 0;
+  }
+
+  return distance * distance / (area * cos_l);
+}
+
+static f64 path_power_heuristic(f64 a, f64 b)
+{
+  return a * a / (a * a + b * b);
+}
+
+// One light chosen by the light tree or uniformly, with a shadow ray to it
+static void path_sample_light(const world *w, const computations *c, const path_bsdf *b, sampler *s, v3 out)
+{
+  memset(out, 0, sizeof(v3));
+
+  f64 u_light = sampler_1d(s);
+  v2 u = {0};
+  sampler_2d(s, u);
+
+  if (w->lights_count == 0 || b->diffuse_weight + b->specular_weight <= 0) {
+    return;
+  }
+
+  u32 index = 0;
+  f64 selection = 0;
+  if (w->light_tree != NULL) {
+    index = light_tree_sample(w->light_tree, c->point, u_light, &selection);
+  } else {
+    index = MIN((u32)(u_light * (f64)w->lights_count), w->lights_count - 1);
+    selection = 1.0 / (f64)w->lights_count;
+  }
+  if (selection <= 0) {
+    return;
+  }
+
+  const light *l = &w->lights[index];
+
+  if (l->type == PointLightType) {
+    v4 wi = {0};
+    v4_sub(l->position, c->over_point, wi);
+    v4_norm(wi, wi);
+
+    f64 cos_i = v4_dot(wi, c->normalv);
+    if (cos_i <= 0 || world_is_shadowed_at_time(w, l, c->over_point, c->time)) {
+      return;
+    }
+
+    v3 f = {0};
+    f64 pdf = 0;
+    path_bsdf_eval(b, c, wi, f, &pdf);
+
+    v3_mul(f, l->intensity, out);
+    v3_scale(out, PI * light_attenuation(l, c->point) * cos_i / selection, out);
+    return;
+  }
+
+  v2 jitter = { u[0] * (f64)l->value.area.usteps, u[1] * (f64)l->value.area.vsteps };
+  v4 target = {0};
+  area_light_point(l, 0, 0, jitter, target);
+
+  v4 wi = {0};
+  v4_sub(target, c->over_point, wi);
+  f64 distance = v4_mag(wi);
+  v4_scale(wi, 1 / distance, wi);
+
+  // Taken at the origin of the rays that scatter from here, where the
+  // emitter hit in path_trace takes it, so both strategies weigh the same
+  // radiance
+  f64 attenuation = light_attenuation(l, c->over_point);
+
+  f64 cos_i = v4_dot(wi, c->normalv);
+  f64 light_pdf = selection * path_area_light_pdf(l, wi, distance);
+  if (cos_i <= 0 || light_pdf <= 0 || attenuation <= 0 || world_is_occluded(w, c->over_point, target, c->time)) {
+    return;
+  }
+
+  v3 f = {0};
+  f64 bsdf_pdf = 0;
+  path_bsdf_eval(b, c, wi, f, &bsdf_pdf);
+
+  v3_mul(f, l->intensity, out);
+  v3_scale(out, attenuation * cos_i * path_power_heuristic(light_pdf, bsdf_pdf) / light_pdf, out);
+}
+
+// Nearest area light along r before max_t, found through the light tree
+// when there is one
+static const light *path_hit_light(const world *w, const ray *r, f64 max_t, f64 *t)
+{
+  if (w->light_tree != NULL) {
+    return light_tree_intersect(w->light_tree, w, r, max_t, t);
+  }
+
+  const light *nearest = NULL;
+  *t = max_t;
+
+  for (u32 i = 0; i < w->lights_count; i++) {
+    f64 hit = 0;
+    if (w->lights[i].type == AreaLightType && area_light_intersect(&w->lights[i], r, &hit) && hit < *t) {
+      nearest = &w->lights[i];
+      *t = hit;
+    }
+  }
+
+  return nearest;
+}
+
+// Radiance along r. Paths continue for up to max_depth bounces past the
+// first hit, and past PATH_ROULETTE_DEPTH survive in proportion to their
+// throughput. Light reached by scattering is weighted against the light
+// sample by the power heuristic, except after mirror and refraction bounces,
+// which light samples cannot follow. aov, if set, gets the first hit.
+void path_trace(const world *w, const ray *r, sampler *s, u64 max_depth, aov_sample *aov, v3 out)
+{
+  v3 radiance = {0};
+  v3 throughput = color_init(1, 1, 1);
+
+  ray current = *r;
+  b32 delta = true;
+  f64 bsdf_pdf = 0;
+  v4 previous = {0};
+
+  for (u64 bounce = 0; ; bounce++) {
+    intersection_group ig = {0};
+    world_intersect(w, &current, &ig);
+    const intersection *hit = intersection_group_hit(&ig);
+
+    f64 light_t = 0;
+    const light *l = path_hit_light(w, &current, hit != NULL ? hit->t : F64_INF, &light_t);
+    if (l != NULL) {
+      f64 weight = 1;
+      if (!delta) {
+        f64 light_pdf = path_light_selection_pdf(w, previous, (u32)(l - w->lights)) *
+          path_area_light_pdf(l, current.direction, light_t);
+        weight = path_power_heuristic(bsdf_pdf, light_pdf);
+      }
+
+      v3 emitted = {0};
+      v3_mul(throughput, l->intensity, emitted);
+      v3_scale(emitted, weight * light_attenuation(l, current.origin), emitted);
+      v3_add(radiance, emitted, radiance);
+      break;
+    }
+
+    if (hit == NULL) {
+      break;
+    }
+
+    computations c = {0};
+    computations_prepare(hit, &current, &ig, &c);
+
+    path_bsdf b = {0};
+    path_bsdf_init(&c, &b);
+
+    if (bounce == 0 && aov != NULL) {
+      aov_sample_record(w, &c, aov);
+    }
+
+    v3 direct = {0};
+    path_sample_light(w, &c, &b, s, direct);
+    v3_mul(direct, throughput, direct);
+    v3_add(radiance, direct, radiance);
+
+    if (bounce >= max_depth) {
+      break;
+    }
+
+    f64 u_lobe = sampler_1d(s);
+    v2 u = {0};
+    sampler_2d(s, u);
+
+    v3 weight = {0};
+    if (!path_bsdf_sample(&b, &c, u_lobe, u, &current, weight, &bsdf_pdf, &delta)) {
+      break;
+    }
+    v3_mul(throughput, weight, throughput);
+    memcpy(previous, c.point, sizeof(v4));
+
+    if (bounce + 1 >= PATH_ROULETTE_DEPTH) {
+      f64 survival = MIN(path_max3(throughput), 0.95);
+      if (sampler_1d(s) >= survival) {
+        break;
+      }
+      v3_scale(throughput, 1 / survival, throughput);
+    }
+  }
+
+  memcpy(out, radiance, sizeof(v3));
+}
@@ -90,9 +90,16 @@ void pattern_color_at(const pattern *p, const v4 l, v3 out)
 }
 
 void pattern_object_color_at(const pattern *p, const object *o, const v4 l, v3 out)
+{
+  pattern_object_color_at_time(p, o, l, 0, out);
+}
+
+// Moving objects carry their patterns along, so l is mapped into object
+// space with the transform at the time the point was hit
+void pattern_object_color_at_time(const pattern *p, const object *o, const v4 l, f64 time, v3 out)
 {
   v4 object_point = {0};
-  m4_mulv(o->inverse_transform, l, object_point);
+  object_world_to_object(o, l, time, object_point);
 
   v4 pattern_point = {0};
   m4_mulv(p->inverse_transform, object_point, pattern_point);
@@ -0,0 +1,152 @@
+#include "rtc.h"
+
+// Levels start with every start_step-th pixel in both directions and halve
+// the spacing until every pixel is settled. start_step is rounded down to a
+// power of two so each grid holds the coarser ones. threshold is how far
+// apart, in any channel, the corners of a coarser cell must be for the new
+// pixels in it to be shaded rather than interpolated. 0 shades every pixel.
+preview *preview_alloc(const camera *v, u32 start_step, f64 threshold)
+{
+  preview *p = malloc(sizeof(preview));
+  memset(p, 0, sizeof(preview));
+
+  p->width = v->hsize;
+  p->height = v->vsize;
+  p->step = 1;
+  while (p->step <= start_step / 2) {
+    p->step *= 2;
+  }
+  p->threshold = threshold;
+  p->c = canvas_alloc(v->hsize, v->vsize);
+
+  u32 n = p->width * p->height;
+  p->traced = malloc(n);
+  memset(p->traced, 0, n);
+  p->mask = malloc(n);
+
+  return p;
+}
+
+void preview_free(preview *p)
+{
+  canvas_free(p->c);
+  free(p->traced);
+  free(p->mask);
+  free(p);
+}
+
+// Whether the corners of the cell of the step grid holding (x, y) differ
+// by more than threshold
+static b32 preview_cell_differs(const preview *p, u32 x, u32 y, u32 step)
+{
+  u32 x0 = (x / step) * step;
+  u32 y0 = (y / step) * step;
+  u32 x1 = MIN(x0 + step, ((p->width - 1) / step) * step);
+  u32 y1 = MIN(y0 + step, ((p->height - 1) / step) * step);
+
+  const f64 *a = *canvas_at(p->c, x0, y0);
+  const f64 *b = *canvas_at(p->c, x1, y0);
+  const f64 *c = *canvas_at(p->c, x0, y1);
+  const f64 *d = *canvas_at(p->c, x1, y1);
+
+  for (u32 i = 0; i < 3; i++) {
+    f64 lo = MIN(MIN(a[i], b[i]), MIN(c[i], d[i]));
+    f64 hi = MAX(MAX(a[i], b[i]), MAX(c[i], d[i]));
+    if (hi - lo > p->threshold) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Bilinear interpolation of the step grid to every pixel off it, held
+// constant past the last grid row and column
+static void preview_fill(preview *p, u32 step)
+{
+  u32 last_x = ((p->width - 1) / step) * step;
+  u32 last_y = ((p->height - 1) / step) * step;
+
+  for (u32 y = 0; y < p->height; y++) {
+    u32 y0 = (y / step) * step;
+    u32 y1 = MIN(y0 + step, last_y);
+    f64 ty = y1 > y0 ? (f64)(y - y0) / (f64)(y1 - y0) : 0;
+
+    for (u32 x = 0; x < p->width; x++) {
+      if (x % step == 0 && y % step == 0) {
+        continue;
+      }
+
+      u32 x0 = (x / step) * step;
+      u32 x1 = MIN(x0 + step, last_x);
+      f64 tx = x1 > x0 ? (f64)(x - x0) / (f64)(x1 - x0) : 0;
+
+      const f64 *a = *canvas_at(p->c, x0, y0);
+      const f64 *b = *canvas_at(p->c, x1, y0);
+      const f64 *c = *canvas_at(p->c, x0, y1);
+      const f64 *d = *canvas_at(p->c, x1, y1);
+
+      f64 *out = *canvas_at(p->c, x, y);
+      for (u32 i = 0; i < 3; i++) {
+        f64 top = a[i] + tx * (b[i] - a[i]);
+        f64 bottom = c[i] + tx * (d[i] - c[i]);
+        out[i] = top + ty * (bottom - top);
+      }
+    }
+  }
+}
+
+// Settles the next level into p->c and returns true, or false once every
+// pixel is settled. Pixels shaded at coarser levels are kept, so each
+// level only shades new ones, and only in cells whose coarser corners
+// disagree. Shaded pixels match camera_render, so with a threshold of 0
+// the last level is the full image.
+b32 preview_refine(preview *p, const camera *v, const world *w)
+{
+  assert(p->width == v->hsize && p->height == v->vsize);
+
+  u32 step = p->step;
+  if (step == 0) {
+    return false;
+  }
+
+  memset(p->mask, 0, p->width * p->height);
+
+  for (u32 y = 0; y < p->height; y += step) {
+    for (u32 x = 0; x < p->width; x += step) {
+      u32 i = y * p->width + x;
+      if (p->traced[i]) {
+        continue;
+      }
+
+      if (p->previous == 0 || p->threshold <= 0 || preview_cell_differs(p, x, y, p->previous)) {
+        p->mask[i] = 1;
+      }
+    }
+  }
+
+  render_tiles tiles = {0};
+  tiles.v = v;
+  tiles.w = w;
+  tiles.c = p->c;
+  tiles.mask = p->mask;
+  tiles.tiles_x = (v->hsize + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  tiles.tiles_count = tiles.tiles_x * ((v->vsize + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE);
+  camera_render_tiles(&tiles);
+
+  for (u32 i = 0; i < p->width * p->height; i++) {
+    if (p->mask[i]) {
+      p->traced[i] = 1;
+      p->traced_count++;
+    }
+  }
+
+  // Grid pixels that were not shaded keep the coarser interpolation
+  if (step > 1) {
+    preview_fill(p, step);
+  }
+
+  p->previous = step;
+  p->step = step / 2;
+
+  return true;
+}
@@ -0,0 +1,389 @@
+#include "rtc.h"
+
+progressive *progressive_alloc(const camera *v)
+{
+  progressive *p = malloc(sizeof(progressive));
+  memset(p, 0, sizeof(progressive));
+
+  p->width = v->hsize;
+  p->height = v->vsize;
+  p->tiles_x = (v->hsize + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+  p->tiles_count = p->tiles_x * ((v->vsize + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE);
+
+  u32 n = p->width * p->height;
+  p->sum = malloc(n * sizeof(v3));
+  memset(p->sum, 0, n * sizeof(v3));
+
+  p->sum_squares = malloc(n * sizeof(f64));
+  memset(p->sum_squares, 0, n * sizeof(f64));
+
+  p->tile_samples = malloc(p->tiles_count * sizeof(u32));
+  memset(p->tile_samples, 0, p->tiles_count * sizeof(u32));
+
+  p->tile_sequence = malloc(p->tiles_count * sizeof(u32));
+  memset(p->tile_sequence, 0, p->tiles_count * sizeof(u32));
+
+  return p;
+}
+
+void progressive_free(progressive *p)
+{
+  free(p->sum);
+  free(p->sum_squares);
+  free(p->tile_samples);
+  free(p->tile_sequence);
+  free(p);
+}
+
+// Adds the tile's next sample. It is shaded into a local copy first so the
+// tile is only locked out from readers while it is copied back.
+void progressive_render_tile(render_tiles *tiles, u32 tile)
+{
+  progressive *p = tiles->progressive;
+  const camera *v = tiles->v;
+
+  u32 x0 = (tile % p->tiles_x) * RENDER_TILE_SIZE;
+  u32 y0 = (tile / p->tiles_x) * RENDER_TILE_SIZE;
+  u32 x1 = MIN(x0 + RENDER_TILE_SIZE, p->width);
+  u32 y1 = MIN(y0 + RENDER_TILE_SIZE, p->height);
+  u32 index = p->tile_samples[tile];
+
+  v3 sums[RENDER_TILE_SIZE * RENDER_TILE_SIZE];
+  f64 squares[RENDER_TILE_SIZE * RENDER_TILE_SIZE];
+  for (u32 y = y0; y < y1; y++) {
+    for (u32 x = x0; x < x1; x++) {
+      u32 i = (y - y0) * RENDER_TILE_SIZE + (x - x0);
+
+      v3 sample = {0};
+      camera_sample_pixel(v, tiles->w, x, y, index, NULL, sample);
+      v3_add(sample, p->sum[y * p->width + x], sums[i]);
+
+      f64 luminance = v3_luminance(sample);
+      squares[i] = p->sum_squares[y * p->width + x] + luminance * luminance;
+    }
+  }
+
+  u32 *sequence = &p->tile_sequence[tile];
+  __atomic_store_n(sequence, *sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  for (u32 y = y0; y < y1; y++) {
+    memcpy(&p->sum[y * p->width + x0], &sums[(y - y0) * RENDER_TILE_SIZE], (x1 - x0) * sizeof(v3));
+    memcpy(&p->sum_squares[y * p->width + x0], &squares[(y - y0) * RENDER_TILE_SIZE], (x1 - x0) * sizeof(f64));
+  }
+  __atomic_store_n(&p->tile_samples[tile], index + 1, __ATOMIC_RELAXED);
+
+  __atomic_store_n(sequence, *sequence + 1, __ATOMIC_RELEASE);
+}
+
+static u32 progressive_min_samples(const progressive *p)
+{
+  if (p->tiles_count == 0) {
+    return 0;
+  }
+
+  u32 samples = p->tile_samples[0];
+  for (u32 i = 1; i < p->tiles_count; i++) {
+    samples = MIN(samples, p->tile_samples[i]);
+  }
+  return samples;
+}
+
+static u64 progressive_tile_samples(const progressive *p)
+{
+  u64 samples = 0;
+  for (u32 i = 0; i < p->tiles_count; i++) {
+    samples += p->tile_samples[i];
+  }
+  return samples;
+}
+
+// Adds passes of one sample per pixel until every pixel has max_samples,
+// max_seconds have passed if it is above 0, or progressive_cancel is
+// called. Tiles in flight are finished, so a stopped pass leaves some
+// tiles a sample ahead, and calling this again continues from there.
+// After n passes the image matches camera_render with n samples.
+// Deterministic cameras take a single sample. Returns the samples every
+// pixel has.
+u32 progressive_render(progressive *p, const camera *v, const world *w, u32 max_samples, f64 max_seconds)
+{
+  assert(p->width == v->hsize && p->height == v->vsize);
+
+  u64 deadline = 0;
+  if (max_seconds > 0) {
+    deadline = prof_read_os_timer() + (u64)(max_seconds * (f64)prof_get_os_timer_freq());
+  }
+
+  if (camera_is_deterministic(v)) {
+    max_samples = MIN(max_samples, 1);
+  }
+
+  u32 *order = malloc(p->tiles_count * sizeof(u32));
+
+  for (;;) {
+    u32 pass = progressive_min_samples(p);
+    if (pass >= max_samples || __atomic_load_n(&p->cancelled, __ATOMIC_RELAXED) ||
+        (deadline != 0 && prof_read_os_timer() >= deadline)) {
+      break;
+    }
+
+    u32 order_count = 0;
+    for (u32 i = 0; i < p->tiles_count; i++) {
+      if (p->tile_samples[i] == pass) {
+        order[order_count++] = i;
+      }
+    }
+
+    render_tiles tiles = {0};
+    tiles.v = v;
+    tiles.w = w;
+    tiles.progressive = p;
+    tiles.order = order;
+    tiles.cancel = &p->cancelled;
+    tiles.deadline = deadline;
+    tiles.tiles_x = p->tiles_x;
+    tiles.tiles_count = order_count;
+    camera_render_tiles(&tiles);
+  }
+
+  free(order);
+
+  return progressive_min_samples(p);
+}
+
+// Makes progressive_render return once its tiles in flight are done, may
+// be called from any thread. Later calls return at once until
+// progressive_reset_cancel.
+void progressive_cancel(progressive *p)
+{
+  __atomic_store_n(&p->cancelled, true, __ATOMIC_RELAXED);
+}
+
+void progressive_reset_cancel(progressive *p)
+{
+  __atomic_store_n(&p->cancelled, false, __ATOMIC_RELAXED);
+}
+
+// Writes the mean of each pixel's samples so far to out, black where there
+// are none. Safe to call from any thread while progressive_render runs,
+// tiles being written are copied again. Returns the samples every pixel
+// has.
+u32 progressive_snapshot(const progressive *p, canvas *out)
+{
+  assert(out->width == p->width && out->height == p->height);
+
+  u32 min_samples = 0;
+
+  for (u32 tile = 0; tile < p->tiles_count; tile++) {
+    u32 x0 = (tile % p->tiles_x) * RENDER_TILE_SIZE;
+    u32 y0 = (tile / p->tiles_x) * RENDER_TILE_SIZE;
+    u32 x1 = MIN(x0 + RENDER_TILE_SIZE, p->width);
+    u32 y1 = MIN(y0 + RENDER_TILE_SIZE, p->height);
+
+    for (;;) {
+      u32 before = __atomic_load_n(&p->tile_sequence[tile], __ATOMIC_ACQUIRE);
+      if (before & 1) {
+        sched_yield();
+        continue;
+      }
+
+      u32 samples = __atomic_load_n(&p->tile_samples[tile], __ATOMIC_RELAXED);
+      f64 scale = samples > 0 ? 1.0 / (f64)samples : 0;
+
+      for (u32 y = y0; y < y1; y++) {
+        for (u32 x = x0; x < x1; x++) {
+          v3_scale(p->sum[y * p->width + x], scale, out->pixels[y * p->width + x]);
+        }
+      }
+
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&p->tile_sequence[tile], __ATOMIC_RELAXED) == before) {
+        min_samples = tile == 0 ? samples : MIN(min_samples, samples);
+        break;
+      }
+    }
+  }
+
+  return min_samples;
+}
+
+// Estimated standard error of the tile's pixel means, from the sample
+// variance of their luminance. Infinite below two samples, where it is
+// unknown. Not safe while the tile is being rendered.
+f64 progressive_tile_error(const progressive *p, u32 tile)
+{
+  u32 n = p->tile_samples[tile];
+  if (n < 2) {
+    return F64_INF;
+  }
+
+  u32 x0 = (tile % p->tiles_x) * RENDER_TILE_SIZE;
+  u32 y0 = (tile / p->tiles_x) * RENDER_TILE_SIZE;
+  u32 x1 = MIN(x0 + RENDER_TILE_SIZE, p->width);
+  u32 y1 = MIN(y0 + RENDER_TILE_SIZE, p->height);
+
+  f64 total = 0;
+  for (u32 y = y0; y < y1; y++) {
+    for (u32 x = x0; x < x1; x++) {
+      f64 mean = v3_luminance(p->sum[y * p->width + x]) / (f64)n;
+      f64 variance = (p->sum_squares[y * p->width + x] / (f64)n - mean * mean) * (f64)n / (f64)(n - 1);
+      total += MAX(variance, 0) / (f64)n;
+    }
+  }
+
+  return sqrt(total / (f64)((x1 - x0) * (y1 - y0)));
+}
+
+// Checkpoints hold the camera they were taken with, then each tile's
+// sample count and the sums of every pixel. Pixel samples are drawn from
+// the camera's seed, the pixel and the sample index, so the counts are all
+// the sampler state there is.
+#define PROGRESSIVE_CHECKPOINT_MAGIC 0x54504b4843435452ull
+#define PROGRESSIVE_CHECKPOINT_VERSION 1
+
+typedef struct {
+  u64 magic;
+  u64 version;
+  u64 camera_size;
+  u64 width;
+  u64 height;
+  u64 tiles_count;
+} progressive_checkpoint;
+
+// Whether a and b sample the same rays, threads do not matter
+static b32 progressive_camera_matches(const camera *a, const camera *b)
+{
+  return a->hsize == b->hsize && a->vsize == b->vsize && a->fov == b->fov && a->antialias == b->antialias &&
+    memcmp(a->transform, b->transform, sizeof(m4)) == 0 && a->samples == b->samples &&
+    a->shutter_open == b->shutter_open && a->shutter_close == b->shutter_close && a->seed == b->seed &&
+    a->aperture == b->aperture && a->focal_distance == b->focal_distance &&
+    a->max_depth == b->max_depth && a->integrator == b->integrator;
+}
+
+// Writes p to path through a temporary file that is renamed over it, so
+// path always holds a whole checkpoint. Must not run during a render.
+b32 progressive_save(const progressive *p, const camera *v, const char *path)
+{
+  char temporary[4096];
+  if (snprintf(temporary, sizeof(temporary), "%s.tmp", path) >= (int)sizeof(temporary)) {
+    fprintf(stderr, "progressive_save: path too long %s\n", path);
+    return false;
+  }
+
+  FILE *f = fopen(temporary, "wb");
+  if (f == NULL) {
+    fprintf(stderr, "progressive_save: could not open %s\n", temporary);
+    return false;
+  }
+
+  progressive_checkpoint header = {0};
+  header.magic = PROGRESSIVE_CHECKPOINT_MAGIC;
+  header.version = PROGRESSIVE_CHECKPOINT_VERSION;
+  header.camera_size = sizeof(camera);
+  header.width = p->width;
+  header.height = p->height;
+  header.tiles_count = p->tiles_count;
+
+  u32 n = p->width * p->height;
+  b32 ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+    fwrite(v, sizeof(camera), 1, f) == 1 &&
+    fwrite(p->tile_samples, sizeof(u32), p->tiles_count, f) == p->tiles_count &&
+    fwrite(p->sum, sizeof(v3), n, f) == n &&
+    fwrite(p->sum_squares, sizeof(f64), n, f) == n &&
+    fflush(f) == 0 && fsync(fileno(f)) == 0;
+  ok = fclose(f) == 0 && ok;
+
+  if (!ok || rename(temporary, path) != 0) {
+    fprintf(stderr, "progressive_save: could not write %s\n", path);
+    remove(temporary);
+    return false;
+  }
+
+  // The rename is only durable once the directory holding it is synced
+  char *slash = strrchr(temporary, '/');
+  if (slash == NULL) {
+    strcpy(temporary, ".");
+  } else {
+    slash[slash == temporary ? 1 : 0] = 0;
+  }
+  int dir = open(temporary, O_RDONLY);
+  if (dir >= 0) {
+    fsync(dir);
+    close(dir);
+  }
+  return true;
+}
+
+// Restores p, allocated for v, from a checkpoint of progressive_save.
+// Returns false, leaving p as it was, if there is none or it was taken
+// with a camera that renders differently.
+b32 progressive_load(progressive *p, const camera *v, const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return false;
+  }
+
+  progressive_checkpoint header = {0};
+  camera saved = {0};
+  b32 ok = fread(&header, sizeof(header), 1, f) == 1 &&
+    header.magic == PROGRESSIVE_CHECKPOINT_MAGIC && header.version == PROGRESSIVE_CHECKPOINT_VERSION &&
+    header.camera_size == sizeof(camera) && header.width == p->width && header.height == p->height &&
+    header.tiles_count == p->tiles_count &&
+    fread(&saved, sizeof(camera), 1, f) == 1 && progressive_camera_matches(&saved, v);
+
+  u32 n = p->width * p->height;
+  u32 *tile_samples = malloc(MAX(p->tiles_count, 1) * sizeof(u32));
+  v3 *sum = malloc(MAX(n, 1) * sizeof(v3));
+  f64 *sum_squares = malloc(MAX(n, 1) * sizeof(f64));
+
+  ok = ok && fread(tile_samples, sizeof(u32), p->tiles_count, f) == p->tiles_count &&
+    fread(sum, sizeof(v3), n, f) == n &&
+    fread(sum_squares, sizeof(f64), n, f) == n &&
+    fgetc(f) == EOF;
+  fclose(f);
+
+  if (!ok) {
+    fprintf(stderr, "progressive_load: %s does not match the render\n", path);
+  } else {
+    memcpy(p->tile_samples, tile_samples, p->tiles_count * sizeof(u32));
+    memcpy(p->sum, sum, n * sizeof(v3));
+    memcpy(p->sum_squares, sum_squares, n * sizeof(f64));
+  }
+
+  free(tile_samples);
+  free(sum);
+  free(sum_squares);
+  return ok;
+}
+
+// progressive_render to max_samples, saving a checkpoint to path every
+// interval seconds and once done, 0 saving only then. Every checkpoint
+// follows at least one more pass, so intervals shorter than a pass save
+// once per pass. With resume set it first continues from the checkpoint at
+// path if there is a usable one, and the image then matches a render that
+// was never stopped. Returns the samples every pixel has.
+u32 progressive_render_checkpointed(progressive *p, const camera *v, const world *w, u32 max_samples, f64 interval, const char *path, b32 resume)
+{
+  if (resume) {
+    progressive_load(p, v, path);
+  }
+
+  u32 target = camera_is_deterministic(v) ? MIN(max_samples, 1) : max_samples;
+
+  u32 samples = progressive_min_samples(p);
+  for (;;) {
+    u64 before = progressive_tile_samples(p);
+    samples = progressive_render(p, v, w, max_samples, interval);
+    if (progressive_tile_samples(p) == before && samples < target) {
+      samples = progressive_render(p, v, w, samples + 1, 0);
+    }
+
+    // Without progress, which only a cancel leaves, there is nothing to save
+    if (progressive_tile_samples(p) == before || !progressive_save(p, v, path) ||
+        samples >= target || __atomic_load_n(&p->cancelled, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+  return samples;
+}
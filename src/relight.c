@@ -0,0 +1,212 @@
+#include "rtc.h"
+
+// Traces the center ray of every pixel once. The cache holds pointers into
+// w, whose objects must not change while it is used, only its lights.
+relight_cache *relight_cache_alloc(const camera *v, const world *w)
+{
+  relight_cache *r = malloc(sizeof(relight_cache));
+  memset(r, 0, sizeof(relight_cache));
+
+  r->width = v->hsize;
+  r->height = v->vsize;
+  r->max_depth = v->max_depth;
+  r->time = v->shutter_open;
+
+  u32 n = r->width * r->height;
+  r->hits = malloc(n * sizeof(relight_hit));
+  memset(r->hits, 0, n * sizeof(relight_hit));
+
+  intersection_group ig = {0};
+  for (u32 y = 0; y < r->height; y++) {
+    for (u32 x = 0; x < r->width; x++) {
+      ray camera_ray = {0};
+      camera_ray_for_pixel(v, x, y, &camera_ray);
+
+      ig.count = 0;
+      world_intersect(w, &camera_ray, &ig);
+
+      const intersection *hit = intersection_group_hit(&ig);
+      if (hit == NULL) {
+        continue;
+      }
+
+      computations c = {0};
+      computations_prepare(hit, &camera_ray, &ig, &c);
+
+      relight_hit *h = &r->hits[y * r->width + x];
+      h->hit = true;
+      h->o = c.o;
+      h->t = c.t;
+      memcpy(h->point, c.point, sizeof(v4));
+      memcpy(h->eyev, c.eyev, sizeof(v4));
+      memcpy(h->normalv, c.normalv, sizeof(v4));
+      h->inside = c.inside;
+      h->n1 = c.n1;
+      h->n2 = c.n2;
+    }
+  }
+
+  return r;
+}
+
+void relight_cache_free(relight_cache *r)
+{
+  free(r->hits);
+  free(r->visibility);
+  free(r->direct);
+  free(r);
+}
+
+// Same derived values as computations_prepare
+static void relight_computations(const relight_hit *h, f64 time, computations *c)
+{
+  c->t = h->t;
+  c->o = h->o;
+  c->time = time;
+  c->weight = 1;
+  c->inside = h->inside;
+  c->n1 = h->n1;
+  c->n2 = h->n2;
+
+  memcpy(c->point, h->point, sizeof(v4));
+  memcpy(c->eyev, h->eyev, sizeof(v4));
+  memcpy(c->normalv, h->normalv, sizeof(v4));
+
+  v4_scale(c->normalv, (f64)EPSILON, c->over_point);
+  v4_add(c->point, c->over_point, c->over_point);
+
+  v4_scale(c->normalv, (f64)EPSILON, c->under_point);
+  v4_sub(c->point, c->under_point, c->under_point);
+
+  v4 direction = {0};
+  v4_neg(c->eyev, direction);
+  v4_reflect(direction, c->normalv, c->reflectv);
+}
+
+// Whether the shadows a light casts can differ between a and b
+static b32 relight_light_moved(const light *a, const light *b)
+{
+  if (a->type != b->type || memcmp(a->position, b->position, sizeof(v4)) != 0) {
+    return true;
+  }
+
+  if (a->type != AreaLightType) {
+    return false;
+  }
+
+  return memcmp(a->value.area.corner, b->value.area.corner, sizeof(v4)) != 0 ||
+    memcmp(a->value.area.uvec, b->value.area.uvec, sizeof(v4)) != 0 ||
+    memcmp(a->value.area.vvec, b->value.area.vvec, sizeof(v4)) != 0 ||
+    a->value.area.usteps != b->value.area.usteps ||
+    a->value.area.vsteps != b->value.area.vsteps;
+}
+
+static b32 relight_light_changed(const light *a, const light *b)
+{
+  return relight_light_moved(a, b) || memcmp(a->intensity, b->intensity, sizeof(v3)) != 0 ||
+    a->radius != b->radius;
+}
+
+// Shades every cached hit for w's lights and writes the image to out,
+// which must match the camera's size. Lights unchanged since the last
+// update reuse their direct lighting, lights that only changed intensity
+// or falloff reuse their shadows, and the rest cast new shadow rays.
+// Reflections and refractions are traced again on the surfaces that have
+// them, since they see the new lights too. The image matches world_color_at
+// for each pixel center, with every light evaluated even if w has a light
+// tree.
+void relight_cache_update(relight_cache *r, const world *w, canvas *out)
+{
+  assert(out->width == r->width && out->height == r->height);
+
+  u32 n = r->width * r->height;
+  u32 lights_count = w->lights_count;
+
+  b32 changed[MAX_LIGHTS] = {0};
+  b32 moved[MAX_LIGHTS] = {0};
+
+  if (lights_count != r->lights_count) {
+    free(r->visibility);
+    free(r->direct);
+    r->visibility = malloc(MAX(n * lights_count, 1) * sizeof(f64));
+    r->direct = malloc(MAX(n * lights_count, 1) * sizeof(v3));
+
+    for (u32 i = 0; i < lights_count; i++) {
+      changed[i] = true;
+      moved[i] = true;
+    }
+  } else {
+    for (u32 i = 0; i < lights_count; i++) {
+      moved[i] = relight_light_moved(&r->lights[i], &w->lights[i]);
+      changed[i] = moved[i] || relight_light_changed(&r->lights[i], &w->lights[i]);
+    }
+  }
+
+  r->visibility_tests = 0;
+
+  for (u32 p = 0; p < n; p++) {
+    const relight_hit *h = &r->hits[p];
+    if (!h->hit) {
+      memset(out->pixels[p], 0, sizeof(v3));
+      continue;
+    }
+
+    computations c = {0};
+    relight_computations(h, r->time, &c);
+
+    const material *m = &c.o->material;
+
+    v3 result = {0};
+    for (u32 i = 0; i < lights_count; i++) {
+      f64 *visibility = &r->visibility[p * lights_count + i];
+      f64 *direct = r->direct[p * lights_count + i];
+
+      if (!changed[i]) {
+        v3_add(result, direct, result);
+        continue;
+      }
+
+      if (moved[i]) {
+        *visibility = -1;
+      }
+
+      const light *l = &w->lights[i];
+      memset(direct, 0, sizeof(v3));
+
+      // Culled the same way world_shade_hit does
+      if (material_lighting_bound(m, l, c.point, c.normalv) > w->light_threshold) {
+        if (*visibility < 0) {
+          *visibility = world_light_visibility(w, l, c.over_point, c.time);
+          r->visibility_tests++;
+        }
+
+        material_lighting_visibility(m, l, c.o, c.point, c.time, c.eyev, c.normalv, *visibility, direct);
+      }
+
+      v3_add(result, direct, result);
+    }
+
+    if (m->reflective > 0 || m->transparency > 0) {
+      v3 reflected = {0};
+      world_reflected_color(w, &c, r->max_depth, reflected);
+
+      v3 refracted = {0};
+      world_refracted_color(w, &c, r->max_depth, refracted);
+
+      if (m->reflective > 0 && m->transparency > 0) {
+        f64 reflectance = computations_schlick(&c);
+
+        v3_scale(reflected, reflectance, reflected);
+        v3_scale(refracted, (1 - reflectance), refracted);
+      }
+
+      v3_add(result, reflected, result);
+      v3_add(result, refracted, result);
+    }
+
+    memcpy(out->pixels[p], result, sizeof(v3));
+  }
+
+  memcpy(r->lights, w->lights, lights_count * sizeof(light));
+  r->lights_count = lights_count;
+}
@@ -1,16 +1,33 @@
 #ifndef __RTC_H__
 #define __RTC_H__
 
+// clock_gettime and sysconf are hidden by -std=c99 on glibc
+#if defined(__linux__) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 // Headers
+#include <arpa/inet.h>
 #include <assert.h>
+#include <fcntl.h>
 #include <float.h>
 #include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <time.h>
+#include <unistd.h>
 
 
 // Numeric types
@@ -125,6 +142,35 @@ static inline u64 prof_estimate_cpu_freq(u64 wait_ms)
 #define MAX_OBJECTS 512
 #define MAX_LIGHTS 512
 #define MAX_DEPTH 5
+#define WORLD_RAY_STACK_SIZE 64
+#define AREA_LIGHT_PROBE_SAMPLES 4
+#define SAMPLES_PER_PIXEL 32
+#define RENDER_TILE_SIZE 16
+#define RENDER_OBJECT_WORDS ((MAX_OBJECTS + 63) / 64)
+#define RENDER_MAX_WORKERS 64
+#define RENDER_DAEMON_MAX_SCENES 8
+#define RENDER_DAEMON_MAX_CLIENTS 16
+#define PATH_ROULETTE_DEPTH 3
+
+#define BVH_MAX_LEAF_SIZE 4
+#define BVH_BINS 16
+#define BVH_STACK_SIZE 64
+#define BVH_REBUILD_THRESHOLD 1.5
+
+#define GRID_DENSITY 4.0
+#define GRID_MAX_RESOLUTION 128
+
+#define SDF_LANES 8
+#define SDF_MAX_INSTRUCTIONS 64
+#define SDF_MAX_REGISTERS 16
+#define SDF_MAX_STEPS 256
+#define SDF_MAX_HITS 8
+#define SDF_EPSILON 1e-7
+#define SDF_NORMAL_EPSILON 1e-6
+
+#define HEIGHTFIELD_MAX_LEVELS 32
+#define HEIGHTFIELD_STACK_SIZE (3 * HEIGHTFIELD_MAX_LEVELS + 1)
+#define HEIGHTFIELD_MAX_SAMPLES (1ul << 28)
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) > (b) ? (b) : (a))
@@ -141,6 +187,44 @@ typedef f64 v3[3];
 typedef f64 v4[4];
 typedef f64 m4[16];
 
+enum aov_flags {
+  AovDepth = 1 << 0, AovNormal = 1 << 1, AovAlbedo = 1 << 2,
+  AovObject = 1 << 3, AovHits = 1 << 4, AovShadow = 1 << 5,
+};
+
+// Per pixel buffers filled by camera_render_aovs, only those in flags are
+// allocated. Values are averaged over the pixel's samples. Depth is the
+// mean distance to the first hit over the samples that hit, F64_INF where
+// none did. object is the index in world.objects of the first sample's hit
+// (the top csg for csg children), -1 for none. hits counts the samples
+// that hit anything, hits / samples is the pixel's coverage. shadow is the
+// fraction of the direct light blocked at the first hit, averaged over the
+// samples that hit.
+typedef struct {
+  u32 width;
+  u32 height;
+  u32 flags;
+  f64 *depth;
+  v3 *normal;
+  v3 *albedo;
+  s32 *object;
+  u32 *hits;
+  f64 *shadow;
+} render_aovs;
+
+// Edge stopping a-trous wavelet filter, see canvas_denoise
+typedef struct {
+  u32 iterations;
+  f64 sigma_color;
+  f64 sigma_normal;
+  f64 sigma_depth;
+  u32 threads;
+} denoise_options;
+
+// Whitted is world_color_at's direct lighting with mirror and refraction
+// rays, Path is the path tracer in path.c
+enum integrator_type { WhittedIntegrator, PathIntegrator };
+
 typedef struct {
   u32 hsize;
   u32 vsize;
@@ -151,8 +235,38 @@ typedef struct {
   b32 antialias;
   m4 transform;
   m4 inverse_transform;
+
+  // Samples per pixel when antialiasing or when the shutter is open for a
+  // nonzero interval, each gets a ray time in [shutter_open, shutter_close]
+  u32 samples;
+  f64 shutter_open;
+  f64 shutter_close;
+  u64 seed;
+
+  // Thin lens, aperture is the lens radius in world units and 0 is a
+  // pinhole. Points focal_distance in front of the camera are sharp.
+  f64 aperture;
+  f64 focal_distance;
+
+  // Reflection and refraction bounces per camera ray, or path length past
+  // the first hit when path tracing
+  u64 max_depth;
+
+  enum integrator_type integrator;
+
+  // Worker threads sharing the image's tiles, 0 uses every online CPU
+  u32 threads;
 } camera;
 
+// Deterministic per pixel sample generator. Each sample is a point in a
+// scrambled (0,2)-sequence per pair of dimensions, so any prefix of a
+// pixel's samples is well stratified and renders are reproducible.
+typedef struct {
+  u64 seed;
+  u32 index;
+  u32 dimension;
+} sampler;
+
 typedef struct {
   u64 start;
   u64 end;
@@ -167,17 +281,26 @@ typedef struct {
   v3 *pixels;
 } canvas;
 
-enum light_type { PointLightType };
+enum light_type { PointLightType, AreaLightType };
 
+// position is the center of area lights, which are split into usteps x
+// vsteps cells spanned by uvec and vvec, the size of one cell. A radius of
+// 0 means no falloff, otherwise intensity falls off with the square of the
+// distance and reaches zero at radius.
 typedef struct {
   enum light_type type;
   v4 position;
   v3 intensity;
-  /*
+  f64 radius;
   union {
-    struct {} point_light;
+    struct {
+      v4 corner;
+      v4 uvec;
+      v4 vvec;
+      u32 usteps;
+      u32 vsteps;
+    } area;
   } value;
-  */
 } light;
 
 enum pattern_type { 
@@ -226,13 +349,127 @@ typedef struct {
   pattern *p;
 } material;
 
-enum object_type { SphereType, PlaneType, CubeType, CylinderType, ConeType };
+typedef struct {
+  v4 min;
+  v4 max;
+} bounds;
+
+// Binary tree over lights for importance sampling. Every leaf holds one
+// light, nodes store the bounds and summed power of the lights below them.
+// area is set for nodes with an area light below, so the tree doubles as a
+// hierarchy for rays to hit them. leaves maps each light to its leaf, the
+// root is node 0 and its own parent.
+typedef struct {
+  bounds b;
+  f64 power;
+  f64 radius;
+  u32 parent;
+  u32 left;
+  u32 right;
+  u32 light;
+  b32 leaf;
+  b32 area;
+} light_tree_node;
+
+typedef struct {
+  light_tree_node nodes[2 * MAX_LIGHTS];
+  u32 nodes_count;
+  u32 leaves[MAX_LIGHTS];
+} light_tree;
+
+enum sdf_node_type {
+  SphereSdf, BoxSdf, TorusSdf, UnionSdf, SmoothUnionSdf, IntersectionSdf, SubtractionSdf,
+};
+
+// Expression tree of distance primitives and operators. Primitives use
+// center and size (sphere radius in size[0], box half extents, torus major
+// and minor radius in size[0] and size[1]), operators use left, right and
+// the smooth union blend radius k.
+typedef struct sdf_node {
+  enum sdf_node_type type;
+  v4 center;
+  v4 size;
+  f64 k;
+  const struct sdf_node *left;
+  const struct sdf_node *right;
+} sdf_node;
+
+// Postorder stack program compiled from an sdf_node tree. Primitives write
+// register reg, operators combine reg and reg + 1 into reg.
+typedef struct {
+  enum sdf_node_type type;
+  u32 reg;
+  v4 center;
+  v4 size;
+  f64 k;
+} sdf_instruction;
 
 typedef struct {
+  sdf_instruction code[SDF_MAX_INSTRUCTIONS];
+  u32 count;
+  u32 registers;
+  bounds b;
+} sdf;
+
+// Height samples on a width x depth grid spanning x and z in [0, 1] in
+// object space, sample (i, j) at x = i / (width - 1), z = j / (depth - 1).
+// Level l > 0 of the pyramid holds the min and max height of each block of
+// 2^l x 2^l cells, interleaved, starting at pyramid[2 * level_offset[l]].
+// Single cells are bounded straight from their four samples.
+typedef struct {
+  u32 width;
+  u32 depth;
+  f32 *heights;
+
+  u32 levels;
+  u32 level_width[HEIGHTFIELD_MAX_LEVELS];
+  u32 level_depth[HEIGHTFIELD_MAX_LEVELS];
+  u32 level_offset[HEIGHTFIELD_MAX_LEVELS];
+  f32 *pyramid;
+
+  bounds b;
+} heightfield;
+
+// Two keyed transforms, each split into translation, rotation (quaternion x,
+// y, z, w) and scale, which are interpolated separately so rotating keys
+// stay rigid in between
+typedef struct {
+  f64 start;
+  f64 end;
+  v4 translation[2];
+  v4 rotation[2];
+  m4 scale[2];
+} motion;
+
+enum object_type {
+  SphereType, PlaneType, CubeType, CylinderType, ConeType, CsgType, SdfType, HeightfieldType,
+};
+
+enum csg_operation { UnionOperation, IntersectionOperation, DifferenceOperation };
+
+// GeneralTransform comes first so zeroed objects use the matrix path
+enum transform_class {
+  GeneralTransform, IdentityTransform, TranslateUniformScaleTransform, TranslateScaleTransform,
+};
+
+typedef struct object {
   enum object_type type;
   m4 transform;
   m4 inverse_transform;
   material material;
+
+  // Set for children of a csg, whose transforms are relative to it
+  const struct object *parent;
+
+  // Set by object_set_transform. For the simple classes the transform is
+  // center + extent * p, and spheres (center/radius) and cubes (min/max) are
+  // intersected in world space without transforming the ray.
+  enum transform_class transform_class;
+  v4 center;
+  v4 extent;
+
+  // Set by object_set_motion, transform then holds the start key
+  const motion *motion;
   union {
     struct {
       f64 minimum;
@@ -244,6 +481,20 @@ typedef struct {
       f64 maximum;
       b32 closed;
     } cone;
+    struct {
+      enum csg_operation operation;
+      struct object *left;
+      struct object *right;
+      // Child bounds in csg space, used to skip children the ray misses
+      bounds left_bounds;
+      bounds right_bounds;
+    } csg;
+    struct {
+      const sdf *s;
+    } sdf;
+    struct {
+      const heightfield *h;
+    } heightfield;
   } value;
 } object;
 
@@ -262,6 +513,7 @@ typedef struct {
 typedef struct {
   v4 origin;
   v4 direction;
+  f64 time;
 } ray;
 
 typedef struct {
@@ -275,9 +527,103 @@ typedef struct {
   b32 inside;
   f64 n1;
   f64 n2;
+  f64 time;
+  // How much the ray that made the hit can add to its pixel
+  f64 weight;
   const object *o;
 } computations;
 
+// First hit of a camera ray, recorded by the evaluators for render_aovs.
+// flags are the requested aov_flags, shadow is only computed if asked for.
+typedef struct {
+  u32 flags;
+  b32 hit;
+  f64 depth;
+  v4 normal;
+  v3 albedo;
+  s32 object;
+  f64 shadow;
+} aov_sample;
+
+// Ray waiting on world_color_at_iterative's stack, scale is the product of
+// the reflective, transparency and Fresnel factors on its path
+typedef struct {
+  ray r;
+  u64 depth;
+  f64 weight;
+  f64 scale;
+} world_ray_entry;
+
+// Scattering at a path tracer hit. The surface scatters albedo / pi
+// diffusely plus a normalized Phong lobe scaled by specular, and reflective
+// and transparent materials add perfect mirror and refraction lobes with
+// their Whitted weights. Lobes are sampled in proportion to their weights.
+typedef struct {
+  v3 albedo;
+  f64 specular;
+  f64 shininess;
+  f64 diffuse_weight;
+  f64 specular_weight;
+  f64 reflect_weight;
+  f64 refract_weight;
+  f64 total_weight;
+} path_bsdf;
+
+
+// Leaves have count > 0 and reference prims[first .. first+count), internal
+// nodes have count == 0 and reference their children by node index.
+typedef struct {
+  bounds b;
+  u32 parent;
+  u32 first;
+  u32 left;
+  u32 right;
+  u32 count;
+} bvh_node;
+
+typedef struct {
+  bvh_node nodes[2 * MAX_OBJECTS];
+  u32 nodes_count;
+
+  // Object indices, grouped by leaf
+  u32 prims[MAX_OBJECTS];
+  u32 prims_count;
+
+  // Objects with infinite bounds (planes, open cylinders) are tested on every
+  // ray instead of living in the tree
+  u32 unbounded[MAX_OBJECTS];
+  u32 unbounded_count;
+
+  // Per object cached world bounds and owning leaf, used by refit
+  bounds object_bounds[MAX_OBJECTS];
+  u32 leaf_of[MAX_OBJECTS];
+  u32 objects_count;
+
+  // Surface area weighted cost of the tree when it was built, and the sums
+  // refit maintains to track it. Refit rebuilds once bvh_cost / build_cost
+  // exceeds rebuild_threshold.
+  f64 build_cost;
+  f64 area_sum;
+  f64 objects_area;
+  f64 rebuild_threshold;
+  u32 rebuilds;
+} bvh;
+
+// Cells are stored in compressed rows, objects overlapping cell i are
+// cell_objects[cell_offsets[i] .. cell_offsets[i+1])
+typedef struct {
+  bounds b;
+  u32 resolution[3];
+  v4 cell_size;
+
+  u32 *cell_offsets;
+  u32 *cell_objects;
+  u32 cell_objects_count;
+
+  u32 unbounded[MAX_OBJECTS];
+  u32 unbounded_count;
+  u32 objects_count;
+} grid;
 
 typedef struct {
   object objects[MAX_OBJECTS];
@@ -285,8 +631,246 @@ typedef struct {
 
   light lights[MAX_LIGHTS];
   u32 lights_count;
+
+  // Optional acceleration structures, both NULL uses a linear scan of
+  // objects. The grid is used when both are attached, so either can be
+  // chosen per render without rebuilding the other.
+  bvh *bvh;
+  grid *grid;
+
+  // Many light mode, when set each shading point samples light_samples
+  // lights from the tree instead of looping over all of them
+  light_tree *light_tree;
+  u32 light_samples;
+
+  // Lights that can contribute at most this much at a point are skipped
+  // before casting shadow rays
+  f64 light_threshold;
+
+  // Reflected and refracted rays weighing less than min_weight are dropped,
+  // or with russian_roulette kept with probability weight / min_weight and
+  // scaled up to match
+  f64 min_weight;
+  b32 russian_roulette;
 } world;
 
+// What the rays of one tile touched, see world_trace_objects. objects has
+// a bit per index in world.objects. rays bounds the shadow and secondary
+// ray segments, and is infinite once one of them escapes the scene. Rays
+// from eye are camera rays, which are not bounded.
+typedef struct {
+  u64 objects[RENDER_OBJECT_WORDS];
+  bounds rays;
+  v4 eye;
+} render_trace;
+
+// Traces of every tile of a render, see camera_render_record
+typedef struct {
+  u32 width;
+  u32 height;
+  u32 tiles_x;
+  u32 tiles_count;
+  render_trace *tiles;
+} render_record;
+
+// Samples accumulated pass by pass by progressive_render, sum is each
+// pixel's sum of samples, sum_squares the sum of their squared luminance
+// and tile_samples the samples every pixel of a tile has. A tile is only
+// changed while its tile_sequence is odd, so progressive_snapshot can copy
+// it without locking and retry if the sequence moved. cancelled stops
+// progressive_render from any thread until it is reset.
+typedef struct {
+  u32 width;
+  u32 height;
+  u32 tiles_x;
+  u32 tiles_count;
+  v3 *sum;
+  f64 *sum_squares;
+  u32 *tile_samples;
+  u32 *tile_sequence;
+  b32 cancelled;
+} progressive;
+
+// Quality camera_render_budget reached. Samples are per pixel over the
+// tiles. A tile's error is the estimated standard error of its pixel
+// means' luminance, root mean square over the tile, and only tiles with
+// two or more samples have one. Degraded tiles did not get their first
+// sample before the deadline and were shaded without reflection or
+// refraction.
+typedef struct {
+  f64 seconds;
+  u32 min_samples;
+  u32 max_samples;
+  f64 mean_samples;
+  u32 degraded_tiles;
+  // Unweighted mean of the per tile errors, not root mean square over the frame
+  f64 mean_error;
+  f64 max_error;
+} render_budget_stats;
+
+// Coarse to fine preview, see preview_refine. step is the spacing of the
+// grid of pixels the next level settles, 0 once every pixel is, and
+// previous that of the last level, 0 before the first. traced marks the
+// pixels that were shaded, the rest of c is interpolated.
+typedef struct {
+  u32 width;
+  u32 height;
+  u32 step;
+  u32 previous;
+  f64 threshold;
+  canvas *c;
+  u8 *traced;
+  u8 *mask;
+  u64 traced_count;
+} preview;
+
+// Pixels x0 <= x < x1 and y0 <= y < y1 of an image
+typedef struct {
+  u32 x0;
+  u32 y0;
+  u32 x1;
+  u32 y1;
+} render_region;
+
+// Work shared by camera_render's threads, each takes the next tile of
+// RENDER_TILE_SIZE pixels until none are left. tiles_x is the number of
+// tiles across the image. order, if set, lists the tiles to render,
+// otherwise all tiles_count are. record, if set, gets each tile's trace.
+// progressive, if set, gets one more sample for each tile instead of c.
+// mask, if set, limits c to the pixels where it is not 0, and region, if
+// set, to those in it. c holds only the region if crop is set. No tiles
+// are started once cancel is set or past deadline, an os timer value, if
+// not 0.
+typedef struct {
+  const camera *v;
+  const world *w;
+  canvas *c;
+  render_aovs *aovs;
+  render_record *record;
+  progressive *progressive;
+  const u8 *mask;
+  const render_region *region;
+  b32 crop;
+  const u32 *order;
+  const b32 *cancel;
+  u64 deadline;
+  u32 tiles_x;
+  u32 tiles_count;
+  u32 next;
+  pthread_mutex_t lock;
+} render_tiles;
+
+// One band of rows of one canvas_denoise pass, colors are planar
+typedef struct {
+  const render_aovs *a;
+  const f64 *in;
+  f64 *out;
+  u32 step;
+  f64 sigma_color;
+  f64 sigma_normal;
+  f64 sigma_depth;
+  u32 y0;
+  u32 y1;
+} denoise_band;
+
+// Camera ray hit of one pixel center, enough to rebuild its computations
+typedef struct {
+  b32 hit;
+  const object *o;
+  f64 t;
+  v4 point;
+  v4 eyev;
+  v4 normalv;
+  b32 inside;
+  f64 n1;
+  f64 n2;
+} relight_hit;
+
+// Primary hits of a camera kept so lights can be edited without tracing
+// them again, see relight_cache_update. lights is the world's lights as of
+// the last update. visibility and direct hold, per pixel and light, the
+// light's visibility (-1 if it was never needed) and its direct lighting.
+typedef struct {
+  u32 width;
+  u32 height;
+  u64 max_depth;
+  f64 time;
+  relight_hit *hits;
+
+  light lights[MAX_LIGHTS];
+  u32 lights_count;
+  f64 *visibility;
+  v3 *direct;
+
+  // Shadow visibility computed by the last update
+  u64 visibility_tests;
+} relight_cache;
+
+// A camera and world rebuilt by scene_deserialize, which own everything
+// the world's objects point to. children are the objects of csgs.
+typedef struct {
+  camera v;
+  world *w;
+  pattern *patterns;
+  motion *motions;
+  sdf *sdfs;
+  heightfield **heightfields;
+  u32 heightfields_count;
+  object *children;
+} scene;
+
+// Listening socket of a distributed render, see render_coordinator_run.
+// Workers that take longer than timeout seconds over a tile are dropped.
+typedef struct {
+  int listen_fd;
+  u32 port;
+  f64 timeout;
+} render_coordinator;
+
+// How a distributed render went. workers counts the connections that were
+// sent the scene, lost_workers those that left with tiles in flight and
+// requeued_tiles the tiles given to others because of it.
+typedef struct {
+  f64 seconds;
+  u32 tiles;
+  u32 workers;
+  u32 lost_workers;
+  u32 requeued_tiles;
+} render_distributed_stats;
+
+// Scene kept resident by a render daemon, last_used orders evictions
+typedef struct {
+  u64 hash;
+  scene *s;
+  u64 last_used;
+} render_daemon_scene;
+
+// Connection to a render daemon, with the hash of the scene it uses, 0
+// before it loads one, and the camera and image it renders to
+typedef struct {
+  int fd;
+  u64 hash;
+  camera v;
+  canvas *c;
+} render_daemon_client;
+
+// Render server, see render_daemon_run. scene_hits counts loads answered
+// from memory and scene_misses those that built a scene. Clients that
+// stall for timeout seconds within a request are dropped.
+typedef struct {
+  int listen_fd;
+  f64 timeout;
+  char path[sizeof(((struct sockaddr_un *)NULL)->sun_path)];
+  render_daemon_scene scenes[RENDER_DAEMON_MAX_SCENES];
+  u32 scenes_count;
+  render_daemon_client clients[RENDER_DAEMON_MAX_CLIENTS];
+  u32 clients_count;
+  u64 clock;
+  u64 scene_hits;
+  u64 scene_misses;
+  b32 stopped;
+} render_daemon;
+
 //------------------------------------------------------------------------------
 // Functions
 
@@ -295,11 +879,89 @@ void camera_set_transform(camera *c, const m4 T);
 
 void camera_ray_for_pixel(const camera *c, const u32 x, const u32 y, ray *out);
 void camera_raw_ray_for_pixel(const camera *c, const f64 x_offset, const f64 y_offset, ray *out);
+void camera_lens_ray_for_pixel(const camera *c, const f64 x_offset, const f64 y_offset, const v2 lens, ray *out);
 
+b32 camera_is_deterministic(const camera *v);
+void camera_sample_pixel(const camera *v, const world *w, u32 x, u32 y, u32 index, aov_sample *aov, v3 out);
+void camera_render_pixel(const camera *v, const world *w, u32 x, u32 y, render_aovs *aovs, v3 out);
 canvas *camera_render(const camera *v, const world *w, render_stats *s);
+canvas *camera_render_aovs(const camera *v, const world *w, render_aovs *aovs, render_stats *s);
+void camera_render_tiles(render_tiles *tiles);
+canvas *camera_render_region(const camera *v, const world *w, const render_region *r, render_stats *s);
+b32 camera_render_region_into(const camera *v, const world *w, const render_region *r, canvas *c);
+canvas *camera_render_record(const camera *v, const world *w, render_record *r, render_stats *s);
+u32 camera_rerender(const camera *v, world *w, render_record *r, const u32 *objects, u32 objects_count, canvas *c);
+
+render_record *render_record_alloc(const camera *v);
+void render_record_free(render_record *r);
+
+progressive *progressive_alloc(const camera *v);
+void progressive_free(progressive *p);
+u32 progressive_render(progressive *p, const camera *v, const world *w, u32 max_samples, f64 max_seconds);
+void progressive_render_tile(render_tiles *tiles, u32 tile);
+u32 progressive_snapshot(const progressive *p, canvas *out);
+void progressive_cancel(progressive *p);
+void progressive_reset_cancel(progressive *p);
+f64 progressive_tile_error(const progressive *p, u32 tile);
+b32 progressive_save(const progressive *p, const camera *v, const char *path);
+b32 progressive_load(progressive *p, const camera *v, const char *path);
+u32 progressive_render_checkpointed(progressive *p, const camera *v, const world *w, u32 max_samples, f64 interval, const char *path, b32 resume);
+
+preview *preview_alloc(const camera *v, u32 start_step, f64 threshold);
+void preview_free(preview *p);
+b32 preview_refine(preview *p, const camera *v, const world *w);
+
+canvas *camera_render_budget(const camera *v, const world *w, f64 max_seconds, u32 max_samples, render_budget_stats *s);
+
+render_aovs *render_aovs_alloc(u32 width, u32 height, u32 flags);
+void render_aovs_free(render_aovs *a);
+b32 render_aovs_write_exr(const render_aovs *a, const canvas *c, const char *path);
+void aov_sample_record(const world *w, const computations *c, aov_sample *aov);
+
+relight_cache *relight_cache_alloc(const camera *v, const world *w);
+void relight_cache_free(relight_cache *r);
+void relight_cache_update(relight_cache *r, const world *w, canvas *out);
+
+u8 *scene_serialize(const camera *v, const world *w, u64 *size);
+scene *scene_deserialize(const u8 *data, u64 size);
+void scene_free(scene *s);
+b32 scene_camera(const u8 *data, u64 size, camera *out);
+u64 scene_hash(const u8 *data, u64 size);
+
+render_coordinator *render_coordinator_alloc(const char *address, u32 port);
+void render_coordinator_free(render_coordinator *rc);
+canvas *render_coordinator_run(render_coordinator *rc, const camera *v, const world *w, u32 local_workers, render_distributed_stats *s);
+b32 render_worker_run(const char *host, u32 port, u32 max_tiles);
+b32 socket_send_all(int fd, const void *p, u64 n);
+b32 socket_recv_all(int fd, void *p, u64 n);
+
+render_daemon *render_daemon_alloc(const char *path);
+void render_daemon_free(render_daemon *d);
+void render_daemon_run(render_daemon *d);
+int render_daemon_connect(const char *path);
+b32 render_daemon_load_scene(int fd, const camera *v, const world *w, u64 *hash);
+b32 render_daemon_use_scene(int fd, u64 hash);
+b32 render_daemon_set_camera(int fd, const camera *v);
+b32 render_daemon_render_region(int fd, const render_region *r);
+canvas *render_daemon_fetch_image(int fd);
+b32 render_daemon_shutdown(int fd);
+
+void denoise_options_init(denoise_options *o);
+void canvas_denoise(const canvas *c, const render_aovs *a, const denoise_options *o, canvas *out);
 
 void render_stats_print(const render_stats *s);
 
+void sampler_init(sampler *s, u32 x, u32 y, u64 seed);
+void sampler_start(sampler *s, u32 index);
+f64 sampler_1d(sampler *s);
+void sampler_2d(sampler *s, v2 out);
+
+void path_trace(const world *w, const ray *r, sampler *s, u64 max_depth, aov_sample *aov, v3 out);
+
+u64 hash_u64(u64 x);
+u64 hash_point(const v4 p);
+f64 hash_uniform(u64 key, u64 i);
+
 canvas *canvas_alloc(u32 width, u32 height);
 void canvas_free(canvas *c);
 
@@ -311,11 +973,17 @@ char *canvas_to_ppm(const canvas *c);
 
 void light_init(light *o, const v4 position, const v3 intensity);
 void point_light_init(light *o, const v4 position, const v3 intensity);
+void area_light_init(light *o, const v4 corner, const v4 full_uvec, u32 usteps, const v4 full_vvec, u32 vsteps, const v3 intensity);
+f64 light_attenuation(const light *l, const v4 p);
+void area_light_point(const light *l, u32 u, u32 v, const v2 jitter, v4 out);
+f64 area_light_area(const light *l, v4 normal);
+b32 area_light_intersect(const light *l, const ray *r, f64 *t);
 
 void pattern_init(pattern *p);
 void pattern_set_transform(pattern *p, const m4 T);
 void pattern_color_at(const pattern *p, const v4 l, v3 out);
 void pattern_object_color_at(const pattern *p, const object *o, const v4 l, v3 out);
+void pattern_object_color_at_time(const pattern *p, const object *o, const v4 l, f64 time, v3 out);
 
 void striped_pattern_init(pattern *p, const v3 a, const v3 b);
 void gradient_pattern_init(pattern *p, const v3 a, const v3 b);
@@ -325,6 +993,9 @@ void checker_pattern_init(pattern *p, const v3 a, const v3 b);
 void material_init(material *m);
 
 void material_lighting(const material *m, const light *l, const object *o, const v4 position, const v4 eyev, const v4 normalv, const b32 in_shadow, v3 result);
+void material_lighting_visibility(const material *m, const light *l, const object *o, const v4 position, f64 time, const v4 eyev, const v4 normalv, f64 visibility, v3 result);
+void material_color_at(const material *m, const object *o, const v4 position, f64 time, v3 out);
+f64 material_lighting_bound(const material *m, const light *l, const v4 position, const v4 normalv);
 
 void m4_print(const m4 a);
 
@@ -341,8 +1012,19 @@ b32 m4_eq(const m4 A, const m4 B);
 
 void object_init(object *o);
 void object_set_transform(object *o, const m4 T);
+enum transform_class transform_classify(const m4 T);
 void object_set_material(object *o, const material *M);
 void object_normal_at(const object *o, const v4 p, v4 out);
+void object_normal_at_time(const object *o, const v4 p, f64 time, v4 out);
+void object_world_to_object(const object *o, const v4 p, f64 time, v4 out);
+void object_normal_to_world(const object *o, const v4 n, f64 time, v4 out);
+
+void motion_init(motion *m, const m4 start, f64 start_time, const m4 end, f64 end_time);
+void motion_transform_at(const motion *m, f64 time, m4 T, m4 inverse);
+
+void object_set_motion(object *o, const motion *m);
+void object_transform_at(const object *o, f64 time, m4 T, m4 inverse);
+void object_motion_bounds(const object *o, const bounds *local, bounds *out);
 
 void sphere_init(object *o);
 void glass_sphere_init(object *o);
@@ -350,6 +1032,32 @@ void plane_init(object *o);
 void cube_init(object *o);
 void cylinder_init(object *o);
 void cone_init(object *o);
+void csg_init(object *o, enum csg_operation operation, object *left, object *right);
+
+void sdf_sphere_init(sdf_node *n, const v4 center, f64 radius);
+void sdf_box_init(sdf_node *n, const v4 center, const v4 half_extents);
+void sdf_torus_init(sdf_node *n, const v4 center, f64 major_radius, f64 minor_radius);
+void sdf_operator_init(sdf_node *n, enum sdf_node_type type, const sdf_node *left, const sdf_node *right, f64 k);
+
+void sdf_compile(sdf *s, const sdf_node *root);
+void sdf_eval(const sdf *s, u32 count, const f64 *x, const f64 *y, const f64 *z, f64 *out);
+void sdf_trace(const sdf *s, u32 count, const ray *rays, f64 *out);
+void sdf_normal_at(const sdf *s, const v4 p, v4 out);
+void sdf_intersect(const ray *r, const object *o, intersection_group *ig);
+
+void sdf_object_init(object *o, const sdf *s);
+
+heightfield *heightfield_alloc(u32 width, u32 depth, const f32 *heights);
+heightfield *heightfield_load(const char *path);
+void heightfield_free(heightfield *h);
+f64 heightfield_height_at(const heightfield *h, f64 x, f64 z);
+void heightfield_normal_at(const heightfield *h, const v4 p, v4 out);
+void heightfield_intersect(const ray *r, const object *o, intersection_group *ig);
+
+void heightfield_object_init(object *o, const heightfield *h);
+
+b32 csg_intersection_allowed(enum csg_operation operation, b32 left_hit, b32 in_left, b32 in_right);
+void csg_intersect(const ray *r, const object *o, intersection_group *ig);
 
 int intersection_compare(const void* a, const void* b);
 
@@ -357,9 +1065,12 @@ const intersection *intersection_group_hit(const intersection_group *ig);
 
 void ray_position(const ray *r, f64 t, v4 out);
 void ray_intersect(const ray *r, const object *o, intersection_group *ig);
+b32 ray_hits_before(const ray *r, const object *o, f64 max_t);
+void ray_packet_hits_before(const ray *rays, u32 count, const object *o, const f64 *max_t, const b32 *active, b32 *hit);
 
 void computations_prepare(const intersection *i, const ray *r, const intersection_group *ig, computations *out);
 f64 computations_schlick(const computations *comps);
+b32 computations_refract_direction(const computations *comps, v4 out);
 
 extern const v3 BLACK;
 extern const v3 WHITE;
@@ -404,14 +1115,56 @@ void shearing(f64 xy, f64 xz, f64 yx, f64 yz, f64 zx, f64 zy, m4 out);
 
 void view_transform(v4 from, v4 to, v4 up, m4 out);
 
+void bounds_init(bounds *b);
+void bounds_add_point(bounds *b, const v4 p);
+void bounds_merge(const bounds *a, const bounds *b, bounds *out);
+void bounds_transform(const bounds *b, const m4 T, bounds *out);
+b32 bounds_is_finite(const bounds *b);
+b32 bounds_contains(const bounds *outer, const bounds *inner);
+f64 bounds_surface_area(const bounds *b);
+void bounds_centroid(const bounds *b, v4 out);
+b32 bounds_intersect(const bounds *b, const v4 origin, const v4 inv_direction, f64 *tmin, f64 *tmax);
+
+void object_local_bounds(const object *o, bounds *out);
+void object_bounds(const object *o, bounds *out);
+
+bvh *bvh_alloc(const world *w);
+void bvh_free(bvh *b);
+void bvh_build(bvh *b, const world *w);
+b32 bvh_refit(bvh *b, const world *w, const u32 *moved, u32 moved_count);
+f64 bvh_cost(const bvh *b);
+void bvh_intersect(const bvh *b, const world *w, const ray *r, intersection_group *ig);
+b32 bvh_intersect_any(const bvh *b, const world *w, const ray *r, f64 max_t);
+void bvh_intersect_any_packet(const bvh *b, const world *w, const ray *rays, u32 count, const f64 *max_t, b32 *hit);
+
+grid *grid_alloc(const world *w);
+void grid_free(grid *g);
+void grid_intersect(const grid *g, const world *w, const ray *r, intersection_group *ig);
+b32 grid_intersect_any(const grid *g, const world *w, const ray *r, f64 max_t);
+
+light_tree *light_tree_alloc(const world *w);
+void light_tree_free(light_tree *t);
+u32 light_tree_sample(const light_tree *t, const v4 p, f64 u, f64 *pdf);
+f64 light_tree_pdf(const light_tree *t, const v4 p, u32 light);
+const light *light_tree_intersect(const light_tree *t, const world *w, const ray *r, f64 max_t, f64 *hit_t);
+
 void world_init(world *w);
 void world_intersect(const world *w, const ray *r, intersection_group *ig);
+b32 world_intersect_any(const world *w, const ray *r, f64 max_t);
+void world_trace_objects(render_trace *t);
+s32 world_object_index(const world *w, const object *o);
 void world_shade_hit(const world *w, const computations *c, u64 depth, v3 out);
 void world_reflected_color(const world *w, const computations *c, u64 depth, v3 out);
 void world_color_at(const world *w, const ray *r, u64 depth, v3 out);
+void world_color_at_weight(const world *w, const ray *r, u64 depth, f64 weight, v3 out);
+void world_color_at_iterative(const world *w, const ray *r, u64 depth, aov_sample *aov, v3 out);
 void world_refracted_color(const world *w, const computations *c, u64 depth, v3 out);
 
 b32 world_is_shadowed(const world *w, const light *l, const v4 p);
+b32 world_is_shadowed_at_time(const world *w, const light *l, const v4 p, f64 time);
+b32 world_is_occluded(const world *w, const v4 p, const v4 target, f64 time);
+void world_is_occluded_packet(const world *w, const v4 p, v4 *targets, u32 count, f64 time, b32 *out);
+f64 world_light_visibility(const world *w, const light *l, const v4 p, f64 time);
 
 // Static inline functions
 
@@ -522,6 +1275,12 @@ static inline void v3_scale(const v3 a, f64 b, v3 out)
   out[2] = a[2] * b;
 }
 
+// Rec. 709 luminance of a linear color
+static inline f64 v3_luminance(const v3 a)
+{
+  return 0.2126 * a[0] + 0.7152 * a[1] + 0.0722 * a[2];
+}
+
 static inline void v4_add(const v4 a, const v4 b, v4 out)
 {
   out[0] = a[0] + b[0];
@@ -550,6 +1309,15 @@ static inline void ray_transform(const ray *r, const m4 T, ray *out)
 {
   m4_mulv(T, r->origin, out->origin);
   m4_mulv(T, r->direction, out->direction);
+  out->time = r->time;
+}
+
+static inline void ray_inverse_direction(const ray *r, v4 out)
+{
+  out[0] = 1.0 / r->direction[0];
+  out[1] = 1.0 / r->direction[1];
+  out[2] = 1.0 / r->direction[2];
+  out[3] = 0;
 }
 
 static inline b32 cylinder_check_cap(const ray *r, f64 t)
@@ -0,0 +1,131 @@
+#include "rtc.h"
+
+// Hash based Owen scrambling of the Sobol (0,2)-sequence, after Burley,
+// "Practical Hash-based Owen Scrambling", JCGT 2020. All arithmetic is on
+// 32 bit values held in u64s.
+#define SAMPLER_MASK 0xffffffffull
+
+static u64 sampler_hash(u64 x)
+{
+  x ^= x >> 16;
+  x = (x * 0x7feb352dull) & SAMPLER_MASK;
+  x ^= x >> 15;
+  x = (x * 0x846ca68bull) & SAMPLER_MASK;
+  x ^= x >> 16;
+  return x;
+}
+
+static u64 sampler_hash_combine(u64 seed, u64 v)
+{
+  return sampler_hash(seed ^ (v + 0x9e3779b9ull + ((seed << 6) & SAMPLER_MASK) + (seed >> 2)));
+}
+
+static u64 reverse_bits(u64 x)
+{
+  x = ((x >> 1) & 0x55555555ull) | ((x & 0x55555555ull) << 1);
+  x = ((x >> 2) & 0x33333333ull) | ((x & 0x33333333ull) << 2);
+  x = ((x >> 4) & 0x0f0f0f0full) | ((x & 0x0f0f0f0full) << 4);
+  x = ((x >> 8) & 0x00ff00ffull) | ((x & 0x00ff00ffull) << 8);
+  x = ((x >> 16) & 0x0000ffffull) | ((x & 0x0000ffffull) << 16);
+  return x;
+}
+
+static u64 laine_karras_permutation(u64 x, u64 seed)
+{
+  x = (x + seed) & SAMPLER_MASK;
+  x ^= (x * 0x6c50b47cull) & SAMPLER_MASK;
+  x ^= (x * 0xb82f1e52ull) & SAMPLER_MASK;
+  x ^= (x * 0xc7afe638ull) & SAMPLER_MASK;
+  x ^= (x * 0x8d22f6e6ull) & SAMPLER_MASK;
+  return x;
+}
+
+static u64 nested_uniform_scramble(u64 x, u64 seed)
+{
+  return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+// First two Sobol dimensions, the van der Corput sequence and its pair
+static u64 sobol_0(u64 index)
+{
+  return reverse_bits(index);
+}
+
+static u64 sobol_1(u64 index)
+{
+  u64 result = 0;
+  for (u64 v = 1ull << 31; index != 0; index >>= 1, v ^= v >> 1) {
+    if (index & 1) {
+      result ^= v;
+    }
+  }
+  return result;
+}
+
+static f64 sampler_to_unit(u64 x)
+{
+  // 2^-32, never reaches 1
+  return (f64)x * 2.3283064365386963e-10;
+}
+
+void sampler_init(sampler *s, u32 x, u32 y, u64 seed)
+{
+  s->seed = sampler_hash_combine(sampler_hash_combine(sampler_hash(seed & SAMPLER_MASK), x), y);
+  s->index = 0;
+  s->dimension = 0;
+}
+
+void sampler_start(sampler *s, u32 index)
+{
+  s->index = index;
+  s->dimension = 0;
+}
+
+// Each pair of dimensions shuffles the sample order independently, so
+// dimensions are decorrelated while each pair stays stratified
+void sampler_2d(sampler *s, v2 out)
+{
+  u64 seed = sampler_hash_combine(s->seed, s->dimension);
+  s->dimension += 2;
+
+  u64 index = nested_uniform_scramble(s->index & SAMPLER_MASK, seed);
+
+  out[0] = sampler_to_unit(nested_uniform_scramble(sobol_0(index), sampler_hash_combine(seed, 1)));
+  out[1] = sampler_to_unit(nested_uniform_scramble(sobol_1(index), sampler_hash_combine(seed, 2)));
+}
+
+f64 sampler_1d(sampler *s)
+{
+  v2 sample = {0};
+  sampler_2d(s, sample);
+  return sample[0];
+}
+
+// Stateless hashing for decisions that need to be random but reproducible
+// without a sampler, e.g. jittering shadow rays from a shading point
+u64 hash_u64(u64 x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return x;
+}
+
+u64 hash_point(const v4 p)
+{
+  u64 h = 0;
+  for (u32 i = 0; i < 3; i++) {
+    u64 bits = 0;
+    memcpy(&bits, &p[i], sizeof(u64));
+    h = hash_u64(h ^ bits);
+  }
+  return h;
+}
+
+// Uniform in [0, 1) for the i-th draw from key
+f64 hash_uniform(u64 key, u64 i)
+{
+  return (f64)(hash_u64(key + hash_u64(i + 1)) >> 11) * 0x1.0p-53;
+}
@@ -0,0 +1,543 @@
+#include "rtc.h"
+
+// Structs are written as they are in memory, so a scene can only be read
+// by a build with the same layout. The header records the sizes to catch
+// mismatches.
+#define SCENE_MAGIC 0x454e454353435452ull
+#define SCENE_VERSION 1
+#define SCENE_MAX_LIGHT_CELLS (1ull << 20)
+
+typedef struct {
+  u64 magic;
+  u64 version;
+  u64 camera_size;
+  u64 object_size;
+  u64 light_size;
+} scene_header;
+
+typedef struct {
+  u64 objects_count;
+  u64 lights_count;
+  u64 light_samples;
+  f64 light_threshold;
+  f64 min_weight;
+  u64 russian_roulette;
+  u64 has_bvh;
+  u64 has_grid;
+  u64 has_light_tree;
+
+  u64 patterns_count;
+  u64 motions_count;
+  u64 sdfs_count;
+  u64 heightfields_count;
+  u64 children_count;
+} scene_counts;
+
+// Pointers of a written object as table indices, -1 for NULL. Objects are
+// numbered with the world's first, then csg children.
+typedef struct {
+  s64 pattern;
+  s64 motion;
+  s64 parent;
+  s64 left;
+  s64 right;
+  s64 sdf;
+  s64 heightfield;
+} scene_links;
+
+typedef struct {
+  u8 *data;
+  u64 size;
+  u64 capacity;
+} scene_writer;
+
+typedef struct {
+  const u8 *data;
+  u64 size;
+  u64 offset;
+  b32 ok;
+} scene_reader;
+
+// Pointers reachable from a world's objects, deduplicated. children are
+// the objects of csgs, which are not in the world's own list.
+typedef struct {
+  const void *patterns[2 * MAX_OBJECTS];
+  u32 patterns_count;
+  const void *motions[2 * MAX_OBJECTS];
+  u32 motions_count;
+  const void *sdfs[2 * MAX_OBJECTS];
+  u32 sdfs_count;
+  const void *heightfields[2 * MAX_OBJECTS];
+  u32 heightfields_count;
+  const void *children[2 * MAX_OBJECTS];
+  u32 children_count;
+} scene_tables;
+
+static void scene_write(scene_writer *b, const void *p, u64 n)
+{
+  if (b->size + n > b->capacity) {
+    b->capacity = MAX(2 * b->capacity, b->size + n);
+    b->data = realloc(b->data, b->capacity);
+  }
+  memcpy(b->data + b->size, p, n);
+  b->size += n;
+}
+
+static void scene_read(scene_reader *r, void *p, u64 n)
+{
+  if (!r->ok || n > r->size - r->offset) {
+    r->ok = false;
+    memset(p, 0, n);
+    return;
+  }
+  memcpy(p, r->data + r->offset, n);
+  r->offset += n;
+}
+
+// Index of p in table, adding it if it is new and add is set
+static s64 scene_table_index(const void **table, u32 *count, const void *p, b32 add)
+{
+  if (p == NULL) {
+    return -1;
+  }
+
+  for (u32 i = 0; i < *count; i++) {
+    if (table[i] == p) {
+      return (s64)i;
+    }
+  }
+
+  if (!add || *count >= 2 * MAX_OBJECTS) {
+    return -1;
+  }
+  table[*count] = p;
+  return (s64)(*count)++;
+}
+
+static void scene_collect(scene_tables *t, const object *o)
+{
+  scene_table_index(t->patterns, &t->patterns_count, o->material.p, true);
+  scene_table_index(t->motions, &t->motions_count, o->motion, true);
+
+  if (o->type == SdfType) {
+    scene_table_index(t->sdfs, &t->sdfs_count, o->value.sdf.s, true);
+  } else if (o->type == HeightfieldType) {
+    scene_table_index(t->heightfields, &t->heightfields_count, o->value.heightfield.h, true);
+  } else if (o->type == CsgType) {
+    const object *children[2] = { o->value.csg.left, o->value.csg.right };
+    for (u32 i = 0; i < 2; i++) {
+      u32 count = t->children_count;
+      scene_table_index(t->children, &t->children_count, children[i], true);
+      if (t->children_count > count) {
+        scene_collect(t, children[i]);
+      }
+    }
+  }
+}
+
+static s64 scene_object_index(const world *w, scene_tables *t, const object *o)
+{
+  if (o == NULL) {
+    return -1;
+  }
+  if (o >= w->objects && o < w->objects + w->objects_count) {
+    return (s64)(o - w->objects);
+  }
+
+  u32 count = t->children_count;
+  s64 i = scene_table_index(t->children, &count, o, false);
+  return i < 0 ? -1 : (s64)w->objects_count + i;
+}
+
+static void scene_write_object(scene_writer *b, const world *w, scene_tables *t, const object *o)
+{
+  scene_links links = {0};
+  links.pattern = scene_table_index(t->patterns, &t->patterns_count, o->material.p, false);
+  links.motion = scene_table_index(t->motions, &t->motions_count, o->motion, false);
+  links.parent = scene_object_index(w, t, o->parent);
+  links.left = -1;
+  links.right = -1;
+  links.sdf = -1;
+  links.heightfield = -1;
+
+  object copy = {0};
+  memcpy(&copy, o, sizeof(object));
+  copy.material.p = NULL;
+  copy.parent = NULL;
+  copy.motion = NULL;
+
+  if (o->type == CsgType) {
+    links.left = scene_object_index(w, t, o->value.csg.left);
+    links.right = scene_object_index(w, t, o->value.csg.right);
+    copy.value.csg.left = NULL;
+    copy.value.csg.right = NULL;
+  } else if (o->type == SdfType) {
+    links.sdf = scene_table_index(t->sdfs, &t->sdfs_count, o->value.sdf.s, false);
+    copy.value.sdf.s = NULL;
+  } else if (o->type == HeightfieldType) {
+    links.heightfield = scene_table_index(t->heightfields, &t->heightfields_count, o->value.heightfield.h, false);
+    copy.value.heightfield.h = NULL;
+  }
+
+  scene_write(b, &copy, sizeof(object));
+  scene_write(b, &links, sizeof(scene_links));
+}
+
+// Writes v and w, with everything w's objects point to, to one buffer
+// that scene_deserialize rebuilds them from. Acceleration structures are
+// not written, only whether w had them. size gets the buffer's length,
+// which the caller frees.
+u8 *scene_serialize(const camera *v, const world *w, u64 *size)
+{
+  scene_tables *t = malloc(sizeof(scene_tables));
+  memset(t, 0, sizeof(scene_tables));
+
+  for (u32 i = 0; i < w->objects_count; i++) {
+    scene_collect(t, &w->objects[i]);
+  }
+
+  scene_header header = {0};
+  header.magic = SCENE_MAGIC;
+  header.version = SCENE_VERSION;
+  header.camera_size = sizeof(camera);
+  header.object_size = sizeof(object);
+  header.light_size = sizeof(light);
+
+  scene_counts counts = {0};
+  counts.objects_count = w->objects_count;
+  counts.lights_count = w->lights_count;
+  counts.light_samples = w->light_samples;
+  counts.light_threshold = w->light_threshold;
+  counts.min_weight = w->min_weight;
+  counts.russian_roulette = (u64)w->russian_roulette;
+  counts.has_bvh = w->bvh != NULL;
+  counts.has_grid = w->grid != NULL;
+  counts.has_light_tree = w->light_tree != NULL;
+  counts.patterns_count = t->patterns_count;
+  counts.motions_count = t->motions_count;
+  counts.sdfs_count = t->sdfs_count;
+  counts.heightfields_count = t->heightfields_count;
+  counts.children_count = t->children_count;
+
+  scene_writer b = {0};
+  scene_write(&b, &header, sizeof(scene_header));
+  scene_write(&b, v, sizeof(camera));
+  scene_write(&b, &counts, sizeof(scene_counts));
+  scene_write(&b, w->lights, w->lights_count * sizeof(light));
+
+  for (u32 i = 0; i < t->patterns_count; i++) {
+    scene_write(&b, t->patterns[i], sizeof(pattern));
+  }
+  for (u32 i = 0; i < t->motions_count; i++) {
+    scene_write(&b, t->motions[i], sizeof(motion));
+  }
+  for (u32 i = 0; i < t->sdfs_count; i++) {
+    scene_write(&b, t->sdfs[i], sizeof(sdf));
+  }
+  for (u32 i = 0; i < t->heightfields_count; i++) {
+    const heightfield *h = t->heightfields[i];
+    u64 dimensions[2] = { h->width, h->depth };
+    scene_write(&b, dimensions, sizeof(dimensions));
+    scene_write(&b, h->heights, h->width * h->depth * sizeof(f32));
+  }
+
+  for (u32 i = 0; i < w->objects_count; i++) {
+    scene_write_object(&b, w, t, &w->objects[i]);
+  }
+  for (u32 i = 0; i < t->children_count; i++) {
+    scene_write_object(&b, w, t, t->children[i]);
+  }
+
+  free(t);
+
+  *size = b.size;
+  return b.data;
+}
+
+static b32 scene_header_valid(const scene_header *header)
+{
+  return header->magic == SCENE_MAGIC && header->version == SCENE_VERSION &&
+    header->camera_size == sizeof(camera) && header->object_size == sizeof(object) &&
+    header->light_size == sizeof(light);
+}
+
+// Reads only the camera of a serialized scene
+b32 scene_camera(const u8 *data, u64 size, camera *out)
+{
+  scene_reader r = {0};
+  r.data = data;
+  r.size = size;
+  r.ok = true;
+
+  scene_header header = {0};
+  scene_read(&r, &header, sizeof(scene_header));
+  scene_read(&r, out, sizeof(camera));
+  return r.ok && scene_header_valid(&header);
+}
+
+static object *scene_object_at(scene *s, s64 link)
+{
+  if (link < 0) {
+    return NULL;
+  }
+  if ((u64)link < s->w->objects_count) {
+    return &s->w->objects[link];
+  }
+  return &s->children[(u64)link - s->w->objects_count];
+}
+
+static b32 scene_link_valid(s64 link, u64 count)
+{
+  return link >= -1 && link < (s64)count;
+}
+
+// Records are read as they are in memory, so anything that indexes, divides
+// or switches on a field is checked before it is used
+
+static b32 scene_light_valid(const light *l)
+{
+  if ((u64)l->type > AreaLightType) {
+    return false;
+  }
+  if (l->type == AreaLightType) {
+    u64 usteps = l->value.area.usteps;
+    u64 vsteps = l->value.area.vsteps;
+    return usteps > 0 && vsteps > 0 && vsteps <= SCENE_MAX_LIGHT_CELLS / usteps;
+  }
+  return true;
+}
+
+static b32 scene_pattern_valid(const pattern *p)
+{
+  return (u64)p->type <= CheckerPatternType;
+}
+
+static b32 scene_sdf_valid(const sdf *s)
+{
+  if (s->count > SDF_MAX_INSTRUCTIONS || s->registers > SDF_MAX_REGISTERS) {
+    return false;
+  }
+  for (u32 i = 0; i < s->count; i++) {
+    if ((u64)s->code[i].type > SubtractionSdf || s->code[i].reg >= SDF_MAX_REGISTERS) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static b32 scene_object_valid(const object *o)
+{
+  return (u64)o->type <= HeightfieldType && (u64)o->transform_class <= TranslateScaleTransform &&
+    (o->type != CsgType || (u64)o->value.csg.operation <= DifferenceOperation);
+}
+
+// Parents must not loop and a csg's children must have it as their parent,
+// which with the first makes the csg links a forest too
+static b32 scene_links_acyclic(const scene *s, u64 objects_count)
+{
+  for (u64 i = 0; i < objects_count; i++) {
+    const object *o = i < s->w->objects_count ? &s->w->objects[i] : &s->children[i - s->w->objects_count];
+
+    if (o->type == CsgType &&
+        (o->value.csg.left == o->value.csg.right ||
+         o->value.csg.left->parent != o || o->value.csg.right->parent != o)) {
+      return false;
+    }
+
+    u64 depth = 0;
+    for (const object *p = o->parent; p != NULL; p = p->parent) {
+      if (++depth > objects_count) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Rebuilds the camera and world written by scene_serialize, or returns
+// NULL if data is not a scene from this build
+scene *scene_deserialize(const u8 *data, u64 size)
+{
+  scene_reader r = {0};
+  r.data = data;
+  r.size = size;
+  r.ok = true;
+
+  scene_header header = {0};
+  scene_read(&r, &header, sizeof(scene_header));
+  if (!scene_header_valid(&header)) {
+    fprintf(stderr, "scene_deserialize: not a scene from this build\n");
+    return NULL;
+  }
+
+  scene *s = malloc(sizeof(scene));
+  memset(s, 0, sizeof(scene));
+  s->w = malloc(sizeof(world));
+  memset(s->w, 0, sizeof(world));
+
+  scene_read(&r, &s->v, sizeof(camera));
+
+  scene_counts counts = {0};
+  scene_read(&r, &counts, sizeof(scene_counts));
+
+  u64 limit = 2 * MAX_OBJECTS;
+  if (!r.ok || counts.objects_count > MAX_OBJECTS || counts.lights_count > MAX_LIGHTS ||
+      counts.patterns_count > limit || counts.motions_count > limit || counts.sdfs_count > limit ||
+      counts.heightfields_count > limit || counts.children_count > limit) {
+    fprintf(stderr, "scene_deserialize: malformed scene\n");
+    scene_free(s);
+    return NULL;
+  }
+
+  world *w = s->w;
+  w->objects_count = counts.objects_count;
+  w->lights_count = counts.lights_count;
+  w->light_samples = counts.light_samples;
+  w->light_threshold = counts.light_threshold;
+  w->min_weight = counts.min_weight;
+  w->russian_roulette = (b32)counts.russian_roulette;
+  scene_read(&r, w->lights, w->lights_count * sizeof(light));
+  for (u32 i = 0; i < w->lights_count && r.ok; i++) {
+    r.ok = scene_light_valid(&w->lights[i]);
+  }
+
+  s->patterns = malloc(MAX(counts.patterns_count, 1) * sizeof(pattern));
+  scene_read(&r, s->patterns, counts.patterns_count * sizeof(pattern));
+  for (u32 i = 0; i < counts.patterns_count && r.ok; i++) {
+    r.ok = scene_pattern_valid(&s->patterns[i]);
+  }
+
+  s->motions = malloc(MAX(counts.motions_count, 1) * sizeof(motion));
+  scene_read(&r, s->motions, counts.motions_count * sizeof(motion));
+
+  s->sdfs = malloc(MAX(counts.sdfs_count, 1) * sizeof(sdf));
+  scene_read(&r, s->sdfs, counts.sdfs_count * sizeof(sdf));
+  for (u32 i = 0; i < counts.sdfs_count && r.ok; i++) {
+    r.ok = scene_sdf_valid(&s->sdfs[i]);
+  }
+
+  s->heightfields = malloc(MAX(counts.heightfields_count, 1) * sizeof(heightfield *));
+  for (u32 i = 0; i < counts.heightfields_count && r.ok; i++) {
+    u64 dimensions[2] = {0};
+    scene_read(&r, dimensions, sizeof(dimensions));
+    if (dimensions[0] < 2 || dimensions[1] < 2 ||
+        dimensions[1] > (r.size - r.offset) / sizeof(f32) / dimensions[0]) {
+      r.ok = false;
+      break;
+    }
+
+    f32 *heights = malloc(dimensions[0] * dimensions[1] * sizeof(f32));
+    if (heights == NULL) {
+      r.ok = false;
+      break;
+    }
+
+    scene_read(&r, heights, dimensions[0] * dimensions[1] * sizeof(f32));
+    heightfield *h = heightfield_alloc(dimensions[0], dimensions[1], heights);
+    free(heights);
+    if (h == NULL) {
+      r.ok = false;
+      break;
+    }
+
+    s->heightfields[s->heightfields_count++] = h;
+  }
+
+  u64 objects_count = counts.objects_count + counts.children_count;
+  s->children = malloc(MAX(counts.children_count, 1) * sizeof(object));
+
+  for (u64 i = 0; i < objects_count && r.ok; i++) {
+    object *o = i < counts.objects_count ? &w->objects[i] : &s->children[i - counts.objects_count];
+    scene_links links = {0};
+    scene_read(&r, o, sizeof(object));
+    scene_read(&r, &links, sizeof(scene_links));
+
+    if (!r.ok || !scene_object_valid(o) ||
+        !scene_link_valid(links.pattern, counts.patterns_count) ||
+        !scene_link_valid(links.motion, counts.motions_count) ||
+        !scene_link_valid(links.parent, objects_count) ||
+        !scene_link_valid(links.left, objects_count) ||
+        !scene_link_valid(links.right, objects_count) ||
+        !scene_link_valid(links.sdf, counts.sdfs_count) ||
+        !scene_link_valid(links.heightfield, counts.heightfields_count) ||
+        (o->type == CsgType && (links.left < 0 || links.right < 0)) ||
+        (o->type == SdfType && links.sdf < 0) ||
+        (o->type == HeightfieldType && links.heightfield < 0)) {
+      r.ok = false;
+      break;
+    }
+
+    o->material.p = links.pattern < 0 ? NULL : &s->patterns[links.pattern];
+    o->motion = links.motion < 0 ? NULL : &s->motions[links.motion];
+    o->parent = scene_object_at(s, links.parent);
+
+    if (o->type == CsgType) {
+      o->value.csg.left = scene_object_at(s, links.left);
+      o->value.csg.right = scene_object_at(s, links.right);
+    } else if (o->type == SdfType) {
+      o->value.sdf.s = &s->sdfs[links.sdf];
+    } else if (o->type == HeightfieldType) {
+      o->value.heightfield.h = s->heightfields[links.heightfield];
+    }
+  }
+
+  if (!r.ok || r.offset != r.size || !scene_links_acyclic(s, objects_count)) {
+    fprintf(stderr, "scene_deserialize: malformed scene\n");
+    scene_free(s);
+    return NULL;
+  }
+
+  if (counts.has_bvh) {
+    w->bvh = bvh_alloc(w);
+  }
+  if (counts.has_grid) {
+    w->grid = grid_alloc(w);
+  }
+  if (counts.has_light_tree) {
+    w->light_tree = light_tree_alloc(w);
+  }
+
+  return s;
+}
+
+void scene_free(scene *s)
+{
+  if (s->w->bvh != NULL) {
+    bvh_free(s->w->bvh);
+  }
+  if (s->w->grid != NULL) {
+    grid_free(s->w->grid);
+  }
+  if (s->w->light_tree != NULL) {
+    light_tree_free(s->w->light_tree);
+  }
+
+  for (u32 i = 0; i < s->heightfields_count; i++) {
+    heightfield_free(s->heightfields[i]);
+  }
+
+  free(s->heightfields);
+  free(s->patterns);
+  free(s->motions);
+  free(s->sdfs);
+  free(s->children);
+  free(s->w);
+  free(s);
+}
+
+// FNV-1a of a serialized scene, skipping the camera so views of one world
+// share a hash
+u64 scene_hash(const u8 *data, u64 size)
+{
+  u64 skip_start = sizeof(scene_header);
+  u64 skip_end = skip_start + sizeof(camera);
+
+  u64 h = 0xcbf29ce484222325ull;
+  for (u64 i = 0; i < size; i++) {
+    if (i >= skip_start && i < skip_end) {
+      continue;
+    }
+    h = (h ^ data[i]) * 0x100000001b3ull;
+  }
+  return h;
+}
@@ -0,0 +1,376 @@
+#include "rtc.h"
+
+void sdf_sphere_init(sdf_node *n, const v4 center, f64 radius)
+{
+  memset(n, 0, sizeof(sdf_node));
+  n->type = SphereSdf;
+  memcpy(n->center, center, sizeof(v4));
+  n->size[0] = radius;
+}
+
+void sdf_box_init(sdf_node *n, const v4 center, const v4 half_extents)
+{
+  memset(n, 0, sizeof(sdf_node));
+  n->type = BoxSdf;
+  memcpy(n->center, center, sizeof(v4));
+  memcpy(n->size, half_extents, sizeof(v4));
+}
+
+void sdf_torus_init(sdf_node *n, const v4 center, f64 major_radius, f64 minor_radius)
+{
+  memset(n, 0, sizeof(sdf_node));
+  n->type = TorusSdf;
+  memcpy(n->center, center, sizeof(v4));
+  n->size[0] = major_radius;
+  n->size[1] = minor_radius;
+}
+
+void sdf_operator_init(sdf_node *n, enum sdf_node_type type, const sdf_node *left, const sdf_node *right, f64 k)
+{
+  memset(n, 0, sizeof(sdf_node));
+  n->type = type;
+  n->left = left;
+  n->right = right;
+  n->k = k;
+}
+
+static void sdf_node_bounds(const sdf_node *n, bounds *out)
+{
+  v4 half = {0};
+
+  switch (n->type) {
+    case SphereSdf: {
+      memcpy(half, vector(n->size[0], n->size[0], n->size[0]), sizeof(v4));
+    } break;
+    case BoxSdf: {
+      memcpy(half, n->size, sizeof(v4));
+    } break;
+    case TorusSdf: {
+      f64 r = n->size[0] + n->size[1];
+      memcpy(half, vector(r, n->size[1], r), sizeof(v4));
+    } break;
+    case UnionSdf:
+    case SmoothUnionSdf:
+    case IntersectionSdf:
+    case SubtractionSdf: {
+      bounds l = {0};
+      sdf_node_bounds(n->left, &l);
+      bounds r = {0};
+      sdf_node_bounds(n->right, &r);
+
+      if (n->type == SubtractionSdf) {
+        *out = l;
+      } else if (n->type == IntersectionSdf) {
+        for (u32 i = 0; i < 3; i++) {
+          out->min[i] = MAX(l.min[i], r.min[i]);
+          out->max[i] = MIN(l.max[i], r.max[i]);
+        }
+        out->min[3] = 1;
+        out->max[3] = 1;
+      } else {
+        bounds_merge(&l, &r, out);
+
+        // The polynomial smooth minimum lowers distances by at most k / 4
+        f64 grow = n->type == SmoothUnionSdf ? n->k * 0.25 : 0;
+        for (u32 i = 0; i < 3; i++) {
+          out->min[i] -= grow;
+          out->max[i] += grow;
+        }
+      }
+    } return;
+  }
+
+  v4_sub(n->center, half, out->min);
+  v4_add(n->center, half, out->max);
+}
+
+static void sdf_compile_node(sdf *s, const sdf_node *n, u32 reg)
+{
+  if (reg >= SDF_MAX_REGISTERS) {
+    fprintf(stderr, "SDF expression too deep\n");
+    exit(1);
+  }
+
+  switch (n->type) {
+    case SphereSdf:
+    case BoxSdf:
+    case TorusSdf: {
+    } break;
+    case UnionSdf:
+    case SmoothUnionSdf:
+    case IntersectionSdf:
+    case SubtractionSdf: {
+      sdf_compile_node(s, n->left, reg);
+      sdf_compile_node(s, n->right, reg + 1);
+    } break;
+  }
+
+  if (s->count >= SDF_MAX_INSTRUCTIONS) {
+    fprintf(stderr, "Too many SDF instructions\n");
+    exit(1);
+  }
+
+  sdf_instruction *in = &s->code[s->count++];
+  in->type = n->type;
+  in->reg = reg;
+  memcpy(in->center, n->center, sizeof(v4));
+  memcpy(in->size, n->size, sizeof(v4));
+  in->k = n->k;
+
+  s->registers = MAX(s->registers, reg + 1);
+}
+
+// Flattens the tree so evaluation is a straight loop over instructions, each
+// of which runs across all lanes
+void sdf_compile(sdf *s, const sdf_node *root)
+{
+  memset(s, 0, sizeof(sdf));
+  sdf_compile_node(s, root, 0);
+  sdf_node_bounds(root, &s->b);
+  s->b.min[3] = 1;
+  s->b.max[3] = 1;
+}
+
+// Evaluates the distance at count <= SDF_LANES points given as separate x, y
+// and z arrays, so the per instruction lane loops can be vectorized
+void sdf_eval(const sdf *s, u32 count, const f64 *x, const f64 *y, const f64 *z, f64 *out)
+{
+  assert(count <= SDF_LANES);
+
+  f64 regs[SDF_MAX_REGISTERS][SDF_LANES];
+
+  for (u32 i = 0; i < s->count; i++) {
+    const sdf_instruction *in = &s->code[i];
+    f64 *d = regs[in->reg];
+    const f64 *e = regs[(in->reg + 1) % SDF_MAX_REGISTERS];
+
+    f64 cx = in->center[0];
+    f64 cy = in->center[1];
+    f64 cz = in->center[2];
+
+    switch (in->type) {
+      case SphereSdf: {
+        f64 r = in->size[0];
+        for (u32 l = 0; l < count; l++) {
+          f64 px = x[l] - cx;
+          f64 py = y[l] - cy;
+          f64 pz = z[l] - cz;
+          d[l] = sqrt(px*px + py*py + pz*pz) - r;
+        }
+      } break;
+      case BoxSdf: {
+        for (u32 l = 0; l < count; l++) {
+          f64 qx = fabs(x[l] - cx) - in->size[0];
+          f64 qy = fabs(y[l] - cy) - in->size[1];
+          f64 qz = fabs(z[l] - cz) - in->size[2];
+          f64 mx = fmax(qx, 0);
+          f64 my = fmax(qy, 0);
+          f64 mz = fmax(qz, 0);
+          d[l] = sqrt(mx*mx + my*my + mz*mz) + fmin(fmax(qx, fmax(qy, qz)), 0);
+        }
+      } break;
+      case TorusSdf: {
+        f64 major = in->size[0];
+        f64 minor = in->size[1];
+        for (u32 l = 0; l < count; l++) {
+          f64 px = x[l] - cx;
+          f64 py = y[l] - cy;
+          f64 pz = z[l] - cz;
+          f64 q = sqrt(px*px + pz*pz) - major;
+          d[l] = sqrt(q*q + py*py) - minor;
+        }
+      } break;
+      case UnionSdf: {
+        for (u32 l = 0; l < count; l++) {
+          d[l] = fmin(d[l], e[l]);
+        }
+      } break;
+      case SmoothUnionSdf: {
+        f64 k = in->k;
+        for (u32 l = 0; l < count; l++) {
+          f64 h = fmax(k - fabs(d[l] - e[l]), 0) / k;
+          d[l] = fmin(d[l], e[l]) - h*h*k*0.25;
+        }
+      } break;
+      case IntersectionSdf: {
+        for (u32 l = 0; l < count; l++) {
+          d[l] = fmax(d[l], e[l]);
+        }
+      } break;
+      case SubtractionSdf: {
+        for (u32 l = 0; l < count; l++) {
+          d[l] = fmax(d[l], -e[l]);
+        }
+      } break;
+    }
+  }
+
+  memcpy(out, regs[0], sizeof(f64) * count);
+}
+
+// Sphere traces each lane from t[l] until sign * distance drops below
+// SDF_EPSILON, so sign -1 marches from inside the surface to the exit. Lanes
+// passing t_end[l] or running out of steps come back as F64_INF.
+static void sdf_march(const sdf *s, u32 count, const ray *rays, const f64 *inv_length, f64 sign, const f64 *t_end, f64 *t)
+{
+  f64 x[SDF_LANES];
+  f64 y[SDF_LANES];
+  f64 z[SDF_LANES];
+  f64 d[SDF_LANES];
+  b32 active[SDF_LANES];
+  u32 active_count = 0;
+
+  for (u32 l = 0; l < count; l++) {
+    active[l] = t[l] <= t_end[l];
+    if (active[l]) {
+      active_count++;
+    } else {
+      t[l] = F64_INF;
+    }
+  }
+
+  for (u32 step = 0; step < SDF_MAX_STEPS && active_count > 0; step++) {
+    // Finished lanes are evaluated too, keeping the loops branch free
+    for (u32 l = 0; l < count; l++) {
+      f64 tl = active[l] ? t[l] : 0;
+      x[l] = rays[l].origin[0] + tl * rays[l].direction[0];
+      y[l] = rays[l].origin[1] + tl * rays[l].direction[1];
+      z[l] = rays[l].origin[2] + tl * rays[l].direction[2];
+    }
+
+    sdf_eval(s, count, x, y, z, d);
+
+    for (u32 l = 0; l < count; l++) {
+      if (!active[l]) {
+        continue;
+      }
+
+      f64 v = sign * d[l];
+      if (v <= SDF_EPSILON) {
+        active[l] = false;
+        active_count--;
+        continue;
+      }
+
+      t[l] += v * inv_length[l];
+      if (t[l] > t_end[l]) {
+        t[l] = F64_INF;
+        active[l] = false;
+        active_count--;
+      }
+    }
+  }
+
+  for (u32 l = 0; l < count; l++) {
+    if (active[l]) {
+      t[l] = F64_INF;
+    }
+  }
+}
+
+static b32 sdf_clip(const sdf *s, const ray *r, f64 *tmin, f64 *tmax)
+{
+  v4 inv_direction = {0};
+  ray_inverse_direction(r, inv_direction);
+
+  return bounds_intersect(&s->b, r->origin, inv_direction, tmin, tmax);
+}
+
+// First hit at t >= 0 for up to SDF_LANES rays at once, F64_INF on a miss.
+// Rays are in the sdf's space. Area light shadow rays reach it in packets
+// through ray_packet_hits_before.
+void sdf_trace(const sdf *s, u32 count, const ray *rays, f64 *out)
+{
+  assert(count <= SDF_LANES);
+
+  f64 inv_length[SDF_LANES];
+  f64 t_end[SDF_LANES];
+
+  for (u32 l = 0; l < count; l++) {
+    inv_length[l] = 1.0 / v4_mag(rays[l].direction);
+
+    f64 tmin, tmax;
+    if (sdf_clip(s, &rays[l], &tmin, &tmax) && tmax >= 0) {
+      out[l] = MAX(tmin, 0);
+      t_end[l] = tmax;
+    } else {
+      out[l] = F64_INF;
+      t_end[l] = -F64_INF;
+    }
+  }
+
+  sdf_march(s, count, rays, inv_length, 1, t_end, out);
+}
+
+// Tetrahedral central differences, the four taps are one evaluation
+void sdf_normal_at(const sdf *s, const v4 p, v4 out)
+{
+  const f64 h = SDF_NORMAL_EPSILON;
+  const f64 kx[4] = { 1, -1, -1, 1 };
+  const f64 ky[4] = { -1, -1, 1, 1 };
+  const f64 kz[4] = { -1, 1, -1, 1 };
+
+  f64 x[4], y[4], z[4], d[4];
+  for (u32 i = 0; i < 4; i++) {
+    x[i] = p[0] + h * kx[i];
+    y[i] = p[1] + h * ky[i];
+    z[i] = p[2] + h * kz[i];
+  }
+
+  sdf_eval(s, 4, x, y, z, d);
+
+  out[0] = kx[0]*d[0] + kx[1]*d[1] + kx[2]*d[2] + kx[3]*d[3];
+  out[1] = ky[0]*d[0] + ky[1]*d[1] + ky[2]*d[2] + ky[3]*d[3];
+  out[2] = kz[0]*d[0] + kz[1]*d[1] + kz[2]*d[2] + kz[3]*d[3];
+  out[3] = 0;
+
+  // The gradient is only ~4h long, below what v4_norm is willing to scale
+  f64 mag = v4_mag(out);
+  if (mag > 0) {
+    v4_scale(out, 1.0 / mag, out);
+  }
+}
+
+// Reports entry and exit of every interval along the line inside the bounds,
+// like the analytic primitives, so sdfs work as csg children and refract.
+// r is already in object space. Each interval's entry and exit are marched
+// one after the other on a single lane.
+void sdf_intersect(const ray *r, const object *o, intersection_group *ig)
+{
+  const sdf *s = o->value.sdf.s;
+
+  f64 tmin, tmax;
+  if (!sdf_clip(s, r, &tmin, &tmax)) {
+    return;
+  }
+
+  f64 inv_length = 1.0 / v4_mag(r->direction);
+  f64 nudge = 4 * SDF_EPSILON * inv_length;
+  f64 t = tmin;
+
+  for (u32 i = 0; i < SDF_MAX_HITS; i++) {
+    f64 entry = t;
+    sdf_march(s, 1, r, &inv_length, 1, &tmax, &entry);
+    if (entry == F64_INF) {
+      break;
+    }
+
+    f64 exit = entry + nudge;
+    sdf_march(s, 1, r, &inv_length, -1, &tmax, &exit);
+    if (exit == F64_INF) {
+      exit = tmax;
+    }
+
+    intersection_insert(ig, entry, o);
+    intersection_insert(ig, exit, o);
+
+    t = exit + nudge;
+  }
+}
+
+void sdf_object_init(object *o, const sdf *s)
+{
+  object_init(o);
+  o->type = SdfType;
+  o->value.sdf.s = s;
+}
@@ -32,25 +32,270 @@ void world_init(world *w)
   point_light_init(&w->lights[0], point(-10, 10, -10), color(1, 1, 1));
 }
 
-void world_intersect(const world *w, const ray *r, intersection_group *ig)
+// Index in w->objects of o, or of the csg holding it, -1 if it is not in w
+s32 world_object_index(const world *w, const object *o)
+{
+  while (o->parent != NULL) {
+    o = o->parent;
+  }
+
+  if (o < w->objects || o >= w->objects + w->objects_count) {
+    return -1;
+  }
+  return o - w->objects;
+}
+
+// Per thread trace set by world_trace_objects. Looking it up is slow next
+// to a ray, so it is only done while some thread is tracing.
+static pthread_key_t world_trace_key;
+static pthread_once_t world_trace_once = PTHREAD_ONCE_INIT;
+static u32 world_tracing = 0;
+
+static void world_trace_key_create(void)
+{
+  pthread_key_create(&world_trace_key, NULL);
+}
+
+static render_trace *world_trace_current(void)
 {
+  if (__atomic_load_n(&world_tracing, __ATOMIC_RELAXED) == 0) {
+    return NULL;
+  }
+  return pthread_getspecific(world_trace_key);
+}
+
+// Until called again with NULL, the objects the calling thread's rays hit
+// or are blocked by are added to t, and the extent of its shadow and
+// secondary rays to t->rays
+void world_trace_objects(render_trace *t)
+{
+  pthread_once(&world_trace_once, world_trace_key_create);
+
+  b32 tracing = pthread_getspecific(world_trace_key) != NULL;
+  if (t != NULL && !tracing) {
+    __atomic_add_fetch(&world_tracing, 1, __ATOMIC_RELAXED);
+  } else if (t == NULL && tracing) {
+    __atomic_sub_fetch(&world_tracing, 1, __ATOMIC_RELAXED);
+  }
+
+  pthread_setspecific(world_trace_key, t);
+}
+
+// Marks the objects of ig from first on with t in (0, max_t), and adds
+// the ray up to its nearest such hit, or all of it if it has none
+static void world_trace_ray(const world *w, render_trace *t, const ray *r, const intersection_group *ig, u32 first, f64 max_t)
+{
+  f64 nearest = max_t;
+  for (u32 i = first; i < ig->count; i++) {
+    const intersection *x = &ig->xs[i];
+    if (x->t <= 0 || x->t >= max_t) {
+      continue;
+    }
+
+    s32 index = world_object_index(w, x->o);
+    if (index >= 0) {
+      t->objects[index / 64] |= 1ull << (index % 64);
+    }
+    nearest = MIN(nearest, x->t);
+  }
+
+  if (memcmp(r->origin, t->eye, sizeof(v4)) == 0) {
+    return;
+  }
+
+  if (nearest == F64_INF) {
+    memcpy(t->rays.min, point(-F64_INF, -F64_INF, -F64_INF), sizeof(v4));
+    memcpy(t->rays.max, point(F64_INF, F64_INF, F64_INF), sizeof(v4));
+    return;
+  }
+
+  v4 end = {0};
+  ray_position(r, nearest, end);
+  bounds_add_point(&t->rays, r->origin);
+  bounds_add_point(&t->rays, end);
+}
+
+static void world_intersect_untraced(const world *w, const ray *r, intersection_group *ig)
+{
+  if (w->grid != NULL) {
+    grid_intersect(w->grid, w, r, ig);
+    return;
+  }
+
+  if (w->bvh != NULL) {
+    bvh_intersect(w->bvh, w, r, ig);
+    return;
+  }
+
   for (u32 i = 0; i < w->objects_count; i++) {
     ray_intersect(r, &w->objects[i], ig);
   }
 }
 
-void world_shade_hit(const world *w, const computations *c, u64 depth, v3 out)
+void world_intersect(const world *w, const ray *r, intersection_group *ig)
 {
-  v3 result = {0};
+  u32 first = ig->count;
+  world_intersect_untraced(w, r, ig);
+
+  render_trace *t = world_trace_current();
+  if (t != NULL) {
+    world_trace_ray(w, t, r, ig, first, F64_INF);
+  }
+}
+
+static b32 world_intersect_any_untraced(const world *w, const ray *r, f64 max_t);
 
-  for (u32 i = 0; i < w->lights_count; i++) {
-    b32 is_shadowed = world_is_shadowed(w, &w->lights[i], c->over_point);
+// Traced blocked rays are intersected again in full to find what blocks
+// them
+b32 world_intersect_any(const world *w, const ray *r, f64 max_t)
+{
+  b32 blocked = world_intersect_any_untraced(w, r, max_t);
+
+  render_trace *t = world_trace_current();
+  if (t != NULL) {
+    intersection_group ig = {0};
+    if (blocked) {
+      world_intersect_untraced(w, r, &ig);
+    }
+    world_trace_ray(w, t, r, &ig, 0, max_t);
+  }
+
+  return blocked;
+}
+
+static b32 world_intersect_any_untraced(const world *w, const ray *r, f64 max_t)
+{
+  if (w->grid != NULL) {
+    return grid_intersect_any(w->grid, w, r, max_t);
+  }
+
+  if (w->bvh != NULL) {
+    return bvh_intersect_any(w->bvh, w, r, max_t);
+  }
+
+  for (u32 i = 0; i < w->objects_count; i++) {
+    if (ray_hits_before(r, &w->objects[i], max_t)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void world_light_contribution(const world *w, const computations *c, const light *l, v3 out)
+{
+  if (material_lighting_bound(&c->o->material, l, c->point, c->normalv) <= w->light_threshold) {
+    memset(out, 0, sizeof(v3));
+    return;
+  }
+
+  f64 visibility = world_light_visibility(w, l, c->over_point, c->time);
+
+  memset(out, 0, sizeof(v3));
+  material_lighting_visibility(&c->o->material, l, c->o, c->point, c->time, c->eyev, c->normalv, visibility, out);
+}
+
+// Unbiased estimate of the sum over all lights from light_samples lights
+// drawn from the tree. Selection is stratified over the samples and keyed
+// on the shading point, so it is deterministic.
+static void world_sample_lights(const world *w, const computations *c, v3 out)
+{
+  u64 key = hash_point(c->over_point);
+  u32 samples = w->light_samples;
+
+  for (u32 i = 0; i < samples; i++) {
+    f64 u = ((f64)i + hash_uniform(key, i)) / (f64)samples;
+
+    f64 pdf = 0;
+    u32 index = light_tree_sample(w->light_tree, c->point, u, &pdf);
+    if (pdf <= 0) {
+      continue;
+    }
 
     v3 surface = {0};
-    material_lighting(&c->o->material, &w->lights[i], c->o, c->point, c->eyev, c->normalv, is_shadowed, surface);
-    v3_add(result, surface, result);
+    world_light_contribution(w, c, &w->lights[index], surface);
+    v3_scale(surface, 1.0 / (pdf * (f64)samples), surface);
+    v3_add(out, surface, out);
+  }
+}
+
+// Light reaching the surface directly from the lights
+static void world_shade_surface(const world *w, const computations *c, v3 out)
+{
+  memset(out, 0, sizeof(v3));
+
+  if (w->light_tree != NULL && w->light_samples > 0 && w->lights_count > 0) {
+    world_sample_lights(w, c, out);
+  } else {
+    for (u32 i = 0; i < w->lights_count; i++) {
+      v3 surface = {0};
+      world_light_contribution(w, c, &w->lights[i], surface);
+      v3_add(out, surface, out);
+    }
+  }
+}
+
+// Decides whether a secondary ray scaled by factor at c is traced, giving
+// its weight and the factor to scale what it returns by
+static b32 world_secondary_weight(const world *w, const computations *c, f64 factor, u64 salt, f64 *weight, f64 *scale)
+{
+  *weight = c->weight * factor;
+  *scale = factor;
+
+  if (*weight >= w->min_weight) {
+    return true;
+  }
+
+  if (!w->russian_roulette) {
+    return false;
   }
 
+  f64 survival = *weight / w->min_weight;
+  if (hash_uniform(hash_point(c->point), salt) >= survival) {
+    return false;
+  }
+
+  *weight = w->min_weight;
+  *scale = factor / survival;
+  return true;
+}
+
+static b32 world_reflect_ray(const world *w, const computations *c, u64 depth, ray *out, f64 *weight, f64 *scale)
+{
+  if (depth == 0 || req(c->o->material.reflective, 0.0) ||
+      !world_secondary_weight(w, c, c->o->material.reflective, 2 * depth, weight, scale)) {
+    return false;
+  }
+
+  memcpy(out->origin, c->over_point, sizeof(v4));
+  memcpy(out->direction, c->reflectv, sizeof(v4));
+  out->time = c->time;
+
+  return true;
+}
+
+static b32 world_refract_ray(const world *w, const computations *c, u64 depth, ray *out, f64 *weight, f64 *scale)
+{
+  v4 direction = {0};
+
+  if (depth == 0 || req(c->o->material.transparency, 0) ||
+      !computations_refract_direction(c, direction) ||
+      !world_secondary_weight(w, c, c->o->material.transparency, 2 * depth + 1, weight, scale)) {
+    return false;
+  }
+
+  memcpy(out->origin, c->under_point, sizeof(v4));
+  memcpy(out->direction, direction, sizeof(v4));
+  out->time = c->time;
+
+  return true;
+}
+
+void world_shade_hit(const world *w, const computations *c, u64 depth, v3 out)
+{
+  v3 result = {0};
+  world_shade_surface(w, c, result);
+
   v3 reflected = {0};
   world_reflected_color(w, c, depth, reflected);
 
@@ -72,22 +317,28 @@ void world_shade_hit(const world *w, const computations *c, u64 depth, v3 out)
 
 void world_reflected_color(const world *w, const computations *c, u64 depth, v3 out)
 {
-  if (depth == 0 || req(c->o->material.reflective, 0.0)) {
+  f64 weight = 0;
+  f64 scale = 0;
+
+  ray reflect_ray = {0};
+  if (!world_reflect_ray(w, c, depth, &reflect_ray, &weight, &scale)) {
     memcpy(out, color(0, 0, 0), sizeof(v3));
     return;
   }
 
-  ray reflect_ray = {0};
-  memcpy(reflect_ray.origin, c->over_point, sizeof(v4));
-  memcpy(reflect_ray.direction, c->reflectv, sizeof(v4));
-
   v3 result = {0};
-  world_color_at(w, &reflect_ray, depth - 1, result);
+  world_color_at_weight(w, &reflect_ray, depth - 1, weight, result);
 
-  v3_scale(result, c->o->material.reflective, out);
+  v3_scale(result, scale, out);
 }
 
 void world_color_at(const world *w, const ray *r, u64 depth, v3 out)
+{
+  world_color_at_weight(w, r, depth, 1, out);
+}
+
+// weight is how much r can add to its pixel, see world.min_weight
+void world_color_at_weight(const world *w, const ray *r, u64 depth, f64 weight, v3 out)
 {
   intersection_group ig = {0};
   world_intersect(w, r, &ig);
@@ -98,6 +349,7 @@ void world_color_at(const world *w, const ray *r, u64 depth, v3 out)
   } else {
     computations c = {0};
     computations_prepare(hit, r, &ig, &c);
+    c.weight = weight;
 
     world_shade_hit(w, &c, depth, out);
   }
@@ -105,39 +357,99 @@ void world_color_at(const world *w, const ray *r, u64 depth, v3 out)
 
 void world_refracted_color(const world *w, const computations *c, u64 depth, v3 out)
 {
+  f64 weight = 0;
+  f64 scale = 0;
 
-  f64 n_ratio = c->n1 / c->n2;
-  f64 cos_i = v4_dot(c->eyev, c->normalv);
-  f64 sin2_t = (n_ratio*n_ratio) * (1 - (cos_i*cos_i));
-
-  if (depth == 0 || sin2_t > 1 || req(c->o->material.transparency, 0)) {
+  ray refract_ray = {0};
+  if (!world_refract_ray(w, c, depth, &refract_ray, &weight, &scale)) {
     memcpy(out, color(0, 0, 0), sizeof(v3));
     return;
   }
 
-  f64 cos_t = sqrt(1.0 - sin2_t);
-  v4 direction = {0};
-  {
-    v4 a = {0};
-    v4_scale(c->normalv, n_ratio * cos_i - cos_t, a);
+  v3 result = {0};
+  world_color_at_weight(w, &refract_ray, depth - 1, weight, result);
 
-    v4 b = {0};
-    v4_scale(c->eyev, n_ratio, b);
+  v3_scale(result, scale, out);
+}
 
-    v4_sub(a, b, direction);
-  }
+// Same result as world_color_at without recursing. Every hit's color is
+// its direct lighting plus scaled secondary colors, so the total is a sum
+// of direct lighting over the ray tree, each scaled by the product of the
+// factors on its path. Pending rays are kept depth first on a fixed stack,
+// which bounds depth to WORLD_RAY_STACK_SIZE - 1, and share one
+// intersection buffer. aov, if set, gets the first hit.
+void world_color_at_iterative(const world *w, const ray *r, u64 depth, aov_sample *aov, v3 out)
+{
+  world_ray_entry stack[WORLD_RAY_STACK_SIZE];
+  u32 stack_count = 0;
 
-  ray refract_ray = {0};
-  memcpy(refract_ray.origin, c->under_point, sizeof(v4));
-  memcpy(refract_ray.direction, direction, sizeof(v4));
+  memcpy(&stack[0].r, r, sizeof(ray));
+  stack[0].depth = MIN(depth, WORLD_RAY_STACK_SIZE - 1);
+  stack[0].weight = 1;
+  stack[0].scale = 1;
+  stack_count = 1;
 
+  intersection_group ig = {0};
   v3 result = {0};
-  world_color_at(w, &refract_ray, depth - 1, result);
 
-  v3_scale(result, c->o->material.transparency, out);
+  while (stack_count > 0) {
+    world_ray_entry e = stack[--stack_count];
+
+    ig.count = 0;
+    world_intersect(w, &e.r, &ig);
+
+    const intersection *hit = intersection_group_hit(&ig);
+    if (hit == NULL) {
+      continue;
+    }
+
+    computations c = {0};
+    computations_prepare(hit, &e.r, &ig, &c);
+    c.weight = e.weight;
+
+    if (aov != NULL) {
+      aov_sample_record(w, &c, aov);
+      aov = NULL;
+    }
+
+    v3 surface = {0};
+    world_shade_surface(w, &c, surface);
+    v3_scale(surface, e.scale, surface);
+    v3_add(result, surface, result);
+
+    f64 reflectance = 1;
+    f64 transmittance = 1;
+    if (c.o->material.reflective > 0 && c.o->material.transparency > 0) {
+      reflectance = computations_schlick(&c);
+      transmittance = 1 - reflectance;
+    }
+
+    // At most one entry is popped per two pushed, so with depth bounded
+    // the stack holds at most depth + 1 entries
+    world_ray_entry *next = &stack[stack_count];
+    f64 scale = 0;
+    if (world_reflect_ray(w, &c, e.depth, &next->r, &next->weight, &scale)) {
+      next->depth = e.depth - 1;
+      next->scale = e.scale * scale * reflectance;
+      next = &stack[++stack_count];
+    }
+
+    if (world_refract_ray(w, &c, e.depth, &next->r, &next->weight, &scale)) {
+      next->depth = e.depth - 1;
+      next->scale = e.scale * scale * transmittance;
+      stack_count++;
+    }
+  }
+
+  memcpy(out, result, sizeof(v3));
 }
 
 b32 world_is_shadowed(const world *w, const light *l, const v4 p)
+{
+  return world_is_shadowed_at_time(w, l, p, 0);
+}
+
+b32 world_is_shadowed_at_time(const world *w, const light *l, const v4 p, f64 time)
 {
   v4 v = {0};
   v4_sub(l->position, p, v);
@@ -150,13 +462,129 @@ b32 world_is_shadowed(const world *w, const light *l, const v4 p)
   ray r = {0};
   memcpy(r.origin, p, sizeof(v4));
   memcpy(r.direction, direction, sizeof(v4));
+  r.time = time;
 
-  intersection_group ig = {0};
-  world_intersect(w, &r, &ig);
+  return world_intersect_any(w, &r, distance);
+}
+
+
+b32 world_is_occluded(const world *w, const v4 p, const v4 target, f64 time)
+{
+  v4 v = {0};
+  v4_sub(target, p, v);
+
+  f64 distance = v4_mag(v);
+
+  ray r = {0};
+  memcpy(r.origin, p, sizeof(v4));
+  v4_norm(v, r.direction);
+  r.time = time;
+
+  return world_intersect_any(w, &r, distance);
+}
+
+// world_is_occluded for count <= SDF_LANES targets seen from p, so sdfs
+// march the rays together. Grids and traced renders take them one by one.
+void world_is_occluded_packet(const world *w, const v4 p, v4 *targets, u32 count, f64 time, b32 *out)
+{
+  assert(count <= SDF_LANES);
+
+  if (w->grid != NULL || world_trace_current() != NULL) {
+    for (u32 l = 0; l < count; l++) {
+      out[l] = world_is_occluded(w, p, targets[l], time);
+    }
+    return;
+  }
 
-  const intersection *h = intersection_group_hit(&ig);
+  ray rays[SDF_LANES];
+  f64 max_t[SDF_LANES];
+  for (u32 l = 0; l < count; l++) {
+    v4 v = {0};
+    v4_sub(targets[l], p, v);
+    max_t[l] = v4_mag(v);
+
+    memset(&rays[l], 0, sizeof(ray));
+    memcpy(rays[l].origin, p, sizeof(v4));
+    v4_norm(v, rays[l].direction);
+    rays[l].time = time;
+  }
+
+  if (w->bvh != NULL) {
+    bvh_intersect_any_packet(w->bvh, w, rays, count, max_t, out);
+    return;
+  }
 
-  b32 is_object_between = h != NULL && h->t < distance;
-  return is_object_between;
+  b32 active[SDF_LANES];
+  for (u32 l = 0; l < count; l++) {
+    out[l] = false;
+    active[l] = true;
+  }
+  for (u32 i = 0; i < w->objects_count; i++) {
+    ray_packet_hits_before(rays, count, &w->objects[i], max_t, active, out);
+  }
 }
 
+// Fraction of l that reaches p. Area lights cast one shadow ray per cell,
+// jittered within the cell by a hash of p so neighbouring points decorrelate
+// without any shared state. The corner cells are probed first, and if they
+// all agree the light is taken to be fully lit or fully occluded. Shadows
+// narrower than the light that miss every corner are lost to this.
+f64 world_light_visibility(const world *w, const light *l, const v4 p, f64 time)
+{
+  if (l->type == PointLightType) {
+    return world_is_shadowed_at_time(w, l, p, time) ? 0 : 1;
+  }
+
+  u32 usteps = l->value.area.usteps;
+  u32 vsteps = l->value.area.vsteps;
+  u32 cells = usteps * vsteps;
+  u64 key = hash_point(p);
+
+  u32 probes[AREA_LIGHT_PROBE_SAMPLES] = {
+    0, usteps - 1, cells - usteps, cells - 1,
+  };
+  u32 probes_count = usteps > 1 && vsteps > 1 && cells > AREA_LIGHT_PROBE_SAMPLES ?
+    AREA_LIGHT_PROBE_SAMPLES : 0;
+
+  // Shadow rays go in packets of SDF_LANES
+  v4 targets[SDF_LANES];
+  b32 occluded[SDF_LANES];
+
+  for (u32 i = 0; i < probes_count; i++) {
+    v2 jitter = { hash_uniform(key, 2 * probes[i]), hash_uniform(key, 2 * probes[i] + 1) };
+    area_light_point(l, probes[i] % usteps, probes[i] / usteps, jitter, targets[i]);
+  }
+  world_is_occluded_packet(w, p, targets, probes_count, time, occluded);
+
+  u32 visible = 0;
+  for (u32 i = 0; i < probes_count; i++) {
+    visible += !occluded[i];
+  }
+
+  if (probes_count > 0 && (visible == 0 || visible == probes_count)) {
+    return (f64)visible / (f64)probes_count;
+  }
+
+  u32 packet = 0;
+  for (u32 cell = 0; cell < cells; cell++) {
+    b32 probed = false;
+    for (u32 i = 0; i < probes_count; i++) {
+      probed |= probes[i] == cell;
+    }
+
+    if (!probed) {
+      v2 jitter = { hash_uniform(key, 2 * cell), hash_uniform(key, 2 * cell + 1) };
+      area_light_point(l, cell % usteps, cell / usteps, jitter, targets[packet++]);
+    }
+
+    if (packet == SDF_LANES || (cell == cells - 1 && packet > 0)) {
+      world_is_occluded_packet(w, p, targets, packet, time, occluded);
+      for (u32 i = 0; i < packet; i++) {
+        visible += !occluded[i];
+      }
+      packet = 0;
+    }
+  }
+
+  return (f64)visible / (f64)cells;
+}
@@ -0,0 +1,204 @@
+#include "tests.h"
+
+static u64 exr_read_u32(const u8 *p)
+{
+  return (u64)p[0] | ((u64)p[1] << 8) | ((u64)p[2] << 16) | ((u64)p[3] << 24);
+}
+
+static f32 exr_read_f32(const u8 *p)
+{
+  unsigned int bits = (unsigned int)exr_read_u32(p);
+  f32 v = 0;
+  memcpy(&v, &bits, sizeof(f32));
+  return v;
+}
+
+void test_aov(void)
+{
+  TESTS();
+
+  TEST {
+      // Only requested buffers are allocated
+      render_aovs *a = render_aovs_alloc(4, 3, AovDepth | AovAlbedo);
+
+      assert(a->width == 4 && a->height == 3);
+      assert(a->depth != NULL);
+      assert(a->normal == NULL);
+      assert(a->albedo != NULL);
+      assert(a->depth[11] == F64_INF);
+
+      render_aovs_free(a);
+  }
+
+  TEST {
+      // Rendering records the first hit of each pixel
+      static world w = {0};
+      world_init(&w);
+
+      camera v = {0};
+      camera_init(&v, 11, 11, PI_2);
+      m4 T = {0};
+      view_transform(point(0, 0, -5), point(0, 0, 0), vector(0, 1, 0), T);
+      camera_set_transform(&v, T);
+
+      render_aovs *a = render_aovs_alloc(11, 11, AovDepth | AovNormal | AovAlbedo);
+
+      for (u32 k = 0; k < 2; k++) {
+        v.antialias = k == 1;
+        v.samples = 4;
+
+        canvas *c = camera_render_aovs(&v, &w, a, NULL);
+
+        // The center sees the outer sphere head on, antialiased samples
+        // spread over the pixel
+        u32 center = 5 * 11 + 5;
+        assert(fabs(a->depth[center] - 4) < 0.1);
+        assert(fabs(a->normal[center][2] + 1) < 0.1);
+        assert(v3_eq(a->albedo[center], color(0.8, 1.0, 0.6)));
+
+        // The corners see nothing
+        assert(a->depth[0] == F64_INF);
+        assert(v3_eq(a->normal[0], color(0, 0, 0)));
+        assert(v3_eq(a->albedo[0], color(0, 0, 0)));
+
+        canvas_free(c);
+      }
+
+      render_aovs_free(a);
+  }
+
+  TEST {
+      // Object index, coverage and shadow fraction in one pass
+      static world w = {0};
+      world_init(&w);
+
+      object *floor = &w.objects[w.objects_count++];
+      plane_init(floor);
+      m4 T = {0};
+      translation(0, -1, 0, T);
+      object_set_transform(floor, T);
+
+      camera v = {0};
+      camera_init(&v, 41, 41, PI_2);
+      view_transform(point(0, 0, -5), point(0, 0, 0), vector(0, 1, 0), T);
+      camera_set_transform(&v, T);
+
+      render_aovs *a = render_aovs_alloc(41, 41, AovObject | AovHits | AovShadow);
+      assert(a->depth == NULL && a->object[0] == -1);
+
+      canvas *c = camera_render_aovs(&v, &w, a, NULL);
+
+      // The outer sphere hides the inner one, the top row sees nothing
+      u32 center = 20 * 41 + 20;
+      assert(a->object[center] == 0);
+      assert(a->hits[center] == 1);
+      assert(a->shadow[center] == 0);
+      assert(a->object[0] == -1 && a->hits[0] == 0);
+
+      u32 lit = 0;
+      u32 shadowed = 0;
+      for (u32 y = 0; y < 41; y++) {
+        for (u32 x = 0; x < 41; x++) {
+          u32 i = y * 41 + x;
+          if (a->object[i] != 2) {
+            continue;
+          }
+
+          ray r = {0};
+          camera_ray_for_pixel(&v, x, y, &r);
+          v4 p = {0};
+          ray_position(&r, (-1 - r.origin[1]) / r.direction[1], p);
+          p[1] += EPSILON;
+
+          b32 expected = world_is_shadowed(&w, &w.lights[0], p);
+          assert(a->shadow[i] == (expected ? 1 : 0));
+          lit += !expected;
+          shadowed += expected;
+        }
+      }
+      assert(lit > 0 && shadowed > 0);
+
+      canvas_free(c);
+
+      // With antialiasing the silhouette is partly covered
+      v.antialias = true;
+      v.samples = 4;
+      c = camera_render_aovs(&v, &w, a, NULL);
+
+      u32 partial = 0;
+      for (u32 i = 0; i < 41 * 41; i++) {
+        assert(a->hits[i] <= 4);
+        assert(a->shadow[i] >= 0 && a->shadow[i] <= 1);
+        partial += a->hits[i] > 0 && a->hits[i] < 4;
+      }
+      assert(partial > 0);
+
+      canvas_free(c);
+      render_aovs_free(a);
+  }
+
+  TEST {
+      // Writing the beauty and buffers as a multi-layer OpenEXR file
+      render_aovs *a = render_aovs_alloc(2, 1, AovDepth | AovObject);
+      a->depth[0] = 1.5;
+      a->object[1] = 3;
+
+      canvas *c = canvas_alloc(2, 1);
+      canvas_write(c, 0, 0, color(0.25, 0.5, 0.75));
+      canvas_write(c, 1, 0, color(1, 2, 4));
+
+      const char *path = "/tmp/rtc_test_aov.exr";
+      assert(render_aovs_write_exr(a, c, path));
+
+      FILE *f = fopen(path, "rb");
+      u8 buf[1024];
+      u32 n = fread(buf, 1, sizeof(buf), f);
+      fclose(f);
+
+      assert(exr_read_u32(buf) == 20000630);
+      assert(exr_read_u32(buf + 4) == 2);
+
+      // Walk the attributes to the offset table
+      u32 at = 8;
+      b32 has_channels = false;
+      while (buf[at] != 0) {
+        const char *name = (const char *)&buf[at];
+        at += strlen(name) + 1;
+        at += strlen((const char *)&buf[at]) + 1;
+        u32 size = exr_read_u32(&buf[at]);
+        at += 4;
+
+        if (strcmp(name, "channels") == 0) {
+          has_channels = true;
+          const char *expected[5] = { "B", "G", "R", "Z", "object" };
+          u32 ch = at;
+          for (u32 i = 0; i < 5; i++) {
+            assert(strcmp((const char *)&buf[ch], expected[i]) == 0);
+            ch += strlen(expected[i]) + 1;
+            assert(exr_read_u32(&buf[ch]) == 2);
+            ch += 16;
+          }
+          assert(buf[ch] == 0);
+        }
+        at += size;
+      }
+      assert(has_channels);
+      at++;
+
+      u32 line = exr_read_u32(&buf[at]);
+      assert(exr_read_u32(&buf[at + 4]) == 0);
+      assert(line + 8 + 40 == n);
+      assert(exr_read_u32(&buf[line]) == 0);
+      assert(exr_read_u32(&buf[line + 4]) == 40);
+
+      // B, G, R, Z then object, each a line of two floats
+      f32 expected[10] = { 0.75, 4, 0.5, 2, 0.25, 1, 1.5, F64_INF, -1, 3 };
+      for (u32 i = 0; i < 10; i++) {
+        assert(exr_read_f32(&buf[line + 8 + 4 * i]) == expected[i]);
+      }
+
+      canvas_free(c);
+      render_aovs_free(a);
+      remove(path);
+  }
+}
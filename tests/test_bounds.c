@@ -0,0 +1,120 @@
+#include "tests.h"
+
+void test_bounds(void)
+{
+  TESTS();
+
+  TEST {
+      // An empty bounds grows to contain added points
+      bounds b = {0};
+      bounds_init(&b);
+
+      bounds_add_point(&b, point(-5, 2, 0));
+      bounds_add_point(&b, point(7, 0, -3));
+
+      assert(v4_eq(b.min, point(-5, 0, -3)));
+      assert(v4_eq(b.max, point(7, 2, 0)));
+  }
+
+  TEST {
+      // Merging two bounds
+      bounds a = { .min = point_init(-5, -2, 0), .max = point_init(7, 4, 4) };
+      bounds b = { .min = point_init(8, -7, -2), .max = point_init(14, 2, 8) };
+
+      bounds out = {0};
+      bounds_merge(&a, &b, &out);
+
+      assert(v4_eq(out.min, point(-5, -7, -2)));
+      assert(v4_eq(out.max, point(14, 4, 8)));
+  }
+
+  TEST {
+      // Checking whether bounds contain other bounds
+      bounds a = { .min = point_init(5, -2, 0), .max = point_init(11, 4, 7) };
+      bounds b = { .min = point_init(6, -1, 1), .max = point_init(10, 3, 6) };
+      bounds c = { .min = point_init(4, -3, -1), .max = point_init(10, 3, 6) };
+
+      assert(bounds_contains(&a, &b));
+      assert(!bounds_contains(&a, &c));
+  }
+
+  TEST {
+      // Transforming bounds
+      bounds b = { .min = point_init(-1, -1, -1), .max = point_init(1, 1, 1) };
+
+      m4 X = {0};
+      rotation_x(PI_4, X);
+
+      m4 Y = {0};
+      rotation_y(PI_4, Y);
+
+      m4 T = {0};
+      m4_mul(X, Y, T);
+
+      bounds out = {0};
+      bounds_transform(&b, T, &out);
+
+      assert(v4_eq(out.min, point(-1.41421, -1.70710, -1.70710)));
+      assert(v4_eq(out.max, point(1.41421, 1.70710, 1.70710)));
+  }
+
+  TEST {
+      // Infinite bounds stay infinite when transformed
+      bounds b = { .min = point_init(-F64_INF, 0, -F64_INF), .max = point_init(F64_INF, 0, F64_INF) };
+
+      m4 T = {0};
+      rotation_x(PI_2, T);
+
+      bounds out = {0};
+      bounds_transform(&b, T, &out);
+
+      assert(!bounds_is_finite(&out));
+      assert(out.min[1] == -F64_INF);
+      assert(out.max[1] == F64_INF);
+  }
+
+  TEST {
+      // Surface area of bounds
+      bounds b = { .min = point_init(0, 0, 0), .max = point_init(1, 2, 3) };
+      assert(req(bounds_surface_area(&b), 22));
+
+      bounds empty = {0};
+      bounds_init(&empty);
+      assert(req(bounds_surface_area(&empty), 0));
+  }
+
+  TEST {
+      // Intersecting a ray with bounds
+      bounds b = { .min = point_init(5, -2, 0), .max = point_init(11, 4, 7) };
+
+      struct {
+        v4 origin;
+        v4 direction;
+        b32 result;
+      } cases[] = {
+        { point_init(15, 1, 2), vector_init(-1, 0, 0), true },
+        { point_init(-5, -1, 4), vector_init(1, 0, 0), true },
+        { point_init(7, 6, 5), vector_init(0, -1, 0), true },
+        { point_init(9, -5, 6), vector_init(0, 1, 0), true },
+        { point_init(8, 2, 12), vector_init(0, 0, -1), true },
+        { point_init(6, 0, -5), vector_init(0, 0, 1), true },
+        { point_init(8, 1, 3.5), vector_init(0, 0, 1), true },
+        { point_init(9, -1, -8), vector_init(2, 4, 6), false },
+        { point_init(8, 3, -4), vector_init(6, 2, 4), false },
+        { point_init(9, -1, -2), vector_init(4, 6, 2), false },
+        { point_init(4, 0, 9), vector_init(0, 0, -1), false },
+        { point_init(8, 6, -1), vector_init(0, -1, 0), false },
+        { point_init(12, 5, 4), vector_init(-1, 0, 0), false },
+      };
+
+      for (u32 i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        v4 direction = {0};
+        v4_norm(cases[i].direction, direction);
+
+        v4 inv = vector_init(1.0 / direction[0], 1.0 / direction[1], 1.0 / direction[2]);
+
+        f64 tmin, tmax;
+        assert(bounds_intersect(&b, cases[i].origin, inv, &tmin, &tmax) == cases[i].result);
+      }
+  }
+}
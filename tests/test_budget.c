@@ -0,0 +1,88 @@
+#include "tests.h"
+
+static void budget_scene(world *w, camera *v, u32 width, u32 height)
+{
+  world_init(w);
+
+  camera_init(v, width, height, PI_3);
+  m4 T = {0};
+  view_transform(point(0, 0, -5), point(0, 0, 0), vector(0, 1, 0), T);
+  camera_set_transform(v, T);
+  v->antialias = true;
+}
+
+void test_budget(void)
+{
+  TESTS();
+
+  TEST {
+      // With time to spare every pixel gets all its samples
+      static world w = {0};
+      camera v = {0};
+      budget_scene(&w, &v, 40, 24);
+
+      render_budget_stats s = {0};
+      canvas *c = camera_render_budget(&v, &w, 60, 4, &s);
+
+      assert(s.min_samples == 4 && s.max_samples == 4);
+      assert(req(s.mean_samples, 4));
+      assert(s.degraded_tiles == 0);
+      assert(s.max_error > 0 && s.mean_error <= s.max_error);
+      assert(s.seconds < 60);
+
+      v.samples = 4;
+      canvas *expected = camera_render(&v, &w, NULL);
+      assert(memcmp(c->pixels, expected->pixels, 40 * 24 * sizeof(v3)) == 0);
+
+      canvas_free(expected);
+      canvas_free(c);
+  }
+
+  TEST {
+      // Without time, the whole frame is shaded once without bounces
+      static world w = {0};
+      camera v = {0};
+      budget_scene(&w, &v, 40, 24);
+      w.objects[0].material.reflective = 0.5;
+
+      render_budget_stats s = {0};
+      canvas *c = camera_render_budget(&v, &w, 0, 16, &s);
+
+      assert(s.degraded_tiles == 6);
+      assert(s.min_samples == 1 && s.max_samples == 1);
+      assert(req(s.mean_error, 0));
+
+      v.samples = 1;
+      v.max_depth = 0;
+      canvas *expected = camera_render(&v, &w, NULL);
+      assert(memcmp(c->pixels, expected->pixels, 40 * 24 * sizeof(v3)) == 0);
+
+      canvas_free(expected);
+      canvas_free(c);
+  }
+
+  TEST {
+      // Spare time goes to the noisy tiles, the empty ones are left alone
+      static world w = {0};
+      camera v = {0};
+      budget_scene(&w, &v, 96, 64);
+
+      render_budget_stats s = {0};
+      canvas *c = camera_render_budget(&v, &w, 0.3, 1 << 20, &s);
+
+      // The budget runs out long before max_samples
+      assert(s.seconds >= 0.3);
+      assert(s.min_samples >= 1 && s.min_samples <= s.max_samples);
+
+      // No tile gets a third sample before every tile has two, and the
+      // side columns of tiles only see the background, which has no
+      // variance after the second, so they get no more
+      assert(s.min_samples <= 2);
+      if (s.max_samples > 2) {
+        assert(s.degraded_tiles == 0 && s.min_samples == 2);
+        assert(s.mean_samples < s.max_samples);
+      }
+
+      canvas_free(c);
+  }
+}
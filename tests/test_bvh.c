@@ -0,0 +1,187 @@
+#include "tests.h"
+
+static void bvh_test_world(world *w)
+{
+  memset(w, 0, sizeof(world));
+
+  plane_init(&w->objects[w->objects_count++]);
+
+  for (u32 i = 0; i < 8; i++) {
+    for (u32 j = 0; j < 8; j++) {
+      object *o = &w->objects[w->objects_count++];
+      if ((i + j) % 2 == 0) {
+        sphere_init(o);
+      } else {
+        cube_init(o);
+      }
+
+      m4 T = {0};
+      translation((f64)i * 3 - 10, 1, (f64)j * 3 - 10, T);
+
+      m4 S = {0};
+      scaling(0.5 + 0.1 * (f64)i, 0.5, 0.5 + 0.1 * (f64)j, S);
+
+      m4 Z = {0};
+      m4_mul(T, S, Z);
+      object_set_transform(o, Z);
+    }
+  }
+
+  w->lights_count = 1;
+  point_light_init(&w->lights[0], point(-10, 10, -10), color(1, 1, 1));
+}
+
+static void bvh_assert_matches_linear(world *w, bvh *b)
+{
+  for (u32 i = 0; i < 64; i++) {
+    ray r = {
+      .origin = point_init(-15 + (f64)i * 0.5, 3, -15),
+      .direction = vector_init(0.3, -0.1 + 0.003 * (f64)i, 1),
+    };
+    v4_norm(r.direction, r.direction);
+
+    w->bvh = NULL;
+    intersection_group linear = {0};
+    world_intersect(w, &r, &linear);
+    b32 linear_any = world_intersect_any(w, &r, 20);
+
+    w->bvh = b;
+    intersection_group accelerated = {0};
+    world_intersect(w, &r, &accelerated);
+    b32 accelerated_any = world_intersect_any(w, &r, 20);
+
+    assert(linear.count == accelerated.count);
+    for (u32 j = 0; j < linear.count; j++) {
+      assert(req(linear.xs[j].t, accelerated.xs[j].t));
+    }
+    assert(linear_any == accelerated_any);
+  }
+}
+
+void test_bvh(void)
+{
+  TESTS();
+
+  TEST {
+      // A bvh keeps unbounded objects out of the tree
+      static world w = {0};
+      bvh_test_world(&w);
+
+      bvh *b = bvh_alloc(&w);
+
+      assert(b->unbounded_count == 1);
+      assert(b->unbounded[0] == 0);
+      assert(b->prims_count == 64);
+      assert(b->nodes_count > 1);
+
+      bvh_free(b);
+  }
+
+  TEST {
+      // Every node contains its children, every leaf contains its objects
+      static world w = {0};
+      bvh_test_world(&w);
+
+      bvh *b = bvh_alloc(&w);
+
+      for (u32 i = 0; i < b->nodes_count; i++) {
+        const bvh_node *n = &b->nodes[i];
+        if (n->count > 0) {
+          assert(n->count <= BVH_MAX_LEAF_SIZE);
+          for (u32 j = n->first; j < n->first + n->count; j++) {
+            assert(b->leaf_of[b->prims[j]] == i);
+            assert(bounds_contains(&n->b, &b->object_bounds[b->prims[j]]));
+          }
+        } else {
+          assert(b->nodes[n->left].parent == i);
+          assert(b->nodes[n->right].parent == i);
+          assert(bounds_contains(&n->b, &b->nodes[n->left].b));
+          assert(bounds_contains(&n->b, &b->nodes[n->right].b));
+        }
+      }
+
+      bvh_free(b);
+  }
+
+  TEST {
+      // Intersecting through a bvh matches a linear scan
+      static world w = {0};
+      bvh_test_world(&w);
+
+      bvh *b = bvh_alloc(&w);
+      bvh_assert_matches_linear(&w, b);
+
+      bvh_free(b);
+  }
+
+  TEST {
+      // Refitting after small moves keeps the tree and stays correct
+      static world w = {0};
+      bvh_test_world(&w);
+
+      bvh *b = bvh_alloc(&w);
+      u32 rebuilds = b->rebuilds;
+
+      u32 moved[] = { 5, 12, 40 };
+      for (u32 i = 0; i < 3; i++) {
+        m4 T = {0};
+        translation(0.25, 0.5, -0.25, T);
+
+        object *o = &w.objects[moved[i]];
+        m4 Z = {0};
+        m4_mul(T, o->transform, Z);
+        object_set_transform(o, Z);
+      }
+
+      assert(!bvh_refit(b, &w, moved, 3));
+      assert(b->rebuilds == rebuilds);
+
+      bounds ob = {0};
+      object_bounds(&w.objects[12], &ob);
+      assert(bounds_contains(&b->nodes[0].b, &ob));
+      assert(bounds_contains(&b->nodes[b->leaf_of[12]].b, &ob));
+
+      bvh_assert_matches_linear(&w, b);
+
+      bvh_free(b);
+  }
+
+  TEST {
+      // Moving an object far away degrades the tree and triggers a rebuild
+      static world w = {0};
+      bvh_test_world(&w);
+
+      bvh *b = bvh_alloc(&w);
+      u32 rebuilds = b->rebuilds;
+      f64 cost = bvh_cost(b);
+
+      u32 moved[] = { 20 };
+      m4 T = {0};
+      translation(200, 50, 300, T);
+      object_set_transform(&w.objects[20], T);
+
+      assert(bvh_refit(b, &w, moved, 1));
+      assert(b->rebuilds == rebuilds + 1);
+      assert(bvh_cost(b) <= b->build_cost * b->rebuild_threshold);
+      assert(bvh_cost(b) > 0 && cost > 0);
+
+      bvh_assert_matches_linear(&w, b);
+
+      bvh_free(b);
+  }
+
+  TEST {
+      // Adding objects forces a rebuild
+      static world w = {0};
+      bvh_test_world(&w);
+
+      bvh *b = bvh_alloc(&w);
+
+      sphere_init(&w.objects[w.objects_count++]);
+
+      assert(bvh_refit(b, &w, NULL, 0));
+      assert(b->prims_count == 65);
+
+      bvh_free(b);
+  }
+}
@@ -6,14 +6,18 @@ void test_camera(void)
   TESTS();
 
   TEST {
-      // Default camera
-      camera c = {0};
+      // Default camera, every field is set even if c starts out dirty
+      camera c;
+      memset(&c, 0xff, sizeof(camera));
       camera_init(&c, 160, 120, PI_2);
 
       assert(c.hsize == 160);
       assert(c.vsize == 120);
       assert(req(c.fov, PI_2));
       assert(m4_eq(c.transform, IDENTITY));
+      assert(c.max_depth == MAX_DEPTH);
+      assert(c.integrator == WhittedIntegrator);
+      assert(c.threads == 0);
   }
 
   TEST {
@@ -85,7 +89,7 @@ void test_camera(void)
   }
 
   TEST {
-      world w = {0};
+      static world w = {0};
       world_init(&w);
 
       camera v = {0};
@@ -110,5 +114,487 @@ void test_camera(void)
 
       canvas_free(c);
   }
-}
 
+  TEST {
+      // Time samples are spread across the shutter interval
+      camera c = {0};
+      camera_init(&c, 11, 11, PI_2);
+
+      assert(c.samples == SAMPLES_PER_PIXEL);
+      assert(c.shutter_open == 0 && c.shutter_close == 0);
+
+      c.shutter_open = 1;
+      c.shutter_close = 2;
+
+      ray r = {0};
+      camera_ray_for_pixel(&c, 5, 5, &r);
+      assert(r.time == 1);
+  }
+
+  TEST {
+      // A sphere moving across a pixel during the shutter is blurred
+      static world w = {0};
+      w.objects_count = 1;
+      sphere_init(&w.objects[0]);
+      w.objects[0].material.ambient = 1;
+      w.objects[0].material.diffuse = 0;
+      w.objects[0].material.specular = 0;
+      w.lights_count = 1;
+      point_light_init(&w.lights[0], point(0, 0, -10), color(1, 1, 1));
+
+      m4 start = {0};
+      translation(-10, 0, 0, start);
+      m4 end = {0};
+      translation(10, 0, 0, end);
+
+      motion m = {0};
+      motion_init(&m, start, 0, end, 1);
+      object_set_motion(&w.objects[0], &m);
+
+      camera v = {0};
+      camera_init(&v, 1, 1, 0.01);
+      m4 T = {0};
+      view_transform(point(0, 0, -5), point(0, 0, 0), vector(0, 1, 0), T);
+      camera_set_transform(&v, T);
+
+      canvas *open = camera_render(&v, &w, NULL);
+      assert(v3_eq(*canvas_at(open, 0, 0), BLACK));
+      canvas_free(open);
+
+      // The sphere covers the pixel for a tenth of the shutter, stratified
+      // time samples land within two strata of that
+      v.shutter_close = 1;
+      v.samples = 64;
+      canvas *blurred = camera_render(&v, &w, NULL);
+      f64 value = (*canvas_at(blurred, 0, 0))[0];
+      assert(fabs(value - 0.1) <= 2.0 / 64);
+      canvas_free(blurred);
+  }
+
+  TEST {
+      // Lens rays converge on the focal plane
+      camera c = {0};
+      camera_init(&c, 201, 101, PI_2);
+
+      assert(c.aperture == 0);
+      assert(c.focal_distance == 1);
+
+      m4 T = {0};
+      view_transform(point(1, 2, -5), point(1, 2, 0), vector(0, 1, 0), T);
+      camera_set_transform(&c, T);
+
+      c.aperture = 0.5;
+      c.focal_distance = 4;
+
+      f64 x_offset = 30.5 * c.pixel_size;
+      f64 y_offset = 70.5 * c.pixel_size;
+
+      ray pinhole = {0};
+      camera_raw_ray_for_pixel(&c, x_offset, y_offset, &pinhole);
+
+      // Where the pinhole ray crosses the plane 4 units ahead
+      f64 t = 4 / pinhole.direction[2];
+      v4 focus = {0};
+      ray_position(&pinhole, t, focus);
+
+      v2 center = { 0.5, 0.5 };
+      ray r = {0};
+      camera_lens_ray_for_pixel(&c, x_offset, y_offset, center, &r);
+      assert(v4_eq(r.origin, pinhole.origin));
+      assert(v4_eq(r.direction, pinhole.direction));
+
+      v2 samples[3] = { { 0, 0 }, { 1, 0.25 }, { 0.3, 0.9 } };
+      for (u32 i = 0; i < 3; i++) {
+        camera_lens_ray_for_pixel(&c, x_offset, y_offset, samples[i], &r);
+
+        v4 offset = {0};
+        v4_sub(r.origin, pinhole.origin, offset);
+        assert(offset[2] == 0 || req(offset[2], 0));
+        assert(v4_mag(offset) <= 0.5 + EPSILON);
+
+        v4 p = {0};
+        ray_position(&r, (focus[2] - r.origin[2]) / r.direction[2], p);
+        assert(v4_eq(p, focus));
+      }
+  }
+
+  TEST {
+      // Objects away from the focal plane are blurred
+      static world w = {0};
+      w.objects_count = 1;
+      sphere_init(&w.objects[0]);
+      w.objects[0].material.ambient = 1;
+      w.objects[0].material.diffuse = 0;
+      w.objects[0].material.specular = 0;
+      w.lights_count = 1;
+      point_light_init(&w.lights[0], point(0, 0, -10), color(1, 1, 1));
+
+      camera v = {0};
+      camera_init(&v, 21, 21, PI_3);
+      m4 T = {0};
+      view_transform(point(0, 0, -5), point(0, 0, 0), vector(0, 1, 0), T);
+      camera_set_transform(&v, T);
+
+      canvas *sharp = camera_render(&v, &w, NULL);
+
+      v.aperture = 0.5;
+      v.focal_distance = 4;
+      canvas *focused = camera_render(&v, &w, NULL);
+
+      v.focal_distance = 40;
+      canvas *blurred = camera_render(&v, &w, NULL);
+
+      // Count pixels partially covered by the sphere's edge
+      u32 focused_partial = 0;
+      u32 blurred_partial = 0;
+      for (u32 i = 0; i < 21 * 21; i++) {
+        f64 s = sharp->pixels[i][0];
+        assert(s == 0 || s == 1);
+
+        f64 f = focused->pixels[i][0];
+        f64 b = blurred->pixels[i][0];
+        focused_partial += f > 0 && f < 1;
+        blurred_partial += b > 0 && b < 1;
+      }
+
+      assert(blurred_partial > 2 * focused_partial);
+
+      canvas_free(sharp);
+      canvas_free(focused);
+      canvas_free(blurred);
+  }
+
+  TEST {
+      // Dropping light bounces by weight between two half mirrors
+      static world w = {0};
+      w.objects_count = 2;
+      plane_init(&w.objects[0]);
+      w.objects[0].material.reflective = 0.5;
+
+      plane_init(&w.objects[1]);
+      m4 T = {0};
+      translation(0, 1, 0, T);
+      object_set_transform(&w.objects[1], T);
+      w.objects[1].material.reflective = 0.5;
+
+      w.lights_count = 1;
+      point_light_init(&w.lights[0], point(0, 0.5, -3), color(1, 1, 1));
+
+      camera v = {0};
+      camera_init(&v, 8, 8, PI_3);
+      view_transform(point(0, 0.5, 0), point(0, 0, 2), vector(0, 1, 0), T);
+      camera_set_transform(&v, T);
+      v.max_depth = 20;
+
+      canvas *full = camera_render(&v, &w, NULL);
+
+      // Bounces 1 and 2 weigh 0.5 and 0.25, bounce 3 falls under the cutoff
+      w.min_weight = 0.2;
+      canvas *cut = camera_render(&v, &w, NULL);
+
+      w.min_weight = 0;
+      v.max_depth = 2;
+      canvas *shallow = camera_render(&v, &w, NULL);
+
+      for (u32 i = 0; i < 64; i++) {
+        assert(v3_eq(cut->pixels[i], shallow->pixels[i]));
+        assert(cut->pixels[i][0] < full->pixels[i][0]);
+      }
+
+      // Russian roulette keeps the mean
+      w.min_weight = 0.2;
+      w.russian_roulette = true;
+      v.max_depth = 20;
+      canvas *roulette = camera_render(&v, &w, NULL);
+
+      f64 full_mean = 0;
+      f64 roulette_mean = 0;
+      for (u32 i = 0; i < 64; i++) {
+        full_mean += full->pixels[i][0] / 64;
+        roulette_mean += roulette->pixels[i][0] / 64;
+      }
+      assert(fabs(roulette_mean - full_mean) < 0.03 * full_mean);
+
+      canvas_free(full);
+      canvas_free(cut);
+      canvas_free(shallow);
+      canvas_free(roulette);
+  }
+
+  TEST {
+      // Rendering iteratively matches the recursive evaluator
+      static world w = {0};
+      world_init(&w);
+
+      w.objects[0].material.reflective = 0.3;
+      w.objects[0].material.transparency = 0.6;
+      w.objects[0].material.refractive_index = 1.5;
+
+      object *floor = &w.objects[w.objects_count++];
+      plane_init(floor);
+      m4 T = {0};
+      translation(0, -1, 0, T);
+      object_set_transform(floor, T);
+      floor->material.reflective = 0.5;
+
+      camera v = {0};
+      camera_init(&v, 11, 11, PI_3);
+      view_transform(point(0, 0.5, -5), point(0, 0, 0), vector(0, 1, 0), T);
+      camera_set_transform(&v, T);
+      v.max_depth = 8;
+
+      for (u32 k = 0; k < 2; k++) {
+        w.min_weight = k == 0 ? 0 : 0.1;
+
+        canvas *image = camera_render(&v, &w, NULL);
+
+        for (u32 y = 0; y < 11; y++) {
+          for (u32 x = 0; x < 11; x++) {
+            ray r = {0};
+            camera_ray_for_pixel(&v, x, y, &r);
+
+            v3 expected = {0};
+            world_color_at(&w, &r, v.max_depth, expected);
+            assert(v3_eq(image->pixels[y * 11 + x], expected));
+          }
+        }
+
+        canvas_free(image);
+      }
+  }
+
+  TEST {
+      // Images do not depend on how tiles are shared between threads
+      static world w = {0};
+      world_init(&w);
+
+      object *floor = &w.objects[w.objects_count++];
+      plane_init(floor);
+      m4 T = {0};
+      translation(0, -1, 0, T);
+      object_set_transform(floor, T);
+
+      camera v = {0};
+      camera_init(&v, 37, 21, PI_3);
+      view_transform(point(0, 1.5, -5), point(0, 0, 0), vector(0, 1, 0), T);
+      camera_set_transform(&v, T);
+      v.samples = 4;
+
+      for (u32 k = 0; k < 2; k++) {
+        v.integrator = k == 0 ? WhittedIntegrator : PathIntegrator;
+
+        v.threads = 1;
+        canvas *single = camera_render(&v, &w, NULL);
+
+        v.threads = 3;
+        canvas *shared = camera_render(&v, &w, NULL);
+
+        assert(memcmp(single->pixels, shared->pixels, 37 * 21 * sizeof(v3)) == 0);
+
+        canvas_free(single);
+        canvas_free(shared);
+      }
+  }
+
+  TEST {
+      // Rendering again only the tiles an edit can change
+      static world w = {0};
+      world_init(&w);
+
+      object *floor = &w.objects[w.objects_count++];
+      plane_init(floor);
+      m4 T = {0};
+      translation(0, -1, 0, T);
+      object_set_transform(floor, T);
+
+      camera v = {0};
+      camera_init(&v, 64, 48, PI_3);
+      view_transform(point(0, 1.5, -5), point(0, 0, 0), vector(0, 1, 0), T);
+      camera_set_transform(&v, T);
+      v.threads = 2;
+
+      render_record *r = render_record_alloc(&v);
+      canvas *c = camera_render_record(&v, &w, r, NULL);
+      assert(r->tiles_count == 12);
+
+      // The inner sphere is only ever seen through the outer one
+      u32 touched = 0;
+      for (u32 i = 0; i < r->tiles_count; i++) {
+        touched += (r->tiles[i].objects[0] & 2) != 0;
+      }
+      assert(touched > 0 && touched < r->tiles_count);
+
+      // A new color leaves the tiles that never saw the sphere alone
+      memcpy(w.objects[0].material.color, color(0.2, 0.3, 1), sizeof(v3));
+      u32 edited[1] = { 0 };
+      u32 rendered = camera_rerender(&v, &w, r, edited, 1, c);
+      assert(rendered > 0 && rendered < r->tiles_count);
+
+      canvas *expected = camera_render(&v, &w, NULL);
+      assert(memcmp(c->pixels, expected->pixels, 64 * 48 * sizeof(v3)) == 0);
+      canvas_free(expected);
+
+      // Moving it also moves its shadow on the floor
+      translation(1.5, 0, 0.5, T);
+      object_set_transform(&w.objects[0], T);
+      rendered = camera_rerender(&v, &w, r, edited, 1, c);
+      assert(rendered < r->tiles_count);
+
+      expected = camera_render(&v, &w, NULL);
+      assert(memcmp(c->pixels, expected->pixels, 64 * 48 * sizeof(v3)) == 0);
+      canvas_free(expected);
+
+      // A new object in view
+      object *added = &w.objects[w.objects_count++];
+      sphere_init(added);
+      m4 S = {0};
+      m4 U = {0};
+      translation(-2, 0, 0, T);
+      scaling(0.3, 0.3, 0.3, S);
+      m4_mul(T, S, U);
+      object_set_transform(added, U);
+      edited[0] = w.objects_count - 1;
+      rendered = camera_rerender(&v, &w, r, edited, 1, c);
+      assert(rendered > 0 && rendered < r->tiles_count);
+
+      expected = camera_render(&v, &w, NULL);
+      assert(memcmp(c->pixels, expected->pixels, 64 * 48 * sizeof(v3)) == 0);
+      canvas_free(expected);
+
+      canvas_free(c);
+      render_record_free(r);
+  }
+
+  TEST {
+      // Rendering again through a bvh or grid sees the edit
+      for (u32 accel = 0; accel < 2; accel++) {
+        static world w = {0};
+        world_init(&w);
+        for (u32 i = 0; i < 6; i++) {
+          object *o = &w.objects[w.objects_count++];
+          sphere_init(o);
+          m4 T = {0};
+          m4 S = {0};
+          m4 U = {0};
+          translation(-2.5 + (f64)i, 0, (f64)(i % 2), T);
+          scaling(0.4, 0.4, 0.4, S);
+          m4_mul(T, S, U);
+          object_set_transform(o, U);
+        }
+        w.bvh = accel == 0 ? bvh_alloc(&w) : NULL;
+        w.grid = accel == 1 ? grid_alloc(&w) : NULL;
+
+        camera v = {0};
+        camera_init(&v, 64, 48, PI_3);
+        m4 T = {0};
+        view_transform(point(0, 1.5, -5), point(0, 0, 0), vector(0, 1, 0), T);
+        camera_set_transform(&v, T);
+        v.threads = 1;
+
+        render_record *r = render_record_alloc(&v);
+        canvas *c = camera_render_record(&v, &w, r, NULL);
+
+        // Moved out of every node and cell it was in
+        translation(0.5, 1.5, 0, T);
+        object_set_transform(&w.objects[2], T);
+        u32 edited[1] = { 2 };
+        assert(camera_rerender(&v, &w, r, edited, 1, c) > 0);
+
+        // A new object outside the old bounds
+        object *added = &w.objects[w.objects_count++];
+        sphere_init(added);
+        translation(0, -1.5, 0, T);
+        object_set_transform(added, T);
+        edited[0] = w.objects_count - 1;
+        assert(camera_rerender(&v, &w, r, edited, 1, c) > 0);
+
+        bvh *b = w.bvh;
+        grid *g = w.grid;
+        w.bvh = NULL;
+        w.grid = NULL;
+        canvas *expected = camera_render(&v, &w, NULL);
+        assert(memcmp(c->pixels, expected->pixels, 64 * 48 * sizeof(v3)) == 0);
+        canvas_free(expected);
+
+        if (b != NULL) {
+          bvh_free(b);
+        }
+        if (g != NULL) {
+          grid_free(g);
+        }
+        canvas_free(c);
+        render_record_free(r);
+      }
+  }
+
+  TEST {
+      // Rendering a region of the image, cropped or in place
+      static world w = {0};
+      world_init(&w);
+
+      camera v = {0};
+      camera_init(&v, 50, 40, PI_3);
+      m4 T = {0};
+      view_transform(point(0, 0, -5), point(0, 0, 0), vector(0, 1, 0), T);
+      camera_set_transform(&v, T);
+      v.antialias = true;
+      v.samples = 2;
+      v.threads = 2;
+
+      canvas *full = camera_render(&v, &w, NULL);
+
+      render_region r = { .x0 = 13, .y0 = 7, .x1 = 37, .y1 = 35 };
+      canvas *crop = camera_render_region(&v, &w, &r, NULL);
+      assert(crop->width == 24 && crop->height == 28);
+
+      for (u32 y = 0; y < 28; y++) {
+        assert(memcmp(*canvas_at(crop, 0, y), *canvas_at(full, 13, 7 + y), 24 * sizeof(v3)) == 0);
+      }
+
+      canvas *in_place = canvas_alloc(50, 40);
+      for (u32 i = 0; i < 50 * 40; i++) {
+        memcpy(in_place->pixels[i], color(-1, -1, -1), sizeof(v3));
+      }
+      camera_render_region_into(&v, &w, &r, in_place);
+
+      for (u32 y = 0; y < 40; y++) {
+        for (u32 x = 0; x < 50; x++) {
+          if (x >= r.x0 && x < r.x1 && y >= r.y0 && y < r.y1) {
+            assert(memcmp(*canvas_at(in_place, x, y), *canvas_at(full, x, y), sizeof(v3)) == 0);
+          } else {
+            assert(v3_eq(*canvas_at(in_place, x, y), color(-1, -1, -1)));
+          }
+        }
+      }
+
+      // Regions put together make the whole frame
+      render_region halves[2] = {
+        { .x0 = 0, .y0 = 0, .x1 = 50, .y1 = 17 },
+        { .x0 = 0, .y0 = 17, .x1 = 50, .y1 = 40 },
+      };
+      for (u32 k = 0; k < 2; k++) {
+        camera_render_region_into(&v, &w, &halves[k], in_place);
+      }
+      assert(memcmp(in_place->pixels, full->pixels, 50 * 40 * sizeof(v3)) == 0);
+
+      // Empty regions render nothing, regions outside the image are errors
+      render_region empty = { .x0 = 20, .y0 = 10, .x1 = 20, .y1 = 30 };
+      assert(camera_render_region_into(&v, &w, &empty, in_place));
+      assert(memcmp(in_place->pixels, full->pixels, 50 * 40 * sizeof(v3)) == 0);
+
+      canvas *none = camera_render_region(&v, &w, &empty, NULL);
+      assert(none != NULL && none->width == 0 && none->height == 20);
+      canvas_free(none);
+
+      render_region outside = { .x0 = 40, .y0 = 0, .x1 = 51, .y1 = 40 };
+      render_region flipped = { .x0 = 30, .y0 = 0, .x1 = 20, .y1 = 40 };
+      assert(camera_render_region(&v, &w, &outside, NULL) == NULL);
+      assert(camera_render_region(&v, &w, &flipped, NULL) == NULL);
+      assert(!camera_render_region_into(&v, &w, &outside, in_place));
+      assert(!camera_render_region_into(&v, &w, &r, crop));
+
+      canvas_free(in_place);
+      canvas_free(crop);
+      canvas_free(full);
+  }
+}
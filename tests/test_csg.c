@@ -0,0 +1,259 @@
+#include "tests.h"
+
+void test_csg(void)
+{
+  TESTS();
+
+  TEST {
+      // CSG is created with an operation and two children
+      object s = {0};
+      sphere_init(&s);
+      object c = {0};
+      cube_init(&c);
+
+      object g = {0};
+      csg_init(&g, UnionOperation, &s, &c);
+
+      assert(g.type == CsgType);
+      assert(g.value.csg.operation == UnionOperation);
+      assert(g.value.csg.left == &s);
+      assert(g.value.csg.right == &c);
+      assert(s.parent == &g);
+      assert(c.parent == &g);
+  }
+
+  TEST {
+      // Evaluating the rule for a CSG operation
+      typedef struct {
+        enum csg_operation op;
+        b32 lhit;
+        b32 inl;
+        b32 inr;
+        b32 result;
+      } test_case;
+      test_case cases[] = {
+        { UnionOperation, true, true, true, false },
+        { UnionOperation, true, true, false, true },
+        { UnionOperation, true, false, true, false },
+        { UnionOperation, true, false, false, true },
+        { UnionOperation, false, true, true, false },
+        { UnionOperation, false, true, false, false },
+        { UnionOperation, false, false, true, true },
+        { UnionOperation, false, false, false, true },
+        { IntersectionOperation, true, true, true, true },
+        { IntersectionOperation, true, true, false, false },
+        { IntersectionOperation, true, false, true, true },
+        { IntersectionOperation, true, false, false, false },
+        { IntersectionOperation, false, true, true, true },
+        { IntersectionOperation, false, true, false, true },
+        { IntersectionOperation, false, false, true, false },
+        { IntersectionOperation, false, false, false, false },
+        { DifferenceOperation, true, true, true, false },
+        { DifferenceOperation, true, true, false, true },
+        { DifferenceOperation, true, false, true, false },
+        { DifferenceOperation, true, false, false, true },
+        { DifferenceOperation, false, true, true, true },
+        { DifferenceOperation, false, true, false, true },
+        { DifferenceOperation, false, false, true, false },
+        { DifferenceOperation, false, false, false, false },
+      };
+      u32 L = sizeof(cases) / sizeof(test_case);
+
+      for (u32 i = 0; i < L; i++) {
+        test_case T = cases[i];
+        assert(csg_intersection_allowed(T.op, T.lhit, T.inl, T.inr) == T.result);
+      }
+  }
+
+  TEST {
+      // Merging intervals keeps only the boundaries of the combined solid
+      typedef struct {
+        enum csg_operation op;
+        f64 t0;
+        b32 left0;
+        f64 t1;
+        b32 left1;
+      } test_case;
+      test_case cases[] = {
+        { UnionOperation, 4, true, 6.5, false },
+        { IntersectionOperation, 4.5, false, 6, true },
+        { DifferenceOperation, 4, true, 4.5, false },
+      };
+      u32 L = sizeof(cases) / sizeof(test_case);
+
+      for (u32 i = 0; i < L; i++) {
+        test_case T = cases[i];
+
+        object s1 = {0};
+        sphere_init(&s1);
+
+        object s2 = {0};
+        sphere_init(&s2);
+        m4 M = {0};
+        translation(0, 0, 0.5, M);
+        object_set_transform(&s2, M);
+
+        object g = {0};
+        csg_init(&g, T.op, &s1, &s2);
+
+        ray r = {
+          .origin = point_init(0, 0, -5),
+          .direction = vector_init(0, 0, 1),
+        };
+
+        intersection_group ig = {0};
+        ray_intersect(&r, &g, &ig);
+
+        assert(ig.count == 2);
+        assert(req(ig.xs[0].t, T.t0));
+        assert(ig.xs[0].o == (T.left0 ? &s1 : &s2));
+        assert(req(ig.xs[1].t, T.t1));
+        assert(ig.xs[1].o == (T.left1 ? &s1 : &s2));
+      }
+  }
+
+  TEST {
+      // A ray misses a CSG object
+      object s = {0};
+      sphere_init(&s);
+      object c = {0};
+      cube_init(&c);
+
+      object g = {0};
+      csg_init(&g, UnionOperation, &s, &c);
+
+      ray r = {
+        .origin = point_init(0, 2, -5),
+        .direction = vector_init(0, 0, 1),
+      };
+
+      intersection_group ig = {0};
+      ray_intersect(&r, &g, &ig);
+      assert(ig.count == 0);
+  }
+
+  TEST {
+      // Intersections that miss one child only keep what the operation allows
+      object s1 = {0};
+      sphere_init(&s1);
+
+      object s2 = {0};
+      sphere_init(&s2);
+      m4 M = {0};
+      translation(0, 3, 0, M);
+      object_set_transform(&s2, M);
+
+      ray r = {
+        .origin = point_init(0, 0, -5),
+        .direction = vector_init(0, 0, 1),
+      };
+
+      object g = {0};
+      csg_init(&g, IntersectionOperation, &s1, &s2);
+      intersection_group ig = {0};
+      ray_intersect(&r, &g, &ig);
+      assert(ig.count == 0);
+
+      csg_init(&g, DifferenceOperation, &s1, &s2);
+      ig.count = 0;
+      ray_intersect(&r, &g, &ig);
+      assert(ig.count == 2);
+      assert(ig.xs[0].o == &s1);
+
+      csg_init(&g, DifferenceOperation, &s2, &s1);
+      ig.count = 0;
+      ray_intersect(&r, &g, &ig);
+      assert(ig.count == 0);
+  }
+
+  TEST {
+      // Bounds of a CSG object contain its transformed children
+      object s = {0};
+      sphere_init(&s);
+
+      object c = {0};
+      cube_init(&c);
+      m4 M = {0};
+      translation(2, 0, 0, M);
+      object_set_transform(&c, M);
+
+      object g = {0};
+      csg_init(&g, UnionOperation, &s, &c);
+
+      m4 T = {0};
+      translation(0, 5, 0, T);
+      object_set_transform(&g, T);
+
+      bounds b = {0};
+      object_bounds(&g, &b);
+      assert(v4_eq(b.min, point(-1, 4, -1)));
+      assert(v4_eq(b.max, point(3, 6, 1)));
+  }
+
+  TEST {
+      // Normals of children account for the CSG transform
+      object s1 = {0};
+      sphere_init(&s1);
+      m4 S = {0};
+      scaling(2, 2, 2, S);
+      object_set_transform(&s1, S);
+
+      object s2 = {0};
+      sphere_init(&s2);
+
+      object g = {0};
+      csg_init(&g, DifferenceOperation, &s1, &s2);
+
+      m4 T = {0};
+      translation(5, 0, 0, T);
+      object_set_transform(&g, T);
+
+      ray r = {
+        .origin = point_init(5, 0, -5),
+        .direction = vector_init(0, 0, 1),
+      };
+
+      intersection_group ig = {0};
+      ray_intersect(&r, &g, &ig);
+
+      assert(ig.count == 4);
+      assert(req(ig.xs[0].t, 3));
+      assert(req(ig.xs[1].t, 4));
+
+      computations c = {0};
+      computations_prepare(&ig.xs[1], &r, &ig, &c);
+      assert(c.o == &s2);
+      assert(v4_eq(c.point, point(5, 0, -1)));
+      assert(v4_eq(c.normalv, vector(0, 0, -1)));
+
+      v4 normal = {0};
+      object_normal_at(&s1, point(7, 0, 0), normal);
+      assert(v4_eq(normal, vector(1, 0, 0)));
+  }
+
+  TEST {
+      // Shadow rays pass through the hole of a difference
+      static world w = {0};
+      w.lights_count = 1;
+      point_light_init(&w.lights[0], point(0, 10, 0), color(1, 1, 1));
+
+      object inner[2] = {0};
+      cube_init(&inner[0]);
+      cylinder_init(&inner[1]);
+      inner[1].value.cylinder.minimum = -2;
+      inner[1].value.cylinder.maximum = 2;
+      inner[1].value.cylinder.closed = true;
+      m4 S = {0};
+      scaling(0.5, 1, 0.5, S);
+      object_set_transform(&inner[1], S);
+
+      csg_init(&w.objects[w.objects_count++], DifferenceOperation, &inner[0], &inner[1]);
+
+      w.bvh = bvh_alloc(&w);
+
+      assert(!world_is_shadowed(&w, &w.lights[0], point(0, -3, 0)));
+      assert(world_is_shadowed(&w, &w.lights[0], point(0.75, -3, 0)));
+
+      bvh_free(w.bvh);
+  }
+}
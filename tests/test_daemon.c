@@ -0,0 +1,165 @@
+#include "tests.h"
+
+static void *daemon_thread(void *arg)
+{
+  render_daemon_run(arg);
+  return NULL;
+}
+
+void test_daemon(void)
+{
+  TESTS();
+
+  TEST {
+      // Scenes stay loaded across clients and camera jobs
+      static world w = {0};
+      world_init(&w);
+      w.bvh = bvh_alloc(&w);
+
+      camera v = {0};
+      camera_init(&v, 40, 30, PI_3);
+      m4 T = {0};
+      view_transform(point(0, 1.5, -5), point(0, 1, 0), vector(0, 1, 0), T);
+      camera_set_transform(&v, T);
+
+      const char *path = "/tmp/rtc_test_daemon.sock";
+      render_daemon *d = render_daemon_alloc(path);
+      assert(d != NULL);
+
+      pthread_t thread;
+      pthread_create(&thread, NULL, daemon_thread, d);
+
+      int fd = render_daemon_connect(path);
+      assert(fd >= 0);
+
+      u64 hash = 0;
+      assert(render_daemon_load_scene(fd, &v, &w, &hash));
+
+      // Two halves put together match a full render
+      render_region top = { 0, 0, 40, 13 };
+      render_region bottom = { 0, 13, 40, 30 };
+      assert(render_daemon_render_region(fd, &top));
+      assert(render_daemon_render_region(fd, &bottom));
+
+      canvas *c = render_daemon_fetch_image(fd);
+      canvas *expected = camera_render(&v, &w, NULL);
+      assert(c->width == 40 && c->height == 30);
+      assert(memcmp(c->pixels, expected->pixels, 40 * 30 * sizeof(v3)) == 0);
+      canvas_free(expected);
+      canvas_free(c);
+
+      // A region past the image is refused, an empty one does nothing
+      render_region outside = { 0, 0, 41, 30 };
+      assert(!render_daemon_render_region(fd, &outside));
+      render_region empty = { 5, 5, 5, 30 };
+      assert(render_daemon_render_region(fd, &empty));
+
+      // So is a camera too large to hold an image for
+      camera huge = v;
+      huge.hsize = 1ul << 40;
+      huge.vsize = 1ul << 40;
+      assert(!render_daemon_set_camera(fd, &huge));
+
+      // Another client reuses the scene by its hash with its own camera
+      int other = render_daemon_connect(path);
+      assert(!render_daemon_use_scene(other, hash + 1));
+      assert(render_daemon_use_scene(other, hash));
+
+      camera moved = v;
+      camera_init(&moved, 20, 20, PI_2);
+      view_transform(point(2, 1, -4), point(0, 1, 0), vector(0, 1, 0), T);
+      camera_set_transform(&moved, T);
+      assert(render_daemon_set_camera(other, &moved));
+
+      render_region all = { 0, 0, 20, 20 };
+      assert(render_daemon_render_region(other, &all));
+      c = render_daemon_fetch_image(other);
+      expected = camera_render(&moved, &w, NULL);
+      assert(memcmp(c->pixels, expected->pixels, 20 * 20 * sizeof(v3)) == 0);
+      canvas_free(expected);
+      canvas_free(c);
+
+      // Loading the same world from another view does not rebuild it
+      u64 again = 0;
+      assert(render_daemon_load_scene(other, &moved, &w, &again));
+      assert(again == hash);
+
+      assert(render_daemon_shutdown(other));
+      pthread_join(thread, NULL);
+
+      assert(d->scene_misses == 1);
+      assert(d->scene_hits == 2);
+      assert(d->scenes_count == 1);
+
+      close(other);
+      close(fd);
+      render_daemon_free(d);
+      bvh_free(w.bvh);
+  }
+
+  TEST {
+      // Only a stale socket is replaced
+      const char *path = "/tmp/rtc_test_daemon_path";
+      remove(path);
+
+      FILE *f = fopen(path, "w");
+      fputs("not a socket", f);
+      fclose(f);
+      assert(render_daemon_alloc(path) == NULL);
+      f = fopen(path, "r");
+      assert(f != NULL);
+      fclose(f);
+      remove(path);
+
+      render_daemon *d = render_daemon_alloc(path);
+      assert(d != NULL);
+      assert(render_daemon_alloc(path) == NULL);
+
+      // Left behind by a daemon that did not clean up
+      close(d->listen_fd);
+      d->listen_fd = -1;
+      render_daemon *replaced = render_daemon_alloc(path);
+      assert(replaced != NULL);
+
+      free(d);
+      render_daemon_free(replaced);
+  }
+
+  TEST {
+      // A client stalling in the middle of a request is dropped and does
+      // not hold up the others
+      static world w = {0};
+      world_init(&w);
+
+      camera v = {0};
+      camera_init(&v, 8, 8, PI_3);
+
+      const char *path = "/tmp/rtc_test_daemon_stall.sock";
+      render_daemon *d = render_daemon_alloc(path);
+      assert(d != NULL);
+      d->timeout = 0.2;
+
+      pthread_t thread;
+      pthread_create(&thread, NULL, daemon_thread, d);
+
+      // The type of a request header, then nothing
+      int stalled = render_daemon_connect(path);
+      u64 partial = 0;
+      assert(socket_send_all(stalled, &partial, sizeof(partial)));
+
+      int fd = render_daemon_connect(path);
+      assert(render_daemon_load_scene(fd, &v, &w, NULL));
+
+      // The daemon has hung up on it
+      char byte = 0;
+      assert(recv(stalled, &byte, 1, 0) == 0);
+
+      assert(render_daemon_shutdown(fd));
+      pthread_join(thread, NULL);
+      assert(d->clients_count == 1);
+
+      close(stalled);
+      close(fd);
+      render_daemon_free(d);
+  }
+}
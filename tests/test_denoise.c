@@ -0,0 +1,140 @@
+#include "tests.h"
+
+// w x h image of two halves split at x = w / 2, facing different ways, with
+// uniform noise of the given amplitude
+static void denoise_test_image(canvas *c, render_aovs *a, f64 left, f64 right, f64 noise)
+{
+  srand(11);
+  for (u32 y = 0; y < c->height; y++) {
+    for (u32 x = 0; x < c->width; x++) {
+      u32 p = y * c->width + x;
+      b32 is_left = x < c->width / 2;
+
+      f64 value = (is_left ? left : right) + noise * (random_uniform() - 0.5);
+      memcpy(c->pixels[p], color(value, value, value), sizeof(v3));
+
+      memcpy(a->normal[p], is_left ? color(1, 0, 0) : color(0, 1, 0), sizeof(v3));
+      memcpy(a->albedo[p], color(1, 1, 1), sizeof(v3));
+      a->depth[p] = 1;
+    }
+  }
+}
+
+static void denoise_test_stats(const canvas *c, u32 x0, u32 x1, f64 *mean, f64 *variance)
+{
+  f64 sum = 0;
+  f64 sum2 = 0;
+  u32 n = 0;
+  for (u32 y = 0; y < c->height; y++) {
+    for (u32 x = x0; x < x1; x++) {
+      f64 v = c->pixels[y * c->width + x][0];
+      sum += v;
+      sum2 += v * v;
+      n++;
+    }
+  }
+  *mean = sum / (f64)n;
+  *variance = sum2 / (f64)n - *mean * *mean;
+}
+
+void test_denoise(void)
+{
+  TESTS();
+
+  TEST {
+      // Noise is smoothed away and the mean kept
+      canvas *c = canvas_alloc(32, 32);
+      render_aovs *a = render_aovs_alloc(32, 32, AovDepth | AovNormal | AovAlbedo);
+      denoise_test_image(c, a, 0.5, 0.5, 0.4);
+      for (u32 p = 0; p < 32 * 32; p++) {
+        memcpy(a->normal[p], color(0, 0, -1), sizeof(v3));
+      }
+
+      denoise_options o = {0};
+      denoise_options_init(&o);
+
+      canvas *out = canvas_alloc(32, 32);
+      canvas_denoise(c, a, &o, out);
+
+      f64 before_mean, before_variance, after_mean, after_variance;
+      denoise_test_stats(c, 0, 32, &before_mean, &before_variance);
+      denoise_test_stats(out, 0, 32, &after_mean, &after_variance);
+
+      assert(after_variance < before_variance / 10);
+      assert(fabs(after_mean - before_mean) < 0.01);
+
+      canvas_free(c);
+      canvas_free(out);
+      render_aovs_free(a);
+  }
+
+  TEST {
+      // Edges in the normals are not blurred across
+      canvas *c = canvas_alloc(32, 16);
+      render_aovs *a = render_aovs_alloc(32, 16, AovDepth | AovNormal | AovAlbedo);
+      denoise_test_image(c, a, 0.2, 0.8, 0.1);
+
+      denoise_options o = {0};
+      denoise_options_init(&o);
+      canvas_denoise(c, a, &o, c);
+
+      for (u32 y = 0; y < 16; y++) {
+        assert(fabs(c->pixels[y * 32 + 15][0] - 0.2) < 0.03);
+        assert(fabs(c->pixels[y * 32 + 16][0] - 0.8) < 0.03);
+      }
+
+      canvas_free(c);
+      render_aovs_free(a);
+  }
+
+  TEST {
+      // Albedo is divided out, so texture survives
+      canvas *c = canvas_alloc(16, 16);
+      render_aovs *a = render_aovs_alloc(16, 16, AovDepth | AovNormal | AovAlbedo);
+      denoise_test_image(c, a, 0.5, 0.5, 0);
+      for (u32 p = 0; p < 16 * 16; p++) {
+        f64 albedo = (p + p / 16) % 2 == 0 ? 0.2 : 1;
+        memcpy(a->albedo[p], color(albedo, albedo, albedo), sizeof(v3));
+        memcpy(a->normal[p], color(0, 0, -1), sizeof(v3));
+        memcpy(c->pixels[p], color(0.5 * albedo, 0.5 * albedo, 0.5 * albedo), sizeof(v3));
+      }
+
+      canvas *out = canvas_alloc(16, 16);
+      denoise_options o = {0};
+      denoise_options_init(&o);
+      canvas_denoise(c, a, &o, out);
+
+      for (u32 p = 0; p < 16 * 16; p++) {
+        assert(v3_eq(out->pixels[p], c->pixels[p]));
+      }
+
+      canvas_free(c);
+      canvas_free(out);
+      render_aovs_free(a);
+  }
+
+  TEST {
+      // The result does not depend on the number of threads
+      canvas *c = canvas_alloc(24, 19);
+      render_aovs *a = render_aovs_alloc(24, 19, AovDepth | AovNormal | AovAlbedo);
+      denoise_test_image(c, a, 0.3, 0.6, 0.3);
+
+      denoise_options o = {0};
+      denoise_options_init(&o);
+
+      o.threads = 1;
+      canvas *single = canvas_alloc(24, 19);
+      canvas_denoise(c, a, &o, single);
+
+      o.threads = 4;
+      canvas *shared = canvas_alloc(24, 19);
+      canvas_denoise(c, a, &o, shared);
+
+      assert(memcmp(single->pixels, shared->pixels, 24 * 19 * sizeof(v3)) == 0);
+
+      canvas_free(c);
+      canvas_free(single);
+      canvas_free(shared);
+      render_aovs_free(a);
+  }
+}
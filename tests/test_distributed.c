@@ -0,0 +1,178 @@
+#include "tests.h"
+
+static void distributed_scene(world *w, camera *v)
+{
+  world_init(w);
+
+  object *floor = &w->objects[w->objects_count++];
+  plane_init(floor);
+  m4 T = {0};
+  translation(0, -1, 0, T);
+  object_set_transform(floor, T);
+  floor->material.reflective = 0.3;
+
+  camera_init(v, 70, 50, PI_3);
+  view_transform(point(0, 0.5, -5), point(0, 0, 0), vector(0, 1, 0), T);
+  camera_set_transform(v, T);
+  v->threads = 1;
+}
+
+typedef struct {
+  render_coordinator *rc;
+  const camera *v;
+  const world *w;
+  render_distributed_stats stats;
+  canvas *c;
+} distributed_run;
+
+static void *distributed_run_thread(void *arg)
+{
+  distributed_run *r = arg;
+  r->c = render_coordinator_run(r->rc, r->v, r->w, 0, &r->stats);
+  return NULL;
+}
+
+// Worker process that waits for a byte on fd before it connects
+static pid_t distributed_fork_worker(u32 port, u32 max_tiles, int *fd)
+{
+  int fds[2];
+  assert(pipe(fds) == 0);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[1]);
+    char go = 0;
+    b32 ok = read(fds[0], &go, 1) == 1 && render_worker_run("127.0.0.1", port, max_tiles);
+    _exit(ok ? 0 : 1);
+  }
+
+  close(fds[0]);
+  *fd = fds[1];
+  return pid;
+}
+
+void test_distributed(void)
+{
+  TESTS();
+
+  TEST {
+      // Local worker processes render the same image as camera_render
+      static world w = {0};
+      camera v = {0};
+      distributed_scene(&w, &v);
+
+      render_coordinator *rc = render_coordinator_alloc("127.0.0.1", 0);
+      assert(rc != NULL && rc->port != 0);
+
+      render_distributed_stats s = {0};
+      canvas *c = render_coordinator_run(rc, &v, &w, 3, &s);
+      render_coordinator_free(rc);
+
+      assert(s.tiles == 5 * 4);
+      assert(s.workers == 3);
+      assert(s.lost_workers == 0 && s.requeued_tiles == 0);
+
+      canvas *expected = camera_render(&v, &w, NULL);
+      assert(memcmp(c->pixels, expected->pixels, 70 * 50 * sizeof(v3)) == 0);
+
+      canvas_free(expected);
+      canvas_free(c);
+  }
+
+  TEST {
+      // Tiles of a worker that leaves mid render are rendered by another
+      static world w = {0};
+      camera v = {0};
+      distributed_scene(&w, &v);
+
+      render_coordinator *rc = render_coordinator_alloc("127.0.0.1", 0);
+
+      int quitter_fd = -1;
+      pid_t quitter = distributed_fork_worker(rc->port, 3, &quitter_fd);
+      int worker_fd = -1;
+      pid_t worker = distributed_fork_worker(rc->port, 0, &worker_fd);
+
+      distributed_run r = {0};
+      r.rc = rc;
+      r.v = &v;
+      r.w = &w;
+      pthread_t thread;
+      pthread_create(&thread, NULL, distributed_run_thread, &r);
+
+      // The quitter takes jobs past its last tile and drops them
+      int status = 0;
+      assert(write(quitter_fd, "", 1) == 1);
+      waitpid(quitter, &status, 0);
+      assert(WIFEXITED(status) && WEXITSTATUS(status) == 1);
+
+      assert(write(worker_fd, "", 1) == 1);
+      pthread_join(thread, NULL);
+      waitpid(worker, &status, 0);
+      assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+      close(quitter_fd);
+      close(worker_fd);
+      render_coordinator_free(rc);
+
+      assert(r.stats.workers == 2);
+      assert(r.stats.lost_workers == 1);
+      assert(r.stats.requeued_tiles == 2);
+
+      canvas *expected = camera_render(&v, &w, NULL);
+      assert(memcmp(r.c->pixels, expected->pixels, 70 * 50 * sizeof(v3)) == 0);
+
+      canvas_free(expected);
+      canvas_free(r.c);
+  }
+
+  TEST {
+      // Tiles of a worker that connects and then goes silent are taken
+      // back once it has held them past the timeout
+      static world w = {0};
+      camera v = {0};
+      distributed_scene(&w, &v);
+
+      render_coordinator *rc = render_coordinator_alloc("127.0.0.1", 0);
+      rc->timeout = 1;
+
+      int worker_fd = -1;
+      pid_t worker = distributed_fork_worker(rc->port, 0, &worker_fd);
+
+      // Waits in the backlog, so it is accepted and given tiles first
+      struct sockaddr_in addr = {0};
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons((u16)rc->port);
+      inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+      int silent = socket(AF_INET, SOCK_STREAM, 0);
+      assert(connect(silent, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+
+      distributed_run r = {0};
+      r.rc = rc;
+      r.v = &v;
+      r.w = &w;
+      pthread_t thread;
+      pthread_create(&thread, NULL, distributed_run_thread, &r);
+
+      assert(write(worker_fd, "", 1) == 1);
+      pthread_join(thread, NULL);
+
+      int status = 0;
+      waitpid(worker, &status, 0);
+      assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+      close(silent);
+      close(worker_fd);
+      render_coordinator_free(rc);
+
+      assert(r.stats.workers == 2);
+      assert(r.stats.lost_workers == 1);
+      assert(r.stats.requeued_tiles == 2);
+      assert(r.stats.seconds >= 1);
+
+      canvas *expected = camera_render(&v, &w, NULL);
+      assert(memcmp(r.c->pixels, expected->pixels, 70 * 50 * sizeof(v3)) == 0);
+
+      canvas_free(expected);
+      canvas_free(r.c);
+  }
+}
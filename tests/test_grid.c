@@ -0,0 +1,155 @@
+#include "tests.h"
+
+static void grid_test_world(world *w)
+{
+  memset(w, 0, sizeof(world));
+
+  plane_init(&w->objects[w->objects_count++]);
+
+  for (u32 i = 0; i < 6; i++) {
+    for (u32 j = 0; j < 6; j++) {
+      for (u32 k = 0; k < 6; k++) {
+        object *o = &w->objects[w->objects_count++];
+        sphere_init(o);
+
+        m4 T = {0};
+        translation((f64)i * 2 - 5, (f64)j * 2 + 1, (f64)k * 2 - 5, T);
+
+        m4 S = {0};
+        scaling(0.4 + 0.05 * (f64)k, 0.4, 0.4, S);
+
+        m4 Z = {0};
+        m4_mul(T, S, Z);
+        object_set_transform(o, Z);
+      }
+    }
+  }
+
+  // One large object spanning many cells
+  object *c = &w->objects[w->objects_count++];
+  cube_init(c);
+  m4 S = {0};
+  scaling(6, 0.2, 6, S);
+  object_set_transform(c, S);
+}
+
+void test_grid(void)
+{
+  TESTS();
+
+  TEST {
+      // Grid resolution follows object density
+      static world w = {0};
+      grid_test_world(&w);
+
+      grid *g = grid_alloc(&w);
+
+      assert(g->unbounded_count == 1);
+
+      u32 cells = g->resolution[0] * g->resolution[1] * g->resolution[2];
+      assert(cells >= 217);
+      assert(cells <= 217 * 2 * GRID_DENSITY);
+      assert(g->cell_offsets[cells] == g->cell_objects_count);
+
+      grid_free(g);
+  }
+
+  TEST {
+      // Objects spanning many cells are only intersected once
+      static world w = {0};
+      grid_test_world(&w);
+
+      grid *g = grid_alloc(&w);
+      w.grid = g;
+
+      ray r = {
+        .origin = point_init(-20, 0.1, 0.05),
+        .direction = vector_init(1, 0, 0),
+      };
+
+      intersection_group ig = {0};
+      world_intersect(&w, &r, &ig);
+
+      assert(ig.count == 2);
+      assert(req(ig.xs[0].t, 14));
+      assert(req(ig.xs[1].t, 26));
+
+      grid_free(g);
+  }
+
+  TEST {
+      // Intersecting through a grid matches a linear scan
+      static world w = {0};
+      grid_test_world(&w);
+
+      grid *g = grid_alloc(&w);
+
+      for (u32 i = 0; i < 128; i++) {
+        ray r = {
+          .origin = point_init(-8 + (f64)(i % 16), 15, -12 + (f64)(i / 16)),
+          .direction = vector_init(0.2 - 0.01 * (f64)i, -1, 0.4),
+        };
+        v4_norm(r.direction, r.direction);
+
+        w.grid = NULL;
+        intersection_group linear = {0};
+        world_intersect(&w, &r, &linear);
+        b32 linear_any = world_intersect_any(&w, &r, 10);
+
+        w.grid = g;
+        intersection_group accelerated = {0};
+        world_intersect(&w, &r, &accelerated);
+        b32 accelerated_any = world_intersect_any(&w, &r, 10);
+
+        assert(linear.count == accelerated.count);
+        for (u32 j = 0; j < linear.count; j++) {
+          assert(req(linear.xs[j].t, accelerated.xs[j].t));
+          assert(linear.xs[j].o == accelerated.xs[j].o);
+        }
+        assert(linear_any == accelerated_any);
+      }
+
+      grid_free(g);
+  }
+
+  TEST {
+      // Any hit respects the maximum distance
+      static world w = {0};
+      grid_test_world(&w);
+
+      grid *g = grid_alloc(&w);
+      w.grid = g;
+
+      ray r = {
+        .origin = point_init(-5, 20, -5),
+        .direction = vector_init(0, -1, 0),
+      };
+
+      // First sphere top is at y = 11.4
+      assert(!world_intersect_any(&w, &r, 8.5));
+      assert(world_intersect_any(&w, &r, 8.7));
+
+      grid_free(g);
+  }
+
+  TEST {
+      // A world with only unbounded objects
+      static world w = {0};
+      plane_init(&w.objects[w.objects_count++]);
+
+      grid *g = grid_alloc(&w);
+      w.grid = g;
+
+      ray r = {
+        .origin = point_init(0, 1, 0),
+        .direction = vector_init(0, -1, 0),
+      };
+
+      intersection_group ig = {0};
+      world_intersect(&w, &r, &ig);
+      assert(ig.count == 1);
+      assert(world_intersect_any(&w, &r, 2));
+
+      grid_free(g);
+  }
+}
@@ -0,0 +1,308 @@
+#include "tests.h"
+
+// First crossing of height(x, z) - y along the ray by fine marching and
+// bisection, independent of the pyramid
+static f64 heightfield_reference_t(const heightfield *h, const ray *r)
+{
+  f64 step = 1e-4;
+  f64 prev = F64_INF;
+
+  for (f64 t = 0; t < 4; t += step) {
+    v4 p = {0};
+    ray_position(r, t, p);
+    if (p[0] < 0 || p[0] > 1 || p[2] < 0 || p[2] > 1) {
+      prev = F64_INF;
+      continue;
+    }
+
+    f64 f = heightfield_height_at(h, p[0], p[2]) - p[1];
+    if (prev != F64_INF && (f >= 0) != (prev >= 0)) {
+      f64 a = t - step;
+      f64 b = t;
+      for (u32 i = 0; i < 60; i++) {
+        f64 m = 0.5 * (a + b);
+        ray_position(r, m, p);
+        f64 fm = heightfield_height_at(h, p[0], p[2]) - p[1];
+        if ((fm >= 0) == (prev >= 0)) {
+          a = m;
+        } else {
+          b = m;
+        }
+      }
+      return 0.5 * (a + b);
+    }
+    prev = f;
+  }
+
+  return F64_INF;
+}
+
+void test_heightfield(void)
+{
+  TESTS();
+
+  TEST {
+      // Building the min/max pyramid over the cells
+      f32 heights[15] = {
+        0, 1, 2, 3, 4,
+        1, 0, 0, 0, 0,
+        0, 0, 5, 0, -1,
+      };
+      heightfield *h = heightfield_alloc(5, 3, heights);
+
+      assert(h->levels == 3);
+      assert(h->level_width[0] == 4 && h->level_depth[0] == 2);
+      assert(h->level_width[1] == 2 && h->level_depth[1] == 1);
+      assert(h->level_width[2] == 1 && h->level_depth[2] == 1);
+
+      // Level 1 covers 2x2 cells, i.e. samples 0..2 and 2..4 in x
+      const f32 *l1 = &h->pyramid[2 * h->level_offset[1]];
+      assert(l1[0] == 0 && l1[1] == 5);
+      assert(l1[2] == -1 && l1[3] == 5);
+
+      assert(v4_eq(h->b.min, point(0, -1, 0)));
+      assert(v4_eq(h->b.max, point(1, 5, 1)));
+
+      heightfield_free(h);
+  }
+
+  TEST {
+      // Heights are bilinear between samples
+      f32 heights[4] = { 0, 1, 2, 5 };
+      heightfield *h = heightfield_alloc(2, 2, heights);
+
+      assert(req(heightfield_height_at(h, 0, 0), 0));
+      assert(req(heightfield_height_at(h, 1, 0), 1));
+      assert(req(heightfield_height_at(h, 0, 1), 2));
+      assert(req(heightfield_height_at(h, 1, 1), 5));
+      assert(req(heightfield_height_at(h, 0.5, 0.5), 2));
+      assert(req(heightfield_height_at(h, 0.25, 0.5), 1.5));
+
+      heightfield_free(h);
+  }
+
+  TEST {
+      // The normal of a sloped heightfield
+      f32 heights[9] = {
+        0, 0.5, 1,
+        0, 0.5, 1,
+        0, 0.5, 1,
+      };
+      heightfield *h = heightfield_alloc(3, 3, heights);
+
+      v4 n = {0};
+      heightfield_normal_at(h, point(0.3, 0.3, 0.7), n);
+      assert(v4_eq(n, vector(-ROOT_2_2, ROOT_2_2, 0)));
+
+      heightfield_free(h);
+  }
+
+  TEST {
+      // A ray straight down hits the interpolated height
+      f32 heights[9] = {
+        0, 1, 0,
+        1, 2, 1,
+        0, 1, 0,
+      };
+      heightfield *h = heightfield_alloc(3, 3, heights);
+
+      object o = {0};
+      heightfield_object_init(&o, h);
+
+      ray r = { .origin = point_init(0.25, 10, 0.4), .direction = vector_init(0, -1, 0) };
+      intersection_group ig = {0};
+      ray_intersect(&r, &o, &ig);
+
+      assert(ig.count == 1);
+      assert(ig.xs[0].o == &o);
+      assert(req(ig.xs[0].t, 10 - heightfield_height_at(h, 0.25, 0.4)));
+
+      heightfield_free(h);
+  }
+
+  TEST {
+      // Rays passing above or away from the heightfield miss it
+      f32 heights[9] = {
+        0, 1, 0,
+        1, 2, 1,
+        0, 1, 0,
+      };
+      heightfield *h = heightfield_alloc(3, 3, heights);
+
+      object o = {0};
+      heightfield_object_init(&o, h);
+
+      ray rays[3] = {
+        { .origin = point_init(-1, 2.5, 0.5), .direction = vector_init(1, 0, 0) },
+        { .origin = point_init(2, 0.5, 0.5), .direction = vector_init(0, -1, 0) },
+        { .origin = point_init(0.5, 0.5, 0.5), .direction = vector_init(0, 1, 0) },
+      };
+
+      for (u32 i = 0; i < 2; i++) {
+        intersection_group ig = {0};
+        ray_intersect(&rays[i], &o, &ig);
+        assert(ig.count == 0);
+      }
+
+      // From below, the surface is hit from underneath
+      intersection_group ig = {0};
+      ray_intersect(&rays[2], &o, &ig);
+      assert(ig.count == 1);
+      assert(req(ig.xs[0].t, 1.5));
+
+      heightfield_free(h);
+  }
+
+  TEST {
+      // The pyramid walk finds the first crossing of a rough terrain
+      f32 heights[33 * 17];
+      for (u32 j = 0; j < 17; j++) {
+        for (u32 i = 0; i < 33; i++) {
+          heights[j * 33 + i] = (f32)(0.3 * sin(0.7 * (f64)i) * cos(1.3 * (f64)j) + 0.1 * sin((f64)(i * j)));
+        }
+      }
+      heightfield *h = heightfield_alloc(33, 17, heights);
+
+      object o = {0};
+      heightfield_object_init(&o, h);
+
+      srand(7);
+      u32 hits = 0;
+      for (u32 k = 0; k < 48; k++) {
+        v4 from = point_init(random_uniform() * 1.4 - 0.2, 0.6, random_uniform() * 1.4 - 0.2);
+        v4 to = point_init(random_uniform(), -0.2 + 0.2 * random_uniform(), random_uniform());
+
+        ray r = {0};
+        memcpy(r.origin, from, sizeof(v4));
+        v4_sub(to, from, r.direction);
+
+        intersection_group ig = {0};
+        ray_intersect(&r, &o, &ig);
+
+        f64 expected = heightfield_reference_t(h, &r);
+        if (expected == F64_INF) {
+          assert(ig.count == 0);
+          continue;
+        }
+
+        hits++;
+        assert(ig.count == 1);
+        assert(fabs(ig.xs[0].t - expected) < 1e-4);
+      }
+      assert(hits > 24);
+
+      heightfield_free(h);
+  }
+
+  TEST {
+      // Intersecting a transformed heightfield in a world
+      f32 heights[4] = { 0, 0, 0, 1 };
+      heightfield *h = heightfield_alloc(2, 2, heights);
+
+      static world w = {0};
+      world_init(&w);
+      object *o = &w.objects[w.objects_count++];
+      heightfield_object_init(o, h);
+
+      m4 T = {0};
+      scaling(10, 2, 10, T);
+      object_set_transform(o, T);
+
+      bounds b = {0};
+      object_bounds(o, &b);
+      assert(v4_eq(b.min, point(0, 0, 0)));
+      assert(v4_eq(b.max, point(10, 2, 10)));
+
+      ray r = { .origin = point_init(10, 5, 10), .direction = vector_init(0, -1, 0) };
+      intersection_group ig = {0};
+      world_intersect(&w, &r, &ig);
+      assert(ig.count == 1);
+      assert(req(ig.xs[0].t, 3));
+
+      computations comps = {0};
+      computations_prepare(&ig.xs[0], &r, &ig, &comps);
+      assert(comps.normalv[1] > 0);
+
+      heightfield_free(h);
+  }
+
+  TEST {
+      // Loading heightfields from PGM and PFM files
+      const char *ascii = "/tmp/rtc_test_heightfield_p2.pgm";
+      FILE *f = fopen(ascii, "wb");
+      fprintf(f, "P2\n# comment\n3 2\n10\n0 5 10\n10 5 0\n");
+      fclose(f);
+
+      heightfield *h = heightfield_load(ascii);
+      assert(h != NULL);
+      assert(h->width == 3 && h->depth == 2);
+      assert(req(heightfield_height_at(h, 0.5, 0), 0.5));
+      assert(req(heightfield_height_at(h, 1, 0), 1));
+      assert(req(heightfield_height_at(h, 0, 1), 1));
+      heightfield_free(h);
+
+      const char *binary = "/tmp/rtc_test_heightfield_p5.pgm";
+      f = fopen(binary, "wb");
+      fprintf(f, "P5 2 2 65535\n");
+      u8 samples[8] = { 0, 0, 0xff, 0xff, 0x80, 0x00, 0, 0 };
+      fwrite(samples, 1, 8, f);
+      fclose(f);
+
+      h = heightfield_load(binary);
+      assert(h != NULL);
+      assert(req(heightfield_height_at(h, 1, 0), 1));
+      assert(fabs(heightfield_height_at(h, 0, 1) - 0.5) < 1e-4);
+      heightfield_free(h);
+
+      // PFM rows are stored bottom up
+      const char *pfm = "/tmp/rtc_test_heightfield.pfm";
+      f = fopen(pfm, "wb");
+      fprintf(f, "Pf\n2 2\n-1.0\n");
+      u8 floats[16] = {
+        0x00, 0x00, 0x80, 0x3f,  0x00, 0x00, 0x00, 0x40,  // 1, 2
+        0x00, 0x00, 0x40, 0x40,  0x00, 0x00, 0x80, 0x40,  // 3, 4
+      };
+      fwrite(floats, 1, 16, f);
+      fclose(f);
+
+      h = heightfield_load(pfm);
+      assert(h != NULL);
+      assert(req(heightfield_height_at(h, 0, 0), 3));
+      assert(req(heightfield_height_at(h, 1, 0), 4));
+      assert(req(heightfield_height_at(h, 0, 1), 1));
+      assert(req(heightfield_height_at(h, 1, 1), 2));
+      heightfield_free(h);
+
+      const char *truncated = "/tmp/rtc_test_heightfield_bad.pgm";
+      f = fopen(truncated, "wb");
+      fprintf(f, "P2\n3 3\n255\n0 1 2\n");
+      fclose(f);
+      assert(heightfield_load(truncated) == NULL);
+
+      // Sizes whose product would overflow are rejected before allocating
+      f = fopen(truncated, "wb");
+      fprintf(f, "P5 4294967295 4294967295 255\n");
+      fclose(f);
+      assert(heightfield_load(truncated) == NULL);
+
+      f = fopen(truncated, "wb");
+      fprintf(f, "P2 99999999999999999999 2 255\n");
+      fclose(f);
+      assert(heightfield_load(truncated) == NULL);
+
+      // Loading a directory fails instead of reading garbage
+      assert(heightfield_load("/tmp") == NULL);
+
+      remove(ascii);
+      remove(binary);
+      remove(pfm);
+      remove(truncated);
+  }
+
+  TEST {
+      // Sizes outside the supported range are reported instead of asserting
+      f32 heights[4] = {0};
+      assert(heightfield_alloc(1, 4, heights) == NULL);
+      assert(heightfield_alloc(HEIGHTFIELD_MAX_SAMPLES, 4, heights) == NULL);
+  }
+}
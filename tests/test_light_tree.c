@@ -0,0 +1,202 @@
+#include "tests.h"
+
+// Lights on an n x n grid in the plane y = 5
+static void light_tree_grid_world(world *w, u32 n)
+{
+  w->lights_count = 0;
+  for (u32 j = 0; j < n; j++) {
+    for (u32 i = 0; i < n; i++) {
+      f64 x = 2 * (f64)i - (f64)n;
+      f64 z = 2 * (f64)j - (f64)n;
+      f64 brightness = 0.1 + 0.05 * (f64)((i * 7 + j * 3) % 5);
+      point_light_init(&w->lights[w->lights_count++], point(x, 5, z), color(brightness, brightness, brightness));
+    }
+  }
+}
+
+void test_light_tree(void)
+{
+  TESTS();
+
+  TEST {
+      // Building a tree over the lights
+      static world w = {0};
+      light_tree_grid_world(&w, 5);
+
+      light_tree *t = light_tree_alloc(&w);
+      assert(t->nodes_count == 2 * w.lights_count - 1);
+
+      f64 power = 0;
+      u32 seen[25] = {0};
+      for (u32 i = 0; i < t->nodes_count; i++) {
+        if (t->nodes[i].leaf) {
+          seen[t->nodes[i].light]++;
+          power += t->nodes[i].power;
+        }
+      }
+      for (u32 i = 0; i < w.lights_count; i++) {
+        assert(seen[i] == 1);
+      }
+      assert(req(t->nodes[0].power, power));
+
+      // Leaves lead back up to the root
+      for (u32 i = 0; i < w.lights_count; i++) {
+        u32 index = t->leaves[i];
+        assert(t->nodes[index].leaf && t->nodes[index].light == i);
+
+        u32 depth = 0;
+        while (index != 0) {
+          u32 parent = t->nodes[index].parent;
+          assert(t->nodes[parent].left == index || t->nodes[parent].right == index);
+          index = parent;
+          depth++;
+        }
+        assert(depth <= 5);
+      }
+
+      light_tree_free(t);
+  }
+
+  TEST {
+      // Sampling probabilities sum to one and match the sampled pdf
+      static world w = {0};
+      light_tree_grid_world(&w, 5);
+      light_tree *t = light_tree_alloc(&w);
+
+      v4 points[3] = {
+        point_init(0, 0, 0),
+        point_init(-4, 1, 3),
+        point_init(20, -3, 0),
+      };
+
+      for (u32 k = 0; k < 3; k++) {
+        f64 total = 0;
+        for (u32 i = 0; i < w.lights_count; i++) {
+          total += light_tree_pdf(t, points[k], i);
+        }
+        assert(req(total, 1));
+
+        for (u32 i = 0; i < 16; i++) {
+          f64 pdf = 0;
+          u32 index = light_tree_sample(t, points[k], ((f64)i + 0.5) / 16, &pdf);
+          assert(index < w.lights_count);
+          assert(req(pdf, light_tree_pdf(t, points[k], index)));
+        }
+      }
+
+      light_tree_free(t);
+  }
+
+  TEST {
+      // Nearby lights are chosen more often than distant ones
+      static world w = {0};
+      w.lights_count = 3;
+      point_light_init(&w.lights[0], point(0, 1, 0), color(1, 1, 1));
+      point_light_init(&w.lights[1], point(10, 1, 0), color(1, 1, 1));
+      point_light_init(&w.lights[2], point(30, 1, 0), color(1, 1, 1));
+      light_tree *t = light_tree_alloc(&w);
+
+      v4 p = point_init(0, 0, 0);
+      assert(light_tree_pdf(t, p, 0) > light_tree_pdf(t, p, 1));
+      assert(light_tree_pdf(t, p, 1) > light_tree_pdf(t, p, 2));
+
+      // A single light is always chosen
+      w.lights_count = 1;
+      light_tree_free(t);
+      t = light_tree_alloc(&w);
+
+      f64 pdf = 0;
+      assert(light_tree_sample(t, p, 0.7, &pdf) == 0);
+      assert(pdf == 1);
+
+      light_tree_free(t);
+  }
+
+  TEST {
+      // Sampling a few lights estimates shading by all of them
+      static world w = {0};
+      w.objects_count = 1;
+      plane_init(&w.objects[0]);
+      w.objects[0].material.specular = 0;
+      light_tree_grid_world(&w, 8);
+
+      ray r = { .origin = point_init(0.3, 1, -0.7), .direction = vector_init(0, -1, 0) };
+      intersection_group ig = {0};
+      world_intersect(&w, &r, &ig);
+      computations comps = {0};
+      computations_prepare(&ig.xs[0], &r, &ig, &comps);
+
+      v3 expected = {0};
+      world_shade_hit(&w, &comps, 1, expected);
+
+      w.light_tree = light_tree_alloc(&w);
+      w.light_samples = 16;
+
+      v3 estimate = {0};
+      world_shade_hit(&w, &comps, 1, estimate);
+      assert(fabs(estimate[0] - expected[0]) < 0.1 * expected[0]);
+
+      // The estimate is unbiased, so averaging over nearby points converges
+      f64 mean = 0;
+      f64 reference = 0;
+      for (u32 i = 0; i < 32; i++) {
+        r.origin[0] = 0.3 + 0.01 * (f64)i;
+        intersection_group xs = {0};
+        world_intersect(&w, &r, &xs);
+        computations_prepare(&xs.xs[0], &r, &xs, &comps);
+
+        world_shade_hit(&w, &comps, 1, estimate);
+        mean += estimate[0] / 32;
+
+        light_tree *t = w.light_tree;
+        w.light_tree = NULL;
+        world_shade_hit(&w, &comps, 1, expected);
+        reference += expected[0] / 32;
+        w.light_tree = t;
+      }
+      assert(fabs(mean - reference) < 0.02 * reference);
+
+      light_tree_free(w.light_tree);
+  }
+
+  TEST {
+      // Rays find the nearest area light through the tree, as a scan would
+      static world w = {0};
+      light_tree_grid_world(&w, 4);
+      for (u32 i = 0; i < w.lights_count; i += 3) {
+        v4 corner = point_init(w.lights[i].position[0] - 0.5, 5 - 0.1 * (f64)i, w.lights[i].position[2] - 0.5);
+        area_light_init(&w.lights[i], corner, vector(1, 0, 0), 1, vector(0, 0, 1), 1, color(1, 1, 1));
+      }
+      light_tree *t = light_tree_alloc(&w);
+      assert(t->nodes[0].area);
+
+      u32 hits = 0;
+      for (u32 k = 0; k < 400; k++) {
+        ray r = { .origin = point_init(0, 0, 0) };
+        memcpy(r.direction, vector(hash_uniform(k, 0) * 2 - 1, 1, hash_uniform(k, 1) * 2 - 1), sizeof(v4));
+
+        const light *expected = NULL;
+        f64 nearest = F64_INF;
+        for (u32 i = 0; i < w.lights_count; i++) {
+          f64 hit = 0;
+          if (w.lights[i].type == AreaLightType && area_light_intersect(&w.lights[i], &r, &hit) && hit < nearest) {
+            expected = &w.lights[i];
+            nearest = hit;
+          }
+        }
+
+        f64 hit = 0;
+        assert(light_tree_intersect(t, &w, &r, F64_INF, &hit) == expected);
+        if (expected != NULL) {
+          assert(hit == nearest);
+          hits++;
+
+          // Nothing is hit past max_t
+          assert(light_tree_intersect(t, &w, &r, nearest * 0.5, &hit) == NULL);
+        }
+      }
+      assert(hits > 10);
+
+      light_tree_free(t);
+  }
+}
@@ -16,5 +16,147 @@ void test_lights(void)
       assert(v4_eq(l.position, position));
       assert(v3_eq(l.intensity, intensity));
   }
-}
 
+  TEST {
+      // Attenuation with and without a radius
+      light l = {0};
+      point_light_init(&l, point(0, 0, 0), color(1, 1, 1));
+
+      assert(light_attenuation(&l, point(100, 0, 0)) == 1);
+
+      l.radius = 10;
+      assert(req(light_attenuation(&l, point(0, 0, 0)), 1));
+      assert(req(light_attenuation(&l, point(0, 3, 0)), (1 - 0.0081) * (1 - 0.0081) / 10));
+      assert(light_attenuation(&l, point(0, 0, 10)) == 0);
+      assert(light_attenuation(&l, point(20, 0, 0)) == 0);
+  }
+
+  TEST {
+      // Creating an area light
+      light l = {0};
+      area_light_init(&l, point(0, 0, 0), vector(2, 0, 0), 4, vector(0, 0, 1), 2, color(1, 1, 1));
+
+      assert(l.type == AreaLightType);
+      assert(v4_eq(l.value.area.corner, point(0, 0, 0)));
+      assert(v4_eq(l.value.area.uvec, vector(0.5, 0, 0)));
+      assert(l.value.area.usteps == 4);
+      assert(v4_eq(l.value.area.vvec, vector(0, 0, 0.5)));
+      assert(l.value.area.vsteps == 2);
+      assert(v4_eq(l.position, point(1, 0, 0.5)));
+  }
+
+  TEST {
+      // Finding a point on an area light
+      light l = {0};
+      area_light_init(&l, point(0, 0, 0), vector(2, 0, 0), 4, vector(0, 0, 1), 2, color(1, 1, 1));
+
+      typedef struct {
+        u32 u;
+        u32 v;
+        v2 jitter;
+        v4 expected;
+      } test_case;
+
+      test_case cases[4] = {
+        { 0, 0, { 0.5, 0.5 }, point_init(0.25, 0, 0.25) },
+        { 1, 0, { 0.5, 0.5 }, point_init(0.75, 0, 0.25) },
+        { 3, 1, { 0.5, 0.5 }, point_init(1.75, 0, 0.75) },
+        { 2, 1, { 0.3, 0.7 }, point_init(1.15, 0, 0.85) },
+      };
+
+      for (u32 i = 0; i < 4; i++) {
+        v4 p = {0};
+        area_light_point(&l, cases[i].u, cases[i].v, cases[i].jitter, p);
+        assert(v4_eq(p, cases[i].expected));
+      }
+  }
+
+  TEST {
+      // Visibility of an area light from points around an occluder
+      static world w = {0};
+      world_init(&w);
+
+      light l = {0};
+      area_light_init(&l, point(-0.5, -0.5, -5), vector(1, 0, 0), 4, vector(0, 1, 0), 4, color(1, 1, 1));
+
+      // Fully lit, fully occluded, and within the penumbra
+      assert(world_light_visibility(&w, &l, point(0, 0, -2), 0) == 1);
+      assert(world_light_visibility(&w, &l, point(0, 0, 2), 0) == 0);
+
+      f64 partial = world_light_visibility(&w, &l, point(1.6, 0, 2), 0);
+      assert(partial > 0 && partial < 1);
+
+      // The same point always gets the same jitter
+      assert(world_light_visibility(&w, &l, point(1.6, 0, 2), 0) == partial);
+
+      // Point lights are all or nothing
+      assert(world_light_visibility(&w, &w.lights[0], point(10, -10, 10), 0) == 0);
+      assert(world_light_visibility(&w, &w.lights[0], point(0, 10, 0), 0) == 1);
+  }
+
+  TEST {
+      // Soft shadow edges from an area light
+      static world w = {0};
+      w.objects_count = 2;
+
+      plane_init(&w.objects[0]);
+      w.objects[0].material.ambient = 0;
+      w.objects[0].material.specular = 0;
+
+      cube_init(&w.objects[1]);
+      m4 T = {0};
+      translation(0, 2, 0, T);
+      object_set_transform(&w.objects[1], T);
+
+      w.lights_count = 1;
+      area_light_init(&w.lights[0], point(-1, 6, -1), vector(2, 0, 0), 8, vector(0, 0, 2), 8, color(1, 1, 1));
+
+      // Walk out from under the cube, brightness never decreases and passes
+      // through intermediate values
+      f64 previous = -1;
+      u32 partial = 0;
+      for (u32 i = 0; i <= 20; i++) {
+        ray r = { .origin = point_init(0.15 * (f64)i, 1, -2), .direction = vector_init(0, -1, 2) };
+        v4_norm(r.direction, r.direction);
+
+        v3 c = {0};
+        world_color_at(&w, &r, 1, c);
+
+        assert(c[0] >= previous - 0.05);
+        previous = c[0];
+        partial += c[0] > 0.05 && c[0] < 0.85 * 0.9;
+      }
+      assert(partial >= 2);
+  }
+
+  TEST {
+      // Lights that cannot contribute are skipped before shadowing
+      static world w = {0};
+      w.objects_count = 1;
+      plane_init(&w.objects[0]);
+
+      w.lights_count = 2;
+      point_light_init(&w.lights[0], point(0, 5, 0), color(1, 1, 1));
+      point_light_init(&w.lights[1], point(50, 5, 0), color(1, 1, 1));
+      w.lights[1].radius = 10;
+
+      ray r = { .origin = point_init(0, 1, 0), .direction = vector_init(0, -1, 0) };
+      intersection_group ig = {0};
+      world_intersect(&w, &r, &ig);
+      computations comps = {0};
+      computations_prepare(&ig.xs[0], &r, &ig, &comps);
+
+      v3 both = {0};
+      world_shade_hit(&w, &comps, 1, both);
+
+      w.lights_count = 1;
+      v3 near = {0};
+      world_shade_hit(&w, &comps, 1, near);
+      assert(v3_eq(both, near));
+
+      // Above the threshold even the unattenuated light is skipped
+      w.light_threshold = 10;
+      world_shade_hit(&w, &comps, 1, near);
+      assert(v3_eq(near, color(0, 0, 0)));
+  }
+}
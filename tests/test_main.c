@@ -12,6 +12,25 @@ int main(int argc, char **argv)
   test_world();
   test_camera();
   test_patterns();
+  test_bounds();
+  test_bvh();
+  test_grid();
+  test_csg();
+  test_sdf();
+  test_heightfield();
+  test_sampler();
+  test_motion();
+  test_light_tree();
+  test_path();
+  test_aov();
+  test_denoise();
+  test_relight();
+  test_progressive();
+  test_budget();
+  test_preview();
+  test_scene();
+  test_distributed();
+  test_daemon();
 
   printf("\n%ld total tests passed\n", test_total);
   return 0;
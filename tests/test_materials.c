@@ -164,5 +164,66 @@ void test_materials(void)
     material_lighting(&m, &l, &sphere, point(1.1, 0, 0), eyev, normalv, false, c2);
     assert(v3_eq(c2, color(0, 0, 0)));
   }
-}
 
+  TEST {
+      // Light visibility scales diffuse and specular but not ambient
+      material m = {0};
+      material_init(&m);
+      object sphere = {0};
+      sphere_init(&sphere);
+
+      v4 position = point_init(0, 0, 0);
+      v4 eyev = vector_init(0, 0, -1);
+      v4 normalv = vector_init(0, 0, -1);
+
+      light l = {0};
+      point_light_init(&l, point(0, 0, -10), color(1, 1, 1));
+
+      typedef struct {
+        f64 visibility;
+        v3 expected;
+      } test_case;
+
+      test_case cases[3] = {
+        { 1.0, color_init(1.9, 1.9, 1.9) },
+        { 0.5, color_init(1.0, 1.0, 1.0) },
+        { 0.0, color_init(0.1, 0.1, 0.1) },
+      };
+
+      for (u32 i = 0; i < 3; i++) {
+        v3 result = {0};
+        material_lighting_visibility(&m, &l, &sphere, position, 0, eyev, normalv, cases[i].visibility, result);
+        assert(v3_eq(result, cases[i].expected));
+      }
+  }
+
+  TEST {
+      // Lighting falls off with distance and the bound covers it
+      material m = {0};
+      material_init(&m);
+      object sphere = {0};
+      sphere_init(&sphere);
+
+      v4 eyev = vector_init(0, 0, -1);
+      v4 normalv = vector_init(0, 0, -1);
+
+      light l = {0};
+      point_light_init(&l, point(0, 0, -10), color(1, 1, 1));
+      l.radius = 20;
+
+      f64 previous = F64_INF;
+      for (u32 i = 0; i < 6; i++) {
+        v4 position = point_init(0, 0, 5 * (f64)i);
+
+        v3 result = {0};
+        material_lighting_visibility(&m, &l, &sphere, position, 0, eyev, normalv, 1, result);
+        assert(result[0] <= previous);
+        assert(result[0] <= material_lighting_bound(&m, &l, position, normalv) + EPSILON);
+        previous = result[0];
+      }
+
+      // Nothing at or beyond the radius
+      assert(req(previous, 0));
+      assert(material_lighting_bound(&m, &l, point(0, 0, 15), normalv) == 0);
+  }
+}
@@ -0,0 +1,221 @@
+#include "tests.h"
+
+void test_motion(void)
+{
+  TESTS();
+
+  TEST {
+      // Keys are reproduced at the ends and clamped outside them
+      m4 R = {0};
+      rotation_z(PI_6, R);
+      m4 S = {0};
+      scaling(2, -1, 3, S);
+      m4 T = {0};
+      translation(1, 2, 3, T);
+
+      m4 RS = {0};
+      m4_mul(R, S, RS);
+      m4 start = {0};
+      m4_mul(T, RS, start);
+
+      m4 end = {0};
+      translation(-4, 0, 1, end);
+
+      motion m = {0};
+      motion_init(&m, start, 2, end, 4);
+
+      m4 A = {0};
+      m4 A_inverse = {0};
+
+      motion_transform_at(&m, 2, A, A_inverse);
+      assert(m4_eq(A, start));
+
+      motion_transform_at(&m, 0, A, A_inverse);
+      assert(m4_eq(A, start));
+
+      motion_transform_at(&m, 4, A, A_inverse);
+      assert(m4_eq(A, end));
+
+      // Halfway between a mirrored and an unmirrored key the scale passes
+      // through zero, a quarter of the way it is still invertible
+      m4 I = {0};
+      motion_transform_at(&m, 2.5, A, A_inverse);
+      m4_mul(A, A_inverse, I);
+      assert(m4_eq(I, IDENTITY));
+  }
+
+  TEST {
+      // Rotations are interpolated rigidly
+      m4 start = {0};
+      memcpy(start, IDENTITY, sizeof(m4));
+      m4 R = {0};
+      rotation_y(PI_2, R);
+      m4 T = {0};
+      translation(4, 0, 0, T);
+      m4 end = {0};
+      m4_mul(T, R, end);
+
+      motion m = {0};
+      motion_init(&m, start, 0, end, 1);
+
+      m4 A = {0};
+      m4 A_inverse = {0};
+      motion_transform_at(&m, 0.5, A, A_inverse);
+
+      m4 half = {0};
+      rotation_y(PI_4, half);
+      translation(2, 0, 0, T);
+      m4 expected = {0};
+      m4_mul(T, half, expected);
+
+      assert(m4_eq(A, expected));
+  }
+
+  TEST {
+      // A moving sphere is hit where it is at the ray's time
+      object s = {0};
+      sphere_init(&s);
+
+      m4 start = {0};
+      translation(0, 0, 0, start);
+      m4 end = {0};
+      translation(4, 0, 0, end);
+
+      motion m = {0};
+      motion_init(&m, start, 0, end, 1);
+      object_set_motion(&s, &m);
+
+      assert(s.motion == &m);
+      assert(s.transform_class == GeneralTransform);
+
+      ray r = { .origin = point_init(2, 0, -5), .direction = vector_init(0, 0, 1) };
+
+      intersection_group ig = {0};
+      r.time = 0;
+      ray_intersect(&r, &s, &ig);
+      assert(ig.count == 0);
+
+      r.time = 0.5;
+      ray_intersect(&r, &s, &ig);
+      assert(ig.count == 2);
+      assert(req(ig.xs[0].t, 4));
+
+      // Normals use the transform at the hit's time
+      v4 n = {0};
+      object_normal_at_time(&s, point(3, 0, 0), 0.5, n);
+      assert(v4_eq(n, vector(1, 0, 0)));
+
+      // Setting a static transform clears the motion
+      object_set_transform(&s, IDENTITY);
+      assert(s.motion == NULL);
+  }
+
+  TEST {
+      // Bounds cover the whole motion
+      object c = {0};
+      cube_init(&c);
+
+      m4 start = {0};
+      translation(-3, 0, 0, start);
+      m4 R = {0};
+      rotation_z(PI_3, R);
+      m4 T = {0};
+      translation(3, 1, 0, T);
+      m4 end = {0};
+      m4_mul(T, R, end);
+
+      motion m = {0};
+      motion_init(&m, start, 0, end, 1);
+      object_set_motion(&c, &m);
+
+      bounds b = {0};
+      object_bounds(&c, &b);
+
+      for (u32 i = 0; i <= 32; i++) {
+        m4 A = {0};
+        m4 A_inverse = {0};
+        motion_transform_at(&m, (f64)i / 32.0, A, A_inverse);
+
+        bounds local = {0};
+        object_local_bounds(&c, &local);
+        bounds at = {0};
+        bounds_transform(&local, A, &at);
+
+        assert(bounds_contains(&b, &at));
+      }
+
+      // Without rotation the bounds are the union of the keys
+      translation(3, 0, 0, end);
+      motion_init(&m, start, 0, end, 1);
+      object_set_motion(&c, &m);
+      object_bounds(&c, &b);
+
+      assert(v4_eq(b.min, point(-4, -1, -1)));
+      assert(v4_eq(b.max, point(4, 1, 1)));
+  }
+
+  TEST {
+      // Acceleration structures find moving objects at any time
+      static world w = {0};
+      w.objects_count = 1;
+      sphere_init(&w.objects[0]);
+
+      m4 start = {0};
+      translation(-6, 0, 0, start);
+      m4 end = {0};
+      translation(6, 0, 0, end);
+
+      motion m = {0};
+      motion_init(&m, start, 0, end, 1);
+      object_set_motion(&w.objects[0], &m);
+
+      w.bvh = bvh_alloc(&w);
+      w.grid = NULL;
+
+      for (u32 i = 0; i <= 8; i++) {
+        ray r = { .origin = point_init(-6 + 1.5 * (f64)i, 0, -5), .direction = vector_init(0, 0, 1) };
+        r.time = (f64)i / 8.0;
+
+        intersection_group ig = {0};
+        world_intersect(&w, &r, &ig);
+        assert(ig.count == 2);
+        assert(req(ig.xs[0].t, 4));
+        assert(world_intersect_any(&w, &r, 10));
+      }
+
+      bvh_free(w.bvh);
+      w.bvh = NULL;
+
+      w.grid = grid_alloc(&w);
+      ray r = { .origin = point_init(3, 0, -5), .direction = vector_init(0, 0, 1) };
+      r.time = 0.75;
+      intersection_group ig = {0};
+      world_intersect(&w, &r, &ig);
+      assert(ig.count == 2);
+      grid_free(w.grid);
+  }
+
+  TEST {
+      // Patterns move with the object
+      object s = {0};
+      sphere_init(&s);
+
+      pattern p = {0};
+      striped_pattern_init(&p, WHITE, BLACK);
+
+      m4 start = {0};
+      translation(0, 0, 0, start);
+      m4 end = {0};
+      translation(1, 0, 0, end);
+
+      motion m = {0};
+      motion_init(&m, start, 0, end, 1);
+      object_set_motion(&s, &m);
+
+      v3 c = {0};
+      pattern_object_color_at_time(&p, &s, point(0.5, 0, 0), 0, c);
+      assert(v3_eq(c, WHITE));
+      pattern_object_color_at_time(&p, &s, point(0.5, 0, 0), 1, c);
+      assert(v3_eq(c, BLACK));
+  }
+}
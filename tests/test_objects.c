@@ -1214,6 +1214,141 @@ void test_objects(void)
       assert(v4_eq(normal, T.normal));
     }
   }
+
+  TEST {
+    // Bounds of primitives in object space
+    object s = {0};
+    sphere_init(&s);
+    bounds b = {0};
+    object_local_bounds(&s, &b);
+    assert(v4_eq(b.min, point(-1, -1, -1)));
+    assert(v4_eq(b.max, point(1, 1, 1)));
+
+    object p = {0};
+    plane_init(&p);
+    object_local_bounds(&p, &b);
+    assert(!bounds_is_finite(&b));
+    assert(req(b.min[1], 0) && req(b.max[1], 0));
+
+    object c = {0};
+    cone_init(&c);
+    c.value.cone.minimum = -5;
+    c.value.cone.maximum = 3;
+    object_local_bounds(&c, &b);
+    assert(v4_eq(b.min, point(-5, -5, -5)));
+    assert(v4_eq(b.max, point(5, 3, 5)));
+
+    object y = {0};
+    cylinder_init(&y);
+    object_local_bounds(&y, &b);
+    assert(!bounds_is_finite(&b));
+  }
+
+  TEST {
+    // World bounds of a transformed object
+    object s = {0};
+    sphere_init(&s);
+
+    m4 T = {0};
+    translation(1, -3, 5, T);
+    m4 S = {0};
+    scaling(0.5, 2, 4, S);
+    m4 Z = {0};
+    m4_mul(T, S, Z);
+    object_set_transform(&s, Z);
+
+    bounds b = {0};
+    object_bounds(&s, &b);
+    assert(v4_eq(b.min, point(0.5, -5, 1)));
+    assert(v4_eq(b.max, point(1.5, -1, 9)));
+  }
+
+  TEST {
+    // Classifying transforms
+    m4 T = {0};
+    translation(1, 2, 3, T);
+    m4 S = {0};
+    scaling(2, 2, -2, S);
+    m4 N = {0};
+    scaling(1, 2, 3, N);
+    m4 R = {0};
+    rotation_y(PI_4, R);
+
+    m4 TS = {0};
+    m4_mul(T, S, TS);
+    m4 TN = {0};
+    m4_mul(T, N, TN);
+    m4 TR = {0};
+    m4_mul(T, R, TR);
+
+    assert(transform_classify(IDENTITY) == IdentityTransform);
+    assert(transform_classify(T) == TranslateUniformScaleTransform);
+    assert(transform_classify(TS) == TranslateUniformScaleTransform);
+    assert(transform_classify(TN) == TranslateScaleTransform);
+    assert(transform_classify(TR) == GeneralTransform);
+    assert(transform_classify(R) == GeneralTransform);
+
+    object s = {0};
+    sphere_init(&s);
+    object_set_transform(&s, TS);
+    assert(s.transform_class == TranslateUniformScaleTransform);
+    assert(v4_eq(s.center, point(1, 2, 3)));
+    assert(v4_eq(s.extent, vector(2, 2, 2)));
+  }
+
+  TEST {
+    // World space spheres and cubes match the transformed ray path
+    m4 T = {0};
+    translation(0.5, -1, 2, T);
+    m4 U = {0};
+    scaling(1.5, 1.5, 1.5, U);
+    m4 N = {0};
+    scaling(0.5, 2, 1.25, N);
+
+    m4 TU = {0};
+    m4_mul(T, U, TU);
+    m4 TN = {0};
+    m4_mul(T, N, TN);
+
+    object fast[3] = {0};
+    sphere_init(&fast[0]);
+    object_set_transform(&fast[0], TU);
+    cube_init(&fast[1]);
+    object_set_transform(&fast[1], TN);
+    cube_init(&fast[2]);
+    object_set_transform(&fast[2], TU);
+
+    for (u32 k = 0; k < 3; k++) {
+      object slow = fast[k];
+      slow.transform_class = GeneralTransform;
+
+      for (u32 i = 0; i < 32; i++) {
+        ray r = {
+          .origin = point_init(-4.1 + 0.25 * (f64)i, 3, -6),
+          .direction = vector_init(0.1 * (f64)(i % 5), -0.5, 1 + 0.05 * (f64)i),
+        };
+
+        intersection_group a = {0};
+        ray_intersect(&r, &fast[k], &a);
+        intersection_group b = {0};
+        ray_intersect(&r, &slow, &b);
+
+        assert(a.count == b.count);
+        for (u32 j = 0; j < a.count; j++) {
+          assert(req(a.xs[j].t, b.xs[j].t));
+
+          v4 p = {0};
+          ray_position(&r, a.xs[j].t, p);
+
+          v4 na = {0};
+          object_normal_at(&fast[k], p, na);
+          v4 nb = {0};
+          object_normal_at(&slow, p, nb);
+          assert(v4_eq(na, nb));
+        }
+      }
+    }
+  }
 }
 
 
@@ -0,0 +1,127 @@
+#include "tests.h"
+
+static void path_mean(const world *w, const ray *r, u64 max_depth, u32 samples, v3 out)
+{
+  sampler s = {0};
+  sampler_init(&s, 0, 0, 1);
+
+  memset(out, 0, sizeof(v3));
+  for (u32 i = 0; i < samples; i++) {
+    sampler_start(&s, i);
+
+    v3 c = {0};
+    path_trace(w, r, &s, max_depth, NULL, c);
+    v3_add(out, c, out);
+  }
+  v3_scale(out, 1.0 / (f64)samples, out);
+}
+
+void test_path(void)
+{
+  TESTS();
+
+  TEST {
+      // Direct light from a point light matches the Whitted diffuse term
+      static world w = {0};
+      w.objects_count = 1;
+      plane_init(&w.objects[0]);
+      memcpy(w.objects[0].material.color, color(0.8, 0.6, 0.4), sizeof(v3));
+      w.objects[0].material.ambient = 0;
+      w.objects[0].material.specular = 0;
+
+      w.lights_count = 1;
+      point_light_init(&w.lights[0], point(2, 4, -1), color(1, 1, 0.5));
+
+      ray r = { .origin = point_init(0, 1, -2), .direction = vector_init(0.3, -1, 1) };
+      v4_norm(r.direction, r.direction);
+
+      v3 expected = {0};
+      world_color_at(&w, &r, 0, expected);
+
+      v3 result = {0};
+      path_mean(&w, &r, 0, 1, result);
+      assert(v3_eq(result, expected));
+  }
+
+  TEST {
+      // Light sampling and scattering into an area light agree
+      static world w = {0};
+      w.objects_count = 1;
+      plane_init(&w.objects[0]);
+      w.objects[0].material.specular = 0;
+
+      w.lights_count = 1;
+      area_light_init(&w.lights[0], point(-0.5, 2, -0.5), vector(1, 0, 0), 1, vector(0, 0, 1), 1, color(1, 1, 1));
+
+      // Irradiance at the origin, h^2 / r^4 over the light
+      f64 irradiance = 0;
+      u32 n = 200;
+      for (u32 j = 0; j < n; j++) {
+        for (u32 i = 0; i < n; i++) {
+          f64 x = ((f64)i + 0.5) / (f64)n - 0.5;
+          f64 z = ((f64)j + 0.5) / (f64)n - 0.5;
+          f64 r2 = x * x + z * z + 4;
+          irradiance += 4 / (r2 * r2) / (f64)(n * n);
+        }
+      }
+      f64 expected = 0.9 * irradiance / PI;
+
+      ray r = { .origin = point_init(0, 1, -3), .direction = vector_init(0, -1, 3) };
+      v4_norm(r.direction, r.direction);
+
+      v3 direct = {0};
+      path_mean(&w, &r, 0, 1024, direct);
+      assert(fabs(direct[0] - expected) < 0.02 * expected);
+
+      v3 combined = {0};
+      path_mean(&w, &r, 1, 1024, combined);
+      assert(fabs(combined[0] - expected) < 0.02 * expected);
+
+      // Both strategies fall off with the light's radius
+      w.lights[0].radius = 2.5;
+      expected *= light_attenuation(&w.lights[0], point(0, 0, 0));
+      assert(expected > 0);
+
+      path_mean(&w, &r, 0, 1024, direct);
+      assert(fabs(direct[0] - expected) < 0.02 * expected);
+
+      path_mean(&w, &r, 1, 1024, combined);
+      assert(fabs(combined[0] - expected) < 0.02 * expected);
+
+      // And light nothing past it
+      w.lights[0].radius = 1.5;
+      path_mean(&w, &r, 1, 64, combined);
+      assert(v3_eq(combined, color(0, 0, 0)));
+  }
+
+  TEST {
+      // Light reaches a shadowed point by bouncing
+      static world w = {0};
+      w.objects_count = 2;
+      plane_init(&w.objects[0]);
+      w.objects[0].material.specular = 0;
+
+      cube_init(&w.objects[1]);
+      m4 T = {0};
+      m4 S = {0};
+      translation(0, 2, 0, T);
+      scaling(2, 1, 2, S);
+      m4 M = {0};
+      m4_mul(T, S, M);
+      object_set_transform(&w.objects[1], M);
+      w.objects[1].material.specular = 0;
+
+      w.lights_count = 1;
+      point_light_init(&w.lights[0], point(0, 6, 0), color(1, 1, 1));
+
+      ray r = { .origin = point_init(0, 0.5, 0), .direction = vector_init(0, -1, 0) };
+
+      v3 direct = {0};
+      path_mean(&w, &r, 0, 64, direct);
+      assert(v3_eq(direct, color(0, 0, 0)));
+
+      v3 indirect = {0};
+      path_mean(&w, &r, 4, 64, indirect);
+      assert(indirect[0] > 0.01);
+  }
+}
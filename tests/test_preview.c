@@ -0,0 +1,113 @@
+#include "tests.h"
+
+static void preview_scene(world *w, camera *v)
+{
+  world_init(w);
+
+  object *floor = &w->objects[w->objects_count++];
+  plane_init(floor);
+  m4 T = {0};
+  translation(0, -1, 0, T);
+  object_set_transform(floor, T);
+
+  camera_init(v, 45, 30, PI_3);
+  view_transform(point(0, 0.5, -5), point(0, 0, 0), vector(0, 1, 0), T);
+  camera_set_transform(v, T);
+}
+
+void test_preview(void)
+{
+  TESTS();
+
+  TEST {
+      // Each level shades only new pixels and the last is the full image
+      static world w = {0};
+      camera v = {0};
+      preview_scene(&w, &v);
+
+      preview *p = preview_alloc(&v, 8, 0);
+
+      assert(preview_refine(p, &v, &w));
+      assert(p->traced_count == 6 * 4);
+      assert(p->traced[8 * 45 + 16] && !p->traced[8 * 45 + 17]);
+
+      // Between the grid the image is interpolated
+      const f64 *a = *canvas_at(p->c, 0, 0);
+      const f64 *b = *canvas_at(p->c, 8, 0);
+      const f64 *m = *canvas_at(p->c, 2, 0);
+      assert(req(m[1], 0.75 * a[1] + 0.25 * b[1]));
+
+      u32 levels = 1;
+      while (preview_refine(p, &v, &w)) {
+        levels++;
+      }
+      assert(levels == 4);
+      assert(p->traced_count == 45 * 30);
+
+      canvas *expected = camera_render(&v, &w, NULL);
+      assert(memcmp(p->c->pixels, expected->pixels, 45 * 30 * sizeof(v3)) == 0);
+
+      canvas_free(expected);
+      preview_free(p);
+  }
+
+  TEST {
+      // With a threshold, flat areas are interpolated and edges are shaded
+      static world w = {0};
+      camera v = {0};
+      preview_scene(&w, &v);
+
+      preview *p = preview_alloc(&v, 8, 0.05);
+      while (preview_refine(p, &v, &w)) {
+      }
+      assert(p->traced_count < 45 * 30 / 2);
+
+      canvas *expected = camera_render(&v, &w, NULL);
+
+      for (u32 i = 0; i < 45 * 30; i++) {
+        if (p->traced[i]) {
+          assert(v3_eq(p->c->pixels[i], expected->pixels[i]));
+        }
+      }
+
+      // The black sky above the horizon is never refined, the sphere's
+      // silhouette against it is
+      assert(!p->traced[1 * 45 + 3]);
+      assert(v3_eq(*canvas_at(p->c, 3, 1), color(0, 0, 0)));
+
+      u32 edges = 0;
+      for (u32 x = 1; x < 45; x++) {
+        const f64 *left = *canvas_at(expected, x - 1, 8);
+        const f64 *right = *canvas_at(expected, x, 8);
+        if (fabs(left[1] - right[1]) > 0.3) {
+          edges++;
+          assert(p->traced[8 * 45 + x - 1] || p->traced[8 * 45 + x]);
+        }
+      }
+      assert(edges > 0);
+
+      canvas_free(expected);
+      preview_free(p);
+  }
+
+  TEST {
+      // A start step that is not a power of two is rounded down, so coarse
+      // grids stay inside finer ones and the last level is still exact
+      static world w = {0};
+      camera v = {0};
+      preview_scene(&w, &v);
+
+      preview *p = preview_alloc(&v, 7, 0);
+      assert(p->step == 4);
+
+      while (preview_refine(p, &v, &w)) {
+      }
+      assert(p->traced_count == 45 * 30);
+
+      canvas *expected = camera_render(&v, &w, NULL);
+      assert(memcmp(p->c->pixels, expected->pixels, 45 * 30 * sizeof(v3)) == 0);
+
+      canvas_free(expected);
+      preview_free(p);
+  }
+}
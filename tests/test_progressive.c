@@ -0,0 +1,212 @@
+#include "tests.h"
+
+typedef struct {
+  progressive *p;
+  canvas *c;
+  u32 snapshots;
+} progressive_watcher;
+
+// Snapshots the render while it runs, then cancels it
+static void *progressive_watch(void *arg)
+{
+  progressive_watcher *watcher = arg;
+
+  while (progressive_snapshot(watcher->p, watcher->c) < 2) {
+    for (u32 i = 0; i < watcher->c->width * watcher->c->height; i++) {
+      assert(isfinite(watcher->c->pixels[i][0]));
+    }
+    watcher->snapshots++;
+  }
+
+  progressive_cancel(watcher->p);
+  return NULL;
+}
+
+static void progressive_scene(world *w, camera *v)
+{
+  world_init(w);
+
+  object *floor = &w->objects[w->objects_count++];
+  plane_init(floor);
+  m4 T = {0};
+  translation(0, -1, 0, T);
+  object_set_transform(floor, T);
+
+  camera_init(v, 40, 24, PI_3);
+  view_transform(point(0, 1.5, -5), point(0, 0, 0), vector(0, 1, 0), T);
+  camera_set_transform(v, T);
+  v->antialias = true;
+}
+
+void test_progressive(void)
+{
+  TESTS();
+
+  TEST {
+      // Passes add up to the same image as rendering all samples at once
+      static world w = {0};
+      camera v = {0};
+      progressive_scene(&w, &v);
+      v.threads = 2;
+
+      progressive *p = progressive_alloc(&v);
+      canvas *c = canvas_alloc(40, 24);
+
+      assert(progressive_snapshot(p, c) == 0);
+      assert(v3_eq(c->pixels[0], color(0, 0, 0)));
+
+      assert(progressive_render(p, &v, &w, 2, 0) == 2);
+      assert(progressive_snapshot(p, c) == 2);
+
+      v.samples = 2;
+      canvas *expected = camera_render(&v, &w, NULL);
+      assert(memcmp(c->pixels, expected->pixels, 40 * 24 * sizeof(v3)) == 0);
+      canvas_free(expected);
+
+      // Continuing adds to what is there
+      assert(progressive_render(p, &v, &w, 5, 0) == 5);
+      assert(progressive_snapshot(p, c) == 5);
+
+      v.samples = 5;
+      expected = camera_render(&v, &w, NULL);
+      assert(memcmp(c->pixels, expected->pixels, 40 * 24 * sizeof(v3)) == 0);
+      canvas_free(expected);
+
+      canvas_free(c);
+      progressive_free(p);
+  }
+
+  TEST {
+      // A camera without anything to sample takes one pass
+      static world w = {0};
+      camera v = {0};
+      progressive_scene(&w, &v);
+      v.antialias = false;
+
+      progressive *p = progressive_alloc(&v);
+      assert(progressive_render(p, &v, &w, 8, 0) == 1);
+
+      canvas *c = canvas_alloc(40, 24);
+      progressive_snapshot(p, c);
+
+      canvas *expected = camera_render(&v, &w, NULL);
+      assert(memcmp(c->pixels, expected->pixels, 40 * 24 * sizeof(v3)) == 0);
+
+      canvas_free(expected);
+      canvas_free(c);
+      progressive_free(p);
+  }
+
+  TEST {
+      // Snapshots while rendering, stopped by cancelling or the clock
+      static world w = {0};
+      camera v = {0};
+      progressive_scene(&w, &v);
+      v.threads = 2;
+
+      progressive *p = progressive_alloc(&v);
+      progressive_watcher watcher = { .p = p, .c = canvas_alloc(40, 24) };
+
+      pthread_t thread;
+      pthread_create(&thread, NULL, progressive_watch, &watcher);
+      u32 samples = progressive_render(p, &v, &w, 1 << 20, 0);
+      pthread_join(thread, NULL);
+
+      assert(samples >= 2 && samples < 1 << 20);
+      assert(watcher.snapshots > 0);
+
+      // Tiles in flight finish, so no pixel is more than a pass ahead
+      for (u32 i = 0; i < p->tiles_count; i++) {
+        assert(p->tile_samples[i] == samples || p->tile_samples[i] == samples + 1);
+      }
+
+      // The cancel holds until it is reset
+      assert(progressive_render(p, &v, &w, 1 << 20, 0) == samples);
+
+      progressive_reset_cancel(p);
+      samples = progressive_render(p, &v, &w, samples + 2, 0);
+      assert(samples == progressive_snapshot(p, watcher.c) && samples >= 4);
+
+      // A cancel that lands between checkpoints stops the checkpointed render
+      const char *path = "/tmp/rtc_test_progressive_cancel.ckpt";
+      progressive_cancel(p);
+      assert(progressive_render_checkpointed(p, &v, &w, 1 << 20, 0.01, path, false) == samples);
+      remove(path);
+
+      canvas_free(watcher.c);
+      progressive_free(p);
+  }
+
+  TEST {
+      // Resuming a checkpoint taken mid pass gives the uninterrupted image
+      static world w = {0};
+      camera v = {0};
+      progressive_scene(&w, &v);
+
+      const char *path = "/tmp/rtc_test_progressive.ckpt";
+      remove(path);
+
+      progressive *expected = progressive_alloc(&v);
+      progressive_render(expected, &v, &w, 3, 0);
+
+      // A first pass and part of the second, as if stopped during it
+      progressive *p = progressive_alloc(&v);
+      progressive_render(p, &v, &w, 1, 0);
+
+      u32 order[3] = { 0, 2, 5 };
+      render_tiles tiles = {0};
+      tiles.v = &v;
+      tiles.w = &w;
+      tiles.progressive = p;
+      tiles.order = order;
+      tiles.tiles_x = p->tiles_x;
+      tiles.tiles_count = 3;
+      camera_render_tiles(&tiles);
+
+      assert(progressive_save(p, &v, path));
+      progressive_free(p);
+
+      // A camera that samples differently cannot use it
+      camera other = v;
+      other.seed++;
+      p = progressive_alloc(&other);
+      assert(!progressive_load(p, &other, path));
+      assert(p->tile_samples[0] == 0);
+      progressive_free(p);
+
+      p = progressive_alloc(&v);
+      v.threads = 2;
+      assert(progressive_render_checkpointed(p, &v, &w, 3, 0, path, true) == 3);
+
+      canvas *a = canvas_alloc(40, 24);
+      canvas *b = canvas_alloc(40, 24);
+      progressive_snapshot(expected, a);
+      progressive_snapshot(p, b);
+      assert(memcmp(a->pixels, b->pixels, 40 * 24 * sizeof(v3)) == 0);
+      assert(memcmp(expected->sum_squares, p->sum_squares, 40 * 24 * sizeof(f64)) == 0);
+      progressive_free(p);
+
+      // The final checkpoint holds the finished render
+      p = progressive_alloc(&v);
+      assert(progressive_load(p, &v, path));
+      assert(progressive_render(p, &v, &w, 3, 0) == 3);
+      progressive_snapshot(p, b);
+      assert(memcmp(a->pixels, b->pixels, 40 * 24 * sizeof(v3)) == 0);
+
+      // Intervals too short to finish a tile still make progress
+      f64 intervals[2] = { 0, 1e-9 };
+      for (u32 i = 0; i < 2; i++) {
+        progressive_free(p);
+        p = progressive_alloc(&v);
+        assert(progressive_render_checkpointed(p, &v, &w, 3, intervals[i], path, false) == 3);
+        progressive_snapshot(p, b);
+        assert(memcmp(a->pixels, b->pixels, 40 * 24 * sizeof(v3)) == 0);
+      }
+
+      canvas_free(a);
+      canvas_free(b);
+      progressive_free(p);
+      progressive_free(expected);
+      remove(path);
+  }
+}
@@ -0,0 +1,83 @@
+#include "tests.h"
+
+// Every pixel matches tracing its center ray from scratch
+static b32 relight_matches(const world *w, const camera *v, const canvas *c)
+{
+  for (u32 y = 0; y < v->vsize; y++) {
+    for (u32 x = 0; x < v->hsize; x++) {
+      ray r = {0};
+      camera_ray_for_pixel(v, x, y, &r);
+
+      v3 expected = {0};
+      world_color_at(w, &r, v->max_depth, expected);
+      if (!v3_eq(*canvas_at(c, x, y), expected)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void test_relight(void)
+{
+  TESTS();
+
+  TEST {
+      // Editing lights after caching the camera's hits
+      static world w = {0};
+      world_init(&w);
+      w.objects[0].material.reflective = 0.5;
+
+      object *floor = &w.objects[w.objects_count++];
+      plane_init(floor);
+      m4 T = {0};
+      translation(0, -1, 0, T);
+      object_set_transform(floor, T);
+
+      point_light_init(&w.lights[w.lights_count++], point(5, 10, -10), color(0.5, 0.5, 0.5));
+
+      camera v = {0};
+      camera_init(&v, 21, 21, PI_2);
+      view_transform(point(0, 0, -5), point(0, 0, 0), vector(0, 1, 0), T);
+      camera_set_transform(&v, T);
+
+      relight_cache *r = relight_cache_alloc(&v, &w);
+      canvas *c = canvas_alloc(21, 21);
+
+      u32 hits = 0;
+      for (u32 i = 0; i < 21 * 21; i++) {
+        hits += r->hits[i].hit;
+      }
+      assert(hits > 0 && hits < 21 * 21);
+
+      relight_cache_update(r, &w, c);
+      assert(r->visibility_tests > 0);
+      assert(relight_matches(&w, &v, c));
+
+      // A brighter light keeps its shadows
+      memcpy(w.lights[1].intensity, color(1, 0.2, 0.2), sizeof(v3));
+      relight_cache_update(r, &w, c);
+      assert(r->visibility_tests == 0);
+      assert(relight_matches(&w, &v, c));
+
+      // A moved light casts new shadow rays, only for itself
+      memcpy(w.lights[0].position, point(-5, 10, -10), sizeof(v4));
+      relight_cache_update(r, &w, c);
+      assert(r->visibility_tests > 0 && r->visibility_tests <= hits);
+      assert(relight_matches(&w, &v, c));
+
+      // Nothing changed, nothing is traced
+      relight_cache_update(r, &w, c);
+      assert(r->visibility_tests == 0);
+      assert(relight_matches(&w, &v, c));
+
+      // Adding a light redoes them all
+      point_light_init(&w.lights[w.lights_count++], point(0, 3, -3), color(0.2, 0.2, 0.2));
+      relight_cache_update(r, &w, c);
+      assert(r->visibility_tests > hits);
+      assert(relight_matches(&w, &v, c));
+
+      canvas_free(c);
+      relight_cache_free(r);
+  }
+}
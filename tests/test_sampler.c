@@ -0,0 +1,81 @@
+#include "tests.h"
+
+void test_sampler(void)
+{
+  TESTS();
+
+  TEST {
+      // Samples are deterministic per pixel and seed
+      sampler a = {0};
+      sampler_init(&a, 3, 7, 42);
+      sampler b = {0};
+      sampler_init(&b, 3, 7, 42);
+      sampler c = {0};
+      sampler_init(&c, 4, 7, 42);
+
+      u32 differ = 0;
+      for (u32 i = 0; i < 8; i++) {
+        sampler_start(&a, i);
+        sampler_start(&b, i);
+        sampler_start(&c, i);
+
+        for (u32 d = 0; d < 3; d++) {
+          v2 x = {0};
+          v2 y = {0};
+          v2 z = {0};
+          sampler_2d(&a, x);
+          sampler_2d(&b, y);
+          sampler_2d(&c, z);
+
+          assert(x[0] == y[0] && x[1] == y[1]);
+          assert(0 <= x[0] && x[0] < 1 && 0 <= x[1] && x[1] < 1);
+          differ += x[0] != z[0];
+        }
+      }
+
+      assert(differ > 20);
+  }
+
+  TEST {
+      // Any power of two prefix of a 2D dimension is stratified
+      sampler s = {0};
+      sampler_init(&s, 10, 20, 0);
+
+      for (u32 d = 0; d < 3; d++) {
+        u32 cells[16] = {0};
+        for (u32 i = 0; i < 16; i++) {
+          sampler_start(&s, i);
+          v2 x = {0};
+          for (u32 k = 0; k <= d; k++) {
+            sampler_2d(&s, x);
+          }
+
+          u32 cx = (u32)(x[0] * 4);
+          u32 cy = (u32)(x[1] * 4);
+          cells[cy * 4 + cx]++;
+        }
+
+        for (u32 i = 0; i < 16; i++) {
+          assert(cells[i] == 1);
+        }
+      }
+  }
+
+  TEST {
+      // 1D samples are stratified as well
+      sampler s = {0};
+      sampler_init(&s, 1, 1, 9);
+
+      u32 bins[32] = {0};
+      for (u32 i = 0; i < 32; i++) {
+        sampler_start(&s, i);
+        v2 pixel = {0};
+        sampler_2d(&s, pixel);
+        bins[(u32)(sampler_1d(&s) * 32)]++;
+      }
+
+      for (u32 i = 0; i < 32; i++) {
+        assert(bins[i] == 1);
+      }
+  }
+}
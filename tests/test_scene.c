@@ -0,0 +1,223 @@
+#include "tests.h"
+
+#include <stddef.h>
+
+// Offset of the first copy of n bytes of record in data
+static u64 scene_find(const u8 *data, u64 size, const void *record, u64 n)
+{
+  for (u64 i = 0; i + n <= size; i++) {
+    if (memcmp(data + i, record, n) == 0) {
+      return i;
+    }
+  }
+  assert(false);
+  return 0;
+}
+
+// Whether data still reads with n bytes at offset replaced by value
+static b32 scene_reads_with(const u8 *data, u64 size, u64 offset, const void *value, u64 n)
+{
+  u8 *copy = malloc(size);
+  memcpy(copy, data, size);
+  memcpy(copy + offset, value, n);
+
+  scene *sc = scene_deserialize(copy, size);
+  free(copy);
+  if (sc == NULL) {
+    return false;
+  }
+  scene_free(sc);
+  return true;
+}
+
+void test_scene(void)
+{
+  TESTS();
+
+  TEST {
+      // A scene read back renders the same, with every kind of shared data
+      static world w = {0};
+      world_init(&w);
+
+      pattern checkers = {0};
+      checker_pattern_init(&checkers, WHITE, BLACK);
+
+      object *floor = &w.objects[w.objects_count++];
+      plane_init(floor);
+      m4 T = {0};
+      translation(0, -1, 0, T);
+      object_set_transform(floor, T);
+      floor->material.p = &checkers;
+
+      m4 start = {0};
+      translation(-2, 0, 1, start);
+      m4 end = {0};
+      translation(-1, 0, 1, end);
+      motion m = {0};
+      motion_init(&m, start, 0, end, 1);
+      object_set_motion(&w.objects[0], &m);
+
+      sdf_node a = {0};
+      sdf_sphere_init(&a, point(0, 0, 0), 0.5);
+      sdf_node b = {0};
+      sdf_box_init(&b, point(0.4, 0, 0), vector(0.3, 0.3, 0.3));
+      sdf_node root = {0};
+      sdf_operator_init(&root, SmoothUnionSdf, &a, &b, 0.2);
+      sdf s = {0};
+      sdf_compile(&s, &root);
+
+      object *blob = &w.objects[w.objects_count++];
+      sdf_object_init(blob, &s);
+      translation(1.5, 0.5, 0, T);
+      object_set_transform(blob, T);
+
+      f32 heights[9] = { 0, 0.2f, 0, 0.1f, 0.4f, 0.1f, 0, 0.2f, 0 };
+      heightfield *h = heightfield_alloc(3, 3, heights);
+      object *terrain = &w.objects[w.objects_count++];
+      heightfield_object_init(terrain, h);
+      translation(-0.5, -1, -1, T);
+      object_set_transform(terrain, T);
+
+      object left = {0};
+      sphere_init(&left);
+      left.material.p = &checkers;
+      object right = {0};
+      cube_init(&right);
+      scaling(0.5, 0.5, 2, T);
+      object_set_transform(&right, T);
+      object *carved = &w.objects[w.objects_count++];
+      csg_init(carved, DifferenceOperation, &left, &right);
+      translation(0, 1.5, 1, T);
+      object_set_transform(carved, T);
+
+      w.bvh = bvh_alloc(&w);
+
+      camera v = {0};
+      camera_init(&v, 40, 30, PI_3);
+      view_transform(point(0, 1.5, -5), point(0, 0, 0), vector(0, 1, 0), T);
+      camera_set_transform(&v, T);
+
+      u64 size = 0;
+      u8 *data = scene_serialize(&v, &w, &size);
+      scene *sc = scene_deserialize(data, size);
+      assert(sc != NULL);
+
+      assert(sc->w->objects_count == w.objects_count);
+      assert(sc->w->lights_count == w.lights_count);
+      assert(sc->w->bvh != NULL && sc->w->grid == NULL);
+      assert(sc->w->objects[0].motion != NULL);
+      assert(sc->w->objects[2].material.p == sc->w->objects[5].value.csg.left->material.p);
+      assert(sc->w->objects[5].value.csg.right->parent == &sc->w->objects[5]);
+      assert(sc->w->objects[4].value.heightfield.h->width == 3);
+
+      canvas *expected = camera_render(&v, &w, NULL);
+      canvas *actual = camera_render(&sc->v, sc->w, NULL);
+      assert(memcmp(actual->pixels, expected->pixels, 40 * 30 * sizeof(v3)) == 0);
+
+      // Truncated or foreign data is rejected
+      assert(scene_deserialize(data, size - 1) == NULL);
+      data[0] ^= 1;
+      assert(scene_deserialize(data, size) == NULL);
+
+      canvas_free(actual);
+      canvas_free(expected);
+      scene_free(sc);
+      free(data);
+      bvh_free(w.bvh);
+      heightfield_free(h);
+  }
+
+  TEST {
+      // Records that would index, divide or loop out of bounds are rejected
+      static world w = {0};
+      world_init(&w);
+      w.lights_count = 1;
+      area_light_init(&w.lights[0], point(-1, 4, -1), vector(2, 0, 0), 2, vector(0, 0, 2), 2, WHITE);
+
+      pattern stripes = {0};
+      striped_pattern_init(&stripes, WHITE, BLACK);
+
+      sdf_node a = {0};
+      sdf_sphere_init(&a, point(0, 0, 0), 0.5);
+      sdf_node b = {0};
+      sdf_torus_init(&b, point(0, 0, 0), 0.7, 0.1);
+      sdf_node root = {0};
+      sdf_operator_init(&root, UnionSdf, &a, &b, 0);
+      sdf s = {0};
+      sdf_compile(&s, &root);
+
+      m4 T = {0};
+      object *blob = &w.objects[w.objects_count++];
+      sdf_object_init(blob, &s);
+      blob->material.p = &stripes;
+      translation(2, 0, 0, T);
+      object_set_transform(blob, T);
+
+      f32 heights[6] = { 0, 0.25f, 0.5f, 0.75f, 1, 0.5f };
+      heightfield *h = heightfield_alloc(3, 2, heights);
+      object *terrain = &w.objects[w.objects_count++];
+      heightfield_object_init(terrain, h);
+      translation(0, -1, 0, T);
+      object_set_transform(terrain, T);
+
+      object left = {0};
+      sphere_init(&left);
+      translation(0, 0, 0.5, T);
+      object_set_transform(&left, T);
+      object right = {0};
+      sphere_init(&right);
+      translation(0, 0, -0.5, T);
+      object_set_transform(&right, T);
+      object *lens = &w.objects[w.objects_count++];
+      csg_init(lens, IntersectionOperation, &left, &right);
+      translation(-2, 0, 0, T);
+      object_set_transform(lens, T);
+
+      camera v = {0};
+      camera_init(&v, 8, 8, PI_3);
+
+      u64 size = 0;
+      u8 *data = scene_serialize(&v, &w, &size);
+      assert(scene_reads_with(data, size, 0, data, 1));
+
+      // Enums out of range
+      u32 bad = 99;
+      u64 at = scene_find(data, size, &w.lights[0], sizeof(light));
+      assert(!scene_reads_with(data, size, at + offsetof(light, type), &bad, sizeof(u32)));
+      at = scene_find(data, size, &stripes, sizeof(pattern));
+      assert(!scene_reads_with(data, size, at + offsetof(pattern, type), &bad, sizeof(u32)));
+      u64 lens_at = scene_find(data, size, lens->transform, 2 * sizeof(m4)) - offsetof(object, transform);
+      assert(!scene_reads_with(data, size, lens_at + offsetof(object, type), &bad, sizeof(u32)));
+      assert(!scene_reads_with(data, size, lens_at + offsetof(object, value.csg.operation), &bad, sizeof(u32)));
+
+      // Area lights without cells
+      u32 zero = 0;
+      at = scene_find(data, size, &w.lights[0], sizeof(light));
+      assert(!scene_reads_with(data, size, at + offsetof(light, value.area.usteps), &zero, sizeof(u32)));
+      assert(!scene_reads_with(data, size, at + offsetof(light, value.area.vsteps), &zero, sizeof(u32)));
+
+      // Sdf programs past their instructions or registers
+      at = scene_find(data, size, &s, sizeof(sdf));
+      u32 count = SDF_MAX_INSTRUCTIONS + 1;
+      assert(!scene_reads_with(data, size, at + offsetof(sdf, count), &count, sizeof(u32)));
+      u32 reg = SDF_MAX_REGISTERS;
+      assert(!scene_reads_with(data, size, at + offsetof(sdf, code[1].reg), &reg, sizeof(u32)));
+
+      // Heightfield sizes whose product wraps around
+      u64 dimensions[2] = { (1ull << 62) + 1, 4 };
+      at = scene_find(data, size, heights, sizeof(heights)) - sizeof(dimensions);
+      assert(!scene_reads_with(data, size, at, dimensions, sizeof(dimensions)));
+
+      // Links that loop: the csg as its own child, and as its child's child.
+      // Links are pattern, motion, parent, left, right, and the csg's left
+      // child is the first object after the world's.
+      u64 links = lens_at + sizeof(object);
+      s64 own = lens - w.objects;
+      assert(!scene_reads_with(data, size, links + 3 * sizeof(s64), &own, sizeof(s64)));
+      s64 child = (s64)w.objects_count;
+      assert(!scene_reads_with(data, size, links + 2 * sizeof(s64), &child, sizeof(s64)));
+
+      free(data);
+      heightfield_free(h);
+  }
+}
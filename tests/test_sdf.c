@@ -0,0 +1,286 @@
+#include "tests.h"
+
+void test_sdf(void)
+{
+  TESTS();
+
+  TEST {
+      // Compiling an expression tree to a flat program
+      sdf_node a = {0};
+      sdf_sphere_init(&a, point(-1, 0, 0), 1);
+      sdf_node b = {0};
+      sdf_box_init(&b, point(1, 0, 0), vector(0.5, 0.5, 0.5));
+      sdf_node c = {0};
+      sdf_torus_init(&c, point(0, 2, 0), 1, 0.25);
+
+      sdf_node ab = {0};
+      sdf_operator_init(&ab, SmoothUnionSdf, &a, &b, 0.5);
+      sdf_node root = {0};
+      sdf_operator_init(&root, UnionSdf, &ab, &c, 0);
+
+      sdf s = {0};
+      sdf_compile(&s, &root);
+
+      assert(s.count == 5);
+      assert(s.registers == 2);
+      assert(s.code[0].type == SphereSdf && s.code[0].reg == 0);
+      assert(s.code[1].type == BoxSdf && s.code[1].reg == 1);
+      assert(s.code[2].type == SmoothUnionSdf && s.code[2].reg == 0);
+      assert(s.code[3].type == TorusSdf && s.code[3].reg == 1);
+      assert(s.code[4].type == UnionSdf && s.code[4].reg == 0);
+
+      assert(v4_eq(s.b.min, point(-2.125, -1.125, -1.25)));
+      assert(v4_eq(s.b.max, point(1.625, 2.25, 1.25)));
+  }
+
+  TEST {
+      // Evaluating distances for several points at once
+      sdf_node a = {0};
+      sdf_sphere_init(&a, point(0, 0, 0), 1);
+      sdf_node b = {0};
+      sdf_box_init(&b, point(3, 0, 0), vector(1, 1, 1));
+      sdf_node root = {0};
+      sdf_operator_init(&root, UnionSdf, &a, &b, 0);
+
+      sdf s = {0};
+      sdf_compile(&s, &root);
+
+      f64 x[5] = { 0, 2, 1.5, 3, 6 };
+      f64 y[5] = { 0, 0, 0, 0, 4 };
+      f64 z[5] = { 0, 0, 0, 0, 0 };
+      f64 d[5] = {0};
+      sdf_eval(&s, 5, x, y, z, d);
+
+      assert(req(d[0], -1));
+      assert(req(d[1], 0));
+      assert(req(d[2], 0.5));
+      assert(req(d[3], -1));
+      assert(req(d[4], sqrt(4 + 9)));
+  }
+
+  TEST {
+      // Smooth union blends between primitives
+      sdf_node a = {0};
+      sdf_sphere_init(&a, point(-1, 0, 0), 1);
+      sdf_node b = {0};
+      sdf_sphere_init(&b, point(1, 0, 0), 1);
+
+      sdf_node hard = {0};
+      sdf_operator_init(&hard, UnionSdf, &a, &b, 0);
+      sdf_node soft = {0};
+      sdf_operator_init(&soft, SmoothUnionSdf, &a, &b, 1);
+
+      sdf h = {0};
+      sdf_compile(&h, &hard);
+      sdf s = {0};
+      sdf_compile(&s, &soft);
+
+      f64 x[2] = { 0, -3 };
+      f64 y[2] = { 1, 0 };
+      f64 z[2] = { 0, 0 };
+      f64 dh[2] = {0};
+      f64 ds[2] = {0};
+      sdf_eval(&h, 2, x, y, z, dh);
+      sdf_eval(&s, 2, x, y, z, ds);
+
+      assert(req(ds[0], dh[0] - 0.25));
+      assert(req(ds[1], dh[1]));
+  }
+
+  TEST {
+      // Tracing several rays at once
+      sdf_node a = {0};
+      sdf_sphere_init(&a, point(0, 0, 0), 1);
+
+      sdf s = {0};
+      sdf_compile(&s, &a);
+
+      ray rays[3] = {
+        { .origin = point_init(0, 0, -5), .direction = vector_init(0, 0, 1) },
+        { .origin = point_init(0, 0.6, -5), .direction = vector_init(0, 0, 2) },
+        { .origin = point_init(0, 2, -5), .direction = vector_init(0, 0, 1) },
+      };
+
+      f64 t[3] = {0};
+      sdf_trace(&s, 3, rays, t);
+
+      assert(req(t[0], 4));
+      assert(req(t[1], 2.1));
+      assert(t[2] == F64_INF);
+  }
+
+  TEST {
+      // An sdf object reports entry and exit like an analytic sphere
+      sdf_node a = {0};
+      sdf_sphere_init(&a, point(0, 0, 0), 1);
+
+      sdf s = {0};
+      sdf_compile(&s, &a);
+
+      object o = {0};
+      sdf_object_init(&o, &s);
+
+      m4 T = {0};
+      translation(0, 0, 1, T);
+      m4 S = {0};
+      scaling(2, 2, 2, S);
+      m4 Z = {0};
+      m4_mul(T, S, Z);
+      object_set_transform(&o, Z);
+
+      ray r = {
+        .origin = point_init(0, 0, -5),
+        .direction = vector_init(0, 0, 1),
+      };
+
+      intersection_group ig = {0};
+      ray_intersect(&r, &o, &ig);
+
+      assert(ig.count == 2);
+      assert(req(ig.xs[0].t, 4));
+      assert(req(ig.xs[1].t, 8));
+
+      bounds b = {0};
+      object_bounds(&o, &b);
+      assert(v4_eq(b.min, point(-2, -2, -1)));
+      assert(v4_eq(b.max, point(2, 2, 3)));
+  }
+
+  TEST {
+      // Separate blobs give one interval each
+      sdf_node a = {0};
+      sdf_sphere_init(&a, point(-2, 0, 0), 1);
+      sdf_node b = {0};
+      sdf_sphere_init(&b, point(2, 0, 0), 1);
+      sdf_node root = {0};
+      sdf_operator_init(&root, UnionSdf, &a, &b, 0);
+
+      sdf s = {0};
+      sdf_compile(&s, &root);
+
+      object o = {0};
+      sdf_object_init(&o, &s);
+
+      ray r = {
+        .origin = point_init(-5, 0, 0),
+        .direction = vector_init(1, 0, 0),
+      };
+
+      intersection_group ig = {0};
+      ray_intersect(&r, &o, &ig);
+
+      assert(ig.count == 4);
+      assert(req(ig.xs[0].t, 2));
+      assert(req(ig.xs[1].t, 4));
+      assert(req(ig.xs[2].t, 6));
+      assert(req(ig.xs[3].t, 8));
+  }
+
+  TEST {
+      // Normals from tetrahedral differences
+      sdf_node a = {0};
+      sdf_box_init(&a, point(0, 0, 0), vector(1, 2, 1));
+      sdf_node b = {0};
+      sdf_sphere_init(&b, point(0, 0, 0), 1);
+
+      sdf box = {0};
+      sdf_compile(&box, &a);
+      sdf sphere = {0};
+      sdf_compile(&sphere, &b);
+
+      v4 n = {0};
+      sdf_normal_at(&box, point(0.2, 2, 0.3), n);
+      assert(v4_eq(n, vector(0, 1, 0)));
+
+      object o = {0};
+      sdf_object_init(&o, &sphere);
+
+      object_normal_at(&o, point(ROOT_3_3, ROOT_3_3, ROOT_3_3), n);
+      assert(v4_eq(n, vector(ROOT_3_3, ROOT_3_3, ROOT_3_3)));
+  }
+
+  TEST {
+      // Shading an sdf sphere matches an analytic sphere
+      static world w = {0};
+      world_init(&w);
+
+      sdf_node a = {0};
+      sdf_sphere_init(&a, point(0, 0, 0), 1);
+      sdf s = {0};
+      sdf_compile(&s, &a);
+
+      material m = w.objects[0].material;
+      sdf_object_init(&w.objects[0], &s);
+      object_set_material(&w.objects[0], &m);
+
+      ray r = {
+        .origin = point_init(0, 0, -5),
+        .direction = vector_init(0, 0, 1),
+      };
+
+      v3 out = {0};
+      world_color_at(&w, &r, MAX_DEPTH, out);
+      assert(v3_eq(out, color(0.38066, 0.47583, 0.2855)));
+  }
+
+  TEST {
+      // Shadow rays to an area light go through sdfs in packets and agree
+      // with tracing them one at a time
+      static world w = {0};
+      world_init(&w);
+
+      sdf_node a = {0};
+      sdf_torus_init(&a, point(0, 0, 0), 0.8, 0.25);
+      sdf_node b = {0};
+      sdf_sphere_init(&b, point(0.8, 0, 0), 0.4);
+      sdf_node root = {0};
+      sdf_operator_init(&root, SmoothUnionSdf, &a, &b, 0.3);
+      sdf s = {0};
+      sdf_compile(&s, &root);
+
+      m4 T = {0};
+      w.objects_count = 3;
+      sdf_object_init(&w.objects[0], &s);
+      translation(0, 1, 0, T);
+      object_set_transform(&w.objects[0], T);
+      sdf_object_init(&w.objects[1], &s);
+      translation(-1.5, 1.5, 0.5, T);
+      object_set_transform(&w.objects[1], T);
+      sphere_init(&w.objects[2]);
+      translation(1.5, 1.2, 0, T);
+      object_set_transform(&w.objects[2], T);
+
+      light l = {0};
+      area_light_init(&l, point(-2, 3, -2), vector(4, 0, 0), 4, vector(0, 0, 4), 4, WHITE);
+
+      u32 partial = 0;
+      for (u32 k = 0; k < 64; k++) {
+        v4 p = point_init(hash_uniform(k, 0) * 4 - 2, 0, hash_uniform(k, 1) * 4 - 2);
+
+        v4 targets[SDF_LANES];
+        for (u32 i = 0; i < SDF_LANES; i++) {
+          v2 jitter = { hash_uniform(k, 2 + i), hash_uniform(k, 10 + i) };
+          area_light_point(&l, i % 4, i / 4 * 2, jitter, targets[i]);
+        }
+
+        b32 packet[SDF_LANES];
+        for (u32 accel = 0; accel < 2; accel++) {
+          w.bvh = accel == 1 ? bvh_alloc(&w) : NULL;
+          world_is_occluded_packet(&w, p, targets, SDF_LANES, 0, packet);
+
+          u32 occluded = 0;
+          for (u32 i = 0; i < SDF_LANES; i++) {
+            assert(packet[i] == world_is_occluded(&w, p, targets[i], 0));
+            occluded += packet[i] ? 1 : 0;
+          }
+          partial += occluded > 0 && occluded < SDF_LANES ? 1 : 0;
+
+          if (w.bvh != NULL) {
+            bvh_free(w.bvh);
+            w.bvh = NULL;
+          }
+        }
+      }
+      assert(partial > 0);
+  }
+}
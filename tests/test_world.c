@@ -7,7 +7,7 @@ void test_world(void)
 
   TEST {
     // Intersect a ray with a world
-    world w = {0};
+    static world w = {0};
     world_init(&w);
 
     ray r = {
@@ -27,7 +27,7 @@ void test_world(void)
 
   TEST {
     // Shade hit
-    world w = {0};
+    static world w = {0};
     world_init(&w);
 
     ray r = {
@@ -49,7 +49,7 @@ void test_world(void)
 
   TEST {
     // Shade hit from the inside
-    world w = {0};
+    static world w = {0};
     world_init(&w);
 
     memcpy(w.lights[0].position, point(0.0, 0.25, 0.0), sizeof(v4));
@@ -74,7 +74,7 @@ void test_world(void)
 
   TEST {
     // The color when a ray misses
-    world w = {0};
+    static world w = {0};
     world_init(&w);
 
     ray r = {
@@ -90,7 +90,7 @@ void test_world(void)
 
   TEST {
     // The color when a ray hits
-    world w = {0};
+    static world w = {0};
     world_init(&w);
 
     ray r = {
@@ -106,7 +106,7 @@ void test_world(void)
 
   TEST {
     // The color wiwth an intersection behind the ray
-    world w = {0};
+    static world w = {0};
     world_init(&w);
 
     w.objects[0].material.ambient = 1;
@@ -125,7 +125,7 @@ void test_world(void)
 
   TEST {
     // There is not shadow when nothing is colinear with point and ligh
-    world w = {0};
+    static world w = {0};
     world_init(&w);
 
     v4 p = point_init(0, 10, 0);
@@ -137,7 +137,7 @@ void test_world(void)
 
   TEST {
     // There is shadow when object between point and light
-    world w = {0};
+    static world w = {0};
     world_init(&w);
 
     v4 p = point_init(10, -10, 10);
@@ -149,7 +149,7 @@ void test_world(void)
 
   TEST {
     // There is no shadow when object is behind the light
-    world w = {0};
+    static world w = {0};
     world_init(&w);
 
     v4 p = point_init(-20, 20, -20);
@@ -161,7 +161,7 @@ void test_world(void)
 
   TEST {
     // There is no shadow when object is behind the point
-    world w = {0};
+    static world w = {0};
     world_init(&w);
 
     v4 p = point_init(-2, 2, -2);
@@ -225,7 +225,7 @@ void test_world(void)
 
   TEST {
     // The reflected color for a nonreflective material
-    world w = {0};
+    static world w = {0};
     world_init(&w);
 
     ray r = {
@@ -251,7 +251,7 @@ void test_world(void)
 
   TEST {
     // The reflected color for a reflective material
-    world w = {0};
+    static world w = {0};
     world_init(&w);
 
     object p = {0};
@@ -289,7 +289,7 @@ void test_world(void)
 
   TEST {
     // The reflected color for a reflective material from shade hit
-    world w = {0};
+    static world w = {0};
     world_init(&w);
 
     object p = {0};
@@ -327,7 +327,7 @@ void test_world(void)
 
   TEST {
     // The reflected color at the maximum recursive depth
-    world w = {0};
+    static world w = {0};
     world_init(&w);
 
     object p = {0};
@@ -365,7 +365,7 @@ void test_world(void)
 
   TEST {
     // The refracted color with an opaque surface
-    world w = {0};
+    static world w = {0};
     world_init(&w);
 
     object *shape = &w.objects[0];
@@ -394,7 +394,7 @@ void test_world(void)
 
   TEST {
     // The refracted color at max depth
-    world w = {0};
+    static world w = {0};
     world_init(&w);
 
     object *shape = &w.objects[0];
@@ -425,7 +425,7 @@ void test_world(void)
 
   TEST {
     // The refracted color under total internal reflection
-    world w = {0};
+    static world w = {0};
     world_init(&w);
 
     object *shape = &w.objects[0];
@@ -456,7 +456,7 @@ void test_world(void)
 
   TEST {
     // The refracted color under total internal reflection
-    world w = {0};
+    static world w = {0};
     world_init(&w);
 
     object *A = &w.objects[0];
@@ -495,7 +495,7 @@ void test_world(void)
 
   TEST {
     // Shade hit with a transparent material
-    world w = {0};
+    static world w = {0};
     world_init(&w);
 
     object floor = {0};
@@ -548,7 +548,7 @@ void test_world(void)
 
   TEST {
     // Shade hit with a reflective transparent material
-    world w = {0};
+    static world w = {0};
     world_init(&w);
 
     object floor = {0};
@@ -15,16 +15,37 @@ void end_test_context(test_context *ctx);
     .count = 0,\
   };
 
+// A world is several hundred KB, so tests keep theirs static instead of
+// on the stack
 #define TEST __test_context__.count++; test_total++;
 
+void test_aov(void);
+void test_bounds(void);
+void test_budget(void);
+void test_bvh(void);
 void test_camera(void);
 void test_canvas(void);
+void test_csg(void);
+void test_daemon(void);
+void test_denoise(void);
+void test_distributed(void);
+void test_grid(void);
+void test_heightfield(void);
+void test_light_tree(void);
 void test_lights(void);
 void test_materials(void);
+void test_motion(void);
 void test_matrix(void);
 void test_objects(void);
+void test_path(void);
 void test_patterns(void);
+void test_preview(void);
 void test_primitives(void);
+void test_progressive(void);
+void test_relight(void);
+void test_sampler(void);
+void test_scene(void);
+void test_sdf(void);
 void test_transform(void);
 void test_world(void);
 